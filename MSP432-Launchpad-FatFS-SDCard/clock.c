@@ -0,0 +1,153 @@
+/*
+ * clock.c - clock profiles
+ *
+ * MCLK and HSMCLK run from the DCO, SMCLK from the DCO divided down to at
+ * most 24 MHz. A faster profile needs the higher core voltage, the flash
+ * wait states and the SMCLK divider in place before the DCO is raised, and a
+ * slower one drops them only after the DCO is lowered.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "driverlib.h"
+#include "clock.h"
+#include "spiBus.h"
+#include "timebase.h"
+#include "profiler.h"
+#include "trace.h"
+
+typedef struct {
+    uint32_t ui32DCOFreq;       /* CS_DCO_FREQUENCY_x */
+    uint32_t ui32SMCLKDiv;      /* CS_CLOCK_DIVIDER_x for SMCLK */
+    uint_fast8_t ui8Vcore;      /* PCM_VCOREx */
+    uint32_t ui32WaitStates;    /* Flash read wait states */
+} tProfileInfo;
+
+/* In tClockProfile order, which is from slowest to fastest */
+static const tProfileInfo g_psProfiles[CLK_NUM_PROFILES] = {
+    { CS_DCO_FREQUENCY_3,  CS_CLOCK_DIVIDER_1, PCM_VCORE0, 0 },
+    { CS_DCO_FREQUENCY_12, CS_CLOCK_DIVIDER_1, PCM_VCORE0, 0 },
+    { CS_DCO_FREQUENCY_48, CS_CLOCK_DIVIDER_2, PCM_VCORE1, 2 },
+};
+
+/* UCBRSx for the fractional part of N = clock / baud, in 1/10000. The entry
+ * with the largest fraction not above that of N applies. */
+static const struct {
+    uint16_t ui16Frac;
+    uint8_t ui8BRS;
+} g_psBRSTable[] = {
+    {    0, 0x00 }, {  529, 0x01 }, {  715, 0x02 }, {  835, 0x04 },
+    { 1001, 0x08 }, { 1252, 0x10 }, { 1430, 0x20 }, { 1670, 0x11 },
+    { 2147, 0x21 }, { 2224, 0x22 }, { 2503, 0x44 }, { 3000, 0x25 },
+    { 3335, 0x49 }, { 3575, 0x4A }, { 3753, 0x52 }, { 4003, 0x92 },
+    { 4286, 0x53 }, { 4378, 0x55 }, { 5002, 0xAA }, { 5715, 0x6B },
+    { 6003, 0xAD }, { 6254, 0xB5 }, { 6432, 0xB6 }, { 6667, 0xD6 },
+    { 7001, 0xB7 }, { 7147, 0xBB }, { 7503, 0xDD }, { 7861, 0xED },
+    { 8004, 0xEE }, { 8333, 0xBF }, { 8464, 0xDF }, { 8572, 0xEF },
+    { 8751, 0xF7 }, { 9004, 0xFB }, { 9170, 0xFD }, { 9288, 0xFE },
+};
+
+static tClockProfile g_eProfile = CLK_PROFILE_LOW_POWER;
+static uint32_t g_ui32ConsoleBaud;      /* 0 until clk_ConsoleInit() */
+
+void
+clk_UARTConfig(eUSCI_UART_Config *psConfig, uint32_t ui32ClockHz,
+               uint32_t ui32Baud)
+{
+    uint32_t ui32N, ui32Frac;
+    uint_fast8_t i;
+
+    ui32N = ui32ClockHz / ui32Baud;
+    ui32Frac = (uint32_t)((uint64_t)(ui32ClockHz % ui32Baud) * 10000 / ui32Baud);
+
+    for (i = 1; i < sizeof(g_psBRSTable) / sizeof(g_psBRSTable[0]); i++)
+        if (g_psBRSTable[i].ui16Frac > ui32Frac) break;
+    psConfig->secondModReg = g_psBRSTable[i - 1].ui8BRS;
+
+    if (ui32N >= 16) {
+        /* Oversampling: UCBRx = INT(N/16), UCBRFx = INT(frac(N/16) * 16) */
+        psConfig->clockPrescalar = ui32ClockHz / (ui32Baud * 16);
+        psConfig->firstModReg = (ui32ClockHz % (ui32Baud * 16)) / ui32Baud;
+        psConfig->overSampling = EUSCI_A_UART_OVERSAMPLING_BAUDRATE_GENERATION;
+    } else {
+        psConfig->clockPrescalar = ui32N;
+        psConfig->firstModReg = 0;
+        psConfig->overSampling = EUSCI_A_UART_LOW_FREQUENCY_BAUDRATE_GENERATION;
+    }
+}
+
+/* Program the console UART for the current SMCLK */
+static void
+console_init(void)
+{
+    eUSCI_UART_Config sConfig = {
+        EUSCI_A_UART_CLOCKSOURCE_SMCLK,
+        0, 0, 0,                            /* Baud rate, filled in below */
+        EUSCI_A_UART_NO_PARITY,
+        EUSCI_A_UART_LSB_FIRST,
+        EUSCI_A_UART_ONE_STOP_BIT,
+        EUSCI_A_UART_MODE,
+        0
+    };
+
+    clk_UARTConfig(&sConfig, CS_getSMCLK(), g_ui32ConsoleBaud);
+    UART_initModule(EUSCI_A0_MODULE, &sConfig);
+    UART_enableModule(EUSCI_A0_MODULE);
+    UART_enableInterrupt(EUSCI_A0_MODULE, EUSCI_A_UART_RECEIVE_INTERRUPT);
+}
+
+void
+clk_ConsoleInit(uint32_t ui32Baud)
+{
+    g_ui32ConsoleBaud = ui32Baud;
+    console_init();
+    Interrupt_enableInterrupt(INT_EUSCIA0);
+}
+
+tClockProfile
+clk_GetProfile(void)
+{
+    return g_eProfile;
+}
+
+void
+clk_SetProfile(tClockProfile eProfile)
+{
+    const tProfileInfo *psNew = &g_psProfiles[eProfile];
+    bool bMasked, bFaster;
+
+    /* Let the last character out at the old baud rate */
+    if (g_ui32ConsoleBaud)
+        while (UART_queryStatusFlags(EUSCI_A0_MODULE, EUSCI_A_UART_BUSY)) ;
+
+    bMasked = Interrupt_disableMaster();
+
+    bFaster = eProfile > g_eProfile;
+    if (bFaster) {
+        PCM_setCoreVoltageLevel(psNew->ui8Vcore);
+        FlashCtl_setWaitState(FLASH_BANK0, psNew->ui32WaitStates);
+        FlashCtl_setWaitState(FLASH_BANK1, psNew->ui32WaitStates);
+        CS_initClockSignal(CS_SMCLK, CS_DCOCLK_SELECT, psNew->ui32SMCLKDiv);
+    }
+
+    CS_setDCOCenteredFrequency(psNew->ui32DCOFreq);
+    CS_initClockSignal(CS_MCLK, CS_DCOCLK_SELECT, CS_CLOCK_DIVIDER_1);
+    CS_initClockSignal(CS_HSMCLK, CS_DCOCLK_SELECT, CS_CLOCK_DIVIDER_1);
+
+    if (!bFaster) {
+        CS_initClockSignal(CS_SMCLK, CS_DCOCLK_SELECT, psNew->ui32SMCLKDiv);
+        FlashCtl_setWaitState(FLASH_BANK0, psNew->ui32WaitStates);
+        FlashCtl_setWaitState(FLASH_BANK1, psNew->ui32WaitStates);
+        PCM_setCoreVoltageLevel(psNew->ui8Vcore);
+    }
+    g_eProfile = eProfile;
+
+    /* Derive the peripheral clocks again */
+    tb_Rebase();
+    sb_ClockChanged();
+    prof_ClockChanged();
+    tr_ClockChanged();
+    if (g_ui32ConsoleBaud) console_init();
+
+    if (!bMasked) Interrupt_enableMaster();
+}
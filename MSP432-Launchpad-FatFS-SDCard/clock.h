@@ -0,0 +1,47 @@
+/*
+ * clock.h - clock profiles
+ *
+ * A profile sets the DCO frequency, the core voltage and the flash wait
+ * states together. Switching profiles recomputes the console UART baud rate
+ * dividers, the SPI clock divider and the profiler's sampling period, and
+ * carries the time base over, so the peripherals keep their rates at any
+ * speed.
+ */
+
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdint.h>
+#include "driverlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    CLK_PROFILE_LOW_POWER,      /* MCLK = SMCLK = 3 MHz, VCORE0 */
+    CLK_PROFILE_BALANCED,       /* MCLK = SMCLK = 12 MHz, VCORE0 */
+    CLK_PROFILE_MAX,            /* MCLK = 48 MHz, SMCLK = 24 MHz, VCORE1 */
+    CLK_NUM_PROFILES
+} tClockProfile;
+
+/* Switch to a profile. Waits for the console UART to finish sending first. */
+void clk_SetProfile(tClockProfile eProfile);
+
+/* The profile in use */
+tClockProfile clk_GetProfile(void);
+
+/* Set up and enable the console UART (EUSCI A0) with receive interrupts. Its
+ * baud rate is kept over profile switches from then on. */
+void clk_ConsoleInit(uint32_t ui32Baud);
+
+/* Fill in the baud rate fields of a UART configuration for a clock source
+ * frequency, after the eUSCI baud rate calculation in the user's guide */
+void clk_UARTConfig(eUSCI_UART_Config *psConfig, uint32_t ui32ClockHz,
+                    uint32_t ui32Baud);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CLOCK_H__ */
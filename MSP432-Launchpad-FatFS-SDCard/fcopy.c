@@ -0,0 +1,182 @@
+/*
+ * fcopy.c - copy and move files
+ *
+ * The new file is stretched to the size of the old one by f_lseek() before
+ * anything is written, which allocates the whole cluster chain at once and
+ * finds out early whether it fits. The copy loop then overwrites it from
+ * the start, so f_write() does not have to allocate as it goes and writes
+ * on through the clusters that follow each other in one command.
+ *
+ * The copy is written to FCOPY.$$$ in the root directory of the volume of
+ * the new file, and only takes the new name once it is whole, so a copy
+ * that fails leaves a file of that name as it was. A reset after the old
+ * file is removed and before the rename leaves the new data in FCOPY.$$$.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fatfs/src/ff.h"
+#include "fcopy.h"
+
+#if FC_BUF_SIZE % _MAX_SS
+#error FC_BUF_SIZE must be a multiple of the sector size.
+#endif
+
+/* The data on its way, word aligned for the transfers of the card driver */
+static uint32_t g_pui32Buf[FC_BUF_SIZE / 4];
+
+static FILINFO g_sInfo;
+
+/* The name of the copy while it is written, on the drive of the new file */
+static char g_pcTemp[] = "0:/FCOPY.$$$";
+
+/* The drive number of a path, which is skipped. A path without one is on
+ * drive 0, as the current drive is never changed. */
+static int
+drive(const char **ppcPath)
+{
+    const char *pcPath = *ppcPath;
+
+    if (pcPath[0] >= '0' && pcPath[0] <= '9' && pcPath[1] == ':') {
+        *ppcPath = pcPath + 2;
+        return pcPath[0] - '0';
+    }
+    return 0;
+}
+
+/* Copy to pcTo, overwriting a file of that name if bReplace, else
+ * returning FR_EXIST for it */
+static FRESULT
+copy(FIL *psSrc, FIL *psDst, const char *pcFrom, const char *pcTo,
+     bool bReplace, uint32_t *pui32Bytes)
+{
+    FRESULT iFResult, iClose;
+    UINT uRead, uWritten;
+    DWORD ui32Size;
+    const char *pcToPath = pcTo;
+    bool bExists;
+
+    *pui32Bytes = 0;
+    iFResult = f_open(psSrc, pcFrom, FA_READ);
+    if (iFResult != FR_OK) {
+        return iFResult;
+    }
+
+    // A file of the new name is left alone until the copy is whole. A copy
+    // onto itself is found by its directory entry.
+    iFResult = f_open(psDst, pcTo, FA_READ);
+    bExists = iFResult == FR_OK;
+    if (bExists) {
+        if (!bReplace) {
+            iFResult = FR_EXIST;
+        } else if (psDst->fs == psSrc->fs &&
+                   psDst->dir_sect == psSrc->dir_sect &&
+                   psDst->dir_ptr == psSrc->dir_ptr) {
+            iFResult = FR_DENIED;
+        }
+        f_close(psDst);
+    } else if (iFResult == FR_NO_FILE) {
+        iFResult = FR_OK;
+    }
+    if (iFResult == FR_OK) {
+        g_pcTemp[0] = '0' + drive(&pcToPath);
+        iFResult = f_open(psDst, g_pcTemp, FA_CREATE_ALWAYS | FA_WRITE);
+    }
+    if (iFResult != FR_OK) {
+        f_close(psSrc);
+        return iFResult;
+    }
+
+    // Allocate the clusters of the whole file. f_lseek() stops short when
+    // the volume gets full.
+    ui32Size = f_size(psSrc);
+    iFResult = f_lseek(psDst, ui32Size);
+    if (iFResult == FR_OK && f_tell(psDst) != ui32Size) {
+        iFResult = FR_DENIED;
+    }
+    if (iFResult == FR_OK) {
+        iFResult = f_lseek(psDst, 0);
+    }
+
+    while (iFResult == FR_OK && *pui32Bytes < ui32Size) {
+        iFResult = f_read(psSrc, g_pui32Buf, sizeof(g_pui32Buf), &uRead);
+        if (iFResult == FR_OK && !uRead) {
+            iFResult = FR_INT_ERR;
+        }
+        if (iFResult == FR_OK) {
+            iFResult = f_write(psDst, g_pui32Buf, uRead, &uWritten);
+        }
+        if (iFResult == FR_OK && uWritten != uRead) {
+            iFResult = FR_DENIED;
+        }
+        *pui32Bytes += uRead;
+    }
+
+    iClose = f_close(psDst);
+    if (iFResult == FR_OK) {
+        iFResult = iClose;
+    }
+    f_close(psSrc);
+
+    // The old file goes only for a whole copy, which f_rename() takes
+    // without the drive number.
+    if (iFResult == FR_OK && bExists) {
+        iFResult = f_unlink(pcTo);
+    }
+    if (iFResult == FR_OK) {
+        iFResult = f_rename(g_pcTemp, pcToPath);
+    }
+    if (iFResult != FR_OK) {
+        f_unlink(g_pcTemp);
+        *pui32Bytes = 0;
+    }
+    return iFResult;
+}
+
+FRESULT
+fc_Copy(FIL *psSrc, FIL *psDst, const char *pcFrom, const char *pcTo,
+        uint32_t *pui32Bytes)
+{
+    return copy(psSrc, psDst, pcFrom, pcTo, true, pui32Bytes);
+}
+
+FRESULT
+fc_Move(FIL *psSrc, FIL *psDst, const char *pcFrom, const char *pcTo,
+        uint32_t *pui32Bytes)
+{
+    FRESULT iFResult;
+    const char *pcFromPath = pcFrom, *pcToPath = pcTo;
+
+    // f_rename() takes the new name without a drive number.
+    *pui32Bytes = 0;
+    if (drive(&pcFromPath) == drive(&pcToPath)) {
+        return f_rename(pcFrom, pcToPath);
+    }
+
+#if _USE_LFN
+    g_sInfo.lfname = 0;
+    g_sInfo.lfsize = 0;
+#endif
+    // A directory is not copied, and a read-only file could not be removed
+    // after it.
+    iFResult = f_stat(pcFrom, &g_sInfo);
+    if (iFResult == FR_OK && (g_sInfo.fattrib & (AM_DIR | AM_RDO))) {
+        iFResult = FR_DENIED;
+    }
+    if (iFResult == FR_OK) {
+        iFResult = copy(psSrc, psDst, pcFrom, pcTo, false, pui32Bytes);
+    }
+    if (iFResult == FR_OK) {
+        iFResult = f_utime(pcTo, &g_sInfo);
+    }
+    if (iFResult == FR_OK) {
+        iFResult = f_chmod(pcTo, g_sInfo.fattrib, AM_HID | AM_SYS | AM_ARC);
+    }
+
+    // Only a file that is whole on the other volume is removed.
+    if (iFResult == FR_OK) {
+        iFResult = f_unlink(pcFrom);
+    }
+    return iFResult;
+}
@@ -0,0 +1,50 @@
+/*
+ * fcopy.h - copy and move files
+ *
+ * A copy goes through one buffer of FC_BUF_SIZE bytes, which f_read() and
+ * f_write() fill and empty with multiple block transfers straight to and
+ * from the card, instead of a sector at a time through the file buffers.
+ * The clusters of the new file are all allocated before the data is
+ * written, so that they are in a row where the card has the room, and the
+ * writes go on across cluster boundaries as the reads do.
+ *
+ * A move on the same volume changes the directory entry only, with
+ * f_rename(), whatever the size of the file. A move to another volume is a
+ * copy that keeps the time stamp and the attributes, and then removes the
+ * file it came from.
+ */
+
+#ifndef __FCOPY_H__
+#define __FCOPY_H__
+
+#include <stdint.h>
+#include "fatfs/src/ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bytes moved by each f_read() and f_write(), a multiple of the sector size */
+#define FC_BUF_SIZE             8192
+
+/* Copy pcFrom to pcTo, which is replaced if it exists. The file objects
+ * are owned by the caller, and both are closed again on return. *pui32Bytes
+ * gets the bytes copied. Returns FR_DENIED for a copy onto itself or when
+ * the volume of pcTo has no room for the file. A copy that fails leaves
+ * pcTo as it was. */
+FRESULT fc_Copy(FIL *psSrc, FIL *psDst, const char *pcFrom, const char *pcTo,
+                uint32_t *pui32Bytes);
+
+/* Move pcFrom to pcTo, which must not exist yet, else FR_EXIST is returned
+ * before anything is copied. On the same volume this also moves
+ * directories, and *pui32Bytes is set to zero. Otherwise it gets the bytes
+ * copied to the other volume, and FR_DENIED is returned for a directory or
+ * a read-only file. */
+FRESULT fc_Move(FIL *psSrc, FIL *psDst, const char *pcFrom, const char *pcTo,
+                uint32_t *pui32Bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FCOPY_H__ */
@@ -0,0 +1,423 @@
+/*
+ * lzb.c - block compressed files
+ *
+ * The packer is a greedy LZ4 one: a hash of the next 4 bytes finds the last
+ * place they were seen in the block, and a match is taken if the bytes are
+ * the same there. The search steps faster over data that does not match,
+ * so that data that does not pack costs little time. As LZ4 requires, the
+ * last match starts 12 bytes or more before the end of the block and the
+ * last 5 bytes are literals, so any LZ4 block decoder unpacks the blocks.
+ *
+ * The unpacker checks every length and offset against the block, so a
+ * damaged block is reported rather than written past the buffer.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fatfs/src/ff.h"
+#include "lzb.h"
+
+/* Size of the hash table, in bits of the hash */
+#define LZB_HASH_BITS           10
+
+/* LZ4 limits */
+#define MIN_MATCH               4
+#define MF_LIMIT                12      /* Last match starts before this */
+#define LAST_LITERALS           5
+
+#define EMPTY                   0xFFFF
+
+/* Last position of each hash of 4 bytes in the block being packed */
+static uint16_t g_pui16Hash[1 << LZB_HASH_BITS];
+
+/* A packed block with its header, on the way to or from the file */
+static uint8_t g_pui8Packed[4 + LZB_BOUND(LZB_BLOCK)];
+
+static const char g_pcMagic[4] = { 'L', 'Z', 'B', '1' };
+
+static uint32_t
+read32(const uint8_t *pui8Src)
+{
+    uint32_t ui32Val;
+
+    memcpy(&ui32Val, pui8Src, 4);
+    return ui32Val;
+}
+
+static uint_fast16_t
+hash(uint32_t ui32Val)
+{
+    return (ui32Val * 2654435761U) >> (32 - LZB_HASH_BITS);
+}
+
+/* The bytes of a length past the 15 that fit in the token */
+static uint8_t *
+put_length(uint8_t *pui8Dst, uint_fast16_t ui16Len)
+{
+    for (; ui16Len >= 255; ui16Len -= 255)
+        *pui8Dst++ = 255;
+    *pui8Dst++ = ui16Len;
+    return pui8Dst;
+}
+
+/* A sequence of literals and a match, or the literals only if ui16Match is
+ * zero */
+static uint8_t *
+put_sequence(uint8_t *pui8Dst, const uint8_t *pui8Lit, uint_fast16_t ui16Lit,
+             uint_fast16_t ui16Dist, uint_fast16_t ui16Match)
+{
+    uint8_t *pui8Token = pui8Dst++;
+
+    *pui8Token = ((ui16Lit < 15) ? ui16Lit : 15) << 4;
+    if (ui16Lit >= 15) pui8Dst = put_length(pui8Dst, ui16Lit - 15);
+    memcpy(pui8Dst, pui8Lit, ui16Lit);
+    pui8Dst += ui16Lit;
+    if (ui16Match) {
+        *pui8Dst++ = ui16Dist;
+        *pui8Dst++ = ui16Dist >> 8;
+        ui16Match -= MIN_MATCH;
+        *pui8Token |= (ui16Match < 15) ? ui16Match : 15;
+        if (ui16Match >= 15) pui8Dst = put_length(pui8Dst, ui16Match - 15);
+    }
+    return pui8Dst;
+}
+
+uint_fast16_t
+lzb_Pack(const uint8_t *pui8Src, uint_fast16_t ui16Len, uint8_t *pui8Dst)
+{
+    uint_fast16_t ui16Pos = 0, ui16Anchor = 0, ui16Ref, ui16Match, ui16H;
+    uint8_t *pui8Out = pui8Dst;
+    uint32_t ui32Val;
+
+    if (ui16Len > MF_LIMIT) {
+        memset(g_pui16Hash, 0xFF, sizeof(g_pui16Hash));
+        while (ui16Pos < ui16Len - MF_LIMIT) {
+            ui32Val = read32(pui8Src + ui16Pos);
+            ui16H = hash(ui32Val);
+            ui16Ref = g_pui16Hash[ui16H];
+            g_pui16Hash[ui16H] = ui16Pos;
+            if (ui16Ref == EMPTY || read32(pui8Src + ui16Ref) != ui32Val) {
+                ui16Pos += 1 + ((ui16Pos - ui16Anchor) >> 6);
+                continue;
+            }
+            for (ui16Match = MIN_MATCH;
+                 ui16Pos + ui16Match < ui16Len - LAST_LITERALS &&
+                 pui8Src[ui16Ref + ui16Match] == pui8Src[ui16Pos + ui16Match];
+                 ui16Match++)
+                ;
+            pui8Out = put_sequence(pui8Out, pui8Src + ui16Anchor,
+                                   ui16Pos - ui16Anchor, ui16Pos - ui16Ref,
+                                   ui16Match);
+            ui16Pos += ui16Match;
+            ui16Anchor = ui16Pos;
+            g_pui16Hash[hash(read32(pui8Src + ui16Pos - 2))] = ui16Pos - 2;
+        }
+    }
+    pui8Out = put_sequence(pui8Out, pui8Src + ui16Anchor,
+                           ui16Len - ui16Anchor, 0, 0);
+    return pui8Out - pui8Dst;
+}
+
+/* Add the bytes of a length past the 15 in the token. Returns false if the
+ * input ends first. */
+static bool
+get_length(const uint8_t **ppui8Src, const uint8_t *pui8End,
+           uint_fast16_t *pui16Len)
+{
+    uint8_t ui8Byte;
+
+    do {
+        if (*ppui8Src == pui8End) return false;
+        ui8Byte = *(*ppui8Src)++;
+        *pui16Len += ui8Byte;
+    } while (ui8Byte == 255 && *pui16Len < 0xFFFF - 255);
+    return ui8Byte != 255;
+}
+
+uint_fast16_t
+lzb_Unpack(const uint8_t *pui8Src, uint_fast16_t ui16Len, uint8_t *pui8Dst,
+           uint_fast16_t ui16Cap)
+{
+    const uint8_t *pui8End = pui8Src + ui16Len;
+    uint_fast16_t ui16Out = 0, ui16Lit, ui16Match, ui16Dist;
+    uint8_t ui8Token;
+
+    while (pui8Src < pui8End) {
+        ui8Token = *pui8Src++;
+        ui16Lit = ui8Token >> 4;
+        if (ui16Lit == 15 && !get_length(&pui8Src, pui8End, &ui16Lit))
+            return 0;
+        if (ui16Lit > (size_t)(pui8End - pui8Src) ||
+            ui16Lit > ui16Cap - ui16Out)
+            return 0;
+        memcpy(pui8Dst + ui16Out, pui8Src, ui16Lit);
+        pui8Src += ui16Lit;
+        ui16Out += ui16Lit;
+        if (pui8Src == pui8End) break;
+
+        if (pui8End - pui8Src < 2) return 0;
+        ui16Dist = pui8Src[0] | pui8Src[1] << 8;
+        pui8Src += 2;
+        ui16Match = ui8Token & 15;
+        if (ui16Match == 15 && !get_length(&pui8Src, pui8End, &ui16Match))
+            return 0;
+        ui16Match += MIN_MATCH;
+        if (!ui16Dist || ui16Dist > ui16Out || ui16Match > ui16Cap - ui16Out)
+            return 0;
+        for (; ui16Match; ui16Match--, ui16Out++)
+            pui8Dst[ui16Out] = pui8Dst[ui16Out - ui16Dist];
+    }
+    return ui16Out;
+}
+
+/* Read the header of the block at the file position. *pbEnd is set at the
+ * end of the file, and for a header that makes no sense or a block cut
+ * short, as a reset while writing it leaves. */
+static FRESULT
+read_header(FIL *psFile, uint_fast16_t *pui16Raw, uint_fast16_t *pui16Stored,
+            bool *pbEnd)
+{
+    uint8_t pui8Hdr[4];
+    FRESULT iFResult;
+    UINT uRead;
+
+    iFResult = f_read(psFile, pui8Hdr, 4, &uRead);
+    *pui16Raw = pui8Hdr[0] | pui8Hdr[1] << 8;
+    *pui16Stored = pui8Hdr[2] | pui8Hdr[3] << 8;
+    *pbEnd = uRead < 4 || !*pui16Raw || *pui16Raw > LZB_BLOCK ||
+             !*pui16Stored || *pui16Stored > *pui16Raw ||
+             *pui16Stored > f_size(psFile) - f_tell(psFile);
+    return iFResult;
+}
+
+/* Skip blocks from the file position on, which is at offset *pui32Offset of
+ * the data, until the one holding ui32Offset or the end. The file is left at
+ * the header of that block, and *pui32Offset at its offset. */
+static FRESULT
+find_block(FIL *psFile, uint32_t ui32Offset, uint32_t *pui32Offset)
+{
+    uint_fast16_t ui16Raw, ui16Stored;
+    FRESULT iFResult;
+    DWORD ui32Pos;
+    bool bEnd;
+
+    for (;;) {
+        ui32Pos = f_tell(psFile);
+        iFResult = read_header(psFile, &ui16Raw, &ui16Stored, &bEnd);
+        if (iFResult != FR_OK) return iFResult;
+        if (bEnd || *pui32Offset + ui16Raw > ui32Offset) break;
+        *pui32Offset += ui16Raw;
+        iFResult = f_lseek(psFile, f_tell(psFile) + ui16Stored);
+        if (iFResult != FR_OK) return iFResult;
+    }
+    return f_lseek(psFile, ui32Pos);
+}
+
+/* Read and unpack the block at the file position into the block buffer,
+ * which is left empty at the end of the file */
+static FRESULT
+load_block(tLzbFile *psLzb)
+{
+    uint_fast16_t ui16Raw, ui16Stored;
+    DWORD ui32Pos = f_tell(psLzb->psFile);
+    FRESULT iFResult;
+    UINT uRead;
+    bool bEnd;
+
+    psLzb->ui32Offset += psLzb->ui16Len;
+    psLzb->ui16Len = psLzb->ui16Pos = 0;
+    iFResult = read_header(psLzb->psFile, &ui16Raw, &ui16Stored, &bEnd);
+    if (iFResult != FR_OK) return iFResult;
+    if (bEnd) return f_lseek(psLzb->psFile, ui32Pos);
+
+    if (ui16Stored == ui16Raw) {
+        iFResult = f_read(psLzb->psFile, psLzb->pui8Block, ui16Raw, &uRead);
+    } else {
+        iFResult = f_read(psLzb->psFile, g_pui8Packed, ui16Stored, &uRead);
+        if (iFResult == FR_OK &&
+            lzb_Unpack(g_pui8Packed, ui16Stored, psLzb->pui8Block,
+                       LZB_BLOCK) != ui16Raw)
+            iFResult = FR_INT_ERR;
+    }
+    if (iFResult == FR_OK) psLzb->ui16Len = ui16Raw;
+    return iFResult;
+}
+
+/* Pack the block buffer and write it */
+static FRESULT
+write_block(tLzbFile *psLzb)
+{
+    uint_fast16_t ui16Len = psLzb->ui16Len, ui16Stored;
+    FRESULT iFResult;
+    UINT uWritten, uExpected;
+
+    if (!ui16Len) return FR_OK;
+    ui16Stored = lzb_Pack(psLzb->pui8Block, ui16Len, g_pui8Packed + 4);
+    if (ui16Stored >= ui16Len) ui16Stored = ui16Len;
+    g_pui8Packed[0] = ui16Len;
+    g_pui8Packed[1] = ui16Len >> 8;
+    g_pui8Packed[2] = ui16Stored;
+    g_pui8Packed[3] = ui16Stored >> 8;
+    if (ui16Stored == ui16Len) {
+        uExpected = 4;
+        iFResult = f_write(psLzb->psFile, g_pui8Packed, 4, &uWritten);
+        if (iFResult == FR_OK && uWritten == 4) {
+            uExpected = ui16Len;
+            iFResult = f_write(psLzb->psFile, psLzb->pui8Block, ui16Len,
+                               &uWritten);
+        }
+    } else {
+        uExpected = 4 + ui16Stored;
+        iFResult = f_write(psLzb->psFile, g_pui8Packed, uExpected,
+                           &uWritten);
+    }
+    if (iFResult == FR_OK && uWritten != uExpected) iFResult = FR_DENIED;
+    if (iFResult != FR_OK) return iFResult;
+    psLzb->ui32Offset += ui16Len;
+    psLzb->ui16Len = 0;
+    return FR_OK;
+}
+
+FRESULT
+lzb_Open(tLzbFile *psLzb, FIL *psFile, const char *pcPath, uint8_t ui8Mode)
+{
+    FRESULT iFResult;
+    char pcMagic[4];
+    UINT uCount;
+
+    psLzb->psFile = psFile;
+    psLzb->bWrite = (ui8Mode & FA_WRITE) != 0;
+    psLzb->ui16Len = psLzb->ui16Pos = 0;
+    psLzb->ui32Offset = 0;
+    iFResult = f_open(psFile, pcPath, ui8Mode | FA_READ);
+    if (iFResult != FR_OK) return iFResult;
+
+    /* A new file gets the magic, any other must have it to be packed */
+    if (psLzb->bWrite && !f_size(psFile)) {
+        iFResult = f_write(psFile, g_pcMagic, 4, &uCount);
+        psLzb->bPacked = true;
+    } else {
+        iFResult = f_read(psFile, pcMagic, 4, &uCount);
+        psLzb->bPacked = uCount == 4 && !memcmp(pcMagic, g_pcMagic, 4);
+        if (iFResult == FR_OK && !psLzb->bPacked) {
+            iFResult = psLzb->bWrite ? FR_DENIED : f_lseek(psFile, 0);
+        }
+    }
+
+    /* Add to a file after its last whole block */
+    if (iFResult == FR_OK && psLzb->bWrite && f_tell(psFile) == 4) {
+        iFResult = find_block(psFile, 0xFFFFFFFF, &psLzb->ui32Offset);
+        if (iFResult == FR_OK && f_tell(psFile) != f_size(psFile))
+            iFResult = f_truncate(psFile);
+    }
+    if (iFResult != FR_OK) f_close(psFile);
+    return iFResult;
+}
+
+FRESULT
+lzb_Read(tLzbFile *psLzb, void *pvBuf, UINT uSize, UINT *puRead)
+{
+    FRESULT iFResult;
+    uint_fast16_t ui16Count;
+
+    *puRead = 0;
+    if (!psLzb->bPacked) return f_read(psLzb->psFile, pvBuf, uSize, puRead);
+    while (uSize) {
+        if (psLzb->ui16Pos == psLzb->ui16Len) {
+            iFResult = load_block(psLzb);
+            if (iFResult != FR_OK) return iFResult;
+            if (!psLzb->ui16Len) break;
+        }
+        ui16Count = psLzb->ui16Len - psLzb->ui16Pos;
+        if (ui16Count > uSize) ui16Count = uSize;
+        memcpy(pvBuf, psLzb->pui8Block + psLzb->ui16Pos, ui16Count);
+        psLzb->ui16Pos += ui16Count;
+        pvBuf = (uint8_t *)pvBuf + ui16Count;
+        *puRead += ui16Count;
+        uSize -= ui16Count;
+    }
+    return FR_OK;
+}
+
+FRESULT
+lzb_Write(tLzbFile *psLzb, const void *pvBuf, UINT uSize, UINT *puWritten)
+{
+    FRESULT iFResult;
+    uint_fast16_t ui16Count;
+
+    *puWritten = 0;
+    while (uSize) {
+        ui16Count = LZB_BLOCK - psLzb->ui16Len;
+        if (ui16Count > uSize) ui16Count = uSize;
+        memcpy(psLzb->pui8Block + psLzb->ui16Len, pvBuf, ui16Count);
+        psLzb->ui16Len += ui16Count;
+        pvBuf = (const uint8_t *)pvBuf + ui16Count;
+        *puWritten += ui16Count;
+        uSize -= ui16Count;
+        if (psLzb->ui16Len == LZB_BLOCK) {
+            iFResult = write_block(psLzb);
+            if (iFResult != FR_OK) return iFResult;
+        }
+    }
+    return FR_OK;
+}
+
+FRESULT
+lzb_Sync(tLzbFile *psLzb)
+{
+    FRESULT iFResult;
+
+    iFResult = write_block(psLzb);
+    if (iFResult == FR_OK) iFResult = f_sync(psLzb->psFile);
+    return iFResult;
+}
+
+FRESULT
+lzb_Seek(tLzbFile *psLzb, uint32_t ui32Offset)
+{
+    FRESULT iFResult;
+
+    if (!psLzb->bPacked) return f_lseek(psLzb->psFile, ui32Offset);
+
+    if (ui32Offset >= psLzb->ui32Offset &&
+        ui32Offset < psLzb->ui32Offset + psLzb->ui16Len) {
+        psLzb->ui16Pos = ui32Offset - psLzb->ui32Offset;
+        return FR_OK;
+    }
+
+    /* Search on from the block buffer, or from the start for an offset
+     * before it */
+    if (ui32Offset < psLzb->ui32Offset) {
+        iFResult = f_lseek(psLzb->psFile, 4);
+        if (iFResult != FR_OK) return iFResult;
+        psLzb->ui32Offset = 0;
+    } else {
+        psLzb->ui32Offset += psLzb->ui16Len;
+    }
+    psLzb->ui16Len = psLzb->ui16Pos = 0;
+    iFResult = find_block(psLzb->psFile, ui32Offset, &psLzb->ui32Offset);
+    if (iFResult == FR_OK) iFResult = load_block(psLzb);
+    if (iFResult == FR_OK && psLzb->ui16Len)
+        psLzb->ui16Pos = ui32Offset - psLzb->ui32Offset;
+    return iFResult;
+}
+
+uint32_t
+lzb_Tell(tLzbFile *psLzb)
+{
+    if (!psLzb->bPacked) return f_tell(psLzb->psFile);
+    return psLzb->ui32Offset +
+           (psLzb->bWrite ? psLzb->ui16Len : psLzb->ui16Pos);
+}
+
+FRESULT
+lzb_Close(tLzbFile *psLzb)
+{
+    FRESULT iFResult = FR_OK;
+
+    if (psLzb->bWrite) iFResult = write_block(psLzb);
+    if (iFResult == FR_OK) return f_close(psLzb->psFile);
+    f_close(psLzb->psFile);
+    return iFResult;
+}
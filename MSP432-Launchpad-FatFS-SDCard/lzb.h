@@ -0,0 +1,86 @@
+/*
+ * lzb.h - block compressed files
+ *
+ * Data written through lzb_Write() is cut into blocks of LZB_BLOCK bytes,
+ * and each block is compressed on its own, in the LZ4 block format, before
+ * it goes to f_write(). A block that does not get smaller is stored as it
+ * is. The file starts with the 4 bytes "LZB1", and each block with its
+ * size before and after compression, 16 bits each, so that lzb_Seek() finds
+ * the block of an offset by reading the block headers only.
+ *
+ * Blocks do not refer to each other, which keeps the state to the block
+ * buffer of each open file, and a 2KB hash table and a block of compressed
+ * data shared by all of them. Telemetry in CSV packs to about half, and the
+ * card writes half as many sectors. lzb_Sync() ends the block being filled,
+ * so syncing often costs some of the gain. A seek reads one block header
+ * for each block it passes. Files without the "LZB1" start are read as they
+ * are. tools/lzb.py packs and unpacks files on a PC.
+ */
+
+#ifndef __LZB_H__
+#define __LZB_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fatfs/src/ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bytes of data per block, at most 65535 */
+#define LZB_BLOCK               2048
+
+/* An open file. The structure and the FIL are owned by the caller. */
+typedef struct {
+    FIL *psFile;
+    bool bWrite;                /* Opened for writing */
+    bool bPacked;               /* Blocks, else read as it is */
+    uint16_t ui16Len;           /* Bytes in the block buffer */
+    uint16_t ui16Pos;           /* Bytes of them read */
+    uint32_t ui32Offset;        /* Offset in the data of the block buffer */
+    uint8_t pui8Block[LZB_BLOCK];
+} tLzbFile;
+
+/* Open pcPath with psFile. ui8Mode is FA_READ, or FA_WRITE with
+ * FA_CREATE_ALWAYS for a new file or FA_OPEN_ALWAYS to add to the end of
+ * one. A file to add to must be a compressed one, else FR_DENIED is
+ * returned. */
+FRESULT lzb_Open(tLzbFile *psLzb, FIL *psFile, const char *pcPath,
+                 uint8_t ui8Mode);
+
+/* Read up to uSize bytes of data. *puRead is less only at the end. Returns
+ * FR_INT_ERR for a block that does not unpack. */
+FRESULT lzb_Read(tLzbFile *psLzb, void *pvBuf, UINT uSize, UINT *puRead);
+
+/* Write uSize bytes of data. Each full block is packed and written. */
+FRESULT lzb_Write(tLzbFile *psLzb, const void *pvBuf, UINT uSize,
+                  UINT *puWritten);
+
+/* Write the block being filled and sync the file */
+FRESULT lzb_Sync(tLzbFile *psLzb);
+
+/* Move the read position to ui32Offset of the data, or to the end if that
+ * is less. Only the block holding it is unpacked. */
+FRESULT lzb_Seek(tLzbFile *psLzb, uint32_t ui32Offset);
+
+/* Offset in the data of the read or write position */
+uint32_t lzb_Tell(tLzbFile *psLzb);
+
+/* Write the block being filled, and close the file */
+FRESULT lzb_Close(tLzbFile *psLzb);
+
+/* Pack uLen (1 to LZB_BLOCK) bytes into pui8Dst, which has room for
+ * LZB_BOUND(uLen) bytes, and unpack them again. lzb_Unpack() returns 0 if the
+ * data does not unpack into ui16Cap bytes or less. */
+#define LZB_BOUND(n)            ((n) + (n) / 255 + 16)
+uint_fast16_t lzb_Pack(const uint8_t *pui8Src, uint_fast16_t ui16Len,
+                       uint8_t *pui8Dst);
+uint_fast16_t lzb_Unpack(const uint8_t *pui8Src, uint_fast16_t ui16Len,
+                         uint8_t *pui8Dst, uint_fast16_t ui16Cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LZB_H__ */
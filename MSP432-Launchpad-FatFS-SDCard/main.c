@@ -14,16 +14,25 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "utils/cmdline.h"
 #include "fatfs/src/ff.h"
 #include "fatfs/src/diskio.h"
 
-#include "spiDriver.h"
+#include "spiBus.h"
+#include "timebase.h"
+#include "clock.h"
+#include "ymodem.h"
+#include "profiler.h"
+#include "trace.h"
+#include "reclog.h"
+#include "lzb.h"
+#include "fcopy.h"
 
 // Defines the size of the buffers that hold the path, or temporary data from
-// the SD card.  There are two buffers allocated of this size.  The buffer size
+// the SD card.  There are three buffers allocated of this size.  The buffer size
 // must be large enough to hold the longest expected full path name, including
 // the file name, and a trailing null character.
 #define PATH_BUF_SIZE           80
@@ -31,6 +40,16 @@
 // Defines the size of the buffer that holds the command line.
 #define CMD_BUF_SIZE            64
 
+// The sampling rate of "prof start" without a rate.
+#define PROF_DEFAULT_HZ         1000
+
+// The record log of the "log" command, stamped in milliseconds since reset.
+// A new file is started every megabyte or every hour.
+static const tRecLogConfig g_sRecLogConfig = { "0:/LOG", 1024 * 1024,
+		3600000 };
+static tRecLog g_sRecLog;
+static bool g_bRecLogOpen;
+
 // This buffer holds the full path to the current working directory.  Initially
 // it is root ("/").
 static char g_pcCwdBuf[PATH_BUF_SIZE] = "/";
@@ -39,21 +58,71 @@ static char g_pcCwdBuf[PATH_BUF_SIZE] = "/";
 // from the SD card.
 static char g_pcTmpBuf[PATH_BUF_SIZE];
 
+// The path of the file "cp" and "mv" write to.
+static char g_pcDstBuf[PATH_BUF_SIZE];
+
 // The buffer that holds the command line.
 static char g_pcCmdBuf[CMD_BUF_SIZE];
 
 // The following are data structures used by FatFs.
 static FATFS g_sFatFs;
+#if _VOLUMES > 1
+static FATFS g_sFatFs1;
+#endif
+#if _VOLUMES > 2
+static FATFS g_sFatFs2;
+#endif
 static DIR g_sDirObject;
-static FILINFO g_sFileInfo;
 static FIL g_sFileObject;
 
+// The second file of "pack", "cp" and "mv", and the block compressed side of
+// "cat" and "pack".
+static FIL g_sPackFile;
+static tLzbFile g_sLzbFile;
+
+#if _USE_DEFRAG
+// The sectors "defrag" copies each time round the idle loop, and the file it
+// is moving.  g_iDefragResult is the result of the last file moved.
+#define DEFRAG_STEP             8
+static DEFRAG g_sDefrag;
+static FIL g_sDefragFile;
+static FRESULT g_iDefragResult = FR_OK;
+#endif
+
+// The number of entries "ls" reads at a time, one directory sector's worth.
+#define LS_BATCH                16
+
+// The lines of a batch are formatted into one buffer before they are sent to
+// the console.  A line is 37 characters plus the name, so the buffer holds a
+// batch of 8.3 names.  A long name that does not fit sends the buffer first.
+#define LS_BUF_SIZE             (LS_BATCH * (37 + 12) + 1)
+#if _USE_LFN && (37 + _MAX_LFN >= LS_BUF_SIZE)
+#error LS_BUF_SIZE must hold the longest line.
+#endif
+
+static FILINFO g_psLsInfo[LS_BATCH];
+#if _USE_LFN
+static char g_pcLsLfn[LS_BATCH][_MAX_LFN + 1];
+#endif
+static char g_pcLsBuf[LS_BUF_SIZE];
+
 // Command declaration.
 int Cmd_help(int argc, char *argv[]);
 int Cmd_ls(int argc, char *argv[]);
 int Cmd_pwd(int argc, char *argv[]);
 int Cmd_cd(int argc, char *argv[]);
 int Cmd_cat(int argc, char *argv[]);
+int Cmd_get(int argc, char *argv[]);
+int Cmd_put(int argc, char *argv[]);
+int Cmd_prof(int argc, char *argv[]);
+int Cmd_trace(int argc, char *argv[]);
+int Cmd_log(int argc, char *argv[]);
+int Cmd_pack(int argc, char *argv[]);
+int Cmd_cp(int argc, char *argv[]);
+int Cmd_mv(int argc, char *argv[]);
+#if _USE_DEFRAG
+int Cmd_defrag(int argc, char *argv[]);
+#endif
 
 //*****************************************************************************
 //
@@ -64,10 +133,22 @@ int Cmd_cat(int argc, char *argv[]);
 tCmdLineEntry g_psCmdTable[] = {
 		{ "help", Cmd_help, "Display list of commands" }, { "h", Cmd_help,
 				"alias for help" }, { "?", Cmd_help, "alias for help" }, { "ls",
-				Cmd_ls, "Display list of files" }, { "chdir", Cmd_cd,
+				Cmd_ls, "Display list of files [pattern]" }, { "chdir", Cmd_cd,
 				"Change directory" }, { "cd", Cmd_cd, "alias for chdir" }, {
 				"pwd", Cmd_pwd, "Show current working directory" }, { "cat",
-				Cmd_cat, "Show contents of a text file" }, { 0, 0, 0 } };
+				Cmd_cat, "Show contents of a text file" }, { "get", Cmd_get,
+				"Send a file with YMODEM" }, { "put", Cmd_put,
+				"Receive a file with YMODEM [name]" }, { "prof", Cmd_prof,
+				"Profiler: start [Hz], stop, clear or dump" }, { "trace",
+				Cmd_trace, "Event trace: on [fs disk cmd wait], off, clear or dump" },
+				{ "log", Cmd_log, "Record log: add <text>, sync or show [from [to]]" },
+				{ "pack", Cmd_pack, "Compress a file: pack <file> <packed file>" },
+				{ "cp", Cmd_cp, "Copy a file: cp <file> <new file>" },
+				{ "mv", Cmd_mv, "Move or rename: mv <file> <new name>" },
+#if _USE_DEFRAG
+				{ "defrag", Cmd_defrag, "Make a file contiguous: defrag [file or stop]" },
+#endif
+				{ 0, 0, 0 } };
 
 // A structure that holds a mapping between an FRESULT numerical code, and a
 // string representation.  FRESULT codes are returned from the FatFs FAT file
@@ -103,7 +184,8 @@ FRESULT_ENTRY(FR_TIMEOUT),
 FRESULT_ENTRY(FR_LOCKED),
 FRESULT_ENTRY(FR_NOT_ENOUGH_CORE),
 FRESULT_ENTRY(FR_TOO_MANY_OPEN_FILES),
-FRESULT_ENTRY(FR_INVALID_PARAMETER), };
+FRESULT_ENTRY(FR_INVALID_PARAMETER),
+FRESULT_ENTRY(FR_IN_PROGRESS), };
 
 // A macro that holds the number of result codes.
 #define NUM_FRESULT_CODES       (sizeof(g_psFResultStrings) /                 \
@@ -130,32 +212,66 @@ StringFromFResult(FRESULT iFResult) {
 	return ("UNKNOWN ERROR CODE");
 }
 
-/* UART Configuration Parameter. These are the configuration parameters to
- * make the eUSCI A UART module to operate with a 115200 baud rate. These
- * values were calculated using the online calculator that TI provides
- * at:
- * http://processors.wiki.ti.com/index.php/
- *               USCI_UART_Baud_Rate_Gen_Mode_Selection
- */
-const eUSCI_UART_Config uartConfig = {
-EUSCI_A_UART_CLOCKSOURCE_SMCLK,          // SMCLK Clock Source
-		26,                                      // BRDIV = 26
-		0,                                       // UCxBRF = 0
-		0,                                       // UCxBRS = 0
-		EUSCI_A_UART_NO_PARITY,                  // No Parity
-		EUSCI_A_UART_LSB_FIRST,                  // MSB First
-		EUSCI_A_UART_ONE_STOP_BIT,               // One stop bit
-		EUSCI_A_UART_MODE,                       // UART mode
-		EUSCI_A_UART_LOW_FREQUENCY_BAUDRATE_GENERATION  // Low Frequency Mode
-		};
-
-void SysTick_ISR(void) {
-	// Call the FatFs tick timer.
-	disk_timerproc();
+// Baud rate of the console UART.  The dividers are worked out by clock.c
+// from the SMCLK frequency of each clock profile.
+#define CONSOLE_BAUD            115200
+
+// Clock profile while waiting for a command, and while running one.  Card
+// I/O runs in the faster profile.
+#define IDLE_PROFILE            CLK_PROFILE_LOW_POWER
+#define COMMAND_PROFILE         CLK_PROFILE_MAX
 
+// Blink the LED as a heartbeat.
+static tTimer g_sHeartbeat;
+
+static void HeartbeatTimer(tTimer *psTimer) {
 	GPIO_toggleOutputOnPin(GPIO_PORT_P1, GPIO_PIN0);
+	tb_TimerStart(psTimer, 500000, HeartbeatTimer);
 }
 
+#if _FS_SCANFREE
+// The card volumes whose free clusters are counted while idle.  A volume whose
+// count fails, such as drive 1 with its socket empty, is left alone until a
+// command has mounted it, as each try initializes the card again and can wait
+// up to a second for one that does not answer.
+#define SCAN_VOLUMES            ((_VOLUMES > 1) ? 2 : 1)
+static FATFS * const g_ppsScanFs[SCAN_VOLUMES] = { &g_sFatFs,
+#if _VOLUMES > 1
+		&g_sFatFs1,
+#endif
+};
+static bool g_pbScanStopped[SCAN_VOLUMES];
+
+// Count the free clusters a few FAT sectors at a time.
+static void ScanFree(void) {
+	char pcDrive[3] = "0:";
+	FRESULT iFResult;
+	int i;
+
+	for (i = 0; i < SCAN_VOLUMES; i++) {
+		if (g_pbScanStopped[i]) {
+			continue;
+		}
+		pcDrive[0] = '0' + i;
+		iFResult = f_scanfree(pcDrive);
+		if (iFResult != FR_OK && iFResult != FR_IN_PROGRESS) {
+			g_pbScanStopped[i] = true;
+		}
+	}
+}
+
+// Take up the count again on the volumes a command has mounted.
+static void ScanResume(void) {
+	int i;
+
+	for (i = 0; i < SCAN_VOLUMES; i++) {
+		if (g_ppsScanFs[i]->fs_type) {
+			g_pbScanStopped[i] = false;
+		}
+	}
+}
+#endif
+
 /*
  * USCIA0 interrupt handler.
  */
@@ -164,6 +280,12 @@ void EusciA0_ISR(void) {
 	static uint32_t ui32Count = 0;
 	static int8_t bLastWasCR = 0;
 
+	// During a file transfer the bytes are data for the YMODEM receiver.
+	if (ym_Busy()) {
+		ym_RxByte(receiveByte);
+		return;
+	}
+
 	// See if the backspace key was pressed.
 	if (receiveByte == '\b') {
 		// If there are any characters already in the buffer, then delete
@@ -221,15 +343,15 @@ int main(void) {
 
 	int8_t lucNStatus = 0;
 	FRESULT iFResult;
+#if _USE_STAGE
+	WORD luiDropped;
+#endif
 
 	/* Halting WDT and disabling master interrupts */
 	WDTCTL = WDTPW | WDTHOLD;                 // Stop WDT
 
-	/* Initialize main clock to 3MHz */
-	MAP_CS_setDCOCenteredFrequency(CS_DCO_FREQUENCY_3);
-	CS_initClockSignal(CS_MCLK, CS_DCOCLK_SELECT, CS_CLOCK_DIVIDER_1);
-	CS_initClockSignal(CS_HSMCLK, CS_DCOCLK_SELECT, CS_CLOCK_DIVIDER_1);
-	CS_initClockSignal(CS_SMCLK, CS_DCOCLK_SELECT, CS_CLOCK_DIVIDER_1);
+	/* Initialize the clocks for the idle profile */
+	clk_SetProfile(IDLE_PROFILE);
 
 	/* Selecting P1.0 as output (LED). */
 	MAP_GPIO_setAsPeripheralModuleFunctionInputPin(GPIO_PORT_P1,
@@ -242,14 +364,8 @@ int main(void) {
 	MAP_GPIO_setAsPeripheralModuleFunctionInputPin(GPIO_PORT_P1,
 	GPIO_PIN2 | GPIO_PIN3, GPIO_PRIMARY_MODULE_FUNCTION);
 
-	/* Configuring UART Module */
-	MAP_UART_initModule(EUSCI_A0_MODULE, &uartConfig);
-
-	/* Enable UART module */
-	MAP_UART_enableModule(EUSCI_A0_MODULE);
-
-	UART_enableInterrupt(EUSCI_A0_MODULE, EUSCI_A_UART_RECEIVE_INTERRUPT);
-	Interrupt_enableInterrupt(INT_EUSCIA0);
+	/* Configuring and enabling the UART Module */
+	clk_ConsoleInit(CONSOLE_BAUD);
 	Interrupt_enableMaster();
 
 	/* Selecting P1.0 as output (LED). */
@@ -259,14 +375,19 @@ int main(void) {
 	GPIO_setOutputLowOnPin(GPIO_PORT_P1, GPIO_PIN0);
 	GPIO_setAsOutputPin(GPIO_PORT_P1, GPIO_PIN0);
 
-	/* Configure SysTick for a 100Hz interrupt.  The FatFs driver wants a 10 ms
-	 * tick.
+	/* Start the microsecond time base. The FatFs driver takes its timeouts
+	 * from it, and SysTick only runs while a software timer is pending.
 	 */
-	SysTick_setPeriod(3000000 / 100);
-	SysTick_enableModule();
-	SysTick_enableInterrupt();
+	tb_Init();
+	tb_TimerStart(&g_sHeartbeat, 500000, HeartbeatTimer);
 
-	spi_Open();
+	/* Set up the SPI bus shared by the SD cards and any other SPI device */
+	sb_Init();
+
+	/* Set up the event trace, which takes its time stamps from the time
+	 * base and records nothing until the "trace on" command.
+	 */
+	tr_Init();
 
 	// Print hello message to user.
 	printf("\n\nSD Card Example Program\r\n");
@@ -280,12 +401,38 @@ int main(void) {
 		return (1);
 	}
 
+#if _VOLUMES > 1
+	// Mount the card on the second chip select as logical disk 1. Its files
+	// are reached with a "1:" prefix.  f_mount() only registers the work
+	// area, the card is initialized when a path on it is first used, so an
+	// empty socket costs nothing here.
+	iFResult = f_mount(1, &g_sFatFs1);
+	if (iFResult != FR_OK) {
+		printf("f_mount error: %s\n", StringFromFResult(iFResult));
+		return (1);
+	}
+#endif
+
+#if _VOLUMES > 2
+	// Mount the RAM disk as logical disk 2, for scratch files that are "2:"
+	// prefixed.  It is formatted afresh after every reset.
+	iFResult = f_mount(2, &g_sFatFs2);
+	if (iFResult != FR_OK) {
+		printf("f_mount error: %s\n", StringFromFResult(iFResult));
+		return (1);
+	}
+#endif
+
 	/* Main while loop */
 	//MAP_PCM_gotoLPM0();
 	while (1) {
+		// Run the transfers other SPI devices have queued on the bus.
+		sb_Poll();
+
 		if (gucCommandReady) {
 			// Pass the line from the user to the command processor.  It will be
-			// parsed and valid commands executed.
+			// parsed and valid commands executed at full speed.
+			clk_SetProfile(COMMAND_PROFILE);
 			lucNStatus = CmdLineProcess(g_pcCmdBuf);
 
 			/* Clear the command buffer, to prep for the next one. */
@@ -308,9 +455,46 @@ int main(void) {
 						StringFromFResult((FRESULT) lucNStatus));
 			}
 
+#if _USE_STAGE
+			// Sectors staged for a card that has since been swapped out are
+			// given up when the staging log runs full.
+			luiDropped = disk_stage_dropped();
+			if (luiDropped) {
+				printf("Dropped %u sectors staged for another card\r\n",
+						luiDropped);
+			}
+#endif
+
 			printf(">");
 			gucCommandReady = 0;
+			clk_SetProfile(IDLE_PROFILE);
+#if _FS_SCANFREE
+			ScanResume();
+#endif
 		}
+#if _FS_SCANFREE || _USE_STAGE || _USE_DEFRAG
+		else {
+#if _USE_STAGE
+			// Copy the sectors staged in flash while a card was busy to the
+			// card, one at a time.
+			disk_stage_poll();
+#endif
+#if _FS_SCANFREE
+			// Count the free clusters a few FAT sectors at a time while idle,
+			// so that "ls" can report the free space without a full FAT scan.
+			ScanFree();
+#endif
+#if _USE_DEFRAG
+			// Move the file of "defrag" a few sectors at a time.
+			if (g_sDefrag.fp) {
+				g_iDefragResult = f_defragstep(&g_sDefrag, DEFRAG_STEP);
+				if (g_iDefragResult != FR_IN_PROGRESS) {
+					f_close(&g_sDefragFile);
+				}
+			}
+#endif
+		}
+#endif
 	}
 }
 
@@ -350,7 +534,8 @@ int Cmd_help(int argc, char *argv[]) {
 // and enumerates through the contents, and prints a line for each item it
 // finds.  It shows details such as file attributes, time and date, and the
 // file size, along with the name.  It shows a summary of file sizes at the end
-// along with free space.
+// along with free space.  An optional argument lists only the names that match
+// it, with ? and * as wildcards.
 //
 //*****************************************************************************
 int Cmd_ls(int argc, char *argv[]) {
@@ -360,10 +545,14 @@ int Cmd_ls(int argc, char *argv[]) {
 	FRESULT iFResult;
 	FATFS *psFatFs;
 	char *pcFileName;
+	UINT uIdx, uCount, uLen;
+	int iLine;
+	FILINFO *psInfo;
 #if _USE_LFN
-	char pucLfn[_MAX_LFN + 1];
-	g_sFileInfo.lfname = pucLfn;
-	g_sFileInfo.lfsize = sizeof(pucLfn);
+	for (uIdx = 0; uIdx < LS_BATCH; uIdx++) {
+		g_psLsInfo[uIdx].lfname = g_pcLsLfn[uIdx];
+		g_psLsInfo[uIdx].lfsize = sizeof(g_pcLsLfn[uIdx]);
+	}
 #endif
 
 	//
@@ -388,13 +577,12 @@ int Cmd_ls(int argc, char *argv[]) {
 	printf("\r\n");
 
 	//
-	// Enter loop to enumerate through all directory entries.
+	// Enter loop to read the directory a batch of entries at a time, keeping
+	// only the names that match the pattern if one was given.
 	//
-	for (;;) {
-		//
-		// Read an entry from the directory.
-		//
-		iFResult = f_readdir(&g_sDirObject, &g_sFileInfo);
+	do {
+		iFResult = f_readdirs(&g_sDirObject, g_psLsInfo, LS_BATCH, &uCount,
+				0, (argc > 1) ? argv[1] : 0);
 
 		//
 		// Check for error and return if there is a problem.
@@ -404,48 +592,67 @@ int Cmd_ls(int argc, char *argv[]) {
 		}
 
 		//
-		// If the file name is blank, then this is the end of the listing.
+		// Format the lines of the whole batch into the output buffer.
 		//
-		if (!g_sFileInfo.fname[0]) {
-			break;
-		}
+		uLen = 0;
+		for (uIdx = 0; uIdx < uCount; uIdx++) {
+			psInfo = &g_psLsInfo[uIdx];
 
-		//
-		// If the attribue is directory, then increment the directory count.
-		//
-		if (g_sFileInfo.fattrib & AM_DIR) {
-			ui32DirCount++;
-		}
+			//
+			// If the attribue is directory, then increment the directory
+			// count.
+			//
+			if (psInfo->fattrib & AM_DIR) {
+				ui32DirCount++;
+			}
 
-		//
-		// Otherwise, it is a file.  Increment the file count, and add in the
-		// file size to the total.
-		//
-		else {
-			ui32FileCount++;
-			ui32TotalSize += g_sFileInfo.fsize;
-		}
+			//
+			// Otherwise, it is a file.  Increment the file count, and add in
+			// the file size to the total.
+			//
+			else {
+				ui32FileCount++;
+				ui32TotalSize += psInfo->fsize;
+			}
 
 #if _USE_LFN
-		pcFileName = (
-				(*g_sFileInfo.lfname) ? g_sFileInfo.lfname : g_sFileInfo.fname);
+			pcFileName = ((*psInfo->lfname) ? psInfo->lfname : psInfo->fname);
 #else
-		pcFileName = g_sFileInfo.fname;
+			pcFileName = psInfo->fname;
 #endif
+			//
+			// Format the entry information on a single line to show the
+			// attributes, date, time, size, and name.  If the line does not
+			// fit, send the buffer and format it again at the start.
+			//
+			for (;;) {
+				iLine = snprintf(&g_pcLsBuf[uLen], sizeof(g_pcLsBuf) - uLen,
+						"%c%c%c%c%c %u/%02u/%02u %02u:%02u %9u  %s\r\n",
+						(psInfo->fattrib & AM_DIR) ? 'D' : '-',
+						(psInfo->fattrib & AM_RDO) ? 'R' : '-',
+						(psInfo->fattrib & AM_HID) ? 'H' : '-',
+						(psInfo->fattrib & AM_SYS) ? 'S' : '-',
+						(psInfo->fattrib & AM_ARC) ? 'A' : '-',
+						(psInfo->fdate >> 9) + 1980, (psInfo->fdate >> 5) & 15,
+						psInfo->fdate & 31, (psInfo->ftime >> 11),
+						(psInfo->ftime >> 5) & 63, psInfo->fsize, pcFileName);
+				if (uLen + iLine < sizeof(g_pcLsBuf)) {
+					uLen += iLine;
+					break;
+				}
+				g_pcLsBuf[uLen] = 0;
+				fputs(g_pcLsBuf, stdout);
+				uLen = 0;
+			}
+		}
+
 		//
-		// Print the entry information on a single line with formatting to show
-		// the attributes, date, time, size, and name.
+		// Send the lines of the batch in one go.
 		//
-		printf("%c%c%c%c%c %u/%02u/%02u %02u:%02u %9u  %s\r\n",
-				(g_sFileInfo.fattrib & AM_DIR) ? 'D' : '-',
-				(g_sFileInfo.fattrib & AM_RDO) ? 'R' : '-',
-				(g_sFileInfo.fattrib & AM_HID) ? 'H' : '-',
-				(g_sFileInfo.fattrib & AM_SYS) ? 'S' : '-',
-				(g_sFileInfo.fattrib & AM_ARC) ? 'A' : '-',
-				(g_sFileInfo.fdate >> 9) + 1980, (g_sFileInfo.fdate >> 5) & 15,
-				g_sFileInfo.fdate & 31, (g_sFileInfo.ftime >> 11),
-				(g_sFileInfo.ftime >> 5) & 63, g_sFileInfo.fsize, pcFileName);
-	}
+		if (uLen) {
+			fputs(g_pcLsBuf, stdout);
+		}
+	} while (uCount == LS_BATCH);
 
 	//
 	// Print summary lines showing the file, dir, and size totals.
@@ -458,6 +665,14 @@ int Cmd_ls(int argc, char *argv[]) {
 	//
 	iFResult = f_getfree("/", (DWORD *) &ui32TotalSize, &psFatFs);
 
+	//
+	// The free clusters are still being counted in the background.
+	//
+	if (iFResult == FR_IN_PROGRESS) {
+		printf(", free space is being counted\r\n");
+		return (0);
+	}
+
 	//
 	// Check for error and return if there is a problem.
 	//
@@ -509,10 +724,10 @@ int Cmd_cd(int argc, char *argv[]) {
 	strcpy(g_pcTmpBuf, g_pcCwdBuf);
 
 	//
-	// If the first character is /, then this is a fully specified path, and it
-	// should just be used as-is.
+	// If the first character is /, or the path starts with a drive number,
+	// then this is a fully specified path, and it should just be used as-is.
 	//
-	if (argv[1][0] == '/') {
+	if (argv[1][0] == '/' || (argv[1][0] && argv[1][1] == ':')) {
 		//
 		// Make sure the new path is not bigger than the cwd buffer.
 		//
@@ -645,9 +860,9 @@ int Cmd_pwd(int argc, char *argv[]) {
 //*****************************************************************************
 //
 // This function implements the "cat" command.  It reads the contents of a file
-// and prints it to the console.  This should only be used on text files.  If
-// it is used on a binary file, then a bunch of garbage is likely to printed on
-// the console.
+// and prints it to the console.  A file written through lzb.c is unpacked on
+// the way.  This should only be used on text files.  If it is used on a binary
+// file, then a bunch of garbage is likely to printed on the console.
 //
 //*****************************************************************************
 int Cmd_cat(int argc, char *argv[]) {
@@ -683,9 +898,9 @@ int Cmd_cat(int argc, char *argv[]) {
 	strcat(g_pcTmpBuf, argv[1]);
 
 	//
-	// Open the file for reading.
+	// Open the file for reading, packed or not.
 	//
-	iFResult = f_open(&g_sFileObject, g_pcTmpBuf, FA_READ);
+	iFResult = lzb_Open(&g_sLzbFile, &g_sFileObject, g_pcTmpBuf, FA_READ);
 
 	//
 	// If there was some problem opening the file, then return an error.
@@ -705,7 +920,7 @@ int Cmd_cat(int argc, char *argv[]) {
 		// Read a block of data from the file.  Read as much as can fit in the
 		// temporary buffer, including a space for the trailing null.
 		//
-		iFResult = f_read(&g_sFileObject, g_pcTmpBuf, sizeof(g_pcTmpBuf) - 1,
+		iFResult = lzb_Read(&g_sLzbFile, g_pcTmpBuf, sizeof(g_pcTmpBuf) - 1,
 				(UINT *) &ui32BytesRead);
 
 		//
@@ -714,6 +929,7 @@ int Cmd_cat(int argc, char *argv[]) {
 		//
 		if (iFResult != FR_OK) {
 			printf("\r\n");
+			lzb_Close(&g_sLzbFile);
 			return ((int) iFResult);
 		}
 
@@ -730,8 +946,420 @@ int Cmd_cat(int argc, char *argv[]) {
 	} while (ui32BytesRead == sizeof(g_pcTmpBuf) - 1);
 
 	printf("\r\n");
+
 	//
-	// Return success.
+	// Close the file so its sector buffer is returned to the shared pool.
 	//
+	return ((int) lzb_Close(&g_sLzbFile));
+}
+
+//*****************************************************************************
+//
+// This function builds the fully specified name of a file in the current
+// directory in the temporary buffer, as FatFs needs it.  If pcName is empty,
+// the buffer gets the current directory with a trailing separator.  A name
+// that starts with / or a drive number is taken as it is.  It returns zero if
+// the result does not fit.
+//
+//*****************************************************************************
+static int PathInCwd(const char *pcName) {
+	if (pcName[0] == '/' || (pcName[0] && pcName[1] == ':')) {
+		if (strlen(pcName) + 1 > sizeof(g_pcTmpBuf)) {
+			printf("Resulting path name is too long\r\n");
+			return (0);
+		}
+		strcpy(g_pcTmpBuf, pcName);
+		return (1);
+	}
+
+	//
+	// Check that the current path, plus the file name, plus a separator and
+	// trailing null, will all fit in the temporary buffer.
+	//
+	if (strlen(g_pcCwdBuf) + strlen(pcName) + 1 + 1 > sizeof(g_pcTmpBuf)) {
+		printf("Resulting path name is too long\r\n");
+		return (0);
+	}
+
+	//
+	// Copy the current path, and append a separator if not at the root level,
+	// and then the file name.
+	//
+	strcpy(g_pcTmpBuf, g_pcCwdBuf);
+	if (strcmp("/", g_pcCwdBuf)) {
+		strcat(g_pcTmpBuf, "/");
+	}
+	strcat(g_pcTmpBuf, pcName);
+
+	return (1);
+}
+
+//*****************************************************************************
+//
+// This function implements the "get" command.  It sends a file from the
+// current directory to the terminal with YMODEM.  Start the YMODEM receive
+// in the terminal program after entering the command.
+//
+//*****************************************************************************
+int Cmd_get(int argc, char *argv[]) {
+	FRESULT iFResult;
+	uint32_t ui32Bytes;
+
+	if (argc < 2) {
+		printf("get: file name needed\r\n");
+		return (0);
+	}
+	if (!PathInCwd(argv[1])) {
+		return (0);
+	}
+
+	printf("\r\nStart the YMODEM receive\r\n");
+	iFResult = ym_Send(&g_sFileObject, g_pcTmpBuf, &ui32Bytes);
+	if (iFResult != FR_OK) {
+		return ((int) iFResult);
+	}
+
+	printf("\r\nSent %u bytes\r\n", ui32Bytes);
 	return (0);
 }
+
+//*****************************************************************************
+//
+// This function implements the "put" command.  It receives a file from the
+// terminal with YMODEM into the current directory, under the name given, or
+// else under the name the terminal sends.  An existing file is overwritten.
+//
+//*****************************************************************************
+int Cmd_put(int argc, char *argv[]) {
+	FRESULT iFResult;
+	uint32_t ui32Bytes;
+
+	if (!PathInCwd((argc > 1) ? argv[1] : "")) {
+		return (0);
+	}
+
+	printf("\r\nStart the YMODEM send\r\n");
+	iFResult = ym_Receive(&g_sFileObject, g_pcTmpBuf, sizeof(g_pcTmpBuf),
+			&ui32Bytes);
+	if (iFResult != FR_OK) {
+		return ((int) iFResult);
+	}
+
+	printf("\r\nReceived %u bytes into %s\r\n", ui32Bytes, g_pcTmpBuf);
+	return (0);
+}
+
+//*****************************************************************************
+//
+// This function implements the "prof" command.  "prof start" samples the
+// program counter PROF_DEFAULT_HZ times a second, or at the rate given, until
+// "prof stop".  "prof clear" forgets the samples, and "prof" or "prof dump"
+// prints them for tools/profsym.py.
+//
+//*****************************************************************************
+int Cmd_prof(int argc, char *argv[]) {
+	uint32_t ui32Hz;
+
+	if (argc < 2 || !strcmp(argv[1], "dump")) {
+		prof_Dump();
+	} else if (!strcmp(argv[1], "start")) {
+		ui32Hz = (argc > 2) ? strtoul(argv[2], 0, 10) : PROF_DEFAULT_HZ;
+		if (!ui32Hz) {
+			printf("prof: bad rate\r\n");
+			return (0);
+		}
+		prof_Start(ui32Hz);
+	} else if (!strcmp(argv[1], "stop")) {
+		prof_Stop();
+	} else if (!strcmp(argv[1], "clear")) {
+		prof_Clear();
+	} else {
+		printf("prof: start [Hz], stop, clear or dump\r\n");
+	}
+	return (0);
+}
+
+//*****************************************************************************
+//
+// This function implements the "trace" command.  "trace on" records the
+// events of the categories given (fs, disk, cmd and wait), or of all of them,
+// in the trace ring until "trace off".  "trace clear" empties the ring, and
+// "trace" or "trace dump" prints it for tools/trace2json.py.
+//
+//*****************************************************************************
+int Cmd_trace(int argc, char *argv[]) {
+	static const char * const ppcNames[] = { "fs", "disk", "cmd", "wait" };
+	uint8_t ui8Mask;
+	int i, j;
+
+	if (argc < 2 || !strcmp(argv[1], "dump")) {
+		tr_Dump();
+	} else if (!strcmp(argv[1], "on")) {
+		ui8Mask = (argc > 2) ? 0 : TR_ALL;
+		for (i = 2; i < argc; i++) {
+			for (j = 0; j < 4 && strcmp(argv[i], ppcNames[j]); j++)
+				;
+			if (j == 4) {
+				printf("trace: no category %s\r\n", argv[i]);
+				return (0);
+			}
+			ui8Mask |= 1 << j;
+		}
+		tr_Enable(ui8Mask);
+	} else if (!strcmp(argv[1], "off")) {
+		tr_Enable(0);
+	} else if (!strcmp(argv[1], "clear")) {
+		tr_Clear();
+	} else {
+		printf("trace: on [fs disk cmd wait], off, clear or dump\r\n");
+	}
+	return (0);
+}
+
+//*****************************************************************************
+//
+// This function prints a record of the log for "log show", as text.
+//
+//*****************************************************************************
+static bool LogShow(uint32_t ui32Time, const uint8_t *pui8Data,
+		uint_fast16_t ui16Size, void *pvArg) {
+	printf("%10u %.*s\r\n", ui32Time, (int) ui16Size, (const char *) pui8Data);
+	return (true);
+}
+
+//*****************************************************************************
+//
+// This function implements the "log" command.  "log add" appends the rest of
+// the line to the record log in 0:/LOG as a record stamped with the
+// milliseconds since reset, and "log sync" puts the records added so far on
+// the card.  "log show" prints the records of the time range given, from the
+// start or to the end if left out.  The log is opened, and recovered after a
+// reset, the first time the command is used.
+//
+//*****************************************************************************
+int Cmd_log(int argc, char *argv[]) {
+	FRESULT iFResult;
+	uint32_t ui32From, ui32To;
+	int i;
+
+	if (!g_bRecLogOpen) {
+		iFResult = rl_Open(&g_sRecLog, &g_sRecLogConfig);
+		if (iFResult != FR_OK) {
+			return ((int) iFResult);
+		}
+		g_bRecLogOpen = true;
+	}
+
+	if (argc > 2 && !strcmp(argv[1], "add")) {
+		// The command line processor split the text at the spaces, so put
+		// it back together.
+		g_pcTmpBuf[0] = 0;
+		for (i = 2; i < argc; i++) {
+			if (strlen(g_pcTmpBuf) + strlen(argv[i]) + 2 > sizeof(g_pcTmpBuf)) {
+				break;
+			}
+			if (i > 2) {
+				strcat(g_pcTmpBuf, " ");
+			}
+			strcat(g_pcTmpBuf, argv[i]);
+		}
+		iFResult = rl_Append(&g_sRecLog, (uint32_t) (tb_Now() / 1000),
+				g_pcTmpBuf, strlen(g_pcTmpBuf));
+	} else if (argc > 1 && !strcmp(argv[1], "sync")) {
+		iFResult = rl_Sync(&g_sRecLog);
+	} else if (argc > 1 && !strcmp(argv[1], "show")) {
+		ui32From = (argc > 2) ? strtoul(argv[2], 0, 10) : 0;
+		ui32To = (argc > 3) ? strtoul(argv[3], 0, 10) : 0xFFFFFFFF;
+		iFResult = rl_Query(&g_sRecLog, &g_sFileObject, ui32From, ui32To,
+				LogShow, 0);
+	} else {
+		printf("log: add <text>, sync or show [from [to]]\r\n");
+		return (0);
+	}
+	return ((int) iFResult);
+}
+
+//*****************************************************************************
+//
+// This function implements the "pack" command.  It compresses a file of the
+// current directory into another one there, which "cat" shows unpacked and
+// tools/lzb.py unpacks on a PC.  An existing file of the second name is
+// overwritten.
+//
+//*****************************************************************************
+int Cmd_pack(int argc, char *argv[]) {
+	FRESULT iFResult, iClose;
+	UINT uRead, uWritten;
+	uint32_t ui32Packed;
+
+	if (argc < 3) {
+		printf("pack: file names needed\r\n");
+		return (0);
+	}
+	if (!PathInCwd(argv[1])) {
+		return (0);
+	}
+	iFResult = f_open(&g_sFileObject, g_pcTmpBuf, FA_READ);
+	if (iFResult != FR_OK) {
+		return ((int) iFResult);
+	}
+	if (!PathInCwd(argv[2])) {
+		f_close(&g_sFileObject);
+		return (0);
+	}
+	iFResult = lzb_Open(&g_sLzbFile, &g_sPackFile, g_pcTmpBuf,
+			FA_CREATE_ALWAYS | FA_WRITE);
+	if (iFResult != FR_OK) {
+		f_close(&g_sFileObject);
+		return ((int) iFResult);
+	}
+
+	// Copy through the path buffer, which is free again.  The data is packed
+	// a block at a time as it is written.
+	do {
+		iFResult = f_read(&g_sFileObject, g_pcTmpBuf, sizeof(g_pcTmpBuf),
+				&uRead);
+		if (iFResult == FR_OK) {
+			iFResult = lzb_Write(&g_sLzbFile, g_pcTmpBuf, uRead, &uWritten);
+		}
+	} while (iFResult == FR_OK && uRead == sizeof(g_pcTmpBuf));
+
+	iClose = lzb_Close(&g_sLzbFile);
+	if (iFResult == FR_OK) {
+		iFResult = iClose;
+	}
+	if (iFResult == FR_OK) {
+		ui32Packed = f_size(&g_sPackFile);
+		printf("%u bytes packed into %u\r\n",
+				(uint32_t) f_size(&g_sFileObject), ui32Packed);
+	}
+	f_close(&g_sFileObject);
+	return ((int) iFResult);
+}
+
+//*****************************************************************************
+//
+// This function implements the "cp" command.  It copies a file, to another
+// drive too, in transfers of several sectors at a time.  An existing file of
+// the second name is overwritten.
+//
+//*****************************************************************************
+int Cmd_cp(int argc, char *argv[]) {
+	FRESULT iFResult;
+	uint32_t ui32Bytes;
+
+	if (argc < 3) {
+		printf("cp: file names needed\r\n");
+		return (0);
+	}
+	if (!PathInCwd(argv[2])) {
+		return (0);
+	}
+	strcpy(g_pcDstBuf, g_pcTmpBuf);
+	if (!PathInCwd(argv[1])) {
+		return (0);
+	}
+
+	iFResult = fc_Copy(&g_sFileObject, &g_sPackFile, g_pcTmpBuf, g_pcDstBuf,
+			&ui32Bytes);
+	if (iFResult != FR_OK) {
+		return ((int) iFResult);
+	}
+
+	printf("%u bytes copied\r\n", ui32Bytes);
+	return (0);
+}
+
+//*****************************************************************************
+//
+// This function implements the "mv" command.  It renames a file or directory,
+// or moves it to another directory of the same drive, without copying any
+// data.  A file moved to another drive is copied there and then removed.
+// The second name must not exist yet.
+//
+//*****************************************************************************
+int Cmd_mv(int argc, char *argv[]) {
+	FRESULT iFResult;
+	uint32_t ui32Bytes;
+
+	if (argc < 3) {
+		printf("mv: names needed\r\n");
+		return (0);
+	}
+	if (!PathInCwd(argv[2])) {
+		return (0);
+	}
+	strcpy(g_pcDstBuf, g_pcTmpBuf);
+	if (!PathInCwd(argv[1])) {
+		return (0);
+	}
+
+	iFResult = fc_Move(&g_sFileObject, &g_sPackFile, g_pcTmpBuf, g_pcDstBuf,
+			&ui32Bytes);
+	if (iFResult != FR_OK) {
+		return ((int) iFResult);
+	}
+
+	if (ui32Bytes) {
+		printf("%u bytes copied to the other drive\r\n", ui32Bytes);
+	}
+	return (0);
+}
+
+#if _USE_DEFRAG
+//*****************************************************************************
+//
+// This function implements the "defrag" command.  "defrag <file>" starts
+// moving a file of the current directory into contiguous clusters, which is
+// done in the idle loop.  Reads of the file then cross cluster boundaries in
+// one multiple block read.  "defrag" alone shows how far it has got, or the
+// result of the last file moved, and "defrag stop" gives up.  The file must
+// not be written until it is done.
+//
+//*****************************************************************************
+int Cmd_defrag(int argc, char *argv[]) {
+	FRESULT iFResult;
+
+	if (argc < 2) {
+		if (!g_sDefrag.fp) {
+			printf("Last file moved: %s\r\n",
+					StringFromFResult(g_iDefragResult));
+		} else if (!g_sDefrag.dclust) {
+			printf("Looking for %u free clusters in a row\r\n",
+					(uint32_t) g_sDefrag.nclst);
+		} else {
+			printf("%u of %u clusters copied\r\n",
+					(uint32_t) g_sDefrag.ncopy, (uint32_t) g_sDefrag.nclst);
+		}
+		return (0);
+	}
+	if (!strcmp(argv[1], "stop")) {
+		if (g_sDefrag.fp) {
+			g_iDefragResult = f_defragstep(&g_sDefrag, 0);
+			f_close(&g_sDefragFile);
+		}
+		return (0);
+	}
+	if (g_sDefrag.fp) {
+		printf("defrag: already moving a file\r\n");
+		return (0);
+	}
+	if (!PathInCwd(argv[1])) {
+		return (0);
+	}
+	iFResult = f_open(&g_sDefragFile, g_pcTmpBuf, FA_READ | FA_WRITE);
+	if (iFResult != FR_OK) {
+		return ((int) iFResult);
+	}
+	iFResult = f_defrag(&g_sDefrag, &g_sDefragFile);
+	if (iFResult == FR_IN_PROGRESS) {
+		printf("Moving %u clusters\r\n", (uint32_t) g_sDefrag.nclst);
+		return (0);
+	}
+	if (iFResult == FR_OK) {
+		printf("Already contiguous\r\n");
+	}
+	f_close(&g_sDefragFile);
+	return ((int) iFResult);
+}
+#endif
@@ -47,6 +47,8 @@ static void NmiSR(void);
 static void FaultISR(void);
 static void IntDefaultHandler(void);
 extern void SysTick_ISR(void);
+extern void T32_INT1_ISR(void);
+extern void T32_INT2_ISR(void);
 extern void EusciA0_ISR(void);
 
 //*****************************************************************************
@@ -122,8 +124,8 @@ void (* const g_pfnVectors[])(void) =
     IntDefaultHandler,                      // EUSCIB2 ISR
     IntDefaultHandler,                      // EUSCIB3 ISR
     IntDefaultHandler,                      // ADC12 ISR
-    IntDefaultHandler,                      // T32_INT1 ISR
-    IntDefaultHandler,                      // T32_INT2 ISR
+    T32_INT1_ISR,                           // T32_INT1 ISR
+    T32_INT2_ISR,                           // T32_INT2 ISR
     IntDefaultHandler,                      // T32_INTC ISR
     IntDefaultHandler,                      // AES ISR
     IntDefaultHandler,                      // RTC ISR
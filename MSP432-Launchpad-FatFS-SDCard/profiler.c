@@ -0,0 +1,184 @@
+/*
+ * profiler.c - statistical profiler
+ *
+ * T32_INT2_ISR is a few instructions of assembly that hand the exception
+ * frame to prof_Sample(): the frame is on the main or the process stack,
+ * as bit 2 of EXC_RETURN in LR tells, and a C handler cannot find it once
+ * its prologue has moved the stack pointer.
+ *
+ * Samples are counted in an open addressed hash table keyed by the PC (and
+ * LR), probed linearly for PROF_PROBES slots. A sample that finds no slot,
+ * or a count that would overflow, is counted as dropped instead.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "driverlib.h"
+#include "profiler.h"
+
+/* 1: record the LR of each sample too, the caller of a leaf function */
+#define PROF_LR                 1
+
+/* The table has 2^PROF_SLOTS_LOG2 slots, 8 or 12 bytes each */
+#define PROF_SLOTS_LOG2         9
+#define PROF_SLOTS              (1 << PROF_SLOTS_LOG2)
+
+/* Slots tried before a sample is dropped */
+#define PROF_PROBES             8
+
+static uint32_t g_pui32PC[PROF_SLOTS];          /* 0 marks a free slot */
+#if PROF_LR
+static uint32_t g_pui32LR[PROF_SLOTS];
+#endif
+static uint32_t g_pui32Count[PROF_SLOTS];
+static uint32_t g_ui32Samples;                  /* Counted or dropped */
+static uint32_t g_ui32Dropped;
+static uint32_t g_ui32Hz;                       /* Rate, 0 when stopped */
+static uint32_t g_ui32LastHz;                   /* Rate of the last start */
+
+#if defined(__TI_COMPILER_VERSION__)
+__asm("        .text");
+__asm("        .thumb");
+__asm("        .global T32_INT2_ISR");
+__asm("        .ref prof_Sample");
+__asm("T32_INT2_ISR: .asmfunc");
+__asm("        TST LR, #4");
+__asm("        ITE EQ");
+__asm("        MRSEQ R0, MSP");
+__asm("        MRSNE R0, PSP");
+__asm("        B prof_Sample");
+__asm("        .endasmfunc");
+#elif defined(__GNUC__) && defined(__thumb__)
+__asm__("        .text\n"
+        "        .syntax unified\n"
+        "        .thumb\n"
+        "        .global T32_INT2_ISR\n"
+        "        .thumb_func\n"
+        "T32_INT2_ISR:\n"
+        "        tst lr, #4\n"
+        "        ite eq\n"
+        "        mrseq r0, msp\n"
+        "        mrsne r0, psp\n"
+        "        b prof_Sample\n");
+#endif
+
+/* Load Timer32 module 1 for the rate at the current MCLK */
+static void
+set_period(void)
+{
+    uint32_t ui32Period = CS_getMCLK() / g_ui32Hz;
+
+    Timer32_setCount(TIMER32_1_MODULE, ui32Period ? ui32Period : 1);
+}
+
+void
+prof_Sample(const uint32_t *pui32Frame)
+{
+    uint32_t ui32PC = pui32Frame[6], ui32Slot, i;
+#if PROF_LR
+    uint32_t ui32LR = pui32Frame[5];
+#endif
+
+    Timer32_clearInterruptFlag(TIMER32_1_MODULE);
+    g_ui32Samples++;
+
+    /* Fibonacci hashing of the halfword address */
+    ui32Slot = ((ui32PC >> 1) * 2654435761u) >> (32 - PROF_SLOTS_LOG2);
+    for (i = 0; i < PROF_PROBES; i++) {
+        if (!g_pui32PC[ui32Slot]) {
+            g_pui32PC[ui32Slot] = ui32PC;
+#if PROF_LR
+            g_pui32LR[ui32Slot] = ui32LR;
+#endif
+        }
+        if (g_pui32PC[ui32Slot] == ui32PC
+#if PROF_LR
+            && g_pui32LR[ui32Slot] == ui32LR
+#endif
+           ) {
+            if (g_pui32Count[ui32Slot] == 0xFFFFFFFF) break;
+            g_pui32Count[ui32Slot]++;
+            return;
+        }
+        ui32Slot = (ui32Slot + 1) & (PROF_SLOTS - 1);
+    }
+    g_ui32Dropped++;
+}
+
+void
+prof_Start(uint32_t ui32Hz)
+{
+    if (!ui32Hz) return;
+    prof_Stop();
+    g_ui32Hz = g_ui32LastHz = ui32Hz;
+
+    Timer32_initModule(TIMER32_1_MODULE, TIMER32_PRESCALER_1, TIMER32_32BIT,
+                       TIMER32_PERIODIC_MODE);
+    set_period();
+    Timer32_clearInterruptFlag(TIMER32_1_MODULE);
+    Timer32_enableInterrupt(TIMER32_1_MODULE);
+    Interrupt_enableInterrupt(INT_T32_INT2);
+    Timer32_startTimer(TIMER32_1_MODULE, false);
+}
+
+void
+prof_Stop(void)
+{
+    if (!g_ui32Hz) return;
+    Timer32_haltTimer(TIMER32_1_MODULE);
+    Interrupt_disableInterrupt(INT_T32_INT2);
+    Timer32_clearInterruptFlag(TIMER32_1_MODULE);
+    g_ui32Hz = 0;
+}
+
+bool
+prof_Running(void)
+{
+    return g_ui32Hz != 0;
+}
+
+void
+prof_Clear(void)
+{
+    uint32_t i;
+    bool bMasked;
+
+    bMasked = Interrupt_disableMaster();
+    for (i = 0; i < PROF_SLOTS; i++) {
+        g_pui32PC[i] = 0;
+#if PROF_LR
+        g_pui32LR[i] = 0;
+#endif
+        g_pui32Count[i] = 0;
+    }
+    g_ui32Samples = g_ui32Dropped = 0;
+    if (!bMasked) Interrupt_enableMaster();
+}
+
+void
+prof_ClockChanged(void)
+{
+    if (g_ui32Hz) set_period();
+}
+
+void
+prof_Dump(void)
+{
+    uint32_t i, ui32Hz = g_ui32Hz;
+
+    prof_Stop();
+    printf("prof %u Hz %u samples %u dropped\r\n", g_ui32LastHz,
+           g_ui32Samples, g_ui32Dropped);
+    for (i = 0; i < PROF_SLOTS; i++) {
+        if (!g_pui32Count[i]) continue;
+#if PROF_LR
+        printf("%08x %08x %u\r\n", g_pui32PC[i], g_pui32LR[i],
+               g_pui32Count[i]);
+#else
+        printf("%08x 00000000 %u\r\n", g_pui32PC[i], g_pui32Count[i]);
+#endif
+    }
+    printf("prof end\r\n");
+    if (ui32Hz) prof_Start(ui32Hz);
+}
@@ -0,0 +1,57 @@
+/*
+ * profiler.h - statistical profiler
+ *
+ * Timer32 module 1 interrupts at the sampling rate and the program counter
+ * it interrupted is counted in a small hash table in RAM, together with the
+ * link register if PROF_LR is set. prof_Dump() prints the table, and
+ * tools/profsym.py symbolizes it against the ELF file and prints a flat
+ * profile.
+ *
+ * Interrupt handlers of the same priority are not sampled: the sample is
+ * taken when they return. Time spent waiting in LPM0 shows up at the sleep
+ * instruction.
+ */
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Start sampling ui32Hz times a second, adding to the samples taken so far */
+void prof_Start(uint32_t ui32Hz);
+
+/* Stop sampling */
+void prof_Stop(void);
+
+/* Whether sampling is running */
+bool prof_Running(void);
+
+/* Forget the samples taken so far */
+void prof_Clear(void);
+
+/* Carry the sampling rate over a change of the MCLK frequency. Called by
+ * clk_SetProfile(). */
+void prof_ClockChanged(void);
+
+/* Print the samples to stdout, a header line, one "PC LR COUNT" line in hex,
+ * hex and decimal for each distinct sample, and a trailer line. Sampling is
+ * paused meanwhile. */
+void prof_Dump(void);
+
+/* Count the sample in an exception frame (R0-R3, R12, LR, PC, xPSR). Called
+ * by T32_INT2_ISR with the stack pointer it was entered with. */
+void prof_Sample(const uint32_t *pui32Frame);
+
+/* Interrupt handler, installed in the vector table */
+void T32_INT2_ISR(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PROFILER_H__ */
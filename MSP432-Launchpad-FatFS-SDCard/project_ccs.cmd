@@ -41,7 +41,9 @@
 
 MEMORY
 {
-    FLASH     (RX) : origin = 0x00000000, length = 0x00040000
+    FLASH     (RX) : origin = 0x00000000, length = 0x00037000
+    STAGE     (R)  : origin = 0x00037000, length = 0x00008000
+    FMOUNT    (R)  : origin = 0x0003F000, length = 0x00001000
     FLASH_OTP (RX) : origin = 0x00200000, length = 0x00004000
     SRAM      (RWX): origin = 0x20000000, length = 0x00010000
 }
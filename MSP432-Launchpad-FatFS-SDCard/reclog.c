@@ -0,0 +1,547 @@
+/*
+ * reclog.c - append-only record log
+ *
+ * The frame being filled is kept in the log structure and written to its
+ * sector of the file when it is full, when the file is rotated and by
+ * rl_Sync(). The index file is appended to when the first frame of each
+ * group of RL_INDEX_FRAMES is written, so after a reset it lacks at most the
+ * entries of frames written since the last sync, which rl_Open() adds again.
+ *
+ * A query finds the files that may hold the range from the first index
+ * entry of each, which is the time of its first record, and the first frame
+ * to read in a file by a binary search of its index.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "fatfs/src/ff.h"
+#include "reclog.h"
+
+#define RL_MAGIC                0x31474C52  /* "RLG1" */
+
+/* Room for the directory and a file name */
+#define RL_PATH_SIZE            48
+
+typedef struct {
+    uint32_t ui32Magic;         /* RL_MAGIC */
+    uint32_t ui32Frame;         /* Number of the frame in its file */
+    uint32_t ui32First;         /* Time of the first record */
+    uint32_t ui32Last;          /* and of the last one */
+    uint16_t ui16Records;
+    uint16_t ui16Used;          /* Bytes of records after the header */
+    uint32_t ui32Crc;           /* CRC-32 of header and records, taken with
+                                   this field zero */
+} tFrameHdr;
+
+typedef struct {
+    uint32_t ui32Time;          /* Time of the first record of the frame */
+    uint32_t ui32Frame;
+} tIndexEntry;
+
+/* CRC-32 as in zlib, a nibble at a time */
+static const uint32_t g_pui32CrcTable[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static char g_pcPath[RL_PATH_SIZE];
+static DIR g_sDir;
+static FILINFO g_sInfo;
+
+/* Frame read by a query */
+static uint32_t g_pui32Query[RL_FRAME_SIZE / 4];
+
+static uint32_t
+crc32(const uint8_t *pui8Data, uint32_t ui32Len)
+{
+    uint32_t ui32Crc = 0xFFFFFFFF;
+
+    while (ui32Len--) {
+        ui32Crc ^= *pui8Data++;
+        ui32Crc = (ui32Crc >> 4) ^ g_pui32CrcTable[ui32Crc & 15];
+        ui32Crc = (ui32Crc >> 4) ^ g_pui32CrcTable[ui32Crc & 15];
+    }
+    return ~ui32Crc;
+}
+
+static uint32_t
+frame_crc(tFrameHdr *psHdr)
+{
+    uint32_t ui32Saved = psHdr->ui32Crc, ui32Crc;
+
+    psHdr->ui32Crc = 0;
+    ui32Crc = crc32((const uint8_t *)psHdr, RL_FRAME_HDR + psHdr->ui16Used);
+    psHdr->ui32Crc = ui32Saved;
+    return ui32Crc;
+}
+
+/* Whether a frame read back is whole and the one expected */
+static bool
+frame_valid(tFrameHdr *psHdr, uint32_t ui32Frame)
+{
+    return psHdr->ui32Magic == RL_MAGIC && psHdr->ui32Frame == ui32Frame &&
+           psHdr->ui16Used <= RL_FRAME_SIZE - RL_FRAME_HDR &&
+           psHdr->ui32Crc == frame_crc(psHdr);
+}
+
+/* Build the path of a log file or its index in g_pcPath */
+static FRESULT
+make_path(const char *pcDir, uint32_t ui32File, const char *pcExt)
+{
+    int iLen = snprintf(g_pcPath, sizeof(g_pcPath), "%s/%08lu.%s", pcDir,
+                        (unsigned long)ui32File, pcExt);
+
+    if (iLen < 0 || iLen >= (int)sizeof(g_pcPath)) return FR_INVALID_NAME;
+    return FR_OK;
+}
+
+/* Find the lowest and highest numbers of the log files, 0 if there are
+ * none */
+static FRESULT
+scan_dir(const char *pcDir, uint32_t *pui32First, uint32_t *pui32Last)
+{
+    FRESULT iFResult;
+    uint32_t ui32File;
+    int i;
+
+    *pui32First = *pui32Last = 0;
+#if _USE_LFN
+    g_sInfo.lfname = 0;
+    g_sInfo.lfsize = 0;
+#endif
+    iFResult = f_opendir(&g_sDir, pcDir);
+    while (iFResult == FR_OK) {
+        iFResult = f_readdir(&g_sDir, &g_sInfo);
+        if (iFResult != FR_OK || !g_sInfo.fname[0]) break;
+        if (strcmp(&g_sInfo.fname[8], ".RL")) continue;
+        for (i = 0, ui32File = 0; i < 8 && g_sInfo.fname[i] >= '0' &&
+             g_sInfo.fname[i] <= '9'; i++)
+            ui32File = ui32File * 10 + g_sInfo.fname[i] - '0';
+        if (i < 8 || !ui32File) continue;
+        if (!*pui32First || ui32File < *pui32First) *pui32First = ui32File;
+        if (ui32File > *pui32Last) *pui32Last = ui32File;
+    }
+    return iFResult;
+}
+
+static void
+new_frame(tRecLog *psLog)
+{
+    tFrameHdr *psHdr = (tFrameHdr *)psLog->pui32Frame;
+
+    memset(psLog->pui32Frame, 0, sizeof(psLog->pui32Frame));
+    psHdr->ui32Magic = RL_MAGIC;
+    psHdr->ui32Frame = psLog->ui32Frame;
+    psLog->bDirty = false;
+    psLog->bIndexDue = false;
+}
+
+/* Open the files of log file ui32File, creating them if need be */
+static FRESULT
+open_file(tRecLog *psLog, uint32_t ui32File)
+{
+    const char *pcDir = psLog->psConfig->pcDir;
+    FRESULT iFResult;
+
+    psLog->ui32File = ui32File;
+    iFResult = make_path(pcDir, ui32File, "RL");
+    if (iFResult == FR_OK)
+        iFResult = f_open(&psLog->sData, g_pcPath,
+                          FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if (iFResult != FR_OK) return iFResult;
+    make_path(pcDir, ui32File, "RLI");
+    iFResult = f_open(&psLog->sIndex, g_pcPath,
+                      FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if (iFResult != FR_OK) f_close(&psLog->sData);
+    return iFResult;
+}
+
+/* Close the current file and start the next one */
+static FRESULT
+rotate(tRecLog *psLog)
+{
+    FRESULT iFResult;
+
+    iFResult = f_close(&psLog->sData);
+    if (iFResult == FR_OK) iFResult = f_close(&psLog->sIndex);
+    if (iFResult == FR_OK) iFResult = open_file(psLog, psLog->ui32File + 1);
+    psLog->ui32Frame = 0;
+    new_frame(psLog);
+    return iFResult;
+}
+
+/* Write the frame buffer to its sector, and its index entry if due */
+static FRESULT
+write_frame(tRecLog *psLog)
+{
+    tFrameHdr *psHdr = (tFrameHdr *)psLog->pui32Frame;
+    tIndexEntry sEntry;
+    FRESULT iFResult;
+    UINT uWritten;
+
+    psHdr->ui32Crc = frame_crc(psHdr);
+    iFResult = f_lseek(&psLog->sData, psLog->ui32Frame * RL_FRAME_SIZE);
+    if (iFResult == FR_OK)
+        iFResult = f_write(&psLog->sData, psLog->pui32Frame, RL_FRAME_SIZE,
+                           &uWritten);
+    if (iFResult == FR_OK && uWritten != RL_FRAME_SIZE) iFResult = FR_DENIED;
+    if (iFResult != FR_OK) return iFResult;
+    psLog->bDirty = false;
+
+    if (psLog->bIndexDue) {
+        sEntry.ui32Time = psHdr->ui32First;
+        sEntry.ui32Frame = psLog->ui32Frame;
+        iFResult = f_write(&psLog->sIndex, &sEntry, sizeof(sEntry),
+                           &uWritten);
+        if (iFResult == FR_OK && uWritten != sizeof(sEntry))
+            iFResult = FR_DENIED;
+        psLog->bIndexDue = false;
+    }
+    return iFResult;
+}
+
+/* Move on to the next frame after a full one was written, in the next file
+ * if the current one has reached its size */
+static FRESULT
+next_frame(tRecLog *psLog)
+{
+    uint32_t ui32MaxBytes = psLog->psConfig->ui32MaxBytes;
+
+    psLog->ui32Frame++;
+    if (ui32MaxBytes && psLog->ui32Frame * RL_FRAME_SIZE >= ui32MaxBytes)
+        return rotate(psLog);
+    new_frame(psLog);
+    return FR_OK;
+}
+
+/* Read frame ui32Frame of an open log file into pui32Buf. Returns FR_OK and
+ * sets *pbValid even if the frame fails its checks. */
+static FRESULT
+read_frame(FIL *psFile, uint32_t ui32Frame, uint32_t *pui32Buf, bool *pbValid)
+{
+    FRESULT iFResult;
+    UINT uRead;
+
+    *pbValid = false;
+    iFResult = f_lseek(psFile, ui32Frame * RL_FRAME_SIZE);
+    if (iFResult == FR_OK)
+        iFResult = f_read(psFile, pui32Buf, RL_FRAME_SIZE, &uRead);
+    if (iFResult == FR_OK && uRead == RL_FRAME_SIZE)
+        *pbValid = frame_valid((tFrameHdr *)pui32Buf, ui32Frame);
+    return iFResult;
+}
+
+/* Read entry ui32Entry of an open index */
+static FRESULT
+read_entry(FIL *psFile, uint32_t ui32Entry, tIndexEntry *psEntry)
+{
+    FRESULT iFResult;
+    UINT uRead;
+
+    iFResult = f_lseek(psFile, ui32Entry * sizeof(tIndexEntry));
+    if (iFResult == FR_OK)
+        iFResult = f_read(psFile, psEntry, sizeof(tIndexEntry), &uRead);
+    if (iFResult == FR_OK && uRead != sizeof(tIndexEntry))
+        iFResult = FR_INT_ERR;
+    return iFResult;
+}
+
+/* Bring the current file back to its last whole frame after a reset, and
+ * its index in line with it, and carry on from there */
+static FRESULT
+recover(tRecLog *psLog)
+{
+    tFrameHdr *psHdr = (tFrameHdr *)psLog->pui32Frame;
+    uint32_t ui32Frames, ui32Entries, ui32Next;
+    tIndexEntry sEntry;
+    FRESULT iFResult = FR_OK;
+    UINT uWritten;
+    bool bValid;
+
+    /* Drop a torn last frame, and a part frame from an interrupted write */
+    ui32Frames = f_size(&psLog->sData) / RL_FRAME_SIZE;
+    while (ui32Frames) {
+        iFResult = read_frame(&psLog->sData, ui32Frames - 1,
+                              psLog->pui32Frame, &bValid);
+        if (iFResult != FR_OK) return iFResult;
+        if (bValid) break;
+        ui32Frames--;
+    }
+    if (f_size(&psLog->sData) != ui32Frames * RL_FRAME_SIZE) {
+        iFResult = f_lseek(&psLog->sData, ui32Frames * RL_FRAME_SIZE);
+        if (iFResult == FR_OK) iFResult = f_truncate(&psLog->sData);
+        if (iFResult != FR_OK) return iFResult;
+    }
+
+    /* Drop the index entries of frames that are gone, and add those of
+     * frames written since the last sync */
+    ui32Entries = f_size(&psLog->sIndex) / sizeof(tIndexEntry);
+    ui32Next = 0;
+    while (ui32Entries) {
+        iFResult = read_entry(&psLog->sIndex, ui32Entries - 1, &sEntry);
+        if (iFResult != FR_OK) return iFResult;
+        if (sEntry.ui32Frame < ui32Frames) {
+            ui32Next = sEntry.ui32Frame / RL_INDEX_FRAMES * RL_INDEX_FRAMES +
+                       RL_INDEX_FRAMES;
+            break;
+        }
+        ui32Entries--;
+    }
+    iFResult = f_lseek(&psLog->sIndex, ui32Entries * sizeof(tIndexEntry));
+    if (iFResult == FR_OK) iFResult = f_truncate(&psLog->sIndex);
+    for (; iFResult == FR_OK && ui32Next < ui32Frames;
+         ui32Next += RL_INDEX_FRAMES) {
+        iFResult = read_frame(&psLog->sData, ui32Next, psLog->pui32Frame,
+                              &bValid);
+        if (iFResult != FR_OK || !bValid) continue;
+        sEntry.ui32Time = psHdr->ui32First;
+        sEntry.ui32Frame = ui32Next;
+        iFResult = f_write(&psLog->sIndex, &sEntry, sizeof(sEntry),
+                           &uWritten);
+    }
+    if (iFResult != FR_OK) return iFResult;
+
+    /* Take up the last frame again, unless it is full */
+    psLog->ui32Frame = 0;
+    psLog->ui32FileStart = psLog->ui32LastTime = 0;
+    new_frame(psLog);
+    if (!ui32Frames) return FR_OK;
+    iFResult = read_frame(&psLog->sData, 0, psLog->pui32Frame, &bValid);
+    if (iFResult != FR_OK) return iFResult;
+    psLog->ui32FileStart = psHdr->ui32First;
+    iFResult = read_frame(&psLog->sData, ui32Frames - 1, psLog->pui32Frame,
+                          &bValid);
+    if (iFResult != FR_OK) return iFResult;
+    psLog->ui32Frame = ui32Frames - 1;
+    psLog->ui32LastTime = psHdr->ui32Last;
+    psLog->bDirty = false;
+    psLog->bIndexDue = false;
+    if (psHdr->ui16Used + RL_RECORD_HDR >= RL_FRAME_SIZE - RL_FRAME_HDR)
+        return next_frame(psLog);
+    return FR_OK;
+}
+
+FRESULT
+rl_Open(tRecLog *psLog, const tRecLogConfig *psConfig)
+{
+    uint32_t ui32First, ui32Last;
+    FRESULT iFResult;
+
+    psLog->psConfig = psConfig;
+    iFResult = f_mkdir(psConfig->pcDir);
+    if (iFResult != FR_OK && iFResult != FR_EXIST) return iFResult;
+    iFResult = scan_dir(psConfig->pcDir, &ui32First, &ui32Last);
+    if (iFResult != FR_OK) return iFResult;
+
+    iFResult = open_file(psLog, ui32Last ? ui32Last : 1);
+    if (iFResult != FR_OK) return iFResult;
+    iFResult = recover(psLog);
+    if (iFResult == FR_OK) iFResult = rl_Sync(psLog);
+    if (iFResult != FR_OK) {
+        f_close(&psLog->sData);
+        f_close(&psLog->sIndex);
+    }
+    return iFResult;
+}
+
+FRESULT
+rl_Append(tRecLog *psLog, uint32_t ui32Time, const void *pvData,
+          uint_fast16_t ui16Size)
+{
+    tFrameHdr *psHdr = (tFrameHdr *)psLog->pui32Frame;
+    const tRecLogConfig *psConfig = psLog->psConfig;
+    uint8_t *pui8Rec;
+    FRESULT iFResult;
+    uint16_t ui16Len = ui16Size;
+
+    if (ui16Size > RL_MAX_RECORD || ui32Time < psLog->ui32LastTime)
+        return FR_INVALID_PARAMETER;
+
+    /* A new file once the records of this one span the time given */
+    if (psConfig->ui32MaxSpan && (psLog->ui32Frame || psHdr->ui16Records) &&
+        ui32Time - psLog->ui32FileStart >= psConfig->ui32MaxSpan) {
+        if (psLog->bDirty) {
+            iFResult = write_frame(psLog);
+            if (iFResult != FR_OK) return iFResult;
+        }
+        iFResult = rotate(psLog);
+        if (iFResult != FR_OK) return iFResult;
+    }
+
+    /* A new frame if the record does not fit */
+    if (psHdr->ui16Used + RL_RECORD_HDR + ui16Size >
+        RL_FRAME_SIZE - RL_FRAME_HDR) {
+        iFResult = write_frame(psLog);
+        if (iFResult == FR_OK) iFResult = next_frame(psLog);
+        if (iFResult != FR_OK) return iFResult;
+    }
+
+    if (!psHdr->ui16Records) {
+        psHdr->ui32First = ui32Time;
+        if (!(psLog->ui32Frame % RL_INDEX_FRAMES)) psLog->bIndexDue = true;
+        if (!psLog->ui32Frame) psLog->ui32FileStart = ui32Time;
+    }
+    pui8Rec = (uint8_t *)psLog->pui32Frame + RL_FRAME_HDR + psHdr->ui16Used;
+    memcpy(pui8Rec, &ui32Time, 4);
+    memcpy(pui8Rec + 4, &ui16Len, 2);
+    memcpy(pui8Rec + RL_RECORD_HDR, pvData, ui16Size);
+    psHdr->ui16Used += RL_RECORD_HDR + ui16Size;
+    psHdr->ui16Records++;
+    psHdr->ui32Last = ui32Time;
+    psLog->ui32LastTime = ui32Time;
+    psLog->bDirty = true;
+
+    /* Out with the frame as soon as no record fits any more */
+    if (psHdr->ui16Used + RL_RECORD_HDR >= RL_FRAME_SIZE - RL_FRAME_HDR) {
+        iFResult = write_frame(psLog);
+        if (iFResult == FR_OK) iFResult = next_frame(psLog);
+        return iFResult;
+    }
+    return FR_OK;
+}
+
+FRESULT
+rl_Sync(tRecLog *psLog)
+{
+    FRESULT iFResult = FR_OK;
+
+    if (psLog->bDirty) iFResult = write_frame(psLog);
+    if (iFResult == FR_OK) iFResult = f_sync(&psLog->sData);
+    if (iFResult == FR_OK) iFResult = f_sync(&psLog->sIndex);
+    return iFResult;
+}
+
+FRESULT
+rl_Close(tRecLog *psLog)
+{
+    FRESULT iFResult, iData, iIndex;
+
+    iFResult = rl_Sync(psLog);
+    iData = f_close(&psLog->sData);
+    iIndex = f_close(&psLog->sIndex);
+    if (iFResult == FR_OK) iFResult = (iData != FR_OK) ? iData : iIndex;
+    return iFResult;
+}
+
+/* Time of the first record of a log file. Returns FR_NO_FILE for a file
+ * without records. */
+static FRESULT
+file_start(FIL *psFile, const char *pcDir, uint32_t ui32File,
+           uint32_t *pui32Time)
+{
+    tIndexEntry sEntry;
+    FRESULT iFResult;
+
+    iFResult = make_path(pcDir, ui32File, "RLI");
+    if (iFResult == FR_OK) iFResult = f_open(psFile, g_pcPath, FA_READ);
+    if (iFResult != FR_OK) return iFResult;
+    iFResult = read_entry(psFile, 0, &sEntry);
+    f_close(psFile);
+    if (iFResult == FR_INT_ERR) return FR_NO_FILE;
+    *pui32Time = sEntry.ui32Time;
+    return iFResult;
+}
+
+/* Pass the records of a log file in the range to pfnVisit. *pbDone is set
+ * once the range or the query has ended. */
+static FRESULT
+scan_file(FIL *psFile, const char *pcDir, uint32_t ui32File,
+          uint32_t ui32From, uint32_t ui32To, tRecLogVisit pfnVisit,
+          void *pvArg, bool *pbDone)
+{
+    tFrameHdr *psHdr = (tFrameHdr *)g_pui32Query;
+    uint32_t ui32Lo, ui32Hi, ui32Mid, ui32Frame, ui32Frames, ui32Time;
+    tIndexEntry sEntry;
+    FRESULT iFResult;
+    uint8_t *pui8Rec, *pui8End;
+    uint16_t ui16Size;
+    bool bValid;
+
+    /* The last indexed frame that starts before the range */
+    iFResult = make_path(pcDir, ui32File, "RLI");
+    if (iFResult == FR_OK) iFResult = f_open(psFile, g_pcPath, FA_READ);
+    if (iFResult != FR_OK) return iFResult;
+    ui32Lo = 0;
+    ui32Hi = f_size(psFile) / sizeof(tIndexEntry);
+    ui32Frame = 0;
+    while (ui32Lo < ui32Hi) {
+        ui32Mid = (ui32Lo + ui32Hi) / 2;
+        iFResult = read_entry(psFile, ui32Mid, &sEntry);
+        if (iFResult != FR_OK) break;
+        if (sEntry.ui32Time < ui32From) {
+            ui32Frame = sEntry.ui32Frame;
+            ui32Lo = ui32Mid + 1;
+        } else {
+            ui32Hi = ui32Mid;
+        }
+    }
+    f_close(psFile);
+    if (iFResult != FR_OK) return iFResult;
+
+    make_path(pcDir, ui32File, "RL");
+    iFResult = f_open(psFile, g_pcPath, FA_READ);
+    if (iFResult != FR_OK) return iFResult;
+    ui32Frames = f_size(psFile) / RL_FRAME_SIZE;
+    for (; ui32Frame < ui32Frames && !*pbDone; ui32Frame++) {
+        iFResult = read_frame(psFile, ui32Frame, g_pui32Query, &bValid);
+        if (iFResult != FR_OK) break;
+        if (!bValid || psHdr->ui32Last < ui32From) continue;
+        pui8Rec = (uint8_t *)g_pui32Query + RL_FRAME_HDR;
+        pui8End = pui8Rec + psHdr->ui16Used;
+        while (pui8Rec + RL_RECORD_HDR <= pui8End) {
+            memcpy(&ui32Time, pui8Rec, 4);
+            memcpy(&ui16Size, pui8Rec + 4, 2);
+            if (ui32Time > ui32To) {
+                *pbDone = true;
+                break;
+            }
+            if (ui32Time >= ui32From &&
+                !pfnVisit(ui32Time, pui8Rec + RL_RECORD_HDR, ui16Size,
+                          pvArg)) {
+                *pbDone = true;
+                break;
+            }
+            pui8Rec += RL_RECORD_HDR + ui16Size;
+        }
+    }
+    f_close(psFile);
+    return iFResult;
+}
+
+FRESULT
+rl_Query(tRecLog *psLog, FIL *psFile, uint32_t ui32From, uint32_t ui32To,
+         tRecLogVisit pfnVisit, void *pvArg)
+{
+    const char *pcDir = psLog->psConfig->pcDir;
+    uint32_t ui32First, ui32Last, ui32File, ui32Prev, ui32Time;
+    FRESULT iFResult;
+    bool bDone = false;
+
+    iFResult = rl_Sync(psLog);
+    if (iFResult == FR_OK)
+        iFResult = scan_dir(pcDir, &ui32First, &ui32Last);
+    if (iFResult != FR_OK || !ui32Last) return iFResult;
+
+    /* A file is read unless the next one starts before the range */
+    ui32Prev = 0;
+    for (ui32File = ui32First; ui32File <= ui32Last + 1; ui32File++) {
+        ui32Time = 0xFFFFFFFF;
+        if (ui32File <= ui32Last) {
+            iFResult = file_start(psFile, pcDir, ui32File, &ui32Time);
+            if (iFResult == FR_NO_FILE) continue;
+            if (iFResult != FR_OK) return iFResult;
+        }
+        if (ui32Prev && (ui32File > ui32Last || ui32Time >= ui32From)) {
+            iFResult = scan_file(psFile, pcDir, ui32Prev, ui32From, ui32To,
+                                 pfnVisit, pvArg, &bDone);
+            if (iFResult != FR_OK || bDone) return iFResult;
+        }
+        if (ui32Time > ui32To) break;
+        ui32Prev = ui32File;
+    }
+    return FR_OK;
+}
@@ -0,0 +1,98 @@
+/*
+ * reclog.h - append-only record log
+ *
+ * Records of up to RL_MAX_RECORD bytes, each with a time stamp, are packed
+ * into 512-byte frames. A frame fills one sector of a log file and carries
+ * the number of its records, the times of the first and last one and a
+ * CRC-32. Frames are written whole at sector offsets, straight from the
+ * frame buffer to the card.
+ *
+ * The log lives in a directory of numbered files, 00000001.RL and on. A new
+ * file is started when the current one reaches a size, or when its records
+ * span a time. Next to each file, its .RLI index holds the time of the first
+ * record of every RL_INDEX_FRAMES-th frame, so that a query for a time range
+ * reads only the frames that may hold it.
+ *
+ * Time stamps are the caller's, in any unit, and must not go back. The last
+ * frame is written again in place as records are added to it by rl_Sync().
+ * rl_Open() drops a torn last frame and the index entries past the end of
+ * the data after a reset, and carries on with a last frame that is not full.
+ * tools/reclog.py prints the records of log files copied to a PC.
+ */
+
+#ifndef __RECLOG_H__
+#define __RECLOG_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fatfs/src/ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Frame layout: header, then the records, each a 32-bit time, a 16-bit size
+ * and the data, back to back */
+#define RL_FRAME_SIZE           512
+#define RL_FRAME_HDR            24
+#define RL_RECORD_HDR           6
+#define RL_MAX_RECORD           (RL_FRAME_SIZE - RL_FRAME_HDR - RL_RECORD_HDR)
+
+/* Frames per index entry */
+#define RL_INDEX_FRAMES         8
+
+/* Where the log goes and when its files are rotated. A limit of 0 is no
+ * limit. */
+typedef struct {
+    const char *pcDir;          /* Directory of the log files, e.g. "0:/LOG" */
+    uint32_t ui32MaxBytes;      /* Size at which a new file is started */
+    uint32_t ui32MaxSpan;       /* Time the records of a file may span */
+} tRecLogConfig;
+
+/* An open log. The structure is owned by the caller. */
+typedef struct {
+    const tRecLogConfig *psConfig;
+    FIL sData;                  /* Current log file */
+    FIL sIndex;                 /* and its index */
+    uint32_t ui32File;          /* Number of the current file */
+    uint32_t ui32Frame;         /* Frame in the buffer, counted in the file */
+    uint32_t ui32FileStart;     /* Time of the first record of the file */
+    uint32_t ui32LastTime;      /* Time of the last record */
+    bool bDirty;                /* Frame buffer not written since changed */
+    bool bIndexDue;             /* Index entry of the frame not written yet */
+    uint32_t pui32Frame[RL_FRAME_SIZE / 4];
+} tRecLog;
+
+/* Called by rl_Query() for each record in the range, in order. Returns false
+ * to end the query. */
+typedef bool (*tRecLogVisit)(uint32_t ui32Time, const uint8_t *pui8Data,
+                             uint_fast16_t ui16Size, void *pvArg);
+
+/* Open the log in the directory of the configuration, which is created if
+ * need be, and recover the last file after a reset. The configuration must
+ * outlive the log. */
+FRESULT rl_Open(tRecLog *psLog, const tRecLogConfig *psConfig);
+
+/* Add a record. Returns FR_INVALID_PARAMETER if it is longer than
+ * RL_MAX_RECORD or older than the last one. The record is on the card once
+ * its frame is full, or after rl_Sync(). */
+FRESULT rl_Append(tRecLog *psLog, uint32_t ui32Time, const void *pvData,
+                  uint_fast16_t ui16Size);
+
+/* Write the frame being filled and the index, and sync both files */
+FRESULT rl_Sync(tRecLog *psLog);
+
+/* Sync and close the log */
+FRESULT rl_Close(tRecLog *psLog);
+
+/* Pass the records stamped ui32From to ui32To, both included, to pfnVisit.
+ * The log is synced first. psFile is used to read the files, and must not be
+ * open. Frames that fail their CRC are skipped. */
+FRESULT rl_Query(tRecLog *psLog, FIL *psFile, uint32_t ui32From,
+                 uint32_t ui32To, tRecLogVisit pfnVisit, void *pvArg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RECLOG_H__ */
@@ -0,0 +1,262 @@
+/*
+ * spiBus.c - shared SPI bus on EUSCI_B0
+ *
+ * The bus is either owned by a synchronous user between sb_Acquire() and
+ * sb_Release(), held by the device of a queued transfer flagged SB_HOLD, or
+ * free. Queued transfers only run from sb_Poll() while it is free, or held
+ * for their own device. The module is reconfigured when a device with a
+ * different clock or clock mode is selected, and left alone otherwise.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "driverlib.h"
+#include "spiBus.h"
+
+/* Initial setup. The clock and mode are set up again for each device. */
+static const eUSCI_SPI_MasterConfig g_sSpiConfig =
+{
+    EUSCI_B_SPI_CLOCKSOURCE_SMCLK,
+    3000000,
+    400000,
+    EUSCI_B_SPI_MSB_FIRST,
+    EUSCI_B_SPI_PHASE_DATA_CHANGED_ONFIRST_CAPTURED_ON_NEXT,
+    EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_HIGH,
+    EUSCI_B_SPI_3PIN
+};
+
+static tSpiXfer *g_psQueue;             /* Queued transfers, in arrival order */
+static tSpiDevice *g_psOwner;           /* Device of the synchronous user */
+static tSpiDevice *g_psHolder;          /* Device of a transfer with SB_HOLD */
+static bool g_bPolling;                 /* sb_Poll() is running */
+
+static uint32_t g_ui32Smclk;            /* SMCLK frequency in Hz */
+static uint32_t g_ui32Div;              /* Clock divider in use, 0 if unknown */
+static uint_fast16_t g_ui16Phase;       /* Clock phase in use */
+static uint_fast16_t g_ui16Polarity;    /* Clock polarity in use */
+
+/* Set up the clock and mode for a device where they differ */
+static void
+configure(tSpiDevice *psDevice)
+{
+    uint32_t ui32Div;
+
+    if (psDevice->ui16Phase != g_ui16Phase
+        || psDevice->ui16Polarity != g_ui16Polarity) {
+        SPI_changeClockPhasePolarity(EUSCI_B0_MODULE, psDevice->ui16Phase,
+                                     psDevice->ui16Polarity);
+        g_ui16Phase = psDevice->ui16Phase;
+        g_ui16Polarity = psDevice->ui16Polarity;
+    }
+
+    /* The fastest clock that does not exceed the device's */
+    ui32Div = (g_ui32Smclk + psDevice->ui32Hz - 1) / psDevice->ui32Hz;
+    if (!ui32Div) ui32Div = 1;
+    if (ui32Div != g_ui32Div) {
+        SPI_changeMasterClock(EUSCI_B0_MODULE, g_ui32Smclk,
+                              g_ui32Smclk / ui32Div);
+        g_ui32Div = ui32Div;
+    }
+}
+
+static void
+select_device(tSpiDevice *psDevice)
+{
+    configure(psDevice);
+    GPIO_setOutputLowOnPin(psDevice->ui8CsPort, psDevice->ui16CsPin);
+}
+
+static void
+deselect_device(tSpiDevice *psDevice)
+{
+    uint_fast8_t i;
+
+    GPIO_setOutputHighOnPin(psDevice->ui8CsPort, psDevice->ui16CsPin);
+    for (i = 0; i < psDevice->ui8IdleBytes; i++) sb_Byte(0xFF);
+}
+
+/* Wait for a transfer that holds the bus for another device to let go */
+static void
+wait_free(tSpiDevice *psDevice)
+{
+    while (g_psHolder && g_psHolder != psDevice) sb_Poll();
+}
+
+void
+sb_Init(void)
+{
+    /* P1.5, P1.6 and P1.7 are the clock, MOSI and MISO */
+    GPIO_setAsPeripheralModuleFunctionInputPin(GPIO_PORT_P1,
+            GPIO_PIN5 | GPIO_PIN6 | GPIO_PIN7, GPIO_PRIMARY_MODULE_FUNCTION);
+
+    SPI_initMaster(EUSCI_B0_MODULE, &g_sSpiConfig);
+    SPI_enableModule(EUSCI_B0_MODULE);
+
+    g_ui16Phase = g_sSpiConfig.clockPhase;
+    g_ui16Polarity = g_sSpiConfig.clockPolarity;
+    g_ui32Smclk = CS_getSMCLK();
+    g_ui32Div = 0;
+}
+
+void
+sb_AddDevice(tSpiDevice *psDevice)
+{
+    GPIO_setOutputHighOnPin(psDevice->ui8CsPort, psDevice->ui16CsPin);
+    GPIO_setAsOutputPin(psDevice->ui8CsPort, psDevice->ui16CsPin);
+}
+
+void
+sb_SetClock(tSpiDevice *psDevice, uint32_t ui32Hz)
+{
+    psDevice->ui32Hz = ui32Hz;
+    if (psDevice == g_psOwner || psDevice == g_psHolder) configure(psDevice);
+}
+
+void
+sb_ClockChanged(void)
+{
+    g_ui32Smclk = CS_getSMCLK();
+    g_ui32Div = 0;
+    if (g_psOwner) configure(g_psOwner);
+    else if (g_psHolder) configure(g_psHolder);
+}
+
+void
+sb_Acquire(tSpiDevice *psDevice)
+{
+    wait_free(psDevice);
+    g_psOwner = psDevice;
+    if (g_psHolder == psDevice)
+        g_psHolder = 0;                         /* Selected already */
+    else
+        select_device(psDevice);
+}
+
+void
+sb_Release(tSpiDevice *psDevice)
+{
+    deselect_device(psDevice);
+    g_psOwner = 0;
+}
+
+void
+sb_Clock(tSpiDevice *psDevice, uint32_t ui32Bytes)
+{
+    wait_free(psDevice);
+    configure(psDevice);
+    while (ui32Bytes--) sb_Byte(0xFF);
+}
+
+void
+sb_Yield(tSpiDevice *psDevice)
+{
+    if (!sb_Pending()) return;
+    sb_Release(psDevice);
+    sb_Poll();
+    sb_Acquire(psDevice);
+}
+
+bool
+sb_Pending(void)
+{
+    tSpiXfer *psXfer;
+
+    for (psXfer = g_psQueue; psXfer; psXfer = psXfer->psNext)
+        if (psXfer->psDevice != g_psOwner) return true;
+    return false;
+}
+
+uint8_t
+sb_Byte(uint8_t ui8Tx)
+{
+    while (!(UCB0IFG & UCTXIFG)) ;
+    UCB0TXBUF = ui8Tx;
+    while (!(UCB0IFG & UCRXIFG)) ;
+    return UCB0RXBUF;
+}
+
+void
+sb_Transfer(const uint8_t *pui8Tx, uint8_t *pui8Rx, uint32_t ui32Len)
+{
+    uint8_t ui8Rx;
+
+    while (ui32Len--) {
+        while (!(UCB0IFG & UCTXIFG)) ;
+        UCB0TXBUF = pui8Tx ? *pui8Tx++ : 0xFF;
+        while (!(UCB0IFG & UCRXIFG)) ;
+        ui8Rx = UCB0RXBUF;
+        if (pui8Rx) *pui8Rx++ = ui8Rx;
+    }
+}
+
+void
+sb_Submit(tSpiXfer *psXfer)
+{
+    tSpiXfer **ppsNext;
+    bool bMasked;
+
+    psXfer->psNext = 0;
+    psXfer->bBusy = true;
+
+    bMasked = Interrupt_disableMaster();
+    for (ppsNext = &g_psQueue; *ppsNext; ppsNext = &(*ppsNext)->psNext) ;
+    *ppsNext = psXfer;
+    if (!bMasked) Interrupt_enableMaster();
+}
+
+/* Take the next transfer the bus is free for off the queue */
+static tSpiXfer *
+next_xfer(void)
+{
+    tSpiXfer **ppsNext, *psXfer;
+    bool bMasked;
+
+    bMasked = Interrupt_disableMaster();
+    for (ppsNext = &g_psQueue; (psXfer = *ppsNext) != 0;
+         ppsNext = &psXfer->psNext)
+        if (!g_psHolder || psXfer->psDevice == g_psHolder) break;
+    if (psXfer) *ppsNext = psXfer->psNext;
+    if (!bMasked) Interrupt_enableMaster();
+
+    return psXfer;
+}
+
+uint32_t
+sb_Poll(void)
+{
+    tSpiXfer *psXfer;
+    uint32_t ui32Left;
+
+    if (!g_psOwner && !g_bPolling) {
+        g_bPolling = true;
+
+        /* Run the transfers queued so far, and the ones that follow a held
+         * transfer on its device. Transfers queued meanwhile wait for the
+         * next call, so a device that keeps queuing cannot lock the others
+         * out. */
+        for (ui32Left = 0, psXfer = g_psQueue; psXfer; psXfer = psXfer->psNext)
+            ui32Left++;
+        while ((ui32Left || g_psHolder) && (psXfer = next_xfer()) != 0) {
+            if (g_psHolder)
+                g_psHolder = 0;                 /* Selected already */
+            else
+                select_device(psXfer->psDevice);
+            if (ui32Left) ui32Left--;
+
+            sb_Transfer(psXfer->pui8Tx, psXfer->pui8Rx, psXfer->ui16Len);
+
+            if (psXfer->ui8Flags & SB_HOLD)
+                g_psHolder = psXfer->psDevice;
+            else
+                deselect_device(psXfer->psDevice);
+            psXfer->bBusy = false;
+            if (psXfer->pfnDone) psXfer->pfnDone(psXfer);
+        }
+
+        g_bPolling = false;
+    }
+
+    for (ui32Left = 0, psXfer = g_psQueue; psXfer; psXfer = psXfer->psNext)
+        ui32Left++;
+    return ui32Left;
+}
@@ -0,0 +1,111 @@
+/*
+ * spiBus.h - shared SPI bus on EUSCI_B0
+ *
+ * Every device on the bus is described by a tSpiDevice with its chip select,
+ * clock and clock mode, and the bus is switched over to it only when it
+ * changes hands. A device is used in one of two ways:
+ *
+ * - Synchronously, between sb_Acquire() and sb_Release(), with sb_Byte() and
+ *   sb_Transfer(). This is how the SD card driver talks to the cards. It
+ *   lets the other devices in with sb_Yield() whenever the card allows its
+ *   chip select to go high, e.g. while the card is busy programming.
+ *
+ * - With transfers queued by sb_Submit(), from the main loop or an interrupt
+ *   handler, and run in arrival order by sb_Poll() whenever the bus is free.
+ *   A transfer flagged SB_HOLD keeps the chip select asserted and the bus
+ *   reserved for its device, and the next transfer to the device follows
+ *   without the chip select going high in between.
+ */
+
+#ifndef __SPIBUS_H__
+#define __SPIBUS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A device on the bus. The structure is owned by the caller. */
+typedef struct tSpiDevice {
+    uint_fast8_t ui8CsPort;         /* GPIO port of the chip select */
+    uint_fast16_t ui16CsPin;        /* GPIO pin of the chip select */
+    uint32_t ui32Hz;                /* Highest clock the device takes */
+    uint_fast16_t ui16Phase;        /* EUSCI_B_SPI_PHASE_x */
+    uint_fast16_t ui16Polarity;     /* EUSCI_B_SPI_CLOCKPOLARITY_x */
+    uint8_t ui8IdleBytes;           /* 0xFF bytes clocked after the chip
+                                       select goes high, for devices that
+                                       release MISO only on a clock */
+} tSpiDevice;
+
+/* Keep the chip select asserted after the transfer, see tSpiXfer */
+#define SB_HOLD     0x01
+
+/* A queued transfer. The structure is owned by the caller and linked into
+ * the queue until the transfer is done. */
+typedef struct tSpiXfer {
+    struct tSpiXfer *psNext;        /* Next queued transfer */
+    tSpiDevice *psDevice;           /* Device to talk to */
+    const uint8_t *pui8Tx;          /* Bytes to send, or 0 to send 0xFF */
+    uint8_t *pui8Rx;                /* Bytes received, or 0 to drop them */
+    uint16_t ui16Len;               /* Number of bytes */
+    uint8_t ui8Flags;               /* SB_HOLD */
+    void (*pfnDone)(struct tSpiXfer *psXfer);   /* Called when done, or 0 */
+    volatile bool bBusy;            /* Queued or running */
+} tSpiXfer;
+
+/* Set up EUSCI_B0 and its pins. The devices' chip selects are made outputs
+ * by sb_AddDevice(). */
+void sb_Init(void);
+
+/* Drive the chip select of a device high and make it an output */
+void sb_AddDevice(tSpiDevice *psDevice);
+
+/* Change the highest clock of a device. Takes effect at once if the device
+ * has the bus. */
+void sb_SetClock(tSpiDevice *psDevice, uint32_t ui32Hz);
+
+/* Recompute the clock dividers after SMCLK has changed. Called by
+ * clk_SetProfile(). */
+void sb_ClockChanged(void);
+
+/* Take the bus for a device and assert its chip select. Waits, running
+ * sb_Poll(), while a queued transfer holds the bus for another device. */
+void sb_Acquire(tSpiDevice *psDevice);
+
+/* Deassert the chip select and give the bus up */
+void sb_Release(tSpiDevice *psDevice);
+
+/* Clock ui32Bytes bytes of 0xFF at the clock of a device with every chip
+ * select high, e.g. to bring an SD card into SPI mode */
+void sb_Clock(tSpiDevice *psDevice, uint32_t ui32Bytes);
+
+/* Give the bus up for the transfers queued so far and take it back. The
+ * chip select is high meanwhile. */
+void sb_Yield(tSpiDevice *psDevice);
+
+/* Whether transfers to other devices are waiting for the bus */
+bool sb_Pending(void);
+
+/* Exchange a byte with the device that has the bus */
+uint8_t sb_Byte(uint8_t ui8Tx);
+
+/* Exchange ui32Len bytes with the device that has the bus. pui8Tx may be 0
+ * to send 0xFF, and pui8Rx may be 0 to drop the bytes received. */
+void sb_Transfer(const uint8_t *pui8Tx, uint8_t *pui8Rx, uint32_t ui32Len);
+
+/* Queue a transfer. May be called from an interrupt handler. */
+void sb_Submit(tSpiXfer *psXfer);
+
+/* Run the queued transfers the bus is free for, calling their pfnDone in
+ * turn. pfnDone may queue the next transfer, but must not wait for the bus.
+ * Must not be called from an interrupt handler. Returns the number of
+ * transfers left in the queue. */
+uint32_t sb_Poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SPIBUS_H__ */
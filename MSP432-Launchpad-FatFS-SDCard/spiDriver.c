@@ -36,21 +36,19 @@
 
 /* DriverLib Includes */
 #include "driverlib.h"
+#include "spiBus.h"
 #include "spidriver.h"
 
-#define ASSERT_CS()          (P4OUT &= ~BIT6)
-#define DEASSERT_CS()        (P4OUT |= BIT6)
-
-/* SPI Master Configuration Parameter */
-const eUSCI_SPI_MasterConfig spiMasterConfig =
+/* The SimpleLink device on the shared SPI bus. Its chip select is on
+ * BoosterPack pin 18 (P3.0); P4.6 belongs to the SD card. The CC3100 takes
+ * up to 20 MHz in SPI mode 0. */
+static tSpiDevice g_sSpiDevice =
 {
-        EUSCI_B_SPI_CLOCKSOURCE_SMCLK,             // SMCLK Clock Source
-        3000000,                                   // SMCLK 3Mhz
-        500000,                                    // SPICLK = 500khz
-        EUSCI_B_SPI_MSB_FIRST,                     // MSB First
-        EUSCI_B_SPI_PHASE_DATA_CHANGED_ONFIRST_CAPTURED_ON_NEXT,    // Phase
-        EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_HIGH, // High polarity
-        EUSCI_B_SPI_3PIN                           // 3Wire SPI Mode
+    GPIO_PORT_P3, GPIO_PIN0,                   // Chip select
+    12000000,                                  // SPICLK = 12Mhz
+    EUSCI_B_SPI_PHASE_DATA_CAPTURED_ONFIRST_CHANGED_ON_NEXT,    // Phase
+    EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_LOW,  // Low polarity
+    0                                          // No idle bytes
 };
 
 int spi_Close(Fd_t fd)
@@ -63,20 +61,8 @@ int spi_Close(Fd_t fd)
 
 Fd_t spi_Open(void)
 {
-
-    /* Selecting P1.5 P1.6 and P1.7 in SPI mode */
-	GPIO_setAsPeripheralModuleFunctionInputPin(GPIO_PORT_P1,
-			GPIO_PIN5 | GPIO_PIN6 | GPIO_PIN7, GPIO_PRIMARY_MODULE_FUNCTION);
-
-	/* CS setup. */
-    GPIO_setOutputLowOnPin(GPIO_PORT_P4, GPIO_PIN6);
-    GPIO_setAsOutputPin(GPIO_PORT_P4, GPIO_PIN6);
-
-    /* Configuring SPI in 3wire master mode */
-	SPI_initMaster(EUSCI_B0_MODULE, &spiMasterConfig);
-
-	/* Enable SPI module */
-	SPI_enableModule(EUSCI_B0_MODULE);
+    /* The bus itself is set up by sb_Init() */
+    sb_AddDevice(&g_sSpiDevice);
 
     return 0;//NONOS_RET_OK;
 }
@@ -84,40 +70,19 @@ Fd_t spi_Open(void)
 
 int spi_Write(Fd_t fd, unsigned char *pBuff, int len)
 {
-    int len_to_return = len;
-
-    ASSERT_CS();
-    while (len)
-    {
-        while (!(UCB0IFG&UCTXIFG));
-        UCB0TXBUF = *pBuff;
-        while (!(UCB0IFG&UCRXIFG));
-        UCB0RXBUF;
-        len --;
-        pBuff++;
-    }
+    sb_Acquire(&g_sSpiDevice);
+    sb_Transfer(pBuff, 0, len);
+    sb_Release(&g_sSpiDevice);
 
-    DEASSERT_CS();
-
-    return len_to_return;
+    return len;
 }
 
 
 int spi_Read(Fd_t fd, unsigned char *pBuff, int len)
 {
-    int i = 0;
-
-    ASSERT_CS();
-
-    for (i = 0; i < len; i ++)
-    {
-        while (!(UCB0IFG&UCTXIFG));
-        UCB0TXBUF = 0xFF;
-        while (!(UCB0IFG&UCRXIFG));
-        pBuff[i] = UCB0RXBUF;
-    }
-
-    DEASSERT_CS();
+    sb_Acquire(&g_sSpiDevice);
+    sb_Transfer(0, pBuff, len);
+    sb_Release(&g_sSpiDevice);
 
     return len;
 }
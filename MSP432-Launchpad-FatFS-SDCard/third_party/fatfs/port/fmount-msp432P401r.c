@@ -0,0 +1,139 @@
+/*-----------------------------------------------------------------------*/
+/* Mount record store for the MSP432P401R                                */
+/*-----------------------------------------------------------------------*/
+/* FatFs saves the geometry of a mounted volume here (_FS_FASTMOUNT),    */
+/* so that the next mount of the same card skips the search for the      */
+/* volume. The records live in the last 4KB sector of the main flash,    */
+/* which project_ccs.cmd keeps out of the FLASH region.                  */
+/*-----------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fatfs/src/ff.h"
+#include "driverlib.h"
+
+#if _FS_FASTMOUNT
+
+/* Flash sector holding the records (bank 1, sector 31) */
+#define FM_FLASH_ADDR           0x0003F000
+#define FM_FLASH_BANK           FLASH_MAIN_MEMORY_SPACE_BANK1
+#define FM_FLASH_SECTOR         FLASH_SECTOR31
+
+/* Number of physical drives that get a record slot */
+#define FM_NUM_DRIVES           2
+
+#define FM_MAGIC                0x544E4D46  /* "FMNT" */
+
+/* A record slot in the flash sector. The live word is cleared by programming
+ * it to zero, which needs no erase, when the volume is re-formatted. */
+typedef struct {
+    uint32_t magic;             /* FM_MAGIC if the slot holds a record */
+    uint32_t live;              /* 0xFFFFFFFF:record holds, 0:dropped */
+    FMOUNT rec;                 /* The mount record */
+    uint32_t sum;               /* Checksum of rec */
+} tSlot;
+
+#define FM_SLOTS                ((const tSlot *)FM_FLASH_ADDR)
+
+/* Image of the slots while the sector is rewritten (kept off the stack) */
+static
+tSlot g_psSlotImage[FM_NUM_DRIVES];
+
+static
+uint32_t sum_rec (const FMOUNT *rec)
+{
+    const uint8_t *p = (const uint8_t *)rec;
+    uint32_t sum = 0;
+    uint_fast16_t i;
+
+    for (i = 0; i < sizeof(FMOUNT); i++)
+        sum = (sum << 5) + (sum >> 27) + p[i];
+    return sum;
+}
+
+static
+bool slot_valid (const tSlot *slot)
+{
+    return slot->magic == FM_MAGIC && slot->sum == sum_rec(&slot->rec);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the saved mount record of a drive                                 */
+/*-----------------------------------------------------------------------*/
+
+int ff_fmount_load (
+    BYTE pdrv,          /* Physical drive number */
+    FMOUNT* rec         /* Record to fill in */
+)
+{
+    const tSlot *slot = &FM_SLOTS[pdrv];
+
+    if (pdrv >= FM_NUM_DRIVES || !slot_valid(slot) || !slot->live) return 0;
+
+    memcpy(rec, &slot->rec, sizeof(FMOUNT));
+    return 1;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Save the mount record of a drive                                      */
+/*-----------------------------------------------------------------------*/
+
+void ff_fmount_save (
+    BYTE pdrv,          /* Physical drive number */
+    const FMOUNT* rec   /* Record to save */
+)
+{
+    uint_fast8_t i;
+
+    if (pdrv >= FM_NUM_DRIVES) return;
+
+    /* Nothing to do if the same record is already in the flash */
+    if (slot_valid(&FM_SLOTS[pdrv]) && FM_SLOTS[pdrv].live
+        && !memcmp(&FM_SLOTS[pdrv].rec, rec, sizeof(FMOUNT)))
+        return;
+
+    /* Keep the records of the other drives over the sector erase */
+    for (i = 0; i < FM_NUM_DRIVES; i++) {
+        if (slot_valid(&FM_SLOTS[i]))
+            memcpy(&g_psSlotImage[i], &FM_SLOTS[i], sizeof(tSlot));
+        else
+            memset(&g_psSlotImage[i], 0xFF, sizeof(tSlot));
+    }
+    g_psSlotImage[pdrv].magic = FM_MAGIC;
+    g_psSlotImage[pdrv].live = 0xFFFFFFFF;
+    memcpy(&g_psSlotImage[pdrv].rec, rec, sizeof(FMOUNT));
+    g_psSlotImage[pdrv].sum = sum_rec(rec);
+
+    FlashCtl_unprotectSector(FM_FLASH_BANK, FM_FLASH_SECTOR);
+    if (FlashCtl_eraseSector(FM_FLASH_ADDR))
+        FlashCtl_programMemory(g_psSlotImage, (void *)FM_FLASH_ADDR,
+                               sizeof(g_psSlotImage));
+    FlashCtl_protectSector(FM_FLASH_BANK, FM_FLASH_SECTOR);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Drop the mount record of a drive                                      */
+/*-----------------------------------------------------------------------*/
+
+void ff_fmount_stale (
+    BYTE pdrv           /* Physical drive number */
+)
+{
+    static const uint32_t zero = 0;
+
+    if (pdrv >= FM_NUM_DRIVES || !FM_SLOTS[pdrv].live) return;
+
+    FlashCtl_unprotectSector(FM_FLASH_BANK, FM_FLASH_SECTOR);
+    FlashCtl_programMemory((void *)&zero, (void *)&FM_SLOTS[pdrv].live,
+                           sizeof(zero));
+    FlashCtl_protectSector(FM_FLASH_BANK, FM_FLASH_SECTOR);
+}
+
+#endif /* _FS_FASTMOUNT */
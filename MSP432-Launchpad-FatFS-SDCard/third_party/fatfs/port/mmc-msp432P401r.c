@@ -1,8 +1,8 @@
 /*-----------------------------------------------------------------------*/
 /* MMC/SDC (in SPI mode) control module  (C)ChaN, 2007                   */
 /*-----------------------------------------------------------------------*/
-/* Only rcvr_spi(), xmit_spi(), disk_timerproc() and some macros         */
-/* are platform dependent.                                               */
+/* Only rcvr_spi(), xmit_spi() and some macros are platform dependent.  */
+/* Timeouts are deadlines on the microsecond clock of timebase.c.        */
 /*-----------------------------------------------------------------------*/
 
 /*
@@ -18,6 +18,9 @@
 #include <stdbool.h>
 #include "fatfs/src/diskio.h"
 #include "driverlib.h"
+#include "timebase.h"
+#include "spiBus.h"
+#include "trace.h"
 
 /* Definitions for MMC/SDC command */
 #define CMD0    (0x40+0)    /* GO_IDLE_STATE */
@@ -26,12 +29,16 @@
 #define CMD9    (0x40+9)    /* SEND_CSD */
 #define CMD10    (0x40+10)    /* SEND_CID */
 #define CMD12    (0x40+12)    /* STOP_TRANSMISSION */
+#define CMD13    (0x40+13)    /* SD_STATUS (ACMD) */
 #define CMD16    (0x40+16)    /* SET_BLOCKLEN */
 #define CMD17    (0x40+17)    /* READ_SINGLE_BLOCK */
 #define CMD18    (0x40+18)    /* READ_MULTIPLE_BLOCK */
 #define CMD23    (0x40+23)    /* SET_BLOCK_COUNT */
 #define CMD24    (0x40+24)    /* WRITE_BLOCK */
 #define CMD25    (0x40+25)    /* WRITE_MULTIPLE_BLOCK */
+#define CMD32    (0x40+32)    /* ERASE_WR_BLK_START */
+#define CMD33    (0x40+33)    /* ERASE_WR_BLK_END */
+#define CMD38    (0x40+38)    /* ERASE */
 #define CMD41    (0x40+41)    /* SEND_OP_COND (ACMD) */
 #define CMD55    (0x40+55)    /* APP_CMD */
 #define CMD58    (0x40+58)    /* READ_OCR */
@@ -51,18 +58,80 @@
 #define SDC_SSI_PINS            (SDC_SSI_TX | SDC_SSI_RX | SDC_SSI_CLK |      \
                                  SDC_SSI_FSS)
 
-// asserts the CS pin to the card
+/* SPI clock while a card is initialized, and after. The clock is derived
+ * from SMCLK, so it may be lower in a slow clock profile. */
+#define SDC_SPI_INIT_HZ         400000
+#define SDC_SPI_FAST_HZ         12000000
+
+/* Number of SD cards sharing the SPI bus. Each card gets its own chip
+ * select line in the g_psCards table below. */
+#define SDC_NUM_CARDS           2
+
+/* How the cards are presented to FatFs:
+ * 0: each card is a physical drive of its own (drive number = card index)
+ * 1: all cards form physical drive 0, every sector is mirrored to each card
+ * 2: all cards form physical drive 0, sectors are striped across the cards
+ *    in units of SDC_STRIPE_SECTORS */
+#define SDC_ARRAY_MODE          0
+#define SDC_STRIPE_SECTORS      8
+
+/* Number of physical drives presented to FatFs */
+#if SDC_ARRAY_MODE
+#define SDC_DRIVES              1
+#else
+#define SDC_DRIVES              SDC_NUM_CARDS
+#endif
+
+#if _USE_RAMDISK && RAMDISK_DRV < SDC_DRIVES
+#error RAMDISK_DRV must not be one of the card drives.
+#endif
+
+/* Maximum number of requests waiting in the request queue */
+#define DISK_QUEUE_DEPTH        8
+
+/* While a card is busy, the CPU sleeps between polls of the card. The poll
+ * interval starts at SDC_POLL_MIN_US and doubles up to SDC_POLL_MAX_US, which
+ * bounds the time lost after the card gets ready. Setting SDC_POLL_MIN_US to
+ * 0 polls back to back without sleeping. */
+#define SDC_POLL_MIN_US         50
+#define SDC_POLL_MAX_US         500
+
+/* State of a card on the bus */
+typedef struct {
+    tSpiDevice Dev;             /* Chip select and clock on the SPI bus */
+    volatile DSTATUS Stat;      /* Disk status */
+    BYTE CardType;              /* b0:MMC, b1:SDC, b2:Block addressing */
+    BYTE PowerFlag;             /* indicates if "power" is on */
+} tCard;
+
+/* A card on the SPI bus. Cards let go of DO on the first clock after CS goes
+ * high, hence the idle byte. */
+#define SDC_DEVICE(port, pin) \
+    { port, pin, SDC_SPI_INIT_HZ, EUSCI_B_SPI_PHASE_DATA_CHANGED_ONFIRST_CAPTURED_ON_NEXT, \
+      EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_HIGH, 1 }
+
+static
+tCard g_psCards[SDC_NUM_CARDS] = {
+    { SDC_DEVICE(GPIO_PORT_P4, GPIO_PIN6), STA_NOINIT, 0, 0 },  /* BoosterPack socket */
+    { SDC_DEVICE(GPIO_PORT_P4, GPIO_PIN7), STA_NOINIT, 0, 0 },  /* Second socket */
+};
+
+/* The card the low level functions below are talking to */
+static
+tCard *Card = &g_psCards[0];
+
+// takes the SPI bus and asserts the CS pin to the card
 static
 void SELECT (void)
 {
-	GPIO_setOutputLowOnPin(GPIO_PORT_P4, GPIO_PIN6);
+	sb_Acquire(&Card->Dev);
 }
 
-// de-asserts the CS pin to the card
+// de-asserts the CS pin to the card, clocks DO free and gives the bus up
 static
 void DESELECT (void)
 {
-	GPIO_setOutputHighOnPin(GPIO_PORT_P4, GPIO_PIN6);;
+	sb_Release(&Card->Dev);
 }
 
 /*--------------------------------------------------------------------------
@@ -71,17 +140,10 @@ void DESELECT (void)
 
 ---------------------------------------------------------------------------*/
 
-static volatile
-DSTATUS Stat = STA_NOINIT;    /* Disk status */
-
-static volatile
-BYTE Timer1, Timer2;    /* 100Hz decrement timer */
-
-static
-BYTE CardType;            /* b0:MMC, b1:SDC, b2:Block addressing */
-
+#if SDC_ARRAY_MODE
 static
-BYTE PowerFlag = 0;     /* indicates if "power" is on */
+DSTATUS ArrayStat = STA_NOINIT;    /* Status of the card array */
+#endif
 
 /*-----------------------------------------------------------------------*/
 /* Transmit a byte to MMC via SPI  (Platform dependent)                  */
@@ -90,17 +152,7 @@ BYTE PowerFlag = 0;     /* indicates if "power" is on */
 static
 void xmit_spi(BYTE dat)
 {
-
-    uint32_t ui32RcvDat = 0;
-
-    /* Send data. */
-    SPI_transmitData(EUSCI_B0_MODULE, dat );
-
-    /* flush data read during the write */
-    ui32RcvDat = SPI_receiveData(EUSCI_B0_MODULE);
-
-    /* Get rid of "variable set, but unused" warning. */
-    ui32RcvDat = ui32RcvDat + 1;
+    sb_Byte(dat);
 }
 
 
@@ -111,21 +163,24 @@ void xmit_spi(BYTE dat)
 static
 BYTE rcvr_spi (void)
 {
-    uint32_t ui32RcvDat;
-
-    /* Send a dummy. */
-    SPI_transmitData(EUSCI_B0_MODULE, 0xFF);
-
-    ui32RcvDat = SPI_receiveData(EUSCI_B0_MODULE);
-     return (BYTE)ui32RcvDat;
+    return sb_Byte(0xFF);    /* Send a dummy */
 }
 
+/*-----------------------------------------------------------------------*/
+/* Sleep before polling a busy card again                                */
+/*-----------------------------------------------------------------------*/
 
 static
-void rcvr_spi_m (BYTE *dst)
+void poll_delay (
+    uint32_t *us        /* Poll interval, doubled for the next call */
+)
 {
-    *dst = rcvr_spi();
-
+#if SDC_POLL_MIN_US
+    tb_Sleep(*us);
+    *us = (*us < SDC_POLL_MAX_US / 2) ? *us * 2 : SDC_POLL_MAX_US;
+#else
+    (void)us;
+#endif
 }
 
 /*-----------------------------------------------------------------------*/
@@ -136,12 +191,17 @@ static
 BYTE wait_ready (void)
 {
     BYTE res;
+    uint32_t us = SDC_POLL_MIN_US;
+
+    uint64_t end = tb_Deadline(500000);    /* Wait for ready in timeout of 500ms */
 
-    Timer2 = 50;    /* Wait for ready in timeout of 500ms */
+    TR_BEGIN(TR_WAIT, TR_EV_WAIT_READY, 0, 0);
     rcvr_spi();
-    do
-        res = rcvr_spi();
-    while ((res != 0xFF) && Timer2);
+    while ((res = rcvr_spi()) != 0xFF && !tb_Expired(end)) {
+        sb_Yield(&Card->Dev);    /* CS may go high while the card is busy */
+        poll_delay(&us);
+    }
+    TR_FINISH(TR_WAIT, TR_EV_WAIT_READY, res);
 
     return res;
 }
@@ -153,29 +213,9 @@ BYTE wait_ready (void)
 static
 void send_initial_clock_train(void)
 {
-    unsigned int i;
-    uint32_t ui32Dat = 0;
-
-    /* Ensure CS is held high. */
-    DESELECT();
-
-    /* Switch the SSI TX line to a GPIO and drive it high too. */
-    //ROM_GPIOPinTypeGPIOOutput(SDC_GPIO_PORT_BASE, SDC_SSI_TX);
-    //ROM_GPIOPinWrite(SDC_GPIO_PORT_BASE, SDC_SSI_TX, SDC_SSI_TX);
-
-    /* Send 10 bytes over the SSI. This causes the clock to wiggle the */
-    /* required number of times. */
-    for(i = 0 ; i < 10 ; i++)
-    {
-        /* Write DUMMY data. SSIDataPut() waits until there is room in the */
-        /* FIFO. */
-        SPI_transmitData(EUSCI_B0_MODULE, 0xFF);
-
-        ui32Dat = SPI_receiveData(EUSCI_B0_MODULE);
-
-        /* Get rid of "variable set, but unused" warning. */
-        ui32Dat = ui32Dat + 1;
-    }
+    /* Send 10 bytes over the SPI bus with every CS high. This causes the */
+    /* clock to wiggle the required number of times. */
+    sb_Clock(&Card->Dev, 10);
 }
 
 /*-----------------------------------------------------------------------*/
@@ -189,28 +229,57 @@ void power_on (void)
 {
     /* Set DI and CS high and apply more than 74 pulses to SCLK for the card */
     /* to be able to accept a native command. */
+    sb_SetClock(&Card->Dev, SDC_SPI_INIT_HZ);
     send_initial_clock_train();
 
-    PowerFlag = 1;
+    Card->PowerFlag = 1;
 }
 
 // set the SSI speed to the max setting
 static
 void set_max_speed(void)
-{
-
+{
+    sb_SetClock(&Card->Dev, SDC_SPI_FAST_HZ);
 }
 
 static
 void power_off (void)
 {
-    PowerFlag = 0;
+    Card->PowerFlag = 0;
 }
 
 static
 int chk_power(void)        /* Socket power state: 0=off, 1=on */
 {
-    return PowerFlag;
+    return Card->PowerFlag;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Make all chip selects outputs, driven high, so that only the card     */
+/* being addressed ever sees CS low on the shared bus                    */
+/*-----------------------------------------------------------------------*/
+static
+void init_cs_pins (void)
+{
+    BYTE i;
+
+    for (i = 0; i < SDC_NUM_CARDS; i++)
+        sb_AddDevice(&g_psCards[i].Dev);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Check if the current card is still busy programming, without waiting  */
+/*-----------------------------------------------------------------------*/
+static
+BOOL card_busy (void)
+{
+    BYTE res;
+
+    SELECT();
+    res = rcvr_spi();
+    DESELECT();
+
+    return (res != 0xFF);
 }
 
 
@@ -226,17 +295,14 @@ BOOL rcvr_datablock (
 )
 {
     BYTE token;
+    uint64_t end = tb_Deadline(1000000);
 
-    Timer1 = 100;
-    do {                            /* Wait for data packet in timeout of 100ms */
+    do {                            /* Wait for data packet in timeout of 1000ms */
         token = rcvr_spi();
-    } while ((token == 0xFF) && Timer1);
+    } while ((token == 0xFF) && !tb_Expired(end));
     if(token != 0xFE) return FALSE;    /* If not valid data token, retutn with error */
 
-    do {                            /* Receive the data block into buffer */
-        rcvr_spi_m(buff++);
-        rcvr_spi_m(buff++);
-    } while (btr -= 2);
+    sb_Transfer(0, buff, btr);        /* Receive the data block into buffer */
     rcvr_spi();                        /* Discard CRC */
     rcvr_spi();
     return TRUE;                    /* Return with success */
@@ -255,17 +321,13 @@ BOOL xmit_datablock (
     BYTE token            /* Data/Stop token */
 )
 {
-    BYTE resp, wc;
+    BYTE resp;
 
     if (wait_ready() != 0xFF) return FALSE;
 
     xmit_spi(token);                    /* Xmit data token */
     if (token != 0xFD) {    /* Is data token */
-        wc = 0;
-        do {                            /* Xmit the 512 byte data block to MMC */
-            xmit_spi(*buff++);
-            xmit_spi(*buff++);
-        } while (--wc);
+        sb_Transfer(buff, 0, 512);        /* Xmit the 512 byte data block to MMC */
         xmit_spi(0xFF);                    /* CRC (Dummy) */
         xmit_spi(0xFF);
         resp = rcvr_spi();                /* Reveive data response */
@@ -290,7 +352,11 @@ BYTE send_cmd (
 {
     BYTE n, res;
 
-    if (wait_ready() != 0xFF) return 0xFF;
+    TR_BEGIN(TR_CMD, TR_EV_SEND_CMD, cmd & 0x3F, arg);
+    if (wait_ready() != 0xFF) {
+        TR_FINISH(TR_CMD, TR_EV_SEND_CMD, 0xFF);
+        return 0xFF;
+    }
 
     /* Send command packet */
     xmit_spi(cmd);                        /* Command */
@@ -309,6 +375,7 @@ BYTE send_cmd (
     do
         res = rcvr_spi();
     while ((res & 0x80) && --n);
+    TR_FINISH(TR_CMD, TR_EV_SEND_CMD, res);
 
     return res;            /* Return with the response value */
 }
@@ -360,23 +427,22 @@ BYTE send_cmd12 (void)
 
 /*--------------------------------------------------------------------------
 
-   Public Functions
+   Card Functions (operate on the card pointed to by Card)
 
 ---------------------------------------------------------------------------*/
 
 
 /*-----------------------------------------------------------------------*/
-/* Initialize Disk Drive                                                 */
+/* Initialize Card                                                       */
 /*-----------------------------------------------------------------------*/
 
-DSTATUS disk_initialize (
-    BYTE drv        /* Physical drive nmuber (0) */
-)
+static
+DSTATUS card_initialize (void)
 {
     BYTE n, ty, ocr[4];
+    uint64_t end;
 
-    if (drv) return STA_NOINIT;            /* Supports only single drive */
-    if (Stat & STA_NODISK) return Stat;    /* No card in the socket */
+    if (Card->Stat & STA_NODISK) return Card->Stat;    /* No card in the socket */
 
     power_on();                            /* Force socket power on */
     send_initial_clock_train();            /* Ensure the card is in SPI mode */
@@ -384,14 +450,14 @@ DSTATUS disk_initialize (
     SELECT();                /* CS = L */
     ty = 0;
     if (send_cmd(CMD0, 0) == 1) {            /* Enter Idle state */
-        Timer1 = 100;                        /* Initialization timeout of 1000 msec */
+        end = tb_Deadline(1000000);          /* Initialization timeout of 1000 msec */
         if (send_cmd(CMD8, 0x1AA) == 1) {    /* SDC Ver2+ */
             for (n = 0; n < 4; n++) ocr[n] = rcvr_spi();
             if (ocr[2] == 0x01 && ocr[3] == 0xAA) {    /* The card can work at vdd range of 2.7-3.6V */
                 do {
                     if (send_cmd(CMD55, 0) <= 1 && send_cmd(CMD41, 1UL << 30) == 0)    break;    /* ACMD41 with HCS bit */
-                } while (Timer1);
-                if (Timer1 && send_cmd(CMD58, 0) == 0) {    /* Check CCS bit */
+                } while (!tb_Expired(end));
+                if (!tb_Expired(end) && send_cmd(CMD58, 0) == 0) {    /* Check CCS bit */
                     for (n = 0; n < 4; n++) ocr[n] = rcvr_spi();
                     ty = (ocr[0] & 0x40) ? 6 : 2;
                 }
@@ -404,145 +470,154 @@ DSTATUS disk_initialize (
                 } else {
                     if (send_cmd(CMD1, 0) == 0) break;                                /* CMD1 */
                 }
-            } while (Timer1);
-            if (!Timer1 || send_cmd(CMD16, 512) != 0)    /* Select R/W block length */
+            } while (!tb_Expired(end));
+            if (tb_Expired(end) || send_cmd(CMD16, 512) != 0)    /* Select R/W block length */
                 ty = 0;
         }
     }
-    CardType = ty;
-    DESELECT();            /* CS = H */
-    rcvr_spi();            /* Idle (Release DO) */
+    Card->CardType = ty;
+    DESELECT();            /* CS = H, Idle (Release DO) */
 
     if (ty) {            /* Initialization succeded */
-        Stat &= ~STA_NOINIT;        /* Clear STA_NOINIT */
+        Card->Stat &= ~STA_NOINIT;        /* Clear STA_NOINIT */
         set_max_speed();
     } else {            /* Initialization failed */
         power_off();
     }
 
-    return Stat;
+    return Card->Stat;
 }
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Get Disk Status                                                       */
+/* Read Sector(s) from Card                                              */
 /*-----------------------------------------------------------------------*/
+/* The requests in the batch cover consecutive sectors and are read with */
+/* a single command, which is cut between sectors for other devices      */
+/* waiting on the SPI bus.                                               */
 
-DSTATUS disk_status (
-    BYTE drv        /* Physical drive nmuber (0) */
+static
+DRESULT card_read (
+    DREQ *const *batch,    /* Requests in sector order */
+    BYTE n                /* Number of requests (1..DISK_QUEUE_DEPTH) */
 )
 {
-    if (drv) return STA_NOINIT;        /* Supports only single drive */
-    return Stat;
-}
-
-
-
-/*-----------------------------------------------------------------------*/
-/* Read Sector(s)                                                        */
-/*-----------------------------------------------------------------------*/
+    DWORD sector = batch[0]->sector;
+    BYTE *buff = batch[0]->buff, count = batch[0]->count, i = 0;
+    BOOL ok;
 
-DRESULT disk_read (
-    BYTE drv,            /* Physical drive nmuber (0) */
-    BYTE *buff,            /* Pointer to the data buffer to store read data */
-    DWORD sector,        /* Start sector number (LBA) */
-	BYTE count            /* Sector count (1..255) */
-)
-{
-    if (drv || !count) return RES_PARERR;
-    if (Stat & STA_NOINIT) return RES_NOTRDY;
+    if (Card->Stat & STA_NOINIT) return RES_NOTRDY;
 
-    if (!(CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
+    if (!(Card->CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
 
     SELECT();            /* CS = L */
 
-    if (count == 1) {    /* Single block read */
+    if (n == 1 && count == 1) {    /* Single block read */
         if ((send_cmd(CMD17, sector) == 0)    /* READ_SINGLE_BLOCK */
             && rcvr_datablock(buff, 512))
-            count = 0;
+            i = n;
     }
     else {                /* Multiple block read */
-        if (send_cmd(CMD18, sector) == 0) {    /* READ_MULTIPLE_BLOCK */
+        /* CS has to stay low until the read is stopped, so when other    */
+        /* devices wait for the bus the read is stopped after the current */
+        /* sector and started again from the next one once they are done. */
+        while (send_cmd(CMD18, sector) == 0) {    /* READ_MULTIPLE_BLOCK */
             do {
-                if (!rcvr_datablock(buff, 512)) break;
+                ok = rcvr_datablock(buff, 512);
+                if (!ok) break;
                 buff += 512;
-            } while (--count);
+                sector += (Card->CardType & 4) ? 1 : 512;
+                if (!--count && ++i < n) {    /* On to the next request */
+                    buff = batch[i]->buff;
+                    count = batch[i]->count;
+                }
+            } while (i < n && !sb_Pending());
             send_cmd12();                /* STOP_TRANSMISSION */
+            if (!ok || i == n) break;
+            sb_Yield(&Card->Dev);
         }
     }
 
-    DESELECT();            /* CS = H */
-    rcvr_spi();            /* Idle (Release DO) */
+    DESELECT();            /* CS = H, Idle (Release DO) */
 
-    return count ? RES_ERROR : RES_OK;
+    return (i == n) ? RES_OK : RES_ERROR;
 }
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Write Sector(s)                                                       */
+/* Write Sector(s) to Card                                               */
 /*-----------------------------------------------------------------------*/
+/* The requests in the batch cover consecutive sectors and are written   */
+/* with a single command. The card is left programming on return.        */
 
 #if _READONLY == 0
-DRESULT disk_write (
-    BYTE drv,            /* Physical drive nmuber (0) */
-    const BYTE *buff,    /* Pointer to the data to be written */
-    DWORD sector,        /* Start sector number (LBA) */
-	BYTE count            /* Sector count (1..255) */
+static
+DRESULT card_write (
+    DREQ *const *batch,    /* Requests in sector order */
+    BYTE n                /* Number of requests (1..DISK_QUEUE_DEPTH) */
 )
 {
-    if (drv || !count) return RES_PARERR;
-    if (Stat & STA_NOINIT) return RES_NOTRDY;
-    if (Stat & STA_PROTECT) return RES_WRPRT;
+    DWORD sector = batch[0]->sector, total = 0;
+    const BYTE *buff;
+    BYTE count, i;
+
+    if (Card->Stat & STA_NOINIT) return RES_NOTRDY;
+    if (Card->Stat & STA_PROTECT) return RES_WRPRT;
 
-    if (!(CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
+    if (!(Card->CardType & 4)) sector *= 512;    /* Convert to byte address if needed */
+    for (i = 0; i < n; i++) total += batch[i]->count;
+    i = 0;
 
     SELECT();            /* CS = L */
 
-    if (count == 1) {    /* Single block write */
+    if (total == 1) {    /* Single block write */
         if ((send_cmd(CMD24, sector) == 0)    /* WRITE_BLOCK */
-            && xmit_datablock(buff, 0xFE))
-            count = 0;
+            && xmit_datablock(batch[0]->buff, 0xFE))
+            i = n;
     }
     else {                /* Multiple block write */
-        if (CardType & 2) {
-            send_cmd(CMD55, 0); send_cmd(CMD23, count);    /* ACMD23 */
+        if (Card->CardType & 2) {
+            send_cmd(CMD55, 0); send_cmd(CMD23, total);    /* ACMD23 */
         }
         if (send_cmd(CMD25, sector) == 0) {    /* WRITE_MULTIPLE_BLOCK */
-            do {
-                if (!xmit_datablock(buff, 0xFC)) break;
-                buff += 512;
-            } while (--count);
+            for ( ; i < n; i++) {
+                buff = batch[i]->buff;
+                count = batch[i]->count;
+                do {
+                    if (!xmit_datablock(buff, 0xFC)) break;
+                    buff += 512;
+                } while (--count);
+                if (count) break;
+            }
             if (!xmit_datablock(0, 0xFD))    /* STOP_TRAN token */
-                count = 1;
+                i = 0;
         }
     }
 
-    DESELECT();            /* CS = H */
-    rcvr_spi();            /* Idle (Release DO) */
+    DESELECT();            /* CS = H, Idle (Release DO) */
 
-    return count ? RES_ERROR : RES_OK;
+    return (i == n) ? RES_OK : RES_ERROR;
 }
 #endif /* _READONLY */
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Miscellaneous Functions                                               */
+/* Card Control Functions                                                */
 /*-----------------------------------------------------------------------*/
 
-DRESULT disk_ioctl (
-    BYTE drv,        /* Physical drive nmuber (0) */
+static
+DRESULT card_ioctl (
     BYTE ctrl,        /* Control code */
     void *buff        /* Buffer to send/receive control data */
 )
 {
     DRESULT res;
     BYTE n, csd[16], *ptr = buff;
-    WORD csize;
-
-    if (drv) return RES_PARERR;
+    DWORD csize;
+    DWORD st, ed;
 
     res = RES_ERROR;
 
@@ -566,7 +641,7 @@ DRESULT disk_ioctl (
         }
     }
     else {
-        if (Stat & STA_NOINIT) return RES_NOTRDY;
+        if (Card->Stat & STA_NOINIT) return RES_NOTRDY;
 
         SELECT();        /* CS = L */
 
@@ -574,7 +649,7 @@ DRESULT disk_ioctl (
         case GET_SECTOR_COUNT :    /* Get number of sectors on the disk (DWORD) */
             if ((send_cmd(CMD9, 0) == 0) && rcvr_datablock(csd, 16)) {
                 if ((csd[0] >> 6) == 1) {    /* SDC ver 2.00 */
-                    csize = csd[9] + ((WORD)csd[8] << 8) + 1;
+                    csize = csd[9] + ((WORD)csd[8] << 8) + ((DWORD)(csd[7] & 63) << 16) + 1;
                     *(DWORD*)buff = (DWORD)csize << 10;
                 } else {                    /* MMC or SDC ver 1.XX */
                     n = (csd[5] & 15) + ((csd[10] & 128) >> 7) + ((csd[9] & 3) << 1) + 2;
@@ -590,6 +665,46 @@ DRESULT disk_ioctl (
             res = RES_OK;
             break;
 
+        case GET_BLOCK_SIZE :    /* Get erase block size in unit of sector (DWORD) */
+            if (Card->CardType & 2) {    /* SDC: AU size in the SD status */
+                if (send_cmd(CMD55, 0) <= 1 && send_cmd(CMD13, 0) == 0) {    /* ACMD13 */
+                    rcvr_spi();                        /* Second byte of the R2 response */
+                    if (rcvr_datablock(csd, 16)) {    /* Read the head of the 64 byte status */
+                        for (n = 64 - 16; n; n--) rcvr_spi();    /* Purge the rest */
+                        if (csd[10] >> 4) {            /* AU_SIZE (SDC ver 2.00 or later) */
+                            *(DWORD*)buff = 16UL << (csd[10] >> 4);
+                            res = RES_OK;
+                            break;
+                        }
+                    }
+                }
+            }
+            if ((send_cmd(CMD9, 0) == 0) && rcvr_datablock(csd, 16)) {    /* Erase size in the CSD */
+                if (Card->CardType & 2) {    /* SDC ver 1.XX */
+                    *(DWORD*)buff = (((csd[10] & 63) << 1) + ((WORD)(csd[11] & 128) >> 7) + 1) << ((csd[13] >> 6) - 1);
+                } else {                    /* MMC */
+                    *(DWORD*)buff = ((WORD)((csd[10] & 124) >> 2) + 1) * (((csd[11] & 3) << 3) + ((csd[11] & 224) >> 5) + 1);
+                }
+                res = RES_OK;
+            }
+            break;
+
+        case CTRL_ERASE_SECTOR :    /* Erase a block of sectors (DWORD[2]: start, end) */
+            if (!(Card->CardType & 2)) {    /* MMC has no CMD32/33 */
+                res = RES_PARERR;
+                break;
+            }
+            st = ((DWORD*)buff)[0];
+            ed = ((DWORD*)buff)[1];
+            if (!(Card->CardType & 4)) {    /* Convert to byte address if needed */
+                st *= 512; ed *= 512;
+            }
+            if (send_cmd(CMD32, st) == 0 && send_cmd(CMD33, ed) == 0 && send_cmd(CMD38, 0) == 0) {
+                for (n = 60; n && wait_ready() != 0xFF; n--) ;    /* Erase can take up to 30 sec */
+                if (n) res = RES_OK;
+            }
+            break;
+
         case CTRL_SYNC :    /* Make sure that data has been written */
             if (wait_ready() == 0xFF)
                 res = RES_OK;
@@ -613,9 +728,15 @@ DRESULT disk_ioctl (
                     *ptr++ = rcvr_spi();
                 res = RES_OK;
             }
+            break;
+
+        case MMC_GET_BUSY :    /* Check if the card is still programming (1 byte) */
+            *ptr = (rcvr_spi() != 0xFF);
+            res = RES_OK;
+            break;
 
 //        case MMC_GET_TYPE :    /* Get card type flags (1 byte) */
-//            *ptr = CardType;
+//            *ptr = Card->CardType;
 //            res = RES_OK;
 //            break;
 
@@ -623,29 +744,646 @@ DRESULT disk_ioctl (
             res = RES_PARERR;
         }
 
-        DESELECT();            /* CS = H */
-        rcvr_spi();            /* Idle (Release DO) */
+        DESELECT();            /* CS = H, Idle (Release DO) */
+    }
+    return res;
+}
+
+
+
+#if SDC_ARRAY_MODE
+/*--------------------------------------------------------------------------
+
+   Card Array Functions
+
+   The sectors of a request are cut into runs that each live on a single
+   card. After a run has been written the card goes on programming its
+   flash on its own, so rather than waiting for it the scheduler issues the
+   next run to a card that is ready. With two cards this keeps one card
+   busy programming while the other is receiving data.
+
+---------------------------------------------------------------------------*/
+
+/* Distance in array sectors from the end of one run on a card to the start
+ * of the next run on the same card */
+#if SDC_ARRAY_MODE == 2
+#define RUN_SKIP    ((SDC_NUM_CARDS - 1) * SDC_STRIPE_SECTORS)
+#else
+#define RUN_SKIP    0
+#endif
+
+/*-----------------------------------------------------------------------*/
+/* Translate an array sector number into the card sector number          */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD array_to_card (
+    DWORD sector        /* Sector number in the array */
+)
+{
+#if SDC_ARRAY_MODE == 2
+    return sector / SDC_STRIPE_SECTORS / SDC_NUM_CARDS * SDC_STRIPE_SECTORS
+           + sector % SDC_STRIPE_SECTORS;
+#else
+    return sector;
+#endif
+}
+
+/*-----------------------------------------------------------------------*/
+/* Transfer sectors to/from the cards, serving whichever card is ready   */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT array_xfer (
+    DREQ *req            /* Request on the array */
+)
+{
+    DWORD next[SDC_NUM_CARDS], sector, end, n;
+    BYTE c, pending, issued;
+    DREQ run, *prun = &run;
+    DRESULT res;
+
+    sector = req->sector;
+    end = sector + req->count;
+
+    /* Find the first run of each card */
+    for (c = 0; c < SDC_NUM_CARDS; c++) {
+#if SDC_ARRAY_MODE == 2
+        n = sector / SDC_STRIPE_SECTORS;        /* Stripe unit holding the first sector */
+        if (n % SDC_NUM_CARDS == c)
+            next[c] = sector;
+        else
+            next[c] = (n + (c + SDC_NUM_CARDS - n % SDC_NUM_CARDS) % SDC_NUM_CARDS) * SDC_STRIPE_SECTORS;
+#else
+        next[c] = (req->op == DREQ_WRITE) ? sector : end;    /* Mirror reads are served by array_read */
+#endif
+    }
+
+    do {
+        pending = issued = 0;
+        for (c = 0; c < SDC_NUM_CARDS; c++) {
+            if (next[c] >= end) continue;        /* Nothing more for this card */
+            pending++;
+            Card = &g_psCards[c];
+            if (card_busy()) continue;            /* Still programming, serve the others first */
+            n = SDC_STRIPE_SECTORS - next[c] % SDC_STRIPE_SECTORS;
+            if (n > end - next[c]) n = end - next[c];
+            run.buff = req->buff + (next[c] - sector) * 512;
+            run.sector = array_to_card(next[c]);
+            run.count = (BYTE)n;
+#if _READONLY == 0
+            if (req->op == DREQ_WRITE)
+                res = card_write(&prun, 1);
+            else
+#endif
+                res = card_read(&prun, 1);
+            if (res != RES_OK) return res;
+            next[c] += n + RUN_SKIP;
+            issued++;
+        }
+        if (pending && !issued) {
+            /* Every card with work left is busy, wait on the first of them */
+            for (c = 0; next[c] >= end; c++) ;
+            Card = &g_psCards[c];
+            SELECT();
+            n = wait_ready();
+            DESELECT();
+            if (n != 0xFF) return RES_ERROR;
+        }
+    } while (pending);
+
+    return RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s) from the Array                                         */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT array_read (
+    DREQ *req            /* Read request on the array */
+)
+{
+#if SDC_ARRAY_MODE == 1
+    BYTE c, i;
+
+    /* Any copy will do, start with a card that is not busy and fall back
+       to the other copies if it fails */
+    for (c = 0; c < SDC_NUM_CARDS - 1; c++) {
+        Card = &g_psCards[c];
+        if (!card_busy()) break;
+    }
+    for (i = 0; i < SDC_NUM_CARDS; i++) {
+        Card = &g_psCards[(c + i) % SDC_NUM_CARDS];
+        if (card_read(&req, 1) == RES_OK) return RES_OK;
+    }
+    return RES_ERROR;
+#else
+    return array_xfer(req);
+#endif
+}
+
+/*-----------------------------------------------------------------------*/
+/* Array Control Functions                                               */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT array_ioctl (
+    BYTE ctrl,        /* Control code */
+    void *buff        /* Buffer to send/receive control data */
+)
+{
+    DRESULT res;
+    DWORD n, min, rt[2];
+    BYTE c, busy;
+
+    switch (ctrl) {
+    case GET_SECTOR_COUNT :    /* The smallest card limits the array */
+        min = 0xFFFFFFFF;
+        for (c = 0; c < SDC_NUM_CARDS; c++) {
+            Card = &g_psCards[c];
+            res = card_ioctl(GET_SECTOR_COUNT, &n);
+            if (res != RES_OK) return res;
+            if (n < min) min = n;
+        }
+#if SDC_ARRAY_MODE == 2
+        min = min / SDC_STRIPE_SECTORS * SDC_STRIPE_SECTORS * SDC_NUM_CARDS;
+#endif
+        *(DWORD*)buff = min;
+        return RES_OK;
+
+#if SDC_ARRAY_MODE == 2
+    case GET_BLOCK_SIZE :    /* An erase block on each card */
+        Card = &g_psCards[0];
+        res = card_ioctl(GET_BLOCK_SIZE, &n);
+        *(DWORD*)buff = n * SDC_NUM_CARDS;
+        return res;
+#endif
+
+    case CTRL_ERASE_SECTOR :    /* Erase the corresponding range on every card */
+        rt[0] = ((DWORD*)buff)[0];
+        rt[1] = ((DWORD*)buff)[1];
+#if SDC_ARRAY_MODE == 2
+        /* Only ranges of whole stripes map onto one range per card */
+        if (rt[0] % (SDC_STRIPE_SECTORS * SDC_NUM_CARDS)
+            || (rt[1] + 1) % (SDC_STRIPE_SECTORS * SDC_NUM_CARDS))
+            return RES_OK;
+        rt[0] = array_to_card(rt[0]);
+        rt[1] = array_to_card(rt[1]);
+#endif
+        for (c = 0; c < SDC_NUM_CARDS; c++) {
+            Card = &g_psCards[c];
+            res = card_ioctl(CTRL_ERASE_SECTOR, rt);
+            if (res != RES_OK) return res;
+        }
+        return RES_OK;
+
+    case MMC_GET_BUSY :        /* Busy if any of the cards is */
+        *(BYTE*)buff = 0;
+        for (c = 0; c < SDC_NUM_CARDS; c++) {
+            Card = &g_psCards[c];
+            res = card_ioctl(MMC_GET_BUSY, &busy);
+            if (res != RES_OK) return res;
+            *(BYTE*)buff |= busy;
+        }
+        return RES_OK;
+
+    case CTRL_SYNC :            /* Every card has to finish programming */
+    case CTRL_POWER :
+        if (ctrl == CTRL_POWER && *(BYTE*)buff == 2) break;    /* POWER_GET */
+        for (c = 0; c < SDC_NUM_CARDS; c++) {
+            Card = &g_psCards[c];
+            res = card_ioctl(ctrl, buff);
+            if (res != RES_OK) return res;
+        }
+        return RES_OK;
+    }
+
+    Card = &g_psCards[0];            /* Anything else is answered by the first card */
+    return card_ioctl(ctrl, buff);
+}
+#endif /* SDC_ARRAY_MODE */
+
+
+
+#if _USE_STAGE
+/* The staging layer (stage-msp432P401r.c) provides the disk_* functions
+   and calls these */
+#define disk_initialize     mmc_disk_initialize
+#define disk_status         mmc_disk_status
+#define disk_read           mmc_disk_read
+#define disk_write          mmc_disk_write
+#define disk_ioctl          mmc_disk_ioctl
+#define disk_submit         mmc_disk_submit
+#define disk_poll           mmc_disk_poll
+#endif
+
+
+
+/*--------------------------------------------------------------------------
+
+   Request Queue
+
+   Requests wait here until the card they address is not busy programming.
+   Reads are served first, in arrival order. Writes are served in ascending
+   sector order starting where the last write on the drive ended, wrapping
+   around to the lowest sector (circular elevator). Queued requests for
+   adjacent sectors in the same direction are merged into one multiple
+   block command. A request never passes an earlier one that it overlaps
+   when either of the two is a write.
+
+---------------------------------------------------------------------------*/
+
+static
+DREQ *Queue;                /* Queued requests in arrival order */
+
+static
+BYTE QueueLen;              /* Number of queued requests */
+
+static
+BOOL Stalled;               /* The last disk_poll() found nothing to issue */
+
+static
+DWORD Head[SDC_DRIVES];     /* Sector following the last write on each drive */
+
+static
+uint64_t BusyEnd[SDC_DRIVES];   /* Each drive may be busy programming until this time */
+
+
+/*-----------------------------------------------------------------------*/
+/* Check if a queued request may be issued ahead of the ones before it   */
+/*-----------------------------------------------------------------------*/
+
+static
+BOOL req_ready (
+    DREQ *req            /* Queued request */
+)
+{
+    DREQ *p;
+
+    for (p = Queue; p != req; p = p->next) {
+        if (p->pdrv == req->pdrv
+            && (p->op == DREQ_WRITE || req->op == DREQ_WRITE)
+            && p->sector < req->sector + req->count
+            && req->sector < p->sector + p->count)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Check if a drive is busy, without waiting                             */
+/*-----------------------------------------------------------------------*/
+
+static
+BOOL drive_busy (
+    BYTE drv            /* Physical drive nmuber */
+)
+{
+#if SDC_ARRAY_MODE
+    return FALSE;        /* array_xfer() works around busy cards itself */
+#else
+    Card = &g_psCards[drv];
+    if (Card->Stat & STA_NOINIT) return FALSE;
+    if (tb_Expired(BusyEnd[drv])) return FALSE;    /* Busy for too long, let wait_ready() time out */
+    return card_busy();
+#endif
+}
+
+/*-----------------------------------------------------------------------*/
+/* Issue a batch of merged requests                                      */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT issue_batch (
+    DREQ *const *batch,    /* Requests in sector order */
+    BYTE n                /* Number of requests */
+)
+{
+#if SDC_ARRAY_MODE
+    if (ArrayStat & STA_NOINIT) return RES_NOTRDY;
+#if _READONLY == 0
+    if (batch[0]->op == DREQ_WRITE) return array_xfer(batch[0]);
+#endif
+    return array_read(batch[0]);
+#else
+    Card = &g_psCards[batch[0]->pdrv];
+#if _READONLY == 0
+    if (batch[0]->op == DREQ_WRITE) return card_write(batch, n);
+#endif
+    return card_read(batch, n);
+#endif
+}
+
+/*-----------------------------------------------------------------------*/
+/* Wait for a request to complete                                        */
+/*-----------------------------------------------------------------------*/
+
+static
+DRESULT disk_wait (
+    DREQ *req            /* Request to submit and complete */
+)
+{
+    DRESULT res;
+    uint32_t us = SDC_POLL_MIN_US;
+
+    while ((res = disk_submit(req)) == RES_NOTRDY) {    /* Queue is full */
+        disk_poll();
+        if (Stalled) poll_delay(&us);
+    }
+    if (res != RES_OK) return res;
+
+    us = SDC_POLL_MIN_US;
+    while (req->busy) {
+        sb_Poll();      /* Other devices on the bus get a turn between batches */
+        disk_poll();
+        if (Stalled)    /* The cards it waits for are busy programming */
+            poll_delay(&us);
+        else
+            us = SDC_POLL_MIN_US;
+    }
+    return req->res;
+}
+
+
+
+/*--------------------------------------------------------------------------
+
+   Asynchronous Request Functions
+
+---------------------------------------------------------------------------*/
+
+
+/*-----------------------------------------------------------------------*/
+/* Queue a Request                                                       */
+/*-----------------------------------------------------------------------*/
+/* Returns RES_NOTRDY when the queue is full. disk_poll() has to be      */
+/* called to make room before trying again.                              */
+
+DRESULT disk_submit (
+    DREQ *req            /* Request, set up except for next, busy and res */
+)
+{
+    DREQ **pp;
+
+    if (req->pdrv >= SDC_DRIVES || !req->count || req->op > DREQ_WRITE)
+        return RES_PARERR;
+#if _READONLY
+    if (req->op == DREQ_WRITE) return RES_WRPRT;
+#endif
+    if (QueueLen >= DISK_QUEUE_DEPTH) return RES_NOTRDY;
+
+    req->next = 0;
+    req->res = RES_OK;
+    req->busy = 1;
+    for (pp = &Queue; *pp; pp = &(*pp)->next) ;
+    *pp = req;
+    QueueLen++;
+
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Advance the Request Queue                                             */
+/*-----------------------------------------------------------------------*/
+/* Issues at most one (merged) command and returns immediately when all  */
+/* the cards with queued requests are busy. Returns the number of        */
+/* requests left in the queue.                                           */
+
+BYTE disk_poll (void)
+{
+    DREQ *req, *sel, **pp, *batch[DISK_QUEUE_DEPTH];
+    BYTE checked, busy, n, i;
+    DWORD end;
+    DRESULT res;
+
+    /* See which of the drives with queued requests are busy */
+    checked = busy = 0;
+    for (req = Queue; req; req = req->next) {
+        if (!(checked & (1 << req->pdrv))) {
+            checked |= 1 << req->pdrv;
+            if (drive_busy(req->pdrv)) busy |= 1 << req->pdrv;
+        }
+    }
+
+    /* Reads first, in arrival order */
+    for (sel = Queue; sel; sel = sel->next) {
+        if (sel->op == DREQ_READ && !(busy & (1 << sel->pdrv)) && req_ready(sel))
+            break;
+    }
+
+    /* Then the write next to the head position */
+    if (!sel) {
+        for (req = Queue; req; req = req->next) {
+            if (req->op != DREQ_WRITE || (busy & (1 << req->pdrv)) || !req_ready(req))
+                continue;
+            if (!sel || req->sector - Head[req->pdrv] < sel->sector - Head[sel->pdrv])
+                sel = req;
+        }
+    }
+    Stalled = !sel;
+    if (!sel) return QueueLen;
+
+    /* Merge the requests that continue where the batch ends */
+    batch[0] = sel;
+    n = 1;
+    end = sel->sector + sel->count;
+#if !SDC_ARRAY_MODE
+    for (;;) {
+        for (req = Queue; req; req = req->next) {
+            if (req->pdrv == sel->pdrv && req->op == sel->op
+                && req->sector == end && req_ready(req))
+                break;
+        }
+        if (!req) break;
+        batch[n++] = req;
+        end += req->count;
+    }
+#endif
+
+    res = issue_batch(batch, n);
+    if (sel->op == DREQ_WRITE) {
+        Head[sel->pdrv] = end;
+        BusyEnd[sel->pdrv] = tb_Deadline(500000);    /* Card may now be busy programming for up to 500ms */
+    }
+
+    /* Retire the batch */
+    for (i = 0; i < n; i++) {
+        req = batch[i];
+        for (pp = &Queue; *pp != req; pp = &(*pp)->next) ;
+        *pp = req->next;
+        QueueLen--;
+        req->res = res;
+        req->busy = 0;
+        if (req->done) req->done(req);
+    }
+
+    return QueueLen;
+}
+
+
+
+/*--------------------------------------------------------------------------
+
+   Public Functions
+
+---------------------------------------------------------------------------*/
+
+/* The RAM disk (ramdisk-msp432P401r.c) is served directly, outside the
+   request queue */
+
+/*-----------------------------------------------------------------------*/
+/* Initialize Disk Drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize (
+    BYTE drv        /* Physical drive nmuber */
+)
+{
+#if SDC_ARRAY_MODE
+    BYTE c;
+#endif
+
+#if _USE_RAMDISK
+    if (drv == RAMDISK_DRV) return ram_disk_initialize();
+#endif
+#if SDC_ARRAY_MODE
+    if (drv) return STA_NOINIT;            /* The array is drive 0 */
+    while (disk_poll()) ;
+    init_cs_pins();
+    ArrayStat = 0;
+    for (c = 0; c < SDC_NUM_CARDS; c++) {
+        Card = &g_psCards[c];
+        ArrayStat |= card_initialize();    /* The array is ready only if all cards are */
     }
+    return ArrayStat;
+#else
+    if (drv >= SDC_NUM_CARDS) return STA_NOINIT;
+    while (disk_poll()) ;
+    init_cs_pins();
+    Card = &g_psCards[drv];
+    return card_initialize();
+#endif
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Disk Status                                                       */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_status (
+    BYTE drv        /* Physical drive nmuber */
+)
+{
+#if _USE_RAMDISK
+    if (drv == RAMDISK_DRV) return ram_disk_status();
+#endif
+#if SDC_ARRAY_MODE
+    if (drv) return STA_NOINIT;
+    return ArrayStat;
+#else
+    if (drv >= SDC_NUM_CARDS) return STA_NOINIT;
+    return g_psCards[drv].Stat;
+#endif
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_read (
+    BYTE drv,            /* Physical drive nmuber */
+    BYTE *buff,            /* Pointer to the data buffer to store read data */
+    DWORD sector,        /* Start sector number (LBA) */
+	BYTE count            /* Sector count (1..255) */
+)
+{
+    DREQ req;
+    DRESULT res;
+
+#if _USE_RAMDISK
+    if (drv == RAMDISK_DRV) return ram_disk_read(buff, sector, count);
+#endif
+    req.done = 0;
+    req.buff = buff;
+    req.sector = sector;
+    req.pdrv = drv;
+    req.op = DREQ_READ;
+    req.count = count;
+
+    TR_BEGIN(TR_DISK, TR_EV_DISK_READ, (drv << 8) | count, sector);
+    res = disk_wait(&req);
+    TR_FINISH(TR_DISK, TR_EV_DISK_READ, res);
     return res;
 }
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Device Timer Interrupt Procedure  (Platform dependent)                */
+/* Write Sector(s)                                                       */
 /*-----------------------------------------------------------------------*/
-/* This function must be called in period of 10ms                        */
 
-void disk_timerproc (void)
+#if _READONLY == 0
+DRESULT disk_write (
+    BYTE drv,            /* Physical drive nmuber */
+    const BYTE *buff,    /* Pointer to the data to be written */
+    DWORD sector,        /* Start sector number (LBA) */
+	BYTE count            /* Sector count (1..255) */
+)
 {
-//    BYTE n, s;
-    BYTE n;
+    DREQ req;
+    DRESULT res;
 
-    n = Timer1;                        /* 100Hz decrement timer */
-    if (n) Timer1 = --n;
-    n = Timer2;
-    if (n) Timer2 = --n;
+#if _USE_RAMDISK
+    if (drv == RAMDISK_DRV) return ram_disk_write(buff, sector, count);
+#endif
+    req.done = 0;
+    req.buff = (BYTE*)buff;
+    req.sector = sector;
+    req.pdrv = drv;
+    req.op = DREQ_WRITE;
+    req.count = count;
+
+    TR_BEGIN(TR_DISK, TR_EV_DISK_WRITE, (drv << 8) | count, sector);
+    res = disk_wait(&req);
+    TR_FINISH(TR_DISK, TR_EV_DISK_WRITE, res);
+    return res;
 }
+#endif /* _READONLY */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_ioctl (
+    BYTE drv,        /* Physical drive nmuber */
+    BYTE ctrl,        /* Control code */
+    void *buff        /* Buffer to send/receive control data */
+)
+{
+#if _USE_RAMDISK
+    if (drv == RAMDISK_DRV) return ram_disk_ioctl(ctrl, buff);
+#endif
+    if (drv >= SDC_DRIVES) return RES_PARERR;
+
+    while (disk_poll()) ;        /* Let the queued requests go first */
+
+#if SDC_ARRAY_MODE
+    return array_ioctl(ctrl, buff);
+#else
+    Card = &g_psCards[drv];
+    return card_ioctl(ctrl, buff);
+#endif
+}
+
+
 
 /*---------------------------------------------------------*/
 /* User Provided Timer Function for FatFs module           */
@@ -0,0 +1,167 @@
+/*-----------------------------------------------------------------------*/
+/* RAM disk for the MSP432P401R                                          */
+/*-----------------------------------------------------------------------*/
+/* Physical drive RAMDISK_DRV is kept in SRAM, for scratch files that    */
+/* need not survive a reset and are better kept off the card. f_mkfs()   */
+/* wants at least 128 sectors, all of the SRAM, so the drive formats     */
+/* itself as a FAT12 volume of one-sector clusters when it is first      */
+/* initialized after a reset. Requests are a single copy between the     */
+/* caller's buffer and the disk, however many sectors they span.         */
+/*-----------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fatfs/src/ff.h"
+#include "fatfs/src/diskio.h"
+
+#if _USE_RAMDISK
+
+/* Size of the drive in sectors */
+#define RD_SECTORS              32
+
+/* Layout of the volume: boot sector, FAT, root directory of one sector */
+#define RD_FAT_SECTORS          (((RD_SECTORS + 2) * 3 / 2 + 511) / 512)
+#define RD_DIR_ENTRIES          16
+
+/* The sectors, word aligned for the copies */
+static
+uint32_t g_pui32Disk[RD_SECTORS][512 / 4];
+
+static
+DSTATUS g_ui8Stat = STA_NOINIT;
+
+/* Write an empty FAT12 volume over the whole drive */
+static
+void format (void)
+{
+    BYTE *bs = (BYTE *)g_pui32Disk[0];
+    BYTE *fat = (BYTE *)g_pui32Disk[1];
+
+    memset(g_pui32Disk, 0, sizeof(g_pui32Disk));
+
+    memcpy(bs, "\xEB\xFE\x90" "MSDOS5.0", 11);     /* Jump code, OEM name */
+    ST_WORD(bs + 11, 512);                          /* Bytes per sector */
+    bs[13] = 1;                                     /* Sectors per cluster */
+    ST_WORD(bs + 14, 1);                            /* Reserved sectors */
+    bs[16] = 1;                                     /* Number of FATs */
+    ST_WORD(bs + 17, RD_DIR_ENTRIES);               /* Root directory entries */
+    ST_WORD(bs + 19, RD_SECTORS);                   /* Volume size */
+    bs[21] = 0xF8;                                  /* Media descriptor */
+    ST_WORD(bs + 22, RD_FAT_SECTORS);               /* Sectors per FAT */
+    ST_WORD(bs + 24, 1);                            /* Sectors per track */
+    ST_WORD(bs + 26, 1);                            /* Number of heads */
+    bs[36] = 0x80;                                  /* Drive number */
+    bs[38] = 0x29;                                  /* Extended boot signature */
+    memcpy(bs + 43, "RAMDISK    " "FAT12   ", 19);  /* Volume label, FAT type */
+    ST_WORD(bs + 510, 0xAA55);                      /* Signature */
+
+    fat[0] = 0xF8;                                  /* Entries 0 and 1 */
+    fat[1] = 0xFF;
+    fat[2] = 0xFF;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Initialize Disk Drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS ram_disk_initialize (void)
+{
+    if (g_ui8Stat & STA_NOINIT) {
+        format();
+        g_ui8Stat = 0;
+    }
+    return g_ui8Stat;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Disk Status                                                       */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS ram_disk_status (void)
+{
+    return g_ui8Stat;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+
+DRESULT ram_disk_read (
+    BYTE *buff,         /* Pointer to the data buffer to store read data */
+    DWORD sector,       /* Start sector number (LBA) */
+    BYTE count          /* Sector count (1..255) */
+)
+{
+    if (g_ui8Stat & STA_NOINIT) return RES_NOTRDY;
+    if (!count || sector >= RD_SECTORS || count > RD_SECTORS - sector)
+        return RES_PARERR;
+
+    memcpy(buff, g_pui32Disk[sector], count * 512);
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+
+DRESULT ram_disk_write (
+    const BYTE *buff,   /* Pointer to the data to be written */
+    DWORD sector,       /* Start sector number (LBA) */
+    BYTE count          /* Sector count (1..255) */
+)
+{
+    if (g_ui8Stat & STA_NOINIT) return RES_NOTRDY;
+    if (!count || sector >= RD_SECTORS || count > RD_SECTORS - sector)
+        return RES_PARERR;
+
+    memcpy(g_pui32Disk[sector], buff, count * 512);
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+/*-----------------------------------------------------------------------*/
+
+DRESULT ram_disk_ioctl (
+    BYTE ctrl,          /* Control code */
+    void *buff          /* Buffer to send/receive control data */
+)
+{
+    if (g_ui8Stat & STA_NOINIT) return RES_NOTRDY;
+
+    switch (ctrl) {
+    case CTRL_SYNC :            /* Nothing is cached */
+    case CTRL_ERASE_SECTOR :    /* Nothing to gain from erasing RAM */
+        return RES_OK;
+
+    case GET_SECTOR_COUNT :
+        *(DWORD*)buff = RD_SECTORS;
+        return RES_OK;
+
+    case GET_SECTOR_SIZE :
+        *(WORD*)buff = 512;
+        return RES_OK;
+
+    case GET_BLOCK_SIZE :
+        *(DWORD*)buff = 1;
+        return RES_OK;
+
+    case MMC_GET_BUSY :
+        *(BYTE*)buff = 0;
+        return RES_OK;
+    }
+    return RES_PARERR;
+}
+
+#endif /* _USE_RAMDISK */
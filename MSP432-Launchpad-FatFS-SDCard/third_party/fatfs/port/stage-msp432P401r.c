@@ -0,0 +1,634 @@
+/*-----------------------------------------------------------------------*/
+/* Write staging layer for the MSP432P401R                               */
+/*-----------------------------------------------------------------------*/
+/* SD cards stop answering for hundreds of milliseconds now and then     */
+/* while they clean up their flash. When a card is still busy after      */
+/* ST_BUSY_US, disk_write() appends the sectors to a log in the on-chip  */
+/* flash and returns, and disk_stage_poll() copies them to the card once */
+/* it is ready again. Requests queued with disk_submit() go to the card  */
+/* after the staged copies of their sectors. Staged sectors survive a    */
+/* reset and are copied when the same card is initialized again. The log */
+/* takes the 32KB below the mount records, which project_ccs.cmd keeps   */
+/* out of the FLASH region.                                              */
+/*-----------------------------------------------------------------------*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fatfs/src/diskio.h"
+#include "driverlib.h"
+#include "timebase.h"
+
+#if _USE_STAGE
+
+/* Flash region of the log (bank 1, sectors 23 to 30) */
+#define ST_FLASH_ADDR           0x00037000
+#define ST_FLASH_SECTORS        8
+#define ST_FLASH_BANK           FLASH_MAIN_MEMORY_SPACE_BANK1
+#define ST_FLASH_BANK_ADDR      0x00020000
+
+/* How long a write waits for a busy card before its sectors are staged */
+#define ST_BUSY_US              5000
+
+/* Number of physical drives that are staged */
+#define ST_NUM_DRIVES           2
+
+#define ST_MAGIC                0x47545353  /* "SSTG" */
+
+/* A log entry, which holds one sector. The magic word is programmed last,
+ * so an entry torn by a reset is never taken for a complete one. The done
+ * word is cleared by programming it to zero, which needs no erase, when the
+ * sector has been written to the card or a later entry replaces it. */
+typedef struct {
+    uint32_t magic;             /* ST_MAGIC if the entry is complete */
+    uint32_t done;              /* 0xFFFFFFFF:pending, 0:written or replaced */
+    uint32_t seq;               /* Staging order */
+    uint32_t sector;            /* Sector number on the drive */
+    uint32_t card;              /* Checksum of the CID of the card */
+    uint32_t pdrv;              /* Physical drive number */
+    uint32_t sum;               /* Checksum of seq to pdrv and of data */
+    uint32_t pad;               /* Keeps the size a multiple of 16 bytes */
+    BYTE data[512];             /* Sector data */
+} tEntry;
+
+/* Entries do not cross the 4KB flash sectors, so that each can be erased
+ * on its own */
+#define ST_PER_SECTOR           (4096 / sizeof(tEntry))
+#define ST_ENTRIES              (ST_FLASH_SECTORS * ST_PER_SECTOR)
+
+/* Entry being programmed (kept off the stack) */
+static
+tEntry g_sImage;
+
+/* Entries waiting to be written to the card, and their number per drive.
+ * There is at most one pending entry for a sector. */
+static
+bool g_pbPending[ST_ENTRIES];
+
+static
+uint8_t g_pui8Count[ST_NUM_DRIVES];
+
+/* Drives initialized since the reset, and the CID checksum of their cards.
+ * Entries staged for another card stay pending but are left alone. */
+static
+bool g_pbReady[ST_NUM_DRIVES];
+
+static
+uint32_t g_pui32Card[ST_NUM_DRIVES];
+
+/* Drives found busy by the last write; the next one does not wait */
+static
+bool g_pbStalled[ST_NUM_DRIVES];
+
+static
+uint_fast16_t g_ui16Head;       /* Entry to program next */
+
+static
+uint32_t g_ui32Seq;             /* Sequence number of the next entry */
+
+static
+bool g_bScanned;                /* The log has been read after the reset */
+
+static
+WORD g_ui16Dropped;             /* Entries of other cards retired, see reclaim() */
+
+static
+uint32_t sum_bytes (uint32_t sum, const void *buf, uint_fast16_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len--)
+        sum = (sum << 5) + (sum >> 27) + *p++;
+    return sum;
+}
+
+static
+uint32_t sum_entry (const tEntry *e)
+{
+    return sum_bytes(sum_bytes(0, &e->seq, 4 * sizeof(uint32_t)),
+                     e->data, sizeof(e->data));
+}
+
+static
+const tEntry *entry (uint_fast16_t i)
+{
+    return (const tEntry *)(ST_FLASH_ADDR + i / ST_PER_SECTOR * 4096
+                            + i % ST_PER_SECTOR * sizeof(tEntry));
+}
+
+/* Write protection bit of the flash sector holding an entry */
+static
+uint32_t sector_mask (uint_fast16_t i)
+{
+    return FLASH_SECTOR0 << ((ST_FLASH_ADDR - ST_FLASH_BANK_ADDR) / 4096
+                             + i / ST_PER_SECTOR);
+}
+
+static
+bool entry_valid (const tEntry *e)
+{
+    return e->magic == ST_MAGIC && e->pdrv < ST_NUM_DRIVES
+        && e->sum == sum_entry(e);
+}
+
+/* Pending entry of the card now in its drive */
+static
+bool entry_live (uint_fast16_t i)
+{
+    return g_pbPending[i] && entry(i)->card == g_pui32Card[entry(i)->pdrv];
+}
+
+static
+bool entry_blank (const tEntry *e)
+{
+    const uint32_t *p = (const uint32_t *)e;
+    uint_fast16_t i;
+
+    for (i = 0; i < sizeof(tEntry) / 4; i++)
+        if (p[i] != 0xFFFFFFFF) return false;
+    return true;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Log Functions                                                         */
+/*-----------------------------------------------------------------------*/
+
+/* Retire an entry */
+static
+void mark_done (
+    uint_fast16_t i     /* Entry index */
+)
+{
+    static const uint32_t zero = 0;
+
+    if (g_pbPending[i]) {
+        g_pbPending[i] = false;
+        g_pui8Count[entry(i)->pdrv]--;
+    }
+    FlashCtl_unprotectSector(ST_FLASH_BANK, sector_mask(i));
+    FlashCtl_programMemory((void *)&zero, (void *)&entry(i)->done, sizeof(zero));
+    FlashCtl_protectSector(ST_FLASH_BANK, sector_mask(i));
+}
+
+/* Erase the flash sector starting at an entry, unless it is still in use */
+static
+bool erase_sector (
+    uint_fast16_t i     /* Index of the first entry in the sector */
+)
+{
+    uint_fast16_t n;
+    bool ok;
+
+    for (n = i; n < i + ST_PER_SECTOR; n++)
+        if (g_pbPending[n]) return false;
+
+    FlashCtl_unprotectSector(ST_FLASH_BANK, sector_mask(i));
+    ok = FlashCtl_eraseSector((uint32_t)(uintptr_t)entry(i));
+    FlashCtl_protectSector(ST_FLASH_BANK, sector_mask(i));
+    return ok;
+}
+
+/* Find a blank entry from the head on. Flash sectors that still hold
+ * pending entries are skipped. Returns -1 when the log is full. */
+static
+int_fast16_t alloc_entry (void)
+{
+    uint_fast16_t n, i;
+
+    for (n = 0; n < ST_ENTRIES + ST_PER_SECTOR; n++) {
+        i = g_ui16Head;
+        g_ui16Head = (i + 1) % ST_ENTRIES;
+        if (i % ST_PER_SECTOR == 0 && !entry_blank(entry(i))
+            && !erase_sector(i)) {
+            g_ui16Head = (i + ST_PER_SECTOR) % ST_ENTRIES;
+            continue;
+        }
+        if (entry_blank(entry(i))) return i;    /* Torn entries are skipped */
+    }
+    return -1;
+}
+
+/* Retire the entries staged for cards other than the ones in the drives,
+ * to make room when the log is full. They are counted for
+ * disk_stage_dropped(). Returns true if any was retired. */
+static
+bool reclaim (void)
+{
+    uint_fast16_t i;
+    bool any = false;
+
+    for (i = 0; i < ST_ENTRIES; i++) {
+        if (g_pbPending[i] && g_pbReady[entry(i)->pdrv] && !entry_live(i)) {
+            mark_done(i);
+            g_ui16Dropped++;
+            any = true;
+        }
+    }
+    return any;
+}
+
+/* Pending entry of the card in a drive for a sector, or -1 */
+static
+int_fast16_t find_staged (
+    BYTE pdrv,          /* Physical drive number */
+    DWORD sector        /* Sector number */
+)
+{
+    uint_fast16_t i;
+
+    for (i = 0; i < ST_ENTRIES; i++) {
+        if (entry_live(i) && entry(i)->sector == sector
+            && entry(i)->pdrv == pdrv)
+            return i;
+    }
+    return -1;
+}
+
+/* Oldest pending entry of the card in a drive in a range of sectors, or
+ * -1 */
+static
+int_fast16_t oldest (
+    BYTE pdrv,          /* Physical drive number */
+    DWORD sector,       /* Start of the range */
+    DWORD count         /* Number of sectors in the range */
+)
+{
+    int_fast16_t i, sel = -1;
+
+    for (i = 0; i < ST_ENTRIES; i++) {
+        if (!entry_live(i) || entry(i)->pdrv != pdrv
+            || entry(i)->sector - sector >= count)
+            continue;
+        if (sel < 0 || entry(i)->seq < entry(sel)->seq) sel = i;
+    }
+    return sel;
+}
+
+/* Program a sector into the log, replacing an older copy */
+static
+bool stage_sector (
+    BYTE pdrv,          /* Physical drive number */
+    const BYTE *buff,   /* Sector data */
+    DWORD sector        /* Sector number */
+)
+{
+    static const uint32_t magic = ST_MAGIC;
+    int_fast16_t i, old;
+    bool ok;
+
+    old = find_staged(pdrv, sector);
+    i = alloc_entry();
+    if (i < 0 && reclaim()) i = alloc_entry();
+    if (i < 0) return false;
+
+    memset(&g_sImage, 0xFF, 8 * sizeof(uint32_t));
+    g_sImage.seq = g_ui32Seq++;
+    g_sImage.sector = sector;
+    g_sImage.card = g_pui32Card[pdrv];
+    g_sImage.pdrv = pdrv;
+    memcpy(g_sImage.data, buff, sizeof(g_sImage.data));
+    g_sImage.sum = sum_entry(&g_sImage);
+
+    FlashCtl_unprotectSector(ST_FLASH_BANK, sector_mask(i));
+    ok = FlashCtl_programMemory(&g_sImage, (void *)entry(i), sizeof(tEntry))
+        && FlashCtl_programMemory((void *)&magic, (void *)&entry(i)->magic,
+                                  sizeof(magic));
+    FlashCtl_protectSector(ST_FLASH_BANK, sector_mask(i));
+    if (!ok) return false;
+
+    g_pbPending[i] = true;
+    g_pui8Count[pdrv]++;
+    if (old >= 0) mark_done(old);
+    return true;
+}
+
+/* Write a pending entry to the card and retire it */
+static
+DRESULT drain_entry (
+    uint_fast16_t i     /* Entry index */
+)
+{
+    DRESULT res;
+
+    res = mmc_disk_write(entry(i)->pdrv, entry(i)->data, entry(i)->sector, 1);
+    if (res == RES_OK) mark_done(i);
+    return res;
+}
+
+/* Read the log after a reset. Of two pending entries for the same sector
+ * of a card, which a reset between staging the second and retiring the
+ * first leaves, the older one is retired. */
+static
+void scan_log (void)
+{
+    uint_fast16_t i, j;
+    uint32_t last = 0;
+
+    for (i = 0; i < ST_ENTRIES; i++) {
+        if (!entry_valid(entry(i))) continue;
+        if (entry(i)->seq >= last) {
+            last = entry(i)->seq + 1;
+            g_ui16Head = (i + 1) % ST_ENTRIES;
+        }
+        if (entry(i)->done) {
+            g_pbPending[i] = true;
+            g_pui8Count[entry(i)->pdrv]++;
+        }
+    }
+    g_ui32Seq = last;
+
+    for (i = 0; i < ST_ENTRIES; i++) {
+        for (j = 0; g_pbPending[i] && j < ST_ENTRIES; j++) {
+            if (g_pbPending[j] && entry(j)->pdrv == entry(i)->pdrv
+                && entry(j)->card == entry(i)->card
+                && entry(j)->sector == entry(i)->sector
+                && entry(j)->seq < entry(i)->seq)
+                mark_done(j);
+        }
+    }
+    g_bScanned = true;
+}
+
+/* Wait up to us microseconds for a card to finish programming */
+static
+bool card_ready (
+    BYTE pdrv,          /* Physical drive number */
+    uint32_t us         /* Time to wait, 0 to check once */
+)
+{
+    uint64_t end = tb_Deadline(us);
+    BYTE busy;
+
+    do {
+        if (mmc_disk_ioctl(pdrv, MMC_GET_BUSY, &busy) != RES_OK || !busy)
+            return true;    /* Errors are left to the request that follows */
+    } while (!tb_Expired(end));
+    return false;
+}
+
+
+
+/*--------------------------------------------------------------------------
+
+   Public Functions
+
+---------------------------------------------------------------------------*/
+
+
+/*-----------------------------------------------------------------------*/
+/* Initialize Disk Drive                                                 */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize (
+    BYTE pdrv           /* Physical drive number */
+)
+{
+    DSTATUS stat;
+    BYTE cid[16];
+
+    if (!g_bScanned) scan_log();
+
+    stat = mmc_disk_initialize(pdrv);
+    if (pdrv >= ST_NUM_DRIVES) return stat;
+
+    g_pbReady[pdrv] = false;
+    if ((stat & STA_NOINIT) || mmc_disk_ioctl(pdrv, MMC_GET_CID, cid) != RES_OK)
+        return stat;
+    /* Sectors staged for another card are neither read nor written from
+     * now on, but kept for when that card comes back */
+    g_pui32Card[pdrv] = sum_bytes(0, cid, sizeof(cid));
+    g_pbReady[pdrv] = true;
+    return stat;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Disk Status                                                       */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_status (
+    BYTE pdrv           /* Physical drive number */
+)
+{
+    return mmc_disk_status(pdrv);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+/* Staged sectors are read from the log. The card is not read at all if  */
+/* every sector asked for is staged.                                     */
+
+DRESULT disk_read (
+    BYTE pdrv,          /* Physical drive number */
+    BYTE *buff,         /* Pointer to the data buffer to store read data */
+    DWORD sector,       /* Start sector number (LBA) */
+    BYTE count          /* Sector count (1..255) */
+)
+{
+    DRESULT res;
+    int_fast16_t i;
+    BYTE n, staged;
+
+    if (pdrv >= ST_NUM_DRIVES || !g_pui8Count[pdrv])
+        return mmc_disk_read(pdrv, buff, sector, count);
+
+    for (n = staged = 0; n < count; n++)
+        if (find_staged(pdrv, sector + n) >= 0) staged++;
+    if (staged < count) {
+        res = mmc_disk_read(pdrv, buff, sector, count);
+        if (res != RES_OK) return res;
+    }
+    for (n = 0; staged && n < count; n++) {
+        i = find_staged(pdrv, sector + n);
+        if (i >= 0) {
+            memcpy(buff + n * 512, entry(i)->data, 512);
+            staged--;
+        }
+    }
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+/* Sectors go to the log when the card is still busy after ST_BUSY_US,   */
+/* and to the card once the log is full. A staged copy of a sector that  */
+/* is written to the card is written before it, so that a reset never    */
+/* leaves an older copy in the log to be written over the newer one.     */
+
+#if _READONLY == 0
+DRESULT disk_write (
+    BYTE pdrv,          /* Physical drive number */
+    const BYTE *buff,   /* Pointer to the data to be written */
+    DWORD sector,       /* Start sector number (LBA) */
+    BYTE count          /* Sector count (1..255) */
+)
+{
+    DRESULT res;
+    int_fast16_t i;
+    BYTE n;
+
+    if (pdrv >= ST_NUM_DRIVES)
+        return mmc_disk_write(pdrv, buff, sector, count);
+
+    if (g_pbReady[pdrv]) {
+        if (card_ready(pdrv, g_pbStalled[pdrv] ? 0 : ST_BUSY_US)) {
+            g_pbStalled[pdrv] = false;
+            /* Catch up with the log by a sector on every write */
+            i = oldest(pdrv, 0, 0xFFFFFFFF);
+            if (i >= 0 && (res = drain_entry(i)) != RES_OK) return res;
+        } else {
+            g_pbStalled[pdrv] = true;
+            for (n = 0; n < count && stage_sector(pdrv, buff, sector); n++) {
+                buff += 512;
+                sector++;
+            }
+            if (n == count) return RES_OK;
+            count -= n;         /* The log is full, wait for the card */
+        }
+    }
+
+    while ((i = oldest(pdrv, sector, count)) >= 0) {
+        res = drain_entry(i);
+        if (res != RES_OK) return res;
+    }
+    return mmc_disk_write(pdrv, buff, sector, count);
+}
+#endif /* _READONLY */
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+/*-----------------------------------------------------------------------*/
+/* CTRL_SYNC does not wait for a card that stays busy for longer than    */
+/* ST_BUSY_US. What was staged is safe in the log by then; only the last */
+/* sectors written to the card directly may still be programming.        */
+
+DRESULT disk_ioctl (
+    BYTE pdrv,          /* Physical drive number */
+    BYTE ctrl,          /* Control code */
+    void *buff          /* Buffer to send/receive control data */
+)
+{
+    DWORD *rt = buff;
+    int_fast16_t i;
+
+    if (pdrv < ST_NUM_DRIVES && g_pbReady[pdrv]) {
+        switch (ctrl) {
+        case CTRL_SYNC :
+            if (!card_ready(pdrv, g_pbStalled[pdrv] ? 0 : ST_BUSY_US))
+                return RES_OK;
+            break;
+
+        case CTRL_ERASE_SECTOR :    /* Staged copies of the sectors are stale */
+            while ((i = oldest(pdrv, rt[0], rt[1] - rt[0] + 1)) >= 0)
+                mark_done(i);
+            break;
+        }
+    }
+    return mmc_disk_ioctl(pdrv, ctrl, buff);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Queue a Request                                                       */
+/*-----------------------------------------------------------------------*/
+/* Staged copies of the sectors of the request are written to the card   */
+/* first, waiting for it if it is busy, so that the card holds the       */
+/* latest data when the request is served. The card driver keeps the     */
+/* order of the requests for the same sectors from there on.             */
+
+DRESULT disk_submit (
+    DREQ *req           /* Request, set up except for next, busy and res */
+)
+{
+    int_fast16_t i;
+
+    if (req->pdrv < ST_NUM_DRIVES && g_pbReady[req->pdrv]) {
+        while ((i = oldest(req->pdrv, req->sector, req->count)) >= 0) {
+            if (drain_entry(i) != RES_OK)
+                return RES_ERROR;   /* Not RES_NOTRDY, which means the queue is full */
+        }
+    }
+    return mmc_disk_submit(req);
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Advance the Request Queue                                             */
+/*-----------------------------------------------------------------------*/
+
+BYTE disk_poll (void)
+{
+    return mmc_disk_poll();
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Copy Staged Sectors to the Cards                                      */
+/*-----------------------------------------------------------------------*/
+/* Writes at most one staged sector to each card that is not busy, and   */
+/* erases at most one flash sector of the log that nothing is pending in */
+/* any more, so that staging seldom has to wait for an erase. To be      */
+/* called when idle. Returns the number of staged sectors left,          */
+/* including those held for a card not initialized yet or for a card     */
+/* that has been replaced.                                               */
+
+BYTE disk_stage_poll (void)
+{
+    BYTE pdrv, left = 0;
+    int_fast16_t i;
+    uint_fast8_t n;
+
+    if (!g_bScanned) return 0;
+
+    for (pdrv = 0; pdrv < ST_NUM_DRIVES; pdrv++) {
+        if (g_pbReady[pdrv] && g_pui8Count[pdrv] && card_ready(pdrv, 0)) {
+            g_pbStalled[pdrv] = false;
+            i = oldest(pdrv, 0, 0xFFFFFFFF);
+            if (i >= 0 && drain_entry(i) != RES_OK)
+                g_pbReady[pdrv] = false;    /* Held until the next disk_initialize() */
+        }
+        left += g_pui8Count[pdrv];
+    }
+
+    /* Erase a flash sector that is no longer needed, in the order they are
+     * reused, but not the one being filled */
+    for (n = 0; n < ST_FLASH_SECTORS; n++) {
+        i = (g_ui16Head / ST_PER_SECTOR + n) % ST_FLASH_SECTORS * ST_PER_SECTOR;
+        if (g_ui16Head > i && g_ui16Head < i + ST_PER_SECTOR) continue;
+        if (!entry_blank(entry(i)) && erase_sector(i)) break;
+    }
+
+    return left;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Count Dropped Staged Sectors                                          */
+/*-----------------------------------------------------------------------*/
+/* Sectors staged for a card that has been replaced are given up when    */
+/* the log runs full. Returns how many were since the last call.         */
+
+WORD disk_stage_dropped (void)
+{
+    WORD n = g_ui16Dropped;
+
+    g_ui16Dropped = 0;
+    return n;
+}
+
+#endif /* _USE_STAGE */
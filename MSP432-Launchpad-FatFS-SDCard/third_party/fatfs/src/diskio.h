@@ -11,6 +11,8 @@ extern "C" {
 
 #define _USE_WRITE	1	/* 1: Enable disk_write function */
 #define _USE_IOCTL	1	/* 1: Enable disk_ioctl fucntion */
+#define _USE_STAGE	1	/* 1: Stage writes to a busy card in the on-chip flash */
+#define _USE_RAMDISK	1	/* 1: Serve physical drive RAMDISK_DRV from RAM */
 
 #include "integer.h"
 
@@ -37,7 +39,62 @@ DSTATUS disk_status (BYTE pdrv);
 DRESULT disk_read (BYTE pdrv, BYTE*buff, DWORD sector, BYTE count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, BYTE count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
-void	disk_timerproc (void);
+
+#if _USE_STAGE
+/* The disk_* functions above are the staging layer, which passes the
+/  requests on to the card driver under these names */
+DSTATUS mmc_disk_initialize (BYTE pdrv);
+DSTATUS mmc_disk_status (BYTE pdrv);
+DRESULT mmc_disk_read (BYTE pdrv, BYTE* buff, DWORD sector, BYTE count);
+DRESULT mmc_disk_write (BYTE pdrv, const BYTE* buff, DWORD sector, BYTE count);
+DRESULT mmc_disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
+
+BYTE	disk_stage_poll (void);
+WORD	disk_stage_dropped (void);
+#endif
+
+#if _USE_RAMDISK
+/* The card driver hands the requests for this drive to the RAM disk */
+#define RAMDISK_DRV	2
+
+DSTATUS ram_disk_initialize (void);
+DSTATUS ram_disk_status (void);
+DRESULT ram_disk_read (BYTE* buff, DWORD sector, BYTE count);
+DRESULT ram_disk_write (const BYTE* buff, DWORD sector, BYTE count);
+DRESULT ram_disk_ioctl (BYTE cmd, void* buff);
+#endif
+
+
+/*---------------------------------------*/
+/* Asynchronous block requests           */
+
+/* A request stays owned by the driver, together with its data buffer,
+/  from disk_submit() until its busy flag is cleared. The done callback,
+/  if any, is called from within disk_poll() at that point. With
+/  _USE_STAGE, disk_submit() first writes the sectors of the request that
+/  are staged to the card, and waits for it to do so. */
+typedef struct _DREQ {
+	struct _DREQ *next;			/* Link in the request queue (driver use) */
+	void (*done)(struct _DREQ *req);	/* Completion callback (0:none) */
+	BYTE*	buff;				/* Data buffer */
+	DWORD	sector;				/* Start sector number (LBA) */
+	BYTE	pdrv;				/* Physical drive number */
+	BYTE	op;					/* DREQ_READ or DREQ_WRITE */
+	BYTE	count;				/* Sector count (1..255) */
+	volatile BYTE busy;			/* 1:Queued, 0:Completed */
+	DRESULT	res;				/* Result of the request */
+} DREQ;
+
+#define DREQ_READ		0
+#define DREQ_WRITE		1
+
+DRESULT disk_submit (DREQ* req);
+BYTE	disk_poll (void);
+
+#if _USE_STAGE
+DRESULT mmc_disk_submit (DREQ* req);
+BYTE	mmc_disk_poll (void);
+#endif
 
 /* Disk Status Bits (DSTATUS) */
 #define STA_NOINIT		0x01	/* Drive not initialized */
@@ -66,6 +123,7 @@ void	disk_timerproc (void);
 #define MMC_GET_CID			12	/* Get CID */
 #define MMC_GET_OCR			13	/* Get OCR */
 #define MMC_GET_SDSTAT		14	/* Get SD status */
+#define MMC_GET_BUSY		15	/* Check if the card is busy programming, without waiting (1 byte) */
 
 /* ATA/CF specific ioctl command */
 #define ATA_GET_REV			20	/* Get F/W revision */
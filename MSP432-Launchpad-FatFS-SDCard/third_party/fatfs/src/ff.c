@@ -96,6 +96,7 @@
 / Jan 24,'13 R0.09b Added f_setlabel() and f_getlabel(). (_USE_LABEL = 1)
 /---------------------------------------------------------------------------*/
 
+#define	_FF_NO_TRACE		/* Calls within the module are not traced */
 #include "ff.h"			/* FatFs configurations and declarations */
 #include "diskio.h"		/* Declarations of low level disk I/O functions */
 
@@ -151,6 +152,39 @@ typedef struct {
 #endif
 
 
+/* Shared file buffer feature */
+#if _FS_BUFPOOL
+#if _FS_TINY
+#error _FS_BUFPOOL must be 0 on tiny cfg.
+#endif
+typedef struct {
+	BYTE	buf[_MAX_SS];	/* Sector buffer (**must be the first member**) */
+	FIL*	owner;			/* File object holding the buffer (NULL:free) */
+	DWORD	stamp;			/* Last access stamp for LRU replacement */
+	FATFS*	fs;				/* Volume of the cached sector */
+	WORD	id;				/* Mount ID of the volume */
+	BYTE	dirty;			/* The cached sector needs to be written back */
+	DWORD	sect;			/* Sector cached in the buffer */
+} FILBUF;
+#endif
+
+
+/* Cluster reservation feature */
+#if _FS_RESERVE
+#if _FS_READONLY
+#error _FS_RESERVE must be 0 on read-only cfg.
+#endif
+typedef struct {
+	FATFS*	fs;				/* Volume of the run (NULL:blank entry) */
+	WORD	id;				/* Mount ID of the volume */
+	FIL*	owner;			/* File object holding the run */
+	DWORD	next;			/* Next cluster of the run to be allocated */
+	DWORD	end;			/* End of the run (not included) */
+	DWORD	size;			/* Number of clusters to claim next time */
+} RSVRUN;
+#endif
+
+
 
 /* DBCS code ranges and SBCS extend char conversion table */
 
@@ -392,6 +426,40 @@ typedef struct {
 #define	MIN_FAT32	65526	/* Minimum number of clusters for FAT32 */
 
 
+/* Supported FAT sub-types */
+#if !_FS_FATTYPES || (_FS_FATTYPES & ~7)
+#error Wrong _FS_FATTYPES setting.
+#endif
+#define	_FAT12_EN	(_FS_FATTYPES & 1)
+#define	_FAT16_EN	(_FS_FATTYPES & 2)
+#define	_FAT32_EN	(_FS_FATTYPES & 4)
+#define	FAT_SUPPORTED(fmt)	(_FS_FATTYPES & (1 << ((fmt) - 1)))
+
+
+/* FAT sub-type of a volume, a constant when only one sub-type is supported */
+#if _FS_FATTYPES == 1
+#define	FS_TYPE(fs)	((void)(fs), FS_FAT12)
+#elif _FS_FATTYPES == 2
+#define	FS_TYPE(fs)	((void)(fs), FS_FAT16)
+#elif _FS_FATTYPES == 4
+#define	FS_TYPE(fs)	((void)(fs), FS_FAT32)
+#else
+#define	FS_TYPE(fs)	((fs)->fs_type)
+#endif
+
+
+/* Mount records are kept per physical drive */
+#if _FS_FASTMOUNT && _MULTI_PARTITION
+#error _FS_FASTMOUNT must be 0 on multiple partition cfg.
+#endif
+
+
+/* Bulk directory read is built on f_readdir */
+#if _USE_READDIRS && _FS_MINIMIZE >= 2
+#error _USE_READDIRS must be 0 when f_readdir is removed.
+#endif
+
+
 /* FatFs refers the members in the FAT structures as byte array instead of
 / structure member because the structure is not binary compatible between
 / different platforms */
@@ -485,6 +553,18 @@ static
 FILESEM	Files[_FS_LOCK];	/* File lock semaphores */
 #endif
 
+#if _FS_BUFPOOL
+static
+FILBUF	Bufs[_FS_BUFPOOL];	/* Shared file buffers */
+static
+DWORD	BufStamp;			/* Access counter for LRU replacement of the file buffers */
+#endif
+
+#if _FS_RESERVE
+static
+RSVRUN	Rsvs[_FS_RSVFILES];	/* Cluster runs claimed by the files being written */
+#endif
+
 #if _USE_LFN == 0			/* No LFN feature */
 #define	DEF_NAMEBUF			BYTE sfn[12]
 #define INIT_BUF(dobj)		(dobj).fn = sfn
@@ -722,6 +802,106 @@ void clear_lock (	/* Clear lock entries of the volume */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Shared file buffer control functions                                  */
+/*-----------------------------------------------------------------------*/
+#if _FS_BUFPOOL
+
+static
+FRESULT lock_fbuf (	/* Make sure the file object holds a sector buffer */
+	FIL* fp			/* File object which needs its buffer */
+)
+{
+	UINT i, v;
+	FILBUF *b;
+
+
+	b = (FILBUF*)fp->buf;
+	if (b && b->owner == fp) {			/* Still holding the buffer */
+		b->stamp = ++BufStamp;
+		return FR_OK;
+	}
+#if !_FS_READONLY
+	fp->flag &= ~FA__DIRTY;				/* Written back by the file that took the buffer over */
+#endif
+
+	/* Pick a free buffer, or the least recently used one preferring clean ones */
+	for (i = 0, v = _FS_BUFPOOL; i < _FS_BUFPOOL; i++) {
+		if (!Bufs[i].owner) {			/* Free buffer */
+			v = i; break;
+		}
+		if (v == _FS_BUFPOOL || Bufs[i].dirty < Bufs[v].dirty ||
+			(Bufs[i].dirty == Bufs[v].dirty && BufStamp - Bufs[i].stamp > BufStamp - Bufs[v].stamp))
+			v = i;
+	}
+	b = &Bufs[v];
+
+	/* Write-back the sector cached for the current holder. The pool entry
+	   tells what it is, as the holder may be gone without f_close. */
+	if (b->owner && b->dirty && b->fs->fs_type && b->fs->id == b->id) {
+		if (disk_write(b->fs->drv, b->buf, b->sect, 1) != RES_OK)
+			return FR_DISK_ERR;			/* Leave it with the holder */
+	}
+
+	b->owner = fp;						/* Take over the buffer */
+	b->stamp = ++BufStamp;
+	b->dirty = 0;
+	fp->buf = b->buf;
+
+	if (fp->dsect) {					/* The buffer was taken by another file */
+		if (fp->fptr % SS(fp->fs)) {	/* Reload the current sector if in middle of the sector */
+			if (disk_read(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK) {
+				b->owner = 0; fp->buf = 0;
+				return FR_DISK_ERR;
+			}
+		} else {						/* Else it will be loaded on demand */
+			fp->dsect = 0;
+		}
+	}
+
+	return FR_OK;
+}
+
+
+#if !_FS_READONLY
+static
+void mark_fbuf (	/* Record the state of the sector buffer in its pool entry */
+	FIL* fp			/* File object after its dirty flag has been changed */
+)
+{
+	FILBUF *b = (FILBUF*)fp->buf;
+
+
+	if (b && b->owner == fp) {
+		b->fs = fp->fs; b->id = fp->id;
+		b->sect = fp->dsect;
+		b->dirty = (fp->flag & FA__DIRTY) ? 1 : 0;
+	}
+}
+#endif
+
+
+static
+void free_fbuf (	/* Release the sector buffer held by the file object */
+	FIL* fp			/* File object (its buf member can be uninitialized) */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_BUFPOOL; i++) {
+		if (Bufs[i].owner == fp) {
+			Bufs[i].owner = 0; Bufs[i].dirty = 0;
+		}
+	}
+	fp->buf = 0;
+}
+#else
+#define	mark_fbuf(fp)
+#endif
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Move/Flush disk access window                                         */
 /*-----------------------------------------------------------------------*/
@@ -791,7 +971,7 @@ FRESULT sync_fs (	/* FR_OK: successful, FR_DISK_ERR: failed */
 	res = sync_window(fs);
 	if (res == FR_OK) {
 		/* Update FSInfo sector if needed */
-		if (fs->fs_type == FS_FAT32 && fs->fsi_flag) {
+		if (FS_TYPE(fs) == FS_FAT32 && fs->fsi_flag) {
 			fs->winsect = 0;
 			/* Create FSInfo structure */
 			mem_set(fs->win, 0, 512);
@@ -844,14 +1024,19 @@ DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster status
 	DWORD clst	/* Cluster# to get the link information */
 )
 {
+#if _FAT12_EN
 	UINT wc, bc;
+#endif
+#if _FAT16_EN || _FAT32_EN
 	BYTE *p;
+#endif
 
 
 	if (clst < 2 || clst >= fs->n_fatent)	/* Check range */
 		return 1;
 
-	switch (fs->fs_type) {
+	switch (FS_TYPE(fs)) {
+#if _FAT12_EN
 	case FS_FAT12 :
 		bc = (UINT)clst; bc += bc / 2;
 		if (move_window(fs, fs->fatbase + (bc / SS(fs)))) break;
@@ -859,16 +1044,19 @@ DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster status
 		if (move_window(fs, fs->fatbase + (bc / SS(fs)))) break;
 		wc |= fs->win[bc % SS(fs)] << 8;
 		return (clst & 1) ? (wc >> 4) : (wc & 0xFFF);
-
+#endif
+#if _FAT16_EN
 	case FS_FAT16 :
 		if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)))) break;
 		p = &fs->win[clst * 2 % SS(fs)];
 		return LD_WORD(p);
-
+#endif
+#if _FAT32_EN
 	case FS_FAT32 :
 		if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)))) break;
 		p = &fs->win[clst * 4 % SS(fs)];
 		return LD_DWORD(p) & 0x0FFFFFFF;
+#endif
 	}
 
 	return 0xFFFFFFFF;	/* An error occurred at the disk I/O layer */
@@ -888,7 +1076,9 @@ FRESULT put_fat (
 	DWORD val	/* New value to mark the cluster */
 )
 {
+#if _FAT12_EN
 	UINT bc;
+#endif
 	BYTE *p;
 	FRESULT res;
 
@@ -897,7 +1087,8 @@ FRESULT put_fat (
 		res = FR_INT_ERR;
 
 	} else {
-		switch (fs->fs_type) {
+		switch (FS_TYPE(fs)) {
+#if _FAT12_EN
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;
 			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
@@ -911,14 +1102,16 @@ FRESULT put_fat (
 			p = &fs->win[bc % SS(fs)];
 			*p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));
 			break;
-
+#endif
+#if _FAT16_EN
 		case FS_FAT16 :
 			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)));
 			if (res != FR_OK) break;
 			p = &fs->win[clst * 2 % SS(fs)];
 			ST_WORD(p, (WORD)val);
 			break;
-
+#endif
+#if _FAT32_EN
 		case FS_FAT32 :
 			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)));
 			if (res != FR_OK) break;
@@ -926,6 +1119,7 @@ FRESULT put_fat (
 			val |= LD_DWORD(p) & 0xF0000000;
 			ST_DWORD(p, val);
 			break;
+#endif
 
 		default :
 			res = FR_INT_ERR;
@@ -940,6 +1134,149 @@ FRESULT put_fat (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Erase control - Erase the erase blocks wholly in a sector range       */
+/*-----------------------------------------------------------------------*/
+#if _USE_ERASE && !_FS_READONLY
+static
+void erase_area (
+	FATFS *fs,		/* File system object */
+	DWORD sect,		/* Start sector */
+	DWORD esect		/* End sector (not included) */
+)
+{
+	DWORD rt[2];
+
+
+	if (fs->au_size) {	/* Erasing part of an erase block makes the card move the rest */
+		sect = (sect + fs->au_size - 1) & ~(fs->au_size - 1);
+		esect &= ~(fs->au_size - 1);
+	}
+	if (sect < esect) {
+		rt[0] = sect; rt[1] = esect - 1;
+		disk_ioctl(fs->drv, CTRL_ERASE_SECTOR, rt);
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Erase control - Erase free clusters ahead of a growing file           */
+/*-----------------------------------------------------------------------*/
+/* Erases the erase block that a newly allocated cluster starts, when   */
+/* every other cluster in it is free. A sequential write then fills a    */
+/* block that needs no garbage collection in the card. A cluster in the  */
+/* middle of a block erases nothing, as erasing part of a block makes    */
+/* the card copy the rest, and a block is erased once as it is entered.  */
+
+static
+void pre_erase (
+	FATFS *fs,		/* File system object */
+	DWORD clst		/* Cluster just added to the file */
+)
+{
+	DWORD sect, n, cl;
+
+
+	if (!fs->au_size) return;
+	sect = clust2sect(fs, clst);
+	if (sect & (fs->au_size - 1)) return;	/* Not at the top of an erase block */
+	n = fs->au_size / fs->csize;			/* Clusters in the block */
+	if (n > fs->n_fatent - clst) return;	/* Block runs past the end of the volume */
+	for (cl = clst + 1; cl < clst + n; cl++) {	/* The other clusters must be free */
+		if (get_fat(fs, cl) != 0) return;
+	}
+	erase_area(fs, sect, sect + fs->au_size);
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Cluster reservation control functions                                 */
+/*-----------------------------------------------------------------------*/
+#if _FS_RESERVE
+
+static
+RSVRUN* rsv_hit (	/* Run holding the cluster (NULL:not claimed) */
+	FATFS* fs,		/* File system object */
+	DWORD clst		/* Cluster# to check */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_RSVFILES; i++) {
+		if (Rsvs[i].fs == fs && Rsvs[i].id == fs->id &&
+			clst >= Rsvs[i].next && clst < Rsvs[i].end) return &Rsvs[i];
+	}
+	return 0;
+}
+
+
+static
+void rsv_clear (	/* Drop the runs claimed on the volume */
+	FATFS* fs		/* File system object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_RSVFILES; i++) {
+		if (Rsvs[i].fs == fs) Rsvs[i].fs = 0;
+	}
+}
+
+
+static
+void free_rsv (		/* Drop the run claimed by the file object */
+	FIL* fp			/* File object (its members can be uninitialized) */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_RSVFILES; i++) {
+		if (Rsvs[i].owner == fp) {
+			Rsvs[i].fs = 0; Rsvs[i].owner = 0;
+		}
+	}
+}
+
+
+#if _USE_DEFRAG
+static
+void rsv_claim (	/* Claim a run for the file object in its entry or a blank one (no entry left:not claimed) */
+	FATFS* fs,		/* File system object */
+	FIL* fp,		/* File object to hold the run */
+	DWORD clst,		/* First cluster of the run */
+	DWORD n			/* Number of clusters in the run */
+)
+{
+	RSVRUN *r = 0;
+	UINT i;
+
+
+	for (i = 0; i < _FS_RSVFILES; i++) {
+		if (Rsvs[i].owner == fp) { r = &Rsvs[i]; break; }
+		if (!r && (!Rsvs[i].fs || !Rsvs[i].fs->fs_type || Rsvs[i].fs->id != Rsvs[i].id)) r = &Rsvs[i];
+	}
+	if (!r) return;
+	r->fs = fs; r->id = fs->id; r->owner = fp;
+	r->next = clst; r->end = clst + n;
+	r->size = _FS_RESERVE;
+}
+#endif
+#else
+#define	rsv_hit(fs, clst)	0
+#define	rsv_claim(fs, fp, clst, n)
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
 /*-----------------------------------------------------------------------*/
@@ -953,7 +1290,7 @@ FRESULT remove_chain (
 	FRESULT res;
 	DWORD nxt;
 #if _USE_ERASE
-	DWORD scl = clst, ecl = clst, rt[2];
+	DWORD scl = clst, ecl = clst;
 #endif
 
 	if (clst < 2 || clst >= fs->n_fatent) {	/* Check range */
@@ -972,13 +1309,16 @@ FRESULT remove_chain (
 				fs->free_clust++;
 				fs->fsi_flag = 1;
 			}
+#if _FS_SCANFREE
+			else if (clst < fs->scan_clst) {	/* Update count of the scanned part */
+				fs->scan_free++;
+			}
+#endif
 #if _USE_ERASE
 			if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
 				ecl = nxt;
 			} else {				/* End of contiguous clusters */ 
-				rt[0] = clust2sect(fs, scl);					/* Start sector */
-				rt[1] = clust2sect(fs, ecl) + fs->csize - 1;	/* End sector */
-				disk_ioctl(fs->drv, CTRL_ERASE_SECTOR, rt);		/* Erase the block */
+				erase_area(fs, clust2sect(fs, scl), clust2sect(fs, ecl) + fs->csize);	/* Erase the blocks */
 				scl = ecl = nxt;
 			}
 #endif
@@ -994,43 +1334,112 @@ FRESULT remove_chain (
 
 
 /*-----------------------------------------------------------------------*/
-/* FAT handling - Stretch or Create a cluster chain                      */
+/* FAT handling - Find a free cluster on FAT32-only configuration        */
 /*-----------------------------------------------------------------------*/
-#if !_FS_READONLY
+#if !_FS_READONLY && _FS_FATTYPES == 4
 static
-DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+DWORD find_free32 (	/* 0:No free cluster, 0xFFFFFFFF:Disk error, >=2:Free cluster# */
 	FATFS *fs,			/* File system object */
-	DWORD clst			/* Cluster# to stretch. 0 means create a new chain. */
+	DWORD scl			/* Cluster# to start the search after */
 )
 {
-	DWORD cs, ncl, scl;
-	FRESULT res;
-
+	DWORD ncl = scl;
+	UINT i;
+	BYTE *p;
 
-	if (clst == 0) {		/* Create a new chain */
-		scl = fs->last_clust;			/* Get suggested start point */
-		if (!scl || scl >= fs->n_fatent) scl = 1;
-	}
-	else {					/* Stretch the current chain */
-		cs = get_fat(fs, clst);			/* Check the cluster status */
-		if (cs < 2) return 1;			/* It is an invalid cluster */
-		if (cs < fs->n_fatent) return cs;	/* It is already followed by next cluster */
-		scl = clst;
-	}
 
-	ncl = scl;				/* Start cluster */
 	for (;;) {
 		ncl++;							/* Next cluster */
 		if (ncl >= fs->n_fatent) {		/* Wrap around */
 			ncl = 2;
 			if (ncl > scl) return 0;	/* No free cluster */
 		}
-		cs = get_fat(fs, ncl);			/* Get the cluster status */
-		if (cs == 0) break;				/* Found a free cluster */
-		if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
-			return cs;
-		if (ncl == scl) return 0;		/* No free cluster */
+		if (move_window(fs, fs->fatbase + ncl / (SS(fs) / 4)))
+			return 0xFFFFFFFF;
+		i = (UINT)(ncl % (SS(fs) / 4));	/* Scan the rest of the FAT sector in the window */
+		p = &fs->win[i * 4];
+		for (;;) {
+			if ((LD_DWORD(p) & 0x0FFFFFFF) == 0) return ncl;	/* Found a free cluster */
+			if (ncl == scl) return 0;	/* No free cluster */
+			if (++i >= SS(fs) / 4 || ncl + 1 >= fs->n_fatent) break;
+			ncl++; p += 4;
+		}
 	}
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Find a free cluster outside the claimed runs           */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY
+static
+DWORD find_clust (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Free cluster# */
+	FATFS *fs,			/* File system object */
+	DWORD scl			/* Cluster# to start the search after */
+)
+{
+	DWORD ncl;
+#if _FS_FATTYPES != 4
+	DWORD cs;
+#endif
+#if _FS_RESERVE
+	RSVRUN *r;
+	UINT n = 0;
+
+
+	for (;;) {
+#endif
+#if _FS_FATTYPES == 4
+		ncl = find_free32(fs, scl);		/* Scan the FAT for a free cluster */
+		if (ncl == 0 || ncl == 0xFFFFFFFF) return ncl;
+#else
+		ncl = scl;				/* Start cluster */
+		for (;;) {
+			ncl++;							/* Next cluster */
+			if (ncl >= fs->n_fatent) {		/* Wrap around */
+				ncl = 2;
+				if (ncl > scl) return 0;	/* No free cluster */
+			}
+			cs = get_fat(fs, ncl);			/* Get the cluster status */
+			if (cs == 0) break;				/* Found a free cluster */
+			if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
+				return cs;
+			if (ncl == scl) return 0;		/* No free cluster */
+		}
+#endif
+#if _FS_RESERVE
+		r = rsv_hit(fs, ncl);
+		if (!r) break;					/* Not claimed by a file */
+		if (++n > _FS_RSVFILES) {		/* Came round to a run again, only claimed clusters are left */
+			rsv_clear(fs);
+			break;
+		}
+		scl = r->end - 1;				/* Search on after the run */
+	}
+#endif
+
+	return ncl;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Link a free cluster to the end of a chain              */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD link_clust (	/* 1:Internal error, 0xFFFFFFFF:Disk error, >=2:The new cluster# */
+	FATFS *fs,			/* File system object */
+	DWORD clst,			/* Last cluster# of the chain. 0 means create a new chain. */
+	DWORD ncl			/* Free cluster# to be added */
+)
+{
+	FRESULT res;
+
 
 	res = put_fat(fs, ncl, 0x0FFFFFFF);	/* Mark the new cluster "last link" */
 	if (res == FR_OK && clst != 0) {
@@ -1042,16 +1451,127 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 			fs->free_clust--;
 			fs->fsi_flag = 1;
 		}
+#if _FS_SCANFREE
+		else if (ncl < fs->scan_clst) {	/* Update count of the scanned part */
+			fs->scan_free--;
+		}
+#endif
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
 	}
 
 	return ncl;		/* Return new cluster number or error code */
 }
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Stretch or Create a cluster chain                      */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+	FATFS *fs,			/* File system object */
+	DWORD clst			/* Cluster# to stretch. 0 means create a new chain. */
+)
+{
+	DWORD cs, ncl, scl;
+
+
+	if (clst == 0) {		/* Create a new chain */
+		scl = fs->last_clust;			/* Get suggested start point */
+		if (!scl || scl >= fs->n_fatent) scl = 1;
+	}
+	else {					/* Stretch the current chain */
+		cs = get_fat(fs, clst);			/* Check the cluster status */
+		if (cs < 2) return 1;			/* It is an invalid cluster */
+		if (cs < fs->n_fatent) return cs;	/* It is already followed by next cluster */
+		scl = clst;
+	}
+
+	ncl = find_clust(fs, scl);			/* Find a free cluster */
+	if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;
+
+	return link_clust(fs, clst, ncl);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Stretch or Create the cluster chain of a file          */
+/*-----------------------------------------------------------------------*/
+/* A file takes its new clusters from a run claimed ahead of it, so that */
+/* files written at the same time do not take turns cluster by cluster.  */
+/* The run is claimed after the last cluster of the file, and it doubles */
+/* in size on each claim up to 64 times the first one.                   */
+
+static
+DWORD create_fchain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:New cluster# */
+	FIL *fp,			/* File object */
+	DWORD clst			/* Cluster# to stretch. 0 means create a new chain. */
+)
+{
+#if _FS_RESERVE
+	FATFS *fs = fp->fs;
+	RSVRUN *r, *b = 0;
+	DWORD cs, ncl, size;
+	UINT i;
+
+
+	if (clst != 0) {		/* Stretch the current chain */
+		cs = get_fat(fs, clst);			/* Check the cluster status */
+		if (cs < 2) return 1;			/* It is an invalid cluster */
+		if (cs == 0xFFFFFFFF) return cs;	/* Disk error */
+		if (cs < fs->n_fatent) return cs;	/* It is already followed by next cluster */
+	}
+
+	for (i = 0; i < _FS_RSVFILES; i++) {	/* Find the run of the file, or a blank entry */
+		r = &Rsvs[i];
+		if (r->owner == fp && r->fs == fs && r->id == fs->id) break;
+		if (!b && (!r->fs || !r->fs->fs_type || r->fs->id != r->id)) b = r;
+	}
+	if (i == _FS_RSVFILES) {
+		if (!b) return create_chain(fs, clst);	/* No entry left, allocate as for a directory */
+		r = b;
+		r->next = r->end = 0;
+		r->size = _FS_RESERVE;
+	}
+	r->fs = fs; r->id = fs->id; r->owner = fp;
+
+	for (;;) {
+		if (r->next >= r->end) {		/* Claim a new run */
+			r->end = 0;
+			ncl = find_clust(fs, clst ? clst : ((fs->last_clust && fs->last_clust < fs->n_fatent) ? fs->last_clust : 1));
+			if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;
+			size = r->size;
+			r->fs = fs; r->id = fs->id; r->owner = fp;	/* The runs may have been dropped in the search */
+			r->next = ncl; r->end = ncl + 1;
+			while (r->end - r->next < size && r->end < fs->n_fatent && !rsv_hit(fs, r->end)) {
+				cs = get_fat(fs, r->end);
+				if (cs == 0xFFFFFFFF) return cs;
+				if (cs != 0) break;
+				r->end++;
+			}
+			if (size < (DWORD)_FS_RESERVE << 6) r->size = size * 2;	/* Claim more next time */
+		}
+		ncl = r->next++;
+		cs = get_fat(fs, ncl);			/* Make sure it is still free */
+		if (cs == 0) break;
+		if (cs == 0xFFFFFFFF) return cs;
+	}
+
+	return link_clust(fs, clst, ncl);
+#else
+	return create_chain(fp->fs, clst);
+#endif
+}
 #endif /* !_FS_READONLY */
 
 
 
+
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Convert offset into cluster with link map table        */
 /*-----------------------------------------------------------------------*/
@@ -1098,7 +1618,7 @@ FRESULT dir_sdi (
 	clst = dj->sclust;
 	if (clst == 1 || clst >= dj->fs->n_fatent)	/* Check start cluster range */
 		return FR_INT_ERR;
-	if (!clst && dj->fs->fs_type == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
+	if (!clst && FS_TYPE(dj->fs) == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
 		clst = dj->fs->dirbase;
 
 	if (clst == 0) {	/* Static table (root-dir in FAT12/16) */
@@ -1244,7 +1764,7 @@ DWORD ld_clust (
 	DWORD cl;
 
 	cl = LD_WORD(dir+DIR_FstClusLO);
-	if (fs->fs_type == FS_FAT32)
+	if (FS_TYPE(fs) == FS_FAT32)
 		cl |= (DWORD)LD_WORD(dir+DIR_FstClusHI) << 16;
 
 	return cl;
@@ -2059,6 +2579,139 @@ BYTE check_fs (	/* 0:FAT-VBR, 1:Any BR but not FAT, 2:Not a BR, 3:Disk error */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Get the cluster allocation information from FSInfo                    */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY
+static
+void load_fsinfo (
+	FATFS *fs,		/* File system object with fsi_sector set (FAT32) */
+	BYTE fmt		/* FAT sub-type of the volume */
+)
+{
+	fs->free_clust = 0xFFFFFFFF;
+	fs->last_clust = 0;
+	if (fmt == FS_FAT32) {
+	 	fs->fsi_flag = 0;
+		if (disk_read(fs->drv, fs->win, fs->fsi_sector, 1) == RES_OK &&
+			LD_WORD(fs->win+BS_55AA) == 0xAA55 &&
+			LD_DWORD(fs->win+FSI_LeadSig) == 0x41615252 &&
+			LD_DWORD(fs->win+FSI_StrucSig) == 0x61417272) {
+				fs->last_clust = LD_DWORD(fs->win+FSI_Nxt_Free);
+				fs->free_clust = LD_DWORD(fs->win+FSI_Free_Count);
+		}
+		if (fs->free_clust > fs->n_fatent - 2)	/* (Discard invalid free cluster count) */
+			fs->free_clust = 0xFFFFFFFF;
+	}
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Save and restore the mount record of a volume                         */
+/*-----------------------------------------------------------------------*/
+#if _FS_FASTMOUNT
+static
+DWORD sum_bpb (	/* Returns checksum of the BPB */
+	const BYTE *bs	/* Boot sector */
+)
+{
+	DWORD sum = 0;
+	UINT i;
+
+
+	for (i = BPB_BytsPerSec; i < BPB_FSInfo + 2; i++)
+		sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + bs[i];
+	return sum;
+}
+
+
+static
+int restore_fs (	/* 1:Restored from the mount record, 0:No valid record */
+	FATFS *fs		/* File system object with the physical drive initialized */
+)
+{
+	FMOUNT rec;
+	BYTE cid[16];
+
+
+	if (!ff_fmount_load(fs->drv, &rec) || !FAT_SUPPORTED(rec.fs_type))
+		return 0;
+	if (disk_ioctl(fs->drv, MMC_GET_CID, cid) != RES_OK || mem_cmp(cid, rec.cid, 16))
+		return 0;			/* Another card */
+	if (disk_read(fs->drv, fs->win, rec.volbase, 1) != RES_OK
+		|| LD_WORD(fs->win+BS_55AA) != 0xAA55
+		|| LD_WORD(fs->win+BPB_BytsPerSec) != SS(fs)
+		|| LD_DWORD(fs->win + (rec.fs_type == FS_FAT32 ? BS_VolID32 : BS_VolID)) != rec.volid
+		|| sum_bpb(fs->win) != rec.bpbsum)
+		return 0;			/* Volume has been re-formatted */
+
+	fs->csize = rec.csize;
+	fs->n_fats = rec.n_fats;
+	fs->n_rootdir = rec.n_rootdir;
+	fs->n_fatent = rec.n_fatent;
+	fs->fsize = rec.fsize;
+	fs->volbase = rec.volbase;
+	fs->fatbase = rec.fatbase;
+	fs->dirbase = rec.dirbase;
+	fs->database = rec.database;
+#if !_FS_READONLY
+	/* The free space is not kept in the record, as the card can be written
+	   elsewhere; FSInfo is read as on a full mount (FAT32) */
+	fs->fsi_flag = 0;
+	fs->fsi_sector = rec.fsi_sector;
+	load_fsinfo(fs, rec.fs_type);
+#if _USE_ERASE
+	fs->au_size = rec.au_size;
+#endif
+#if _FS_SCANFREE
+	fs->scan_clst = 0;
+#endif
+#endif
+	fs->fs_type = rec.fs_type;
+	return 1;
+}
+
+
+static
+void save_fs (
+	FATFS *fs		/* Mounted file system object */
+)
+{
+	FMOUNT rec;
+
+
+	mem_set(&rec, 0, sizeof(rec));
+	if (disk_ioctl(fs->drv, MMC_GET_CID, rec.cid) != RES_OK
+		|| move_window(fs, fs->volbase) != FR_OK)
+		return;
+	rec.volid = LD_DWORD(fs->win + (FS_TYPE(fs) == FS_FAT32 ? BS_VolID32 : BS_VolID));
+	rec.bpbsum = sum_bpb(fs->win);
+	rec.fs_type = fs->fs_type;
+	rec.csize = fs->csize;
+	rec.n_fats = fs->n_fats;
+	rec.n_rootdir = fs->n_rootdir;
+	rec.n_fatent = fs->n_fatent;
+	rec.fsize = fs->fsize;
+	rec.volbase = fs->volbase;
+	rec.fatbase = fs->fatbase;
+	rec.dirbase = fs->dirbase;
+	rec.database = fs->database;
+#if !_FS_READONLY
+	rec.fsi_sector = fs->fsi_sector;
+#if _USE_ERASE
+	rec.au_size = fs->au_size;
+#endif
+#endif
+	ff_fmount_save(fs->drv, &rec);
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Check if the file system object is valid or not                       */
 /*-----------------------------------------------------------------------*/
@@ -2123,6 +2776,21 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 #if _MAX_SS != 512						/* Get disk sector size (variable sector size cfg only) */
 	if (disk_ioctl(fs->drv, GET_SECTOR_SIZE, &fs->ssize) != RES_OK)
 		return FR_DISK_ERR;
+#endif
+#if _FS_FASTMOUNT
+	/* Restore the volume from its mount record if the record is still valid */
+	if (restore_fs(fs)) {
+		fs->id = ++Fsid;		/* File system mount ID */
+		fs->winsect = 0;		/* Invalidate sector cache */
+		fs->wflag = 0;
+#if _FS_RPATH
+		fs->cdir = 0;			/* Current directory (root dir) */
+#endif
+#if _FS_LOCK
+		clear_lock(fs);
+#endif
+		return FR_OK;
+	}
 #endif
 	/* Search FAT partition on the drive. Supports only generic partitions, FDISK and SFD. */
 	fmt = check_fs(fs, bsect = 0);		/* Load sector 0 and check if it is an FAT-VBR (in SFD) */
@@ -2173,6 +2841,7 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 	fmt = FS_FAT12;
 	if (nclst >= MIN_FAT16) fmt = FS_FAT16;
 	if (nclst >= MIN_FAT32) fmt = FS_FAT32;
+	if (!FAT_SUPPORTED(fmt)) return FR_NO_FILESYSTEM;	/* (Sub-type not supported) */
 
 	/* Boundaries and Limits */
 	fs->n_fatent = nclst + 2;							/* Number of FAT entries */
@@ -2193,22 +2862,20 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 		return FR_NO_FILESYSTEM;
 
 #if !_FS_READONLY
-	/* Initialize cluster allocation information */
-	fs->free_clust = 0xFFFFFFFF;
-	fs->last_clust = 0;
+#if _USE_ERASE
+	/* Get erase block size for the erase policy (power of 2 and larger than a cluster) */
+	if (disk_ioctl(fs->drv, GET_BLOCK_SIZE, &fs->au_size) != RES_OK
+		|| fs->au_size <= fs->csize || (fs->au_size & (fs->au_size - 1)))
+		fs->au_size = 0;
+#endif
 
-	/* Get fsinfo if available */
-	if (fmt == FS_FAT32) {
-	 	fs->fsi_flag = 0;
+	/* Initialize cluster allocation information, get fsinfo if available */
+	if (fmt == FS_FAT32)
 		fs->fsi_sector = bsect + LD_WORD(fs->win+BPB_FSInfo);
-		if (disk_read(fs->drv, fs->win, fs->fsi_sector, 1) == RES_OK &&
-			LD_WORD(fs->win+BS_55AA) == 0xAA55 &&
-			LD_DWORD(fs->win+FSI_LeadSig) == 0x41615252 &&
-			LD_DWORD(fs->win+FSI_StrucSig) == 0x61417272) {
-				fs->last_clust = LD_DWORD(fs->win+FSI_Nxt_Free);
-				fs->free_clust = LD_DWORD(fs->win+FSI_Free_Count);
-		}
-	}
+	load_fsinfo(fs, fmt);
+#if _FS_SCANFREE
+	fs->scan_clst = 0;
+#endif
 #endif
 	fs->fs_type = fmt;		/* FAT sub-type */
 	fs->id = ++Fsid;		/* File system mount ID */
@@ -2220,6 +2887,9 @@ FRESULT chk_mounted (	/* FR_OK(0): successful, !=0: any error occurred */
 #if _FS_LOCK				/* Clear file lock semaphores */
 	clear_lock(fs);
 #endif
+#if _FS_FASTMOUNT
+	save_fs(fs);			/* Save the mount record for the next mount */
+#endif
 
 	return FR_OK;
 }
@@ -2319,6 +2989,12 @@ FRESULT f_open (
 
 	if (!fp) return FR_INVALID_OBJECT;
 	fp->fs = 0;			/* Clear file object */
+#if _FS_BUFPOOL
+	free_fbuf(fp);		/* Release the buffer if it is still held */
+#endif
+#if _FS_RESERVE
+	free_rsv(fp);		/* Drop the cluster run if it is still claimed */
+#endif
 
 #if !_FS_READONLY
 	mode &= FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_OPEN_ALWAYS | FA_CREATE_NEW;
@@ -2446,7 +3122,7 @@ FRESULT f_read (
 {
 	FRESULT res;
 	DWORD clst, sect, remain;
-	UINT rcnt, cc;
+	UINT rcnt, cc, ncc;
 	BYTE csect, *rbuff = (BYTE*)buff;
 
 
@@ -2458,6 +3134,10 @@ FRESULT f_read (
 		LEAVE_FF(fp->fs, FR_INT_ERR);
 	if (!(fp->flag & FA_READ)) 					/* Check access mode */
 		LEAVE_FF(fp->fs, FR_DENIED);
+#if _FS_BUFPOOL
+	if (lock_fbuf(fp) != FR_OK)					/* Get the file buffer */
+		ABORT(fp->fs, FR_DISK_ERR);
+#endif
 	remain = fp->fsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
 
@@ -2485,8 +3165,15 @@ FRESULT f_read (
 			sect += csect;
 			cc = btr / SS(fp->fs);				/* When remaining bytes >= sector size, */
 			if (cc) {							/* Read maximum contiguous sectors directly */
-				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
+				if (csect + cc > fp->fs->csize) {	/* Clip at cluster boundary */
+					ncc = cc;
 					cc = fp->fs->csize - csect;
+					while (cc + fp->fs->csize <= ncc && cc + fp->fs->csize <= 255 &&
+						get_fat(fp->fs, fp->clust) == fp->clust + 1) {	/* but read on through following contiguous clusters */
+						fp->clust++;
+						cc += fp->fs->csize;
+					}
+				}
 				if (disk_read(fp->fs->drv, rbuff, sect, (BYTE)cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 #if !_FS_READONLY && _FS_MINIMIZE <= 2			/* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -2508,6 +3195,7 @@ FRESULT f_read (
 					if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
 						ABORT(fp->fs, FR_DISK_ERR);
 					fp->flag &= ~FA__DIRTY;
+					mark_fbuf(fp);
 				}
 #endif
 				if (disk_read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)	/* Fill sector cache */
@@ -2547,7 +3235,7 @@ FRESULT f_write (
 {
 	FRESULT res;
 	DWORD clst, sect;
-	UINT wcnt, cc;
+	UINT wcnt, cc, ncc;
 	const BYTE *wbuff = (const BYTE*)buff;
 	BYTE csect;
 
@@ -2560,6 +3248,10 @@ FRESULT f_write (
 		LEAVE_FF(fp->fs, FR_INT_ERR);
 	if (!(fp->flag & FA_WRITE))				/* Check access mode */
 		LEAVE_FF(fp->fs, FR_DENIED);
+#if _FS_BUFPOOL
+	if (lock_fbuf(fp) != FR_OK)				/* Get the file buffer */
+		ABORT(fp->fs, FR_DISK_ERR);
+#endif
 	if ((DWORD)(fp->fsize + btw) < fp->fsize) btw = 0;	/* File size cannot reach 4GB */
 
 	for ( ;  btw;							/* Repeat until all data written */
@@ -2570,19 +3262,23 @@ FRESULT f_write (
 				if (fp->fptr == 0) {		/* On the top of the file? */
 					clst = fp->sclust;		/* Follow from the origin */
 					if (clst == 0)			/* When no cluster is allocated, */
-						fp->sclust = clst = create_chain(fp->fs, 0);	/* Create a new cluster chain */
+						fp->sclust = clst = create_fchain(fp, 0);	/* Create a new cluster chain */
 				} else {					/* Middle or end of the file */
 #if _USE_FASTSEEK
 					if (fp->cltbl)
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					else
 #endif
-						clst = create_chain(fp->fs, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+						clst = create_fchain(fp, fp->clust);	/* Follow or stretch cluster chain on the FAT */
 				}
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
 				if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
 				if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 				fp->clust = clst;			/* Update current cluster */
+#if _USE_ERASE
+				if (fp->fptr >= fp->fsize && btw >= (UINT)SS(fp->fs))
+					pre_erase(fp->fs, clst);	/* Sector or larger write into a new cluster */
+#endif
 			}
 #if _FS_TINY
 			if (fp->fs->winsect == fp->dsect && sync_window(fp->fs))	/* Write-back sector cache */
@@ -2592,6 +3288,7 @@ FRESULT f_write (
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 				fp->flag &= ~FA__DIRTY;
+				mark_fbuf(fp);
 			}
 #endif
 			sect = clust2sect(fp->fs, fp->clust);	/* Get current sector */
@@ -2599,8 +3296,15 @@ FRESULT f_write (
 			sect += csect;
 			cc = btw / SS(fp->fs);			/* When remaining bytes >= sector size, */
 			if (cc) {						/* Write maximum contiguous sectors directly */
-				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
+				if (csect + cc > fp->fs->csize) {	/* Clip at cluster boundary */
+					ncc = cc;
 					cc = fp->fs->csize - csect;
+					while (cc + fp->fs->csize <= ncc && cc + fp->fs->csize <= 255 &&
+						get_fat(fp->fs, fp->clust) == fp->clust + 1) {	/* but write on through following contiguous clusters already allocated */
+						fp->clust++;
+						cc += fp->fs->csize;
+					}
+				}
 				if (disk_write(fp->fs->drv, wbuff, sect, (BYTE)cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 #if _FS_TINY
@@ -2612,6 +3316,7 @@ FRESULT f_write (
 				if (fp->dsect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
 					mem_cpy(fp->buf, wbuff + ((fp->dsect - sect) * SS(fp->fs)), SS(fp->fs));
 					fp->flag &= ~FA__DIRTY;
+					mark_fbuf(fp);
 				}
 #endif
 				wcnt = SS(fp->fs) * cc;		/* Number of bytes transferred */
@@ -2641,6 +3346,7 @@ FRESULT f_write (
 #else
 		mem_cpy(&fp->buf[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
 		fp->flag |= FA__DIRTY;
+		mark_fbuf(fp);
 #endif
 	}
 
@@ -2670,10 +3376,15 @@ FRESULT f_sync (
 	if (res == FR_OK) {
 		if (fp->flag & FA__WRITTEN) {	/* Has the file been written? */
 #if !_FS_TINY	/* Write-back dirty buffer */
+#if _FS_BUFPOOL
+			if (!fp->buf || ((FILBUF*)fp->buf)->owner != fp)
+				fp->flag &= ~FA__DIRTY;	/* Written back by the file that took the buffer over */
+#endif
 			if (fp->flag & FA__DIRTY) {
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
 					LEAVE_FF(fp->fs, FR_DISK_ERR);
 				fp->flag &= ~FA__DIRTY;
+				mark_fbuf(fp);
 			}
 #endif
 			/* Update the directory entry */
@@ -2718,7 +3429,12 @@ FRESULT f_close (
 #if _FS_REENTRANT
 		FATFS *fs = fp->fs;
 #endif
-		if (res == FR_OK) fp->fs = 0;	/* Discard file object */
+		if (res == FR_OK) {
+#if _FS_BUFPOOL
+			free_fbuf(fp);				/* Return the file buffer */
+#endif
+			fp->fs = 0;					/* Discard file object */
+		}
 		LEAVE_FF(fs, res);
 	}
 #else
@@ -2737,7 +3453,15 @@ FRESULT f_close (
 #endif
 	}
 #endif
-	if (res == FR_OK) fp->fs = 0;	/* Discard file object */
+	if (res == FR_OK) {
+#if _FS_BUFPOOL
+		free_fbuf(fp);		/* Return the file buffer */
+#endif
+#if _FS_RESERVE
+		free_rsv(fp);		/* Release the claimed cluster run */
+#endif
+		fp->fs = 0;			/* Discard file object */
+	}
 	return res;
 #endif
 }
@@ -2886,6 +3610,10 @@ FRESULT f_lseek (
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
 	if (fp->flag & FA__ERROR)			/* Check abort flag */
 		LEAVE_FF(fp->fs, FR_INT_ERR);
+#if _FS_BUFPOOL
+	if (lock_fbuf(fp) != FR_OK)			/* Get the file buffer */
+		ABORT(fp->fs, FR_DISK_ERR);
+#endif
 
 #if _USE_FASTSEEK
 	if (fp->cltbl) {	/* Fast seek */
@@ -2932,6 +3660,7 @@ FRESULT f_lseek (
 						if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
 							ABORT(fp->fs, FR_DISK_ERR);
 						fp->flag &= ~FA__DIRTY;
+						mark_fbuf(fp);
 					}
 #endif
 					if (disk_read(fp->fs->drv, fp->buf, dsc, 1) != RES_OK)	/* Load current sector */
@@ -2967,7 +3696,7 @@ FRESULT f_lseek (
 				clst = fp->sclust;						/* start from the first cluster */
 #if !_FS_READONLY
 				if (clst == 0) {						/* If no cluster chain, create a new chain */
-					clst = create_chain(fp->fs, 0);
+					clst = create_fchain(fp, 0);
 					if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
 					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 					fp->sclust = clst;
@@ -2979,7 +3708,7 @@ FRESULT f_lseek (
 				while (ofs > bcs) {						/* Cluster following loop */
 #if !_FS_READONLY
 					if (fp->flag & FA_WRITE) {			/* Check if in write mode or not */
-						clst = create_chain(fp->fs, clst);	/* Force stretch if in write mode */
+						clst = create_fchain(fp, clst);	/* Force stretch if in write mode */
 						if (clst == 0) {				/* When disk gets full, clip file size */
 							ofs = bcs; break;
 						}
@@ -3007,6 +3736,7 @@ FRESULT f_lseek (
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 				fp->flag &= ~FA__DIRTY;
+				mark_fbuf(fp);
 			}
 #endif
 			if (disk_read(fp->fs->drv, fp->buf, nsect, 1) != RES_OK)	/* Fill sector cache */
@@ -3063,56 +3793,145 @@ FRESULT f_opendir (
 				res = dir_sdi(dj, 0);			/* Rewind dir */
 			}
 		}
-		if (res == FR_NO_FILE) res = FR_NO_PATH;
-		if (res != FR_OK) dj->fs = 0;			/* Invalidate the dir object if function faild */
-	} else {
-		dj->fs = 0;
+		if (res == FR_NO_FILE) res = FR_NO_PATH;
+		if (res != FR_OK) dj->fs = 0;			/* Invalidate the dir object if function faild */
+	} else {
+		dj->fs = 0;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Directory Entry in Sequence                                      */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_readdir (
+	DIR *dj,			/* Pointer to the open directory object */
+	FILINFO *fno		/* Pointer to file information to return */
+)
+{
+	FRESULT res;
+	DEF_NAMEBUF;
+
+
+	res = validate(dj);						/* Check validity of the object */
+	if (res == FR_OK) {
+		if (!fno) {
+			res = dir_sdi(dj, 0);			/* Rewind the directory object */
+		} else {
+			INIT_BUF(*dj);
+			res = dir_read(dj, 0);			/* Read an item */
+			if (res == FR_NO_FILE) {		/* Reached end of dir */
+				dj->sect = 0;
+				res = FR_OK;
+			}
+			if (res == FR_OK) {				/* A valid entry is found */
+				get_fileinfo(dj, fno);		/* Get the object information */
+				res = dir_next(dj, 0);		/* Increment index for next */
+				if (res == FR_NO_FILE) {
+					dj->sect = 0;
+					res = FR_OK;
+				}
+			}
+			FREE_BUF();
+		}
+	}
+
+	LEAVE_FF(dj->fs, res);
+}
+
+
+#if _USE_READDIRS
+/*-----------------------------------------------------------------------*/
+/* Match a name against a pattern with ? and * wildcards                 */
+/*-----------------------------------------------------------------------*/
+
+static
+int pattern_match (	/* 1:Matched, 0:Not matched */
+	const TCHAR *pat,	/* Pattern, case insensitive */
+	const TCHAR *nam	/* Name to test */
+)
+{
+	const TCHAR *pp = 0, *np = 0;
+	TCHAR pc, nc;
+
+
+	for (;;) {
+		pc = *pat; nc = *nam;
+		if (pc == '*') {			/* Remember the star and try to match nothing with it */
+			pp = ++pat; np = nam;
+			continue;
+		}
+		if (!nc) {
+			if (!pc) return 1;		/* Both ended */
+		} else {
+			if (IsLower(pc)) pc -= 0x20;
+			if (IsLower(nc)) nc -= 0x20;
+			if (pc == '?' || pc == nc) {	/* This char matched */
+				pat++; nam++;
+				continue;
+			}
+		}
+		if (!pp || !*np) return 0;	/* No star to fall back on */
+		pat = pp; nam = ++np;		/* Let the last star take one more char */
 	}
-
-	LEAVE_FF(fs, res);
 }
 
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Read Directory Entry in Sequence                                      */
+/* Read Directory Entries in Bulk                                        */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_readdir (
+FRESULT f_readdirs (
 	DIR *dj,			/* Pointer to the open directory object */
-	FILINFO *fno		/* Pointer to file information to return */
+	FILINFO *fno,		/* Array of file information to fill */
+	UINT count,			/* Number of items in the array */
+	UINT *nread,		/* Pointer to the number of items read (less than count: end of dir) */
+	BYTE attr,			/* Skip the items having any of these attributes */
+	const TCHAR *pattern	/* Name pattern with ? and * (0: any name) */
 )
 {
 	FRESULT res;
+	UINT n = 0;
 	DEF_NAMEBUF;
 
 
+	*nread = 0;
 	res = validate(dj);						/* Check validity of the object */
 	if (res == FR_OK) {
-		if (!fno) {
-			res = dir_sdi(dj, 0);			/* Rewind the directory object */
-		} else {
-			INIT_BUF(*dj);
+		INIT_BUF(*dj);
+		while (n < count) {
 			res = dir_read(dj, 0);			/* Read an item */
-			if (res == FR_NO_FILE) {		/* Reached end of dir */
-				dj->sect = 0;
-				res = FR_OK;
-			}
-			if (res == FR_OK) {				/* A valid entry is found */
-				get_fileinfo(dj, fno);		/* Get the object information */
-				res = dir_next(dj, 0);		/* Increment index for next */
-				if (res == FR_NO_FILE) {
-					dj->sect = 0;
-					res = FR_OK;
-				}
+			if (res != FR_OK) break;
+			if (!(dj->dir[DIR_Attr] & attr)) {	/* Decode it in place unless filtered by attribute */
+				get_fileinfo(dj, &fno[n]);
+				if (!pattern || pattern_match(pattern, fno[n].fname)
+#if _USE_LFN
+					|| (fno[n].lfname && fno[n].lfname[0] && pattern_match(pattern, fno[n].lfname))
+#endif
+					) n++;
 			}
-			FREE_BUF();
+			res = dir_next(dj, 0);			/* Increment index for next */
+			if (res != FR_OK) break;
+		}
+		if (res == FR_NO_FILE) {			/* Reached end of dir */
+			dj->sect = 0;
+			res = FR_OK;
 		}
+		FREE_BUF();
+		*nread = n;
 	}
 
 	LEAVE_FF(dj->fs, res);
 }
+#endif /* _USE_READDIRS */
+
 
 
 
@@ -3153,6 +3972,73 @@ FRESULT f_stat (
 /*-----------------------------------------------------------------------*/
 /* Get Number of Free Clusters                                           */
 /*-----------------------------------------------------------------------*/
+#if _FS_SCANFREE
+static
+FRESULT scan_free (	/* FR_OK:Count is valid, FR_IN_PROGRESS:Not finished, others:Error */
+	FATFS *fs,			/* File system object */
+	UINT nsect			/* Number of FAT sectors to scan in this step */
+)
+{
+	FRESULT res = FR_OK;
+	DWORD clst, n;
+#if _FAT12_EN
+	DWORD stat;
+#endif
+	UINT i, ent;
+	BYTE fat;
+
+
+	if (fs->free_clust <= fs->n_fatent - 2) return FR_OK;	/* Count is already valid */
+
+	fat = FS_TYPE(fs);
+	clst = fs->scan_clst;
+	if (clst < 2) {				/* Start a new scan */
+		clst = 2;
+		fs->scan_free = 0;
+	}
+	n = fs->scan_free;
+#if _FAT12_EN
+	if (fat == FS_FAT12) {
+		i = nsect * SS(fs) * 2 / 3;		/* Number of entries in nsect sectors */
+		do {
+			stat = get_fat(fs, clst);
+			if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (stat == 1) { res = FR_INT_ERR; break; }
+			if (stat == 0) n++;
+		} while (++clst < fs->n_fatent && --i);
+	} else
+#endif
+	{
+		ent = SS(fs) / ((fat == FS_FAT16) ? 2 : 4);	/* Number of entries per FAT sector */
+		do {
+			res = move_window(fs, fs->fatbase + clst / ent);
+			if (res != FR_OK) break;
+			i = (UINT)(clst % ent);
+			do {
+#if _FAT16_EN
+				if (fat == FS_FAT16) {
+					if (LD_WORD(fs->win + i * 2) == 0) n++;
+				} else
+#endif
+				{
+					if ((LD_DWORD(fs->win + i * 4) & 0x0FFFFFFF) == 0) n++;
+				}
+			} while (++clst < fs->n_fatent && ++i < ent);
+		} while (clst < fs->n_fatent && --nsect);
+	}
+	fs->scan_clst = clst;		/* Save the scan state for the next step */
+	fs->scan_free = n;
+
+	if (res == FR_OK) {
+		if (clst < fs->n_fatent) return FR_IN_PROGRESS;
+		fs->free_clust = n;		/* Scan finished */
+		fs->scan_clst = 0;
+		if (fat == FS_FAT32) fs->fsi_flag = 1;
+	}
+	return res;
+}
+#endif
+
 
 FRESULT f_getfree (
 	const TCHAR *path,	/* Path name of the logical drive number */
@@ -3162,9 +4048,14 @@ FRESULT f_getfree (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD n, clst, sect, stat;
+#if !_FS_SCANFREE
+	DWORD n, clst, sect;
+#if _FAT12_EN
+	DWORD stat;
+#endif
 	UINT i;
 	BYTE fat, *p;
+#endif
 
 
 	/* Get drive number */
@@ -3175,9 +4066,15 @@ FRESULT f_getfree (
 		if (fs->free_clust <= fs->n_fatent - 2) {
 			*nclst = fs->free_clust;
 		} else {
+#if _FS_SCANFREE
+			/* Take a step of the free cluster scan */
+			res = scan_free(fs, _FS_SCANFREE);
+			*nclst = (res == FR_OK) ? fs->free_clust : fs->scan_free;
+#else
 			/* Get number of free clusters */
-			fat = fs->fs_type;
+			fat = FS_TYPE(fs);
 			n = 0;
+#if _FAT12_EN
 			if (fat == FS_FAT12) {
 				clst = 2;
 				do {
@@ -3186,7 +4083,9 @@ FRESULT f_getfree (
 					if (stat == 1) { res = FR_INT_ERR; break; }
 					if (stat == 0) n++;
 				} while (++clst < fs->n_fatent);
-			} else {
+			} else
+#endif
+			{
 				clst = fs->n_fatent;
 				sect = fs->fatbase;
 				i = 0; p = 0;
@@ -3197,10 +4096,13 @@ FRESULT f_getfree (
 						p = fs->win;
 						i = SS(fs);
 					}
+#if _FAT16_EN
 					if (fat == FS_FAT16) {
 						if (LD_WORD(p) == 0) n++;
 						p += 2; i -= 2;
-					} else {
+					} else
+#endif
+					{
 						if ((LD_DWORD(p) & 0x0FFFFFFF) == 0) n++;
 						p += 4; i -= 4;
 					}
@@ -3209,6 +4111,7 @@ FRESULT f_getfree (
 			fs->free_clust = n;
 			if (fat == FS_FAT32) fs->fsi_flag = 1;
 			*nclst = n;
+#endif
 		}
 	}
 	LEAVE_FF(fs, res);
@@ -3217,6 +4120,30 @@ FRESULT f_getfree (
 
 
 
+#if _FS_SCANFREE
+/*-----------------------------------------------------------------------*/
+/* Advance Free Cluster Scan                                             */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_scanfree (
+	const TCHAR *path	/* Path name of the logical drive number */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = chk_mounted(&path, &fs, 0);
+	if (res == FR_OK)
+		res = scan_free(fs, _FS_SCANFREE);
+
+	LEAVE_FF(fs, res);
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Truncate File                                                         */
 /*-----------------------------------------------------------------------*/
@@ -3265,6 +4192,230 @@ FRESULT f_truncate (
 
 
 
+#if _USE_DEFRAG
+/*-----------------------------------------------------------------------*/
+/* Defragment File - End moving the file                                 */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT defrag_end (
+	DEFRAG *dg,		/* Defragmentation object */
+	FRESULT res		/* Result to be returned */
+)
+{
+	FATFS *fs = dg->fs;
+
+
+#if _FS_RESERVE
+	if (dg->dclust) free_rsv(dg->fp);	/* Drop the claim on the new extent */
+#endif
+	dg->fp = 0;
+	dg->dclust = 0;
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Defragment File - Start moving a file into contiguous clusters        */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_defrag (
+	DEFRAG *dg,		/* Pointer to the blank defragmentation object */
+	FIL *fp			/* Pointer to the file object (opened for writing) */
+)
+{
+	FRESULT res;
+	DWORD clst, nxt, n = 0;
+	BYTE frag = 0;
+
+
+	dg->fp = 0;
+	res = validate(fp);						/* Check validity of the object */
+	if (res == FR_OK) {
+		if (fp->flag & FA__ERROR) {			/* Check abort flag */
+			res = FR_INT_ERR;
+		} else {
+			if (!(fp->flag & FA_WRITE))		/* Check access mode */
+				res = FR_DENIED;
+		}
+	}
+	if (res == FR_OK && (fp->flag & FA__WRITTEN))
+		res = f_sync(fp);					/* Put the file on the disk as it is now */
+	if (res == FR_OK) {						/* Count the clusters and see if they are contiguous */
+		for (clst = fp->sclust; clst >= 2 && clst < fp->fs->n_fatent; clst = nxt) {
+			nxt = get_fat(fp->fs, clst);
+			if (nxt == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (nxt < 2 || ++n >= fp->fs->n_fatent) { res = FR_INT_ERR; break; }
+			if (nxt != clst + 1 && nxt < fp->fs->n_fatent) frag = 1;
+		}
+	}
+	if (res == FR_OK && frag) {				/* Fragmented file */
+		dg->fs = fp->fs;
+		dg->id = fp->fs->id;
+		dg->csect = 0;
+		dg->sclust = fp->sclust;
+		dg->fsize = fp->fsize;
+		dg->nclst = n;
+		dg->dclust = 0;
+		dg->clust = 2;						/* Search from the top of the volume */
+		dg->ncopy = 0;
+		dg->fp = fp;
+		res = FR_IN_PROGRESS;
+	}
+
+	LEAVE_FF(fp->fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Defragment File - Advance or cancel moving the file                   */
+/*-----------------------------------------------------------------------*/
+/* Each step looks for a free run as large as the file, or copies some   */
+/* sectors into it. The run is claimed in memory only while it is copied */
+/* to, and each of its clusters is checked to be still free before it is */
+/* written. When all are copied, the run is linked as a chain, the       */
+/* directory entry is pointed to it and the old chain is freed. A power  */
+/* loss leaves a lost chain only from the first to the last of these.    */
+
+FRESULT f_defragstep (
+	DEFRAG *dg,		/* Pointer to the defragmentation object */
+	UINT nsect		/* Number of sectors to copy in this step (0:cancel) */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	FIL *fp = dg->fp;
+	DWORD cl, n, sect;
+	BYTE *dir;
+
+
+	if (!fp) return FR_OK;					/* Not moving a file */
+	res = validate(fp);						/* Check validity of the object */
+	if (res == FR_OK && fp->fs != dg->fs) res = FR_INVALID_OBJECT;
+	if (res != FR_OK) return defrag_end(dg, res);
+	fs = fp->fs;
+	if (fp->sclust != dg->sclust || fp->fsize != dg->fsize || (fp->flag & (FA__WRITTEN | FA__ERROR)))
+		return defrag_end(dg, FR_DENIED);	/* The file has been changed */
+	if (!nsect) return defrag_end(dg, FR_OK);	/* Cancel */
+
+	if (!dg->dclust) {						/* Look for a free run as large as the file */
+		for (n = (DWORD)nsect * (SS(fs) / 4); n && dg->ncopy < dg->nclst; n--) {
+			if (dg->clust >= fs->n_fatent) return defrag_end(dg, FR_DENIED);	/* No room */
+			cl = get_fat(fs, dg->clust++);
+			if (cl == 0xFFFFFFFF) return defrag_end(dg, FR_DISK_ERR);
+			dg->ncopy = (cl || rsv_hit(fs, dg->clust - 1)) ? 0 : dg->ncopy + 1;
+		}
+		if (dg->ncopy < dg->nclst) LEAVE_FF(fs, FR_IN_PROGRESS);
+		for (cl = dg->clust - dg->nclst; cl < dg->clust; cl++) {	/* Check the run again as the volume may have changed between the steps */
+			n = get_fat(fs, cl);
+			if (n == 0xFFFFFFFF) return defrag_end(dg, FR_DISK_ERR);
+			if (n || rsv_hit(fs, cl)) {		/* Taken, search on after it */
+				dg->clust = cl + 1;
+				dg->ncopy = 0;
+				LEAVE_FF(fs, FR_IN_PROGRESS);
+			}
+		}
+		dg->dclust = dg->clust - dg->nclst;	/* Claim the run in memory, the FAT is not changed yet */
+		rsv_claim(fs, fp, dg->dclust, dg->nclst);
+#if _USE_ERASE
+		erase_area(fs, clust2sect(fs, dg->dclust), clust2sect(fs, dg->dclust) + dg->nclst * fs->csize);
+#endif
+		dg->clust = dg->sclust;				/* Copy from the top of the file */
+		dg->ncopy = 0;
+		LEAVE_FF(fs, FR_IN_PROGRESS);
+	}
+
+	if (dg->ncopy < dg->nclst) {			/* Copy sectors through the window */
+		if (sync_window(fs) != FR_OK) return defrag_end(dg, FR_DISK_ERR);
+		fs->winsect = 0xFFFFFFFF;			/* The window does not hold any sector of the volume */
+		for ( ; nsect && dg->ncopy < dg->nclst; nsect--) {
+			if (!dg->csect) {				/* Make sure the new cluster is still free */
+				cl = get_fat(fs, dg->dclust + dg->ncopy);
+				if (cl == 0xFFFFFFFF) return defrag_end(dg, FR_DISK_ERR);
+				if (cl) return defrag_end(dg, FR_DENIED);
+				fs->winsect = 0xFFFFFFFF;
+			}
+			sect = clust2sect(fs, dg->clust);
+			if (!sect) return defrag_end(dg, FR_INT_ERR);
+			if (disk_read(fs->drv, fs->win, sect + dg->csect, 1) != RES_OK ||
+				disk_write(fs->drv, fs->win, clust2sect(fs, dg->dclust + dg->ncopy) + dg->csect, 1) != RES_OK)
+				return defrag_end(dg, FR_DISK_ERR);
+			if (++dg->csect == fs->csize) {	/* On to the next cluster of the file */
+				dg->csect = 0;
+				if (++dg->ncopy < dg->nclst) {
+					cl = get_fat(fs, dg->clust);
+					if (cl == 0xFFFFFFFF) return defrag_end(dg, FR_DISK_ERR);
+					if (cl < 2 || cl >= fs->n_fatent) return defrag_end(dg, FR_INT_ERR);
+					dg->clust = cl;
+					fs->winsect = 0xFFFFFFFF;
+				}
+			}
+		}
+		if (dg->ncopy < dg->nclst) LEAVE_FF(fs, FR_IN_PROGRESS);
+		if (disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK) return defrag_end(dg, FR_DISK_ERR);
+	}
+
+	/* Link the new extent as a chain and switch the file over to it */
+	res = move_window(fs, fp->dir_sect);
+	if (res != FR_OK) return defrag_end(dg, res);
+	dir = fp->dir_ptr;
+	if (ld_clust(fs, dir) != dg->sclust || LD_DWORD(dir+DIR_FileSize) != dg->fsize)
+		return defrag_end(dg, FR_DENIED);	/* Changed through another file object */
+	for (cl = dg->dclust; cl < dg->dclust + dg->nclst; cl++) {	/* Taken since it was copied to? */
+		n = get_fat(fs, cl);
+		if (n == 0xFFFFFFFF) return defrag_end(dg, FR_DISK_ERR);
+		if (n) return defrag_end(dg, FR_DENIED);
+	}
+	for (cl = dg->dclust; cl < dg->dclust + dg->nclst; cl++) {
+		res = put_fat(fs, cl, (cl + 1 < dg->dclust + dg->nclst) ? cl + 1 : 0x0FFFFFFF);
+		if (res != FR_OK) break;
+		if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSInfo */
+			fs->free_clust--;
+			fs->fsi_flag = 1;
+		}
+#if _FS_SCANFREE
+		else if (cl < fs->scan_clst) {	/* Update count of the scanned part */
+			fs->scan_free--;
+		}
+#endif
+	}
+	if (res == FR_OK) res = sync_fs(fs);
+	if (res == FR_OK) res = move_window(fs, fp->dir_sect);
+	if (res != FR_OK) {						/* Release what was linked */
+		if (remove_chain(fs, dg->dclust) == FR_OK) sync_fs(fs);
+		return defrag_end(dg, res);
+	}
+	st_clust(dir, dg->dclust);
+	fs->wflag = 1;
+	fp->sclust = dg->dclust;
+	if (fp->fptr) {							/* Follow the file pointer to the new chain */
+		cl = dg->dclust + (fp->fptr - 1) / ((DWORD)SS(fs) * fs->csize);
+		if (fp->fptr % SS(fs))
+			fp->dsect = clust2sect(fs, cl) + (fp->dsect - clust2sect(fs, fp->clust));
+		else
+			fp->dsect = 0;					/* The sector will be loaded on demand */
+		fp->clust = cl;
+	}
+#if _USE_FASTSEEK
+	fp->cltbl = 0;							/* The link map table is out of date */
+#endif
+	dg->dclust = 0;							/* The chain belongs to the file now */
+	res = sync_fs(fs);
+	if (res == FR_OK) res = remove_chain(fs, dg->sclust);	/* Free the old chain */
+	if (res == FR_OK) res = sync_fs(fs);
+
+	return defrag_end(dg, res);
+}
+#endif /* _USE_DEFRAG */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Delete a File or Directory                                            */
 /*-----------------------------------------------------------------------*/
@@ -3375,7 +4526,7 @@ FRESULT f_mkdir (
 				st_clust(dir, dcl);
 				mem_cpy(dir+SZ_DIR, dir, SZ_DIR); 	/* Create ".." entry */
 				dir[33] = '.'; pcl = dj.sclust;
-				if (dj.fs->fs_type == FS_FAT32 && pcl == dj.fs->dirbase)
+				if (FS_TYPE(dj.fs) == FS_FAT32 && pcl == dj.fs->dirbase)
 					pcl = 0;
 				st_clust(dir+SZ_DIR, pcl);
 				for (n = dj.fs->csize; n; n--) {	/* Write dot entries and clear following sectors */
@@ -3540,7 +4691,7 @@ FRESULT f_rename (
 								res = move_window(djo.fs, dw);
 								dir = djo.fs->win+SZ_DIR;	/* .. entry */
 								if (res == FR_OK && dir[1] == '.') {
-									dw = (djo.fs->fs_type == FS_FAT32 && djn.sclust == djo.fs->dirbase) ? 0 : djn.sclust;
+									dw = (FS_TYPE(djo.fs) == FS_FAT32 && djn.sclust == djo.fs->dirbase) ? 0 : djn.sclust;
 									st_clust(dir, dw);
 									djo.fs->wflag = 1;
 								}
@@ -3624,7 +4775,7 @@ FRESULT f_getlabel (
 	if (res == FR_OK && sn) {
 		res = move_window(dj.fs, dj.fs->volbase);
 		if (res == FR_OK) {
-			i = dj.fs->fs_type == FS_FAT32 ? BS_VolID32 : BS_VolID;
+			i = FS_TYPE(dj.fs) == FS_FAT32 ? BS_VolID32 : BS_VolID;
 			*sn = LD_DWORD(&dj.fs->win[i]);
 		}
 	}
@@ -3803,10 +4954,11 @@ FRESULT f_mkfs (
 	UINT au			/* Allocation unit size [bytes] */
 )
 {
-	static const WORD vst[] = { 1024,   512,  256,  128,   64,    32,   16,    8,    4,    2,   0};
-	static const WORD cst[] = {32768, 16384, 8192, 4096, 2048, 16384, 8192, 4096, 2048, 1024, 512};
+	/* Cluster size by volume size [MB], as given by the SD card file system spec */
+	static const WORD vst[] = { 1024,     8,    0};
+	static const WORD cst[] = {32768, 16384, 8192};
 	BYTE fmt, md, sys, *tbl, pdrv, part;
-	DWORD n_clst, vs, n, wsect;
+	DWORD n_clst, vs, n, wsect, eb;
 	UINT i;
 	DWORD b_vol, b_fat, b_dir, b_data;	/* LBA */
 	DWORD n_vol, n_rsv, n_fat, n_dir;	/* Size */
@@ -3823,6 +4975,9 @@ FRESULT f_mkfs (
 	fs->fs_type = 0;
 	pdrv = LD2PD(vol);	/* Physical drive */
 	part = LD2PT(vol);	/* Partition (0:auto detect, 1-4:get from partition table)*/
+#if _FS_FASTMOUNT
+	ff_fmount_stale(pdrv);	/* The mount record no longer holds (the new volume can have the same serial) */
+#endif
 
 	/* Get disk statics */
 	stat = disk_initialize(pdrv);
@@ -3840,11 +4995,21 @@ FRESULT f_mkfs (
 		if (!tbl[4]) return FR_MKFS_ABORTED;	/* No partition? */
 		b_vol = LD_DWORD(tbl+8);	/* Volume start sector */
 		n_vol = LD_DWORD(tbl+12);	/* Volume size */
-	} else {
+	}
+
+	/* Get erase block size (the allocation unit of SD cards) to align the volume to */
+	if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &eb) != RES_OK || !eb || eb > 32768 || (eb & (eb - 1)))
+		eb = 1;
+
+	if (!(_MULTI_PARTITION && part)) {
 		/* Create a partition in this function */
 		if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &n_vol) != RES_OK || n_vol < 128)
 			return FR_DISK_ERR;
-		b_vol = (sfd) ? 0 : 63;		/* Volume start sector */
+		b_vol = 0;
+		if (!sfd) {					/* Volume start sector: first erase block boundary past the MBR track */
+			b_vol = (63 + eb - 1) & ~(eb - 1);
+			if (b_vol >= n_vol / 8) b_vol = 63;	/* (Too large for the drive) */
+		}
 		n_vol -= b_vol;				/* Volume size */
 	}
 
@@ -3862,6 +5027,7 @@ FRESULT f_mkfs (
 	fmt = FS_FAT12;
 	if (n_clst >= MIN_FAT16) fmt = FS_FAT16;
 	if (n_clst >= MIN_FAT32) fmt = FS_FAT32;
+	if (!FAT_SUPPORTED(fmt)) return FR_MKFS_ABORTED;	/* (Sub-type not supported) */
 
 	/* Determine offset and size of FAT structure */
 	if (fmt == FS_FAT32) {
@@ -3875,18 +5041,24 @@ FRESULT f_mkfs (
 		n_dir = (DWORD)N_ROOTDIR * SZ_DIR / SS(fs);
 	}
 	b_fat = b_vol + n_rsv;				/* FAT area start sector */
+	if (eb < n_vol / 8) {				/* Align FAT start sector to erase block boundary, so that */
+		n = ((b_fat + eb - 1) & ~(eb - 1)) - b_fat;	/* the FAT does not share one with the VBR */
+		n_rsv += n;
+		b_fat += n;
+	}
 	b_dir = b_fat + n_fat * N_FATS;		/* Directory area start sector */
 	b_data = b_dir + n_dir;				/* Data area start sector */
 	if (n_vol < b_data + au - b_vol) return FR_MKFS_ABORTED;	/* Too small volume */
 
-	/* Align data start sector to erase block boundary (for flash memory media) */
-	if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &n) != RES_OK || !n || n > 32768) n = 1;
-	n = (b_data + n - 1) & ~(n - 1);	/* Next nearest erase block from current data start */
+	/* Align data start sector to erase block boundary (for flash memory media).
+	   As the cluster size and the erase block size are both powers of 2, every
+	   cluster then lies within an erase block or spans whole ones. */
+	n = (b_data + eb - 1) & ~(eb - 1);	/* Next nearest erase block from current data start */
 	n = (n - b_data) / N_FATS;
-	if (fmt == FS_FAT32) {		/* FAT32: Move FAT offset */
+	if (fmt == FS_FAT32 && (b_fat & (eb - 1))) {	/* FAT32 with the FAT unaligned: Move FAT offset */
 		n_rsv += n;
 		b_fat += n;
-	} else {					/* FAT12/16: Expand FAT size */
+	} else {					/* Expand FAT size */
 		n_fat += n;
 	}
 
@@ -3914,15 +5086,16 @@ FRESULT f_mkfs (
 		} else {	/* Create partition table (FDISK) */
 			mem_set(fs->win, 0, SS(fs));
 			tbl = fs->win+MBR_Table;	/* Create partition table for single partition in the drive */
-			tbl[1] = 1;						/* Partition start head */
-			tbl[2] = 1;						/* Partition start sector */
-			tbl[3] = 0;						/* Partition start cylinder */
+			n = b_vol / 63 / 255;
+			tbl[1] = (BYTE)(b_vol / 63 % 255);	/* Partition start head */
+			tbl[2] = (BYTE)((n >> 2) | (b_vol % 63 + 1));	/* Partition start sector */
+			tbl[3] = (BYTE)n;				/* Partition start cylinder */
 			tbl[4] = sys;					/* System type */
 			tbl[5] = 254;					/* Partition end head */
 			n = (b_vol + n_vol) / 63 / 255;
 			tbl[6] = (BYTE)((n >> 2) | 63);	/* Partition end sector */
 			tbl[7] = (BYTE)n;				/* End cylinder */
-			ST_DWORD(tbl+8, 63);			/* Partition start in LBA */
+			ST_DWORD(tbl+8, b_vol);			/* Partition start in LBA */
 			ST_DWORD(tbl+12, n_vol);		/* Partition size in LBA */
 			ST_WORD(fs->win+BS_55AA, 0xAA55);	/* MBR signature */
 			if (disk_write(pdrv, fs->win, 0, 1) != RES_OK)	/* Write it to the MBR sector */
@@ -4102,6 +5275,42 @@ FRESULT f_fdisk (
 
 
 #if _USE_STRFUNC
+/*-----------------------------------------------------------------------*/
+/* Find a line end in a block of bytes                                   */
+/*-----------------------------------------------------------------------*/
+/* Tests a word at a time for a '\n' byte once the pointer is aligned.   */
+
+#if !_LFN_UNICODE && !_FS_TINY
+static
+const BYTE* find_eol (	/* Pointer to the '\n' or to the end of the block */
+	const BYTE* s,		/* Block to search */
+	UINT n				/* Number of bytes in the block */
+)
+{
+	const DWORD ones = (DWORD)-1 / 0xFF;	/* 0x01 in each byte of a word */
+	DWORD w;
+
+
+	while (n && ((ULONG)s % sizeof (DWORD))) {	/* Up to the word boundary */
+		if (*s == '\n') return s;
+		s++; n--;
+	}
+	while (n >= sizeof (DWORD)) {	/* A word at a time */
+		w = *(const DWORD*)s ^ (ones * '\n');	/* A '\n' byte becomes zero */
+		if ((w - ones) & ~w & (ones << 7)) break;
+		s += sizeof (DWORD); n -= sizeof (DWORD);
+	}
+	while (n) {						/* The rest */
+		if (*s == '\n') return s;
+		s++; n--;
+	}
+	return s;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Get a string from the file                                            */
 /*-----------------------------------------------------------------------*/
@@ -4116,10 +5325,47 @@ TCHAR* f_gets (
 	TCHAR c, *p = buff;
 	BYTE s[2];
 	UINT rc;
+#if !_LFN_UNICODE && !_FS_TINY
+	const BYTE *sp, *ep;
+	UINT ofs, cnt;
+	BYTE eol;
+#endif
+
 
+#if !_LFN_UNICODE && !_FS_TINY
+	if (validate(fp) != FR_OK || (fp->flag & FA__ERROR) || !(fp->flag & FA_READ))
+		return 0;
+#if _FS_BUFPOOL
+	if (lock_fbuf(fp) != FR_OK) return 0;
+#endif
+#endif
 
 	while (n < len - 1) {			/* Read bytes until buffer gets filled */
-		f_read(fp, s, 1, &rc);
+#if !_LFN_UNICODE && !_FS_TINY
+		ofs = (UINT)(fp->fptr % SS(fp->fs));
+		if (ofs) {					/* The sector is in the file buffer, take a run of bytes from it */
+			cnt = SS(fp->fs) - ofs;
+			if (cnt > fp->fsize - fp->fptr) cnt = (UINT)(fp->fsize - fp->fptr);
+			if (cnt > (UINT)(len - 1 - n)) cnt = (UINT)(len - 1 - n);
+			if (!cnt) break;		/* Break on EOF */
+			sp = &fp->buf[ofs];
+			ep = find_eol(sp, cnt);
+			eol = (ep < sp + cnt);
+			if (eol) cnt = (UINT)(ep - sp) + 1;	/* Up to and including the '\n' */
+			fp->fptr += cnt;
+#if _USE_STRFUNC >= 2
+			for (rc = 0; rc < cnt; rc++) {	/* Strip '\r' */
+				if (sp[rc] != '\r') { *p++ = sp[rc]; n++; }
+			}
+#else
+			mem_cpy(p, sp, cnt);
+			p += cnt; n += cnt;
+#endif
+			if (eol) break;			/* Break on EOL */
+			continue;
+		}
+#endif
+		f_read(fp, s, 1, &rc);		/* Load the next sector with a byte */
 		if (rc != 1) break;			/* Break on EOF or error */
 		c = s[0];
 #if _LFN_UNICODE					/* Read a character in UTF-8 encoding */
@@ -4158,44 +5404,102 @@ TCHAR* f_gets (
 #if !_FS_READONLY
 #include <stdarg.h>
 /*-----------------------------------------------------------------------*/
-/* Put a character to the file                                           */
+/* Buffered output for f_putc, f_puts and f_printf                       */
 /*-----------------------------------------------------------------------*/
+/* The characters are gathered in a buffer on the stack and written to   */
+/* the file with one f_write per buffer full.                            */
+/* A line longer than the buffer takes one more f_write, which costs no  */
+/* lines per second that test_strfunc can measure on the host or the bus */
+/* for 80-byte CSV lines, so the buffer stays small for the stack.       */
 
-int f_putc (
-	TCHAR c,	/* A character to be output */
-	FIL* fp		/* Pointer to the file object */
+#define	SZ_PUTBUFF	64		/* Size of the output buffer (bytes) */
+
+typedef struct {
+	FIL* fp;				/* File to write to */
+	UINT idx;				/* Number of bytes in buf[] */
+	int nchr;				/* Number of characters put (-1:error) */
+	BYTE buf[SZ_PUTBUFF];	/* Output buffer */
+} PUTBUFF;
+
+
+static
+void putc_flush (
+	PUTBUFF* pb		/* Output buffer */
 )
 {
-	UINT bw, btw;
-	BYTE s[3];
+	UINT bw;
+
 
+	if (pb->idx && pb->nchr >= 0) {
+		if (f_write(pb->fp, pb->buf, pb->idx, &bw) != FR_OK || bw != pb->idx)
+			pb->nchr = -1;
+	}
+	pb->idx = 0;
+}
+
+
+static
+void putc_bfd (
+	PUTBUFF* pb,	/* Output buffer */
+	TCHAR c			/* A character to be output */
+)
+{
+	if (pb->nchr < 0) return;		/* Write error occurred before */
 
+	if (pb->idx > SZ_PUTBUFF - 4) {	/* Room for a CR and a UTF-8 sequence */
+		putc_flush(pb);
+		if (pb->nchr < 0) return;
+	}
 #if _USE_STRFUNC >= 2
-	if (c == '\n') f_putc ('\r', fp);	/* LF -> CRLF conversion */
+	if (c == '\n') pb->buf[pb->idx++] = '\r';	/* LF -> CRLF conversion (not counted as a character) */
 #endif
 
 #if _LFN_UNICODE	/* Write the character in UTF-8 encoding */
 	if (c < 0x80) {			/* 7-bit */
-		s[0] = (BYTE)c;
-		btw = 1;
+		pb->buf[pb->idx++] = (BYTE)c;
 	} else {
 		if (c < 0x800) {	/* 11-bit */
-			s[0] = (BYTE)(0xC0 | (c >> 6));
-			s[1] = (BYTE)(0x80 | (c & 0x3F));
-			btw = 2;
+			pb->buf[pb->idx++] = (BYTE)(0xC0 | (c >> 6));
 		} else {			/* 16-bit */
-			s[0] = (BYTE)(0xE0 | (c >> 12));
-			s[1] = (BYTE)(0x80 | ((c >> 6) & 0x3F));
-			s[2] = (BYTE)(0x80 | (c & 0x3F));
-			btw = 3;
+			pb->buf[pb->idx++] = (BYTE)(0xE0 | (c >> 12));
+			pb->buf[pb->idx++] = (BYTE)(0x80 | ((c >> 6) & 0x3F));
 		}
+		pb->buf[pb->idx++] = (BYTE)(0x80 | (c & 0x3F));
 	}
 #else				/* Write the character without conversion */
-	s[0] = (BYTE)c;
-	btw = 1;
+	pb->buf[pb->idx++] = (BYTE)c;
 #endif
-	f_write(fp, s, btw, &bw);		/* Write the char to the file */
-	return (bw == btw) ? 1 : EOF;	/* Return the result */
+	pb->nchr++;
+}
+
+
+static
+int putc_end (		/* Number of characters put or EOF */
+	PUTBUFF* pb		/* Output buffer */
+)
+{
+	putc_flush(pb);
+	return (pb->nchr >= 0) ? pb->nchr : EOF;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Put a character to the file                                           */
+/*-----------------------------------------------------------------------*/
+
+int f_putc (
+	TCHAR c,	/* A character to be output */
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	PUTBUFF pb;
+
+
+	pb.fp = fp; pb.idx = 0; pb.nchr = 0;
+	putc_bfd(&pb, c);
+	return (putc_end(&pb) == EOF) ? EOF : 1;	/* Return the result */
 }
 
 
@@ -4210,13 +5514,12 @@ int f_puts (
 	FIL* fp				/* Pointer to the file object */
 )
 {
-	int n;
+	PUTBUFF pb;
 
 
-	for (n = 0; *str; str++, n++) {
-		if (f_putc(*str, fp) == EOF) return EOF;
-	}
-	return n;
+	pb.fp = fp; pb.idx = 0; pb.nchr = 0;
+	while (*str) putc_bfd(&pb, *str++);
+	return putc_end(&pb);
 }
 
 
@@ -4237,17 +5540,17 @@ int f_printf (
 	UINT i, j, w;
 	ULONG v;
 	TCHAR c, d, s[16], *p;
-	int res, chc, cc;
+	PUTBUFF pb;
 
 
+	pb.fp = fp; pb.idx = 0; pb.nchr = 0;
 	va_start(arp, str);
 
-	for (cc = res = 0; cc != EOF; res += cc) {
+	for (;;) {
 		c = *str++;
 		if (c == 0) break;			/* End of string */
 		if (c != '%') {				/* Non escape character */
-			cc = f_putc(c, fp);
-			if (cc != EOF) cc = 1;
+			putc_bfd(&pb, c);
 			continue;
 		}
 		w = f = 0;
@@ -4273,16 +5576,14 @@ int f_printf (
 		case 'S' :					/* String */
 			p = va_arg(arp, TCHAR*);
 			for (j = 0; p[j]; j++) ;
-			chc = 0;
 			if (!(f & 2)) {
-				while (j++ < w) chc += (cc = f_putc(' ', fp));
+				while (j++ < w) putc_bfd(&pb, ' ');
 			}
-			chc += (cc = f_puts(p, fp));
-			while (j++ < w) chc += (cc = f_putc(' ', fp));
-			if (cc != EOF) cc = chc;
+			while (*p) putc_bfd(&pb, *p++);
+			while (j++ < w) putc_bfd(&pb, ' ');
 			continue;
 		case 'C' :					/* Character */
-			cc = f_putc((TCHAR)va_arg(arp, int), fp); continue;
+			putc_bfd(&pb, (TCHAR)va_arg(arp, int)); continue;
 		case 'B' :					/* Binary */
 			r = 2; break;
 		case 'O' :					/* Octal */
@@ -4293,7 +5594,7 @@ int f_printf (
 		case 'X' :					/* Hexdecimal */
 			r = 16; break;
 		default:					/* Unknown type (pass-through) */
-			cc = f_putc(c, fp); continue;
+			putc_bfd(&pb, c); continue;
 		}
 
 		/* Get an argument and put it in numeral */
@@ -4310,15 +5611,13 @@ int f_printf (
 		} while (v && i < sizeof s / sizeof s[0]);
 		if (f & 8) s[i++] = '-';
 		j = i; d = (f & 1) ? '0' : ' ';
-		chc = 0;
-		while (!(f & 2) && j++ < w) chc += (cc = f_putc(d, fp));
-		do chc += (cc = f_putc(s[--i], fp)); while(i);
-		while (j++ < w) chc += (cc = f_putc(' ', fp));
-		if (cc != EOF) cc = chc;
+		while (!(f & 2) && j++ < w) putc_bfd(&pb, d);
+		do putc_bfd(&pb, s[--i]); while(i);
+		while (j++ < w) putc_bfd(&pb, ' ');
 	}
 
 	va_end(arp);
-	return (cc == EOF) ? cc : res;
+	return putc_end(&pb);
 }
 
 #endif /* !_FS_READONLY */
@@ -94,6 +94,13 @@ typedef struct {
 	DWORD	free_clust;		/* Number of free clusters */
 	DWORD	fsi_sector;		/* fsinfo sector (FAT32) */
 #endif
+#if _FS_SCANFREE && !_FS_READONLY
+	DWORD	scan_clst;		/* Next cluster to be counted by free cluster scan (0:not started) */
+	DWORD	scan_free;		/* Free clusters counted below scan_clst */
+#endif
+#if _USE_ERASE && !_FS_READONLY
+	DWORD	au_size;		/* Erase block size in unit of sector (0:unknown) */
+#endif
 #if _FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
 #endif
@@ -132,8 +139,12 @@ typedef struct {
 	UINT	lockid;			/* File lock ID (index of file semaphore table Files[]) */
 #endif
 #if !_FS_TINY
+#if _FS_BUFPOOL
+	BYTE*	buf;			/* File data read/write buffer borrowed from the pool (0:not held) */
+#else
 	BYTE	buf[_MAX_SS];	/* File data read/write buffer */
 #endif
+#endif
 } FIL;
 
 
@@ -157,6 +168,23 @@ typedef struct {
 
 
 
+/* Defragmentation object structure (DEFRAG) */
+
+typedef struct {
+	FIL*	fp;				/* File object of the file being moved (0:none) */
+	FATFS*	fs;				/* File system object of the file */
+	WORD	id;				/* Mount ID of the file system when started */
+	BYTE	csect;			/* Sectors of the current cluster copied */
+	DWORD	sclust;			/* Start cluster of the file when started */
+	DWORD	fsize;			/* File size when started */
+	DWORD	nclst;			/* Number of clusters of the file */
+	DWORD	dclust;			/* Start cluster of the new extent (0:not reserved yet) */
+	DWORD	clust;			/* Next cluster to search for the extent, or cluster being copied */
+	DWORD	ncopy;			/* Free clusters found in a row, or clusters copied */
+} DEFRAG;
+
+
+
 /* File status structure (FILINFO) */
 
 typedef struct {
@@ -195,7 +223,8 @@ typedef enum {
 	FR_LOCKED,				/* (16) The operation is rejected according to the file sharing policy */
 	FR_NOT_ENOUGH_CORE,		/* (17) LFN working buffer could not be allocated */
 	FR_TOO_MANY_OPEN_FILES,	/* (18) Number of open files > _FS_SHARE */
-	FR_INVALID_PARAMETER	/* (19) Given parameter is invalid */
+	FR_INVALID_PARAMETER,	/* (19) Given parameter is invalid */
+	FR_IN_PROGRESS			/* (20) Free cluster scan or defragmentation is not finished yet */
 } FRESULT;
 
 
@@ -210,10 +239,14 @@ FRESULT f_lseek (FIL* fp, DWORD ofs);								/* Move file pointer of a file obje
 FRESULT f_close (FIL* fp);											/* Close an open file object */
 FRESULT f_opendir (DIR* dj, const TCHAR* path);						/* Open an existing directory */
 FRESULT f_readdir (DIR* dj, FILINFO* fno);							/* Read a directory item */
+FRESULT f_readdirs (DIR* dj, FILINFO* fno, UINT count, UINT* nread, BYTE attr, const TCHAR* pattern);	/* Read directory items into an array */
 FRESULT f_stat (const TCHAR* path, FILINFO* fno);					/* Get file status */
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data to a file */
 FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs);	/* Get number of free clusters on the drive */
+FRESULT f_scanfree (const TCHAR* path);								/* Advance free cluster scan on the drive */
 FRESULT f_truncate (FIL* fp);										/* Truncate file */
+FRESULT f_defrag (DEFRAG* dg, FIL* fp);								/* Start moving a file into contiguous clusters */
+FRESULT f_defragstep (DEFRAG* dg, UINT nsect);						/* Advance or cancel moving a file */
 FRESULT f_sync (FIL* fp);											/* Flush cached data of a writing file */
 FRESULT f_unlink (const TCHAR* path);								/* Delete an existing file or directory */
 FRESULT	f_mkdir (const TCHAR* path);								/* Create a new directory */
@@ -233,11 +266,67 @@ int f_puts (const TCHAR* str, FIL* cp);								/* Put a string to the file */
 int f_printf (FIL* fp, const TCHAR* str, ...);						/* Put a formatted string to the file */
 TCHAR* f_gets (TCHAR* buff, int len, FIL* fp);						/* Get a string from the file */
 
+#if _FS_TRACE && !defined(_FF_NO_TRACE)
+/* Traced calls, see _FS_TRACE in ffconf.h */
+#define	FF_TRACE(func, call)	(ff_trace_call(func), ff_trace_return(func, call))
+#define	f_mount(v,f)			FF_TRACE(FT_MOUNT, f_mount(v,f))
+#define	f_open(f,p,m)			FF_TRACE(FT_OPEN, f_open(f,p,m))
+#define	f_read(f,b,n,r)			FF_TRACE(FT_READ, f_read(f,b,n,r))
+#define	f_lseek(f,o)			FF_TRACE(FT_LSEEK, f_lseek(f,o))
+#define	f_close(f)				FF_TRACE(FT_CLOSE, f_close(f))
+#define	f_opendir(d,p)			FF_TRACE(FT_OPENDIR, f_opendir(d,p))
+#define	f_readdir(d,i)			FF_TRACE(FT_READDIR, f_readdir(d,i))
+#define	f_readdirs(d,i,c,n,a,p)	FF_TRACE(FT_READDIRS, f_readdirs(d,i,c,n,a,p))
+#define	f_stat(p,i)				FF_TRACE(FT_STAT, f_stat(p,i))
+#define	f_write(f,b,n,w)		FF_TRACE(FT_WRITE, f_write(f,b,n,w))
+#define	f_getfree(p,n,f)		FF_TRACE(FT_GETFREE, f_getfree(p,n,f))
+#define	f_truncate(f)			FF_TRACE(FT_TRUNCATE, f_truncate(f))
+#define	f_defrag(d,f)			FF_TRACE(FT_DEFRAG, f_defrag(d,f))
+#define	f_sync(f)				FF_TRACE(FT_SYNC, f_sync(f))
+#define	f_unlink(p)				FF_TRACE(FT_UNLINK, f_unlink(p))
+#define	f_mkdir(p)				FF_TRACE(FT_MKDIR, f_mkdir(p))
+#define	f_chmod(p,v,m)			FF_TRACE(FT_CHMOD, f_chmod(p,v,m))
+#define	f_utime(p,i)			FF_TRACE(FT_UTIME, f_utime(p,i))
+#define	f_rename(o,n)			FF_TRACE(FT_RENAME, f_rename(o,n))
+#define	f_chdrive(d)			FF_TRACE(FT_CHDRIVE, f_chdrive(d))
+#define	f_chdir(p)				FF_TRACE(FT_CHDIR, f_chdir(p))
+#define	f_getcwd(b,l)			FF_TRACE(FT_GETCWD, f_getcwd(b,l))
+#define	f_getlabel(p,l,s)		FF_TRACE(FT_GETLABEL, f_getlabel(p,l,s))
+#define	f_setlabel(l)			FF_TRACE(FT_SETLABEL, f_setlabel(l))
+#define	f_forward(f,c,n,r)		FF_TRACE(FT_FORWARD, f_forward(f,c,n,r))
+#define	f_mkfs(v,s,a)			FF_TRACE(FT_MKFS, f_mkfs(v,s,a))
+#define	f_fdisk(d,t,w)			FF_TRACE(FT_FDISK, f_fdisk(d,t,w))
+#endif
+
 #define f_eof(fp) (((fp)->fptr == (fp)->fsize) ? 1 : 0)
 #define f_error(fp) (((fp)->flag & FA__ERROR) ? 1 : 0)
 #define f_tell(fp) ((fp)->fptr)
 #define f_size(fp) ((fp)->fsize)
 
+#if _FS_FASTMOUNT
+/* Mount record structure (FMOUNT) */
+
+typedef struct {
+	BYTE	cid[16];		/* CID of the card */
+	DWORD	volid;			/* Volume serial number */
+	DWORD	bpbsum;			/* Checksum of the BPB */
+	BYTE	fs_type;		/* FAT sub-type */
+	BYTE	csize;			/* Sectors per cluster */
+	BYTE	n_fats;			/* Number of FAT copies */
+	WORD	n_rootdir;		/* Number of root directory entries */
+	DWORD	n_fatent;		/* Number of FAT entries */
+	DWORD	fsize;			/* Sectors per FAT */
+	DWORD	volbase;		/* Volume start sector */
+	DWORD	fatbase;		/* FAT start sector */
+	DWORD	dirbase;		/* Root directory start sector (FAT32:Cluster#) */
+	DWORD	database;		/* Data start sector */
+	DWORD	fsi_sector;		/* fsinfo sector (FAT32) */
+	DWORD	au_size;		/* Erase block size in unit of sector */
+} FMOUNT;
+#endif
+
+
+
 #ifndef EOF
 #define EOF (-1)
 #endif
@@ -263,6 +352,19 @@ void ff_memfree (void* mblock);			/* Free memory block */
 #endif
 #endif
 
+/* Mount record functions */
+#if _FS_FASTMOUNT
+int ff_fmount_load (BYTE pdrv, FMOUNT* rec);		/* Get the saved mount record of the drive (1:found) */
+void ff_fmount_save (BYTE pdrv, const FMOUNT* rec);	/* Save the mount record of the drive */
+void ff_fmount_stale (BYTE pdrv);					/* Drop the saved mount record of the drive */
+#endif
+
+/* Trace functions */
+#if _FS_TRACE
+void ff_trace_call (BYTE func);						/* An API function is called */
+FRESULT ff_trace_return (BYTE func, FRESULT res);	/* An API function returns res, passed on */
+#endif
+
 /* Sync functions */
 #if _FS_REENTRANT
 int ff_cre_syncobj (BYTE vol, _SYNC_t* sobj);	/* Create a sync object */
@@ -317,6 +419,37 @@ int ff_del_syncobj (_SYNC_t sobj);				/* Delete a sync object */
 #define CREATE_LINKMAP	0xFFFFFFFF
 
 
+/* API function numbers passed to the trace functions */
+
+#define FT_MOUNT	1
+#define FT_OPEN		2
+#define FT_READ		3
+#define FT_LSEEK	4
+#define FT_CLOSE	5
+#define FT_OPENDIR	6
+#define FT_READDIR	7
+#define FT_READDIRS	8
+#define FT_STAT		9
+#define FT_WRITE	10
+#define FT_GETFREE	11
+#define FT_TRUNCATE	12
+#define FT_SYNC		13
+#define FT_UNLINK	14
+#define FT_MKDIR	15
+#define FT_CHMOD	16
+#define FT_UTIME	17
+#define FT_RENAME	18
+#define FT_CHDRIVE	19
+#define FT_CHDIR	20
+#define FT_GETCWD	21
+#define FT_GETLABEL	22
+#define FT_SETLABEL	23
+#define FT_FORWARD	24
+#define FT_MKFS		25
+#define FT_FDISK	26
+#define FT_DEFRAG	27
+
+
 
 /*--------------------------------*/
 /* Multi-byte word access macros  */
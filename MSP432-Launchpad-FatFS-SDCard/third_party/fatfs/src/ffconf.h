@@ -20,6 +20,27 @@
 /  data transfer. This reduces memory consumption 512 bytes each file object. */
 
 
+#define	_FS_BUFPOOL		2	/* 0:Disable or >=1:Number of shared file buffers */
+/* When _FS_BUFPOOL is set to 1 or greater, the file object does not embed the
+/  sector buffer but borrows one from a pool of _FS_BUFPOOL buffers on access.
+/  A buffer stays with the file while it is in use, and the least recently used
+/  clean buffer is taken over when another file needs one. This allows many
+/  files to be opened with bounded memory. _FS_TINY must be 0 to enable it. */
+
+
+#define	_FS_RESERVE		16	/* 0:Disable or >=1:Clusters claimed ahead of a file at first */
+#define	_FS_RSVFILES	4	/* Number of files holding a claim at a time */
+/* When _FS_RESERVE is set to 1 or greater, a file that needs a new cluster
+/  claims a run of free clusters following its last one, and clusters for the
+/  other files and directories are taken from outside the claimed runs. The
+/  first run is up to _FS_RESERVE clusters and each following one is twice as
+/  long, up to 64 times, so files appended at the same time stay in long runs
+/  instead of taking turns cluster by cluster. Claims are kept in memory only
+/  and are dropped on f_close or when no other free cluster is left. Up to
+/  _FS_RSVFILES files hold a claim at a time and any more allocate as before.
+/  _FS_READONLY must be 0 to enable it. */
+
+
 #define _FS_READONLY	0	/* 0:Read/Write or 1:Read only */
 /* Setting _FS_READONLY to 1 defines read only configuration. This removes
 /  writing functions, f_write, f_sync, f_unlink, f_mkdir, f_chmod, f_rename,
@@ -36,14 +57,64 @@
 /   3: f_lseek is removed in addition to 2. */
 
 
-#define	_USE_STRFUNC	0	/* 0:Disable or 1-2:Enable */
+#define	_USE_STRFUNC	1	/* 0:Disable or 1-2:Enable */
 /* To enable string functions, set _USE_STRFUNC to 1 or 2. */
 
 
-#define	_USE_MKFS		0	/* 0:Disable or 1:Enable */
+#define	_USE_READDIRS	1	/* 0:Disable or 1:Enable */
+/* To enable f_readdirs function, set _USE_READDIRS to 1 and set _FS_MINIMIZE
+/  to 0 or 1. f_readdirs reads a run of directory items into an array in one
+/  call, skipping the items that have any of the given attributes or whose
+/  name does not match a pattern with ? and * wildcards. */
+
+
+#define	_USE_MKFS		1	/* 0:Disable or 1:Enable */
 /* To enable f_mkfs function, set _USE_MKFS to 1 and set _FS_READONLY to 0 */
 
 
+#define	_FS_SCANFREE	16	/* 0:Disable or >=1:FAT sectors to scan per step */
+/* When _FS_SCANFREE is set to 1 or greater, an unknown free cluster count is
+/  worked out in steps of _FS_SCANFREE FAT sectors instead of a full FAT scan
+/  in f_getfree. f_getfree takes one step and returns FR_IN_PROGRESS with the
+/  count so far until the scan is finished, and f_scanfree takes a step from
+/  the idle loop of the application. */
+
+
+#define	_USE_DEFRAG		1	/* 0:Disable or 1:Enable */
+/* To enable f_defrag and f_defragstep functions, set _USE_DEFRAG to 1 and set
+/  _FS_MINIMIZE to 0. f_defrag starts moving a fragmented file into a free run
+/  of contiguous clusters, and f_defragstep does a part of the work at a time
+/  from the idle loop of the application. The new clusters are claimed in
+/  memory while they are copied to, which keeps other files off them when
+/  _FS_RESERVE is enabled, and are linked as a chain only when all data are
+/  copied. The file is then switched over to them in one directory entry
+/  write, so that a power loss leaves either copy in place, and can lose free
+/  space only from the linking until the old clusters are freed. */
+
+
+#define	_FS_FASTMOUNT	1	/* 0:Disable or 1:Enable */
+/* When _FS_FASTMOUNT is set to 1, the volume geometry found on mounting is
+/  saved in a mount record keyed by the card CID and the volume serial number.
+/  The next mount of the same volume verifies the record with a read of the
+/  boot sector instead of searching the partition table. Unlike the volume
+/  geometry, the free space hints (free cluster count and last allocated
+/  cluster) are not saved. Another host can change the FAT and leave the count
+/  in FSInfo unknown, and no check of FSInfo could then tell its card from one
+/  this firmware left as it was. So a fast mount reads FSInfo as a full mount
+/  does (FAT32), and the free clusters of a FAT12/16 volume are counted again
+/  on the first f_getfree. User provided functions ff_fmount_load,
+/  ff_fmount_save and ff_fmount_stale must be added to the project, and the
+/  disk_ioctl function must support the MMC_GET_CID command. */
+
+
+#define	_FS_TRACE	1	/* 0:Disable or 1:Enable */
+/* When _FS_TRACE is set to 1, the calls of the application to the API
+/  functions that return FRESULT are wrapped by macros in ff.h, which call
+/  the user provided functions ff_trace_call before and ff_trace_return after
+/  the function. Calls within the module itself are not wrapped. f_scanfree
+/  and f_defragstep are left out as they are called from the idle loop. */
+
+
 #define	_USE_FASTSEEK	0	/* 0:Disable or 1:Enable */
 /* To enable fast seek feature, set _USE_FASTSEEK to 1. */
 
@@ -130,8 +201,10 @@
 / Physical Drive Configurations
 /----------------------------------------------------------------------------*/
 
-#define _VOLUMES	1
-/* Number of volumes (logical drives) to be used. */
+#define _VOLUMES	3
+/* Number of volumes (logical drives) to be used. The MMC port maps drive 0 and
+/  1 to the SD cards on its two chip selects, and drive 2 to the RAM disk
+/  (_USE_RAMDISK in diskio.h). */
 
 
 #define	_MAX_SS		512		/* 512, 1024, 2048 or 4096 */
@@ -148,11 +221,19 @@
 / is tied to the partitions listed in VolToPart[]. */
 
 
-#define	_USE_ERASE	0	/* 0:Disable or 1:Enable */
+#define	_USE_ERASE	1	/* 0:Disable or 1:Enable */
 /* To enable sector erase feature, set _USE_ERASE to 1. CTRL_ERASE_SECTOR command
 /  should be added to the disk_ioctl functio. */
 
 
+#define	_FS_FATTYPES	7	/* FAT sub-types to support (b0:FAT12, b1:FAT16, b2:FAT32) */
+/* Volumes of a FAT sub-type left out of _FS_FATTYPES are rejected by f_mount
+/  and are not created by f_mkfs. When a single sub-type is selected, the FAT
+/  access functions are built for that sub-type only, e.g. 4 for a system that
+/  uses SDHC cards alone. A FAT32-only build also looks for free clusters by
+/  scanning the FAT sector by sector. */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -0,0 +1,241 @@
+/*
+ * timebase.c - monotonic microsecond time base and software timers
+ *
+ * Timer32 module 0 counts down from 0xFFFFFFFF at MCLK and reloads. Each
+ * reload raises T32_INT1, which extends the count to 64 bits. SysTick
+ * serves the software timers: it is programmed to fire at the earliest
+ * pending deadline and stays off while no timer is pending (TB_TICKLESS),
+ * or ticks every TB_TICK_US and checks the timers each time. tb_Sleep()
+ * waits in LPM0 for a timer of its own.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "driverlib.h"
+#include "timebase.h"
+
+/* 1: SysTick only fires when a timer is due, 0: SysTick ticks periodically */
+#define TB_TICKLESS             1
+
+/* Tick period when TB_TICKLESS is 0 */
+#define TB_TICK_US              10000
+
+/* Longest SysTick period (24-bit reload register) */
+#define TB_SYSTICK_MAX          0x00FFFFFF
+
+static volatile uint32_t g_ui32Wraps;   /* Timer32 reloads since g_ui64Base */
+static uint32_t g_ui32Clock;            /* Timer32 and SysTick clock in Hz */
+static uint64_t g_ui64Base;             /* Time when Timer32 was last loaded */
+static tTimer *g_psTimers;              /* Pending timers, earliest first */
+
+/* Convert Timer32 counts to microseconds without overflowing 64 bits */
+static uint64_t
+ticks_to_us(uint64_t ui64Ticks)
+{
+    return (ui64Ticks / g_ui32Clock) * 1000000
+           + (ui64Ticks % g_ui32Clock) * 1000000 / g_ui32Clock;
+}
+
+#if TB_TICKLESS
+/* Program SysTick to fire at the deadline of the first pending timer */
+static void
+arm_systick(void)
+{
+    uint64_t ui64Now, ui64Ticks;
+
+    SysTick_disableModule();
+    if (!g_psTimers) return;
+
+    ui64Now = tb_Now();
+    ui64Ticks = 1;
+    if (g_psTimers->ui64Deadline > ui64Now)
+        ui64Ticks = (g_psTimers->ui64Deadline - ui64Now) * g_ui32Clock
+                    / 1000000 + 1;
+    if (ui64Ticks < 64) ui64Ticks = 64;        /* Leave the ISR time to exit */
+    if (ui64Ticks > TB_SYSTICK_MAX) ui64Ticks = TB_SYSTICK_MAX;
+
+    SysTick_setPeriod((uint32_t)ui64Ticks);
+    SysTick->VAL = 0;                           /* Restart from the new period */
+    SysTick_enableInterrupt();
+    SysTick_enableModule();
+}
+#endif
+
+void
+tb_Init(void)
+{
+    g_ui32Clock = CS_getMCLK();
+    g_ui32Wraps = 0;
+    g_ui64Base = 0;
+
+    Timer32_initModule(TIMER32_0_MODULE, TIMER32_PRESCALER_1, TIMER32_32BIT,
+                       TIMER32_PERIODIC_MODE);
+    Timer32_setCount(TIMER32_0_MODULE, 0xFFFFFFFF);
+    Timer32_clearInterruptFlag(TIMER32_0_MODULE);
+    Timer32_enableInterrupt(TIMER32_0_MODULE);
+    Interrupt_enableInterrupt(INT_T32_INT1);
+    Timer32_startTimer(TIMER32_0_MODULE, false);
+
+#if !TB_TICKLESS
+    SysTick_setPeriod(g_ui32Clock / 1000000 * TB_TICK_US);
+    SysTick_enableInterrupt();
+    SysTick_enableModule();
+#endif
+}
+
+uint64_t
+tb_Now(void)
+{
+    uint32_t ui32Wraps, ui32Count, ui32Pending;
+
+    /* Read the wrap count and the counter consistently. If the counter has
+     * reloaded but T32_INT1 has not been served yet (interrupts masked), the
+     * pending flag accounts for the missing wrap. */
+    do {
+        ui32Wraps = g_ui32Wraps;
+        ui32Count = Timer32_getValue(TIMER32_0_MODULE);
+        ui32Pending = Timer32_getInterruptStatus(TIMER32_0_MODULE);
+    } while (ui32Wraps != g_ui32Wraps);
+    if (ui32Pending && ui32Count > 0x80000000) ui32Wraps++;
+
+    return g_ui64Base
+           + ticks_to_us(((uint64_t)ui32Wraps << 32) | (0xFFFFFFFF - ui32Count));
+}
+
+void
+tb_Rebase(void)
+{
+    bool bMasked;
+
+    if (!g_ui32Clock) return;                   /* tb_Init() not called yet */
+
+    bMasked = Interrupt_disableMaster();
+
+    /* Writing the load value restarts the count from it */
+    g_ui64Base = tb_Now();
+    Timer32_setCount(TIMER32_0_MODULE, 0xFFFFFFFF);
+    Timer32_clearInterruptFlag(TIMER32_0_MODULE);
+    g_ui32Wraps = 0;
+    g_ui32Clock = CS_getMCLK();
+
+#if TB_TICKLESS
+    arm_systick();
+#else
+    SysTick_setPeriod(g_ui32Clock / 1000000 * TB_TICK_US);
+#endif
+
+    if (!bMasked) Interrupt_enableMaster();
+}
+
+uint64_t
+tb_Deadline(uint32_t ui32Us)
+{
+    return tb_Now() + ui32Us;
+}
+
+bool
+tb_Expired(uint64_t ui64Deadline)
+{
+    return tb_Now() >= ui64Deadline;
+}
+
+/* Timer callback of tb_Sleep(), the wake-up itself is all it needs */
+static void
+wake(tTimer *psTimer)
+{
+    (void)psTimer;
+}
+
+void
+tb_Sleep(uint32_t ui32Us)
+{
+    tTimer sTimer;
+
+    sTimer.bPending = false;
+    tb_TimerStart(&sTimer, ui32Us, wake);
+
+    /* WFI also wakes up on an interrupt that is pending while the master
+     * enable is off, so the timer cannot expire between the check and the
+     * sleep. Each wake-up serves the interrupt and checks again. */
+    Interrupt_disableMaster();
+    while (sTimer.bPending) {
+        PCM_gotoLPM0();
+        Interrupt_enableMaster();
+        Interrupt_disableMaster();
+    }
+    Interrupt_enableMaster();
+}
+
+void
+tb_TimerStart(tTimer *psTimer, uint32_t ui32Us,
+              void (*pfnCallback)(tTimer *psTimer))
+{
+    tTimer **ppsNext;
+    bool bMasked;
+
+    bMasked = Interrupt_disableMaster();
+
+    if (psTimer->bPending) tb_TimerStop(psTimer);
+    psTimer->ui64Deadline = tb_Now() + ui32Us;
+    psTimer->pfnCallback = pfnCallback;
+
+    /* Keep the list in deadline order, equal deadlines in start order */
+    for (ppsNext = &g_psTimers;
+         *ppsNext && (*ppsNext)->ui64Deadline <= psTimer->ui64Deadline;
+         ppsNext = &(*ppsNext)->psNext) ;
+    psTimer->psNext = *ppsNext;
+    *ppsNext = psTimer;
+    psTimer->bPending = true;
+
+#if TB_TICKLESS
+    if (g_psTimers == psTimer) arm_systick();   /* New earliest deadline */
+#endif
+
+    if (!bMasked) Interrupt_enableMaster();
+}
+
+void
+tb_TimerStop(tTimer *psTimer)
+{
+    tTimer **ppsNext;
+    bool bMasked;
+
+    bMasked = Interrupt_disableMaster();
+
+    if (psTimer->bPending) {
+        for (ppsNext = &g_psTimers; *ppsNext != psTimer;
+             ppsNext = &(*ppsNext)->psNext) ;
+        *ppsNext = psTimer->psNext;
+        psTimer->bPending = false;
+#if TB_TICKLESS
+        if (ppsNext == &g_psTimers) arm_systick();
+#endif
+    }
+
+    if (!bMasked) Interrupt_enableMaster();
+}
+
+/* Timer32 reloaded: one more 2^32 counts */
+void
+T32_INT1_ISR(void)
+{
+    Timer32_clearInterruptFlag(TIMER32_0_MODULE);
+    g_ui32Wraps++;
+}
+
+/* Run the callbacks of the timers that are due */
+void
+SysTick_ISR(void)
+{
+    tTimer *psTimer;
+
+    while ((psTimer = g_psTimers) && tb_Expired(psTimer->ui64Deadline)) {
+        g_psTimers = psTimer->psNext;
+        psTimer->bPending = false;
+        psTimer->pfnCallback(psTimer);
+    }
+
+#if TB_TICKLESS
+    arm_systick();
+#endif
+}
@@ -0,0 +1,66 @@
+/*
+ * timebase.h - monotonic microsecond time base and software timers
+ *
+ * Timer32 module 0 runs free from MCLK and its wrap-arounds are counted in
+ * an interrupt, which gives a 64-bit microsecond clock that does not wrap.
+ * Waits poll a deadline taken from it. Software timers call back from the
+ * SysTick interrupt, which is only armed while a timer is pending.
+ */
+
+#ifndef __TIMEBASE_H__
+#define __TIMEBASE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A software timer. The structure is owned by the caller and linked into the
+ * pending list while the timer runs. */
+typedef struct tTimer {
+    struct tTimer *psNext;          /* Next pending timer (later deadline) */
+    uint64_t ui64Deadline;          /* Expiry time in microseconds */
+    void (*pfnCallback)(struct tTimer *psTimer);    /* Called on expiry */
+    bool bPending;                  /* In the pending list */
+} tTimer;
+
+/* Start the time base. MCLK must be set up before. */
+void tb_Init(void);
+
+/* Microseconds since tb_Init() */
+uint64_t tb_Now(void);
+
+/* Carry the time over a change of the MCLK frequency. To be called right
+ * after the change; the time spent switching is counted at the old rate. */
+void tb_Rebase(void);
+
+/* Deadline ui32Us microseconds from now, for tb_Expired() */
+uint64_t tb_Deadline(uint32_t ui32Us);
+
+/* Whether a deadline has passed */
+bool tb_Expired(uint64_t ui64Deadline);
+
+/* Sleep in LPM0 for at least ui32Us microseconds. Other interrupts are served
+ * meanwhile. Must not be called from an interrupt handler. */
+void tb_Sleep(uint32_t ui32Us);
+
+/* Start a timer that calls pfnCallback from the SysTick interrupt after
+ * ui32Us microseconds. A running timer is restarted. The callback may start
+ * the timer again for periodic use. */
+void tb_TimerStart(tTimer *psTimer, uint32_t ui32Us,
+                   void (*pfnCallback)(tTimer *psTimer));
+
+/* Stop a timer if it is pending */
+void tb_TimerStop(tTimer *psTimer);
+
+/* Interrupt handlers, installed in the vector table */
+void T32_INT1_ISR(void);
+void SysTick_ISR(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TIMEBASE_H__ */
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""Block compressed files of the SD card example.
+
+    lzb.py unpack IN [OUT]      data of a file written through lzb.c
+    lzb.py pack IN [OUT]        a file that cat on the board shows unpacked
+
+"-" or no OUT is standard output, and IN "-" standard input. The format is
+the one of lzb.h: "LZB1", then blocks of at most 2048 bytes of data, each
+with its size before and after packing, 16 bits each, and the data in the
+LZ4 block format, or as it is if that is no smaller. A block cut short at
+the end, as a reset while writing leaves, ends the data. Needs only the
+standard library.
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"LZB1"
+BLOCK = 2048
+HEADER = struct.Struct("<HH")
+MIN_MATCH, MF_LIMIT, LAST_LITERALS = 4, 12, 5
+
+
+def unpack_block(src, size):
+    out = bytearray()
+    pos = 0
+
+    def length(n):
+        nonlocal pos
+        if n == 15:
+            while True:
+                b = src[pos]
+                pos += 1
+                n += b
+                if b != 255:
+                    break
+        return n
+
+    try:
+        while pos < len(src):
+            token = src[pos]
+            pos += 1
+            n = length(token >> 4)
+            out += src[pos:pos + n]
+            pos += n
+            if pos >= len(src):
+                break
+            dist = src[pos] | src[pos + 1] << 8
+            pos += 2
+            n = length(token & 15) + MIN_MATCH
+            if not 0 < dist <= len(out):
+                raise ValueError
+            for _ in range(n):
+                out.append(out[-dist])
+    except (IndexError, ValueError):
+        raise ValueError("damaged block")
+    if len(out) != size:
+        raise ValueError("damaged block")
+    return bytes(out)
+
+
+def pack_block(src):
+    out = bytearray()
+
+    def sequence(lit, dist=0, match=0):
+        n = len(lit)
+        token = min(n, 15) << 4
+        tail = bytearray()
+        if n >= 15:
+            tail += b"\xff" * ((n - 15) // 255) + bytes([(n - 15) % 255])
+        tail += lit
+        if match:
+            tail += bytes([dist & 255, dist >> 8])
+            m = match - MIN_MATCH
+            token |= min(m, 15)
+            if m >= 15:
+                tail += b"\xff" * ((m - 15) // 255) + bytes([(m - 15) % 255])
+        out.append(token)
+        out.extend(tail)
+
+    last, pos, anchor = {}, 0, 0
+    while len(src) > MF_LIMIT and pos < len(src) - MF_LIMIT:
+        key = src[pos:pos + 4]
+        ref = last.get(key)
+        last[key] = pos
+        if ref is None:
+            pos += 1
+            continue
+        match = MIN_MATCH
+        while (pos + match < len(src) - LAST_LITERALS and
+               src[ref + match] == src[pos + match]):
+            match += 1
+        sequence(src[anchor:pos], pos - ref, match)
+        pos += match
+        anchor = pos
+    sequence(src[anchor:])
+    return bytes(out)
+
+
+def unpack(data):
+    if data[:4] != MAGIC:
+        return data
+    out, pos = [], 4
+    while pos + HEADER.size <= len(data):
+        raw, stored = HEADER.unpack_from(data, pos)
+        pos += HEADER.size
+        if not 0 < stored <= raw <= BLOCK or pos + stored > len(data):
+            break
+        block = data[pos:pos + stored]
+        out.append(block if stored == raw else unpack_block(block, raw))
+        pos += stored
+    return b"".join(out)
+
+
+def pack(data):
+    out = [MAGIC]
+    for pos in range(0, len(data), BLOCK):
+        block = data[pos:pos + BLOCK]
+        packed = pack_block(block)
+        if len(packed) >= len(block):
+            packed = block
+        out += [HEADER.pack(len(block), len(packed)), packed]
+    return b"".join(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("command", choices=("pack", "unpack"))
+    ap.add_argument("input")
+    ap.add_argument("output", nargs="?", default="-")
+    args = ap.parse_args()
+
+    try:
+        if args.input == "-":
+            data = sys.stdin.buffer.read()
+        else:
+            with open(args.input, "rb") as f:
+                data = f.read()
+        data = pack(data) if args.command == "pack" else unpack(data)
+        if args.output == "-":
+            sys.stdout.buffer.write(data)
+        else:
+            with open(args.output, "wb") as f:
+                f.write(data)
+    except (ValueError, OSError) as e:
+        sys.stderr.write("%s\n" % e)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+"""Flat profile from the prof command of the SD card example.
+
+    profsym.py [-c] [-n N] ELF DUMP          symbolize a saved dump
+    profsym.py [-c] [-n N] [-b BAUD] -p PORT ELF   fetch it with "prof dump"
+
+DUMP is a capture of the console with the output of "prof dump" in it; the
+last one is used, and "-" reads standard input. ELF is the linked program
+(.out) the board runs. With -c the callers of each function are listed as
+well, from the link register of the samples taken in it; for a function that
+calls others this is only the last return address, not necessarily its
+caller. Needs only the standard library.
+"""
+
+import argparse
+import bisect
+import re
+import struct
+import sys
+from collections import Counter, defaultdict
+
+STT_FUNC = 2
+SHT_SYMTAB = 2
+HEADER = re.compile(r"prof (\d+) Hz (\d+) samples (\d+) dropped")
+
+
+class Symbols:
+    """Function symbols of a 32-bit little endian ELF file"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            raise ValueError("%s: not a 32-bit little endian ELF file" % path)
+        shoff, = struct.unpack_from("<I", data, 32)
+        shentsize, shnum = struct.unpack_from("<HH", data, 46)
+        sections = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize)
+                    for i in range(shnum)]
+
+        funcs = {}
+        for sh in sections:
+            if sh[1] != SHT_SYMTAB:
+                continue
+            strtab = sections[sh[6]]
+            for ofs in range(sh[4], sh[4] + sh[5], 16):
+                name, value, size, info, _, shndx = struct.unpack_from(
+                    "<IIIBBH", data, ofs)
+                if info & 15 != STT_FUNC or not shndx:
+                    continue
+                start = strtab[4] + name
+                name = data[start:data.index(b"\0", start)].decode("latin-1")
+                addr = value & ~1                       # Thumb bit
+                if addr not in funcs or funcs[addr][1] < size:
+                    funcs[addr] = (name, size)
+
+        self.starts = sorted(funcs)
+        self.funcs = [funcs[a] for a in self.starts]
+
+    def lookup(self, addr):
+        """Name of the function holding addr, or None"""
+        i = bisect.bisect_right(self.starts, addr & ~1) - 1
+        if i < 0:
+            return None
+        name, size = self.funcs[i]
+        end = self.starts[i] + size if size else (
+            self.starts[i + 1] if i + 1 < len(self.starts) else addr + 1)
+        return name if addr < end else None
+
+
+class Dump:
+    """Header and samples of the last complete prof dump in some text"""
+
+    def __init__(self, text):
+        self.hz = self.total = self.dropped = None
+        samples = None
+        for line in text.splitlines():
+            f = line.split()
+            m = HEADER.search(line)
+            if m:
+                self.hz, self.total, self.dropped = map(int, m.groups())
+                samples = []
+            elif f == ["prof", "end"] and samples is not None:
+                self.samples = samples
+                samples = None
+            elif samples is not None and len(f) == 3:
+                samples.append((int(f[0], 16), int(f[1], 16), int(f[2])))
+        if not hasattr(self, "samples"):
+            raise ValueError("no complete prof dump found")
+
+
+def describe(syms, addr):
+    if addr >= 0xFFFFFFE0:
+        return "[exception return]"
+    return syms.lookup(addr) or "[0x%08x]" % addr
+
+
+def profile(syms, dump):
+    """(self, callers) counted by function name"""
+    counts = Counter()
+    callers = defaultdict(Counter)
+    for pc, lr, n in dump.samples:
+        name = describe(syms, pc)
+        counts[name] += n
+        if lr:
+            callers[name][describe(syms, lr)] += n
+    return counts, callers
+
+
+def report(syms, dump, limit=None, show_callers=False, out=sys.stdout):
+    counts, callers = profile(syms, dump)
+    total = sum(counts.values())
+    out.write("%d samples at %d Hz, %d dropped\n\n"
+              % (dump.total, dump.hz, dump.dropped))
+    out.write("  %time  cumul%  samples  seconds  function\n")
+    cumul = 0
+    for name, n in counts.most_common(limit):
+        cumul += n
+        out.write("%7.2f %7.2f %8d %8.3f  %s\n"
+                  % (100.0 * n / total, 100.0 * cumul / total, n,
+                     n / dump.hz if dump.hz else 0, name))
+        if show_callers:
+            for caller, m in callers[name].most_common(5):
+                out.write("%34d  <- %s\n" % (m, caller))
+
+
+def fetch(port_path, baud):
+    from ymodem import Cancelled, Port
+    port = Port(port_path, baud)
+    port.write(b"prof dump\r")
+    try:
+        return port.wait_for(b"prof end", 30.0).decode("latin-1")
+    except Cancelled as e:
+        raise ValueError(str(e))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-b", "--baud", type=int, default=115200)
+    ap.add_argument("-p", "--port", help="read the dump from the board")
+    ap.add_argument("-c", "--callers", action="store_true")
+    ap.add_argument("-n", "--limit", type=int, help="functions to list")
+    ap.add_argument("elf")
+    ap.add_argument("dump", nargs="?")
+    args = ap.parse_args()
+
+    try:
+        if args.port:
+            text = fetch(args.port, args.baud)
+        elif args.dump in (None, "-"):
+            text = sys.stdin.read()
+        else:
+            with open(args.dump, encoding="latin-1") as f:
+                text = f.read()
+        report(Symbols(args.elf), Dump(text), args.limit, args.callers)
+    except (ValueError, OSError) as e:
+        sys.stderr.write("%s\n" % e)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Records of the record log of the SD card example.
+
+    reclog.py [-f FROM] [-t TO] [-x] PATH...
+
+PATH is a log directory, e.g. LOG on the card in a card reader, or single
+.RL files. The records stamped FROM to TO are printed one to a line, the time
+first, then the data as text, or in hex with -x. Frames that fail their
+CRC-32 are reported on standard error and skipped. The frame layout is the
+one of reclog.h. Needs only the standard library.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+import zlib
+
+FRAME_SIZE = 512
+FRAME_HDR = struct.Struct("<IIIIHHI")
+RECORD_HDR = struct.Struct("<IH")
+MAGIC = 0x31474C52
+LOG_NAME = re.compile(r"^\d{8}\.RL$", re.IGNORECASE)
+
+
+def log_files(paths):
+    files = []
+    for path in paths:
+        if os.path.isdir(path):
+            files += sorted(os.path.join(path, n) for n in os.listdir(path)
+                            if LOG_NAME.match(n))
+        else:
+            files.append(path)
+    return files
+
+
+def records(path):
+    """(time, data) of the records of a log file, in order"""
+    with open(path, "rb") as f:
+        data = f.read()
+    for n in range(len(data) // FRAME_SIZE):
+        frame = bytearray(data[n * FRAME_SIZE:(n + 1) * FRAME_SIZE])
+        magic, number, first, last, count, used, crc = \
+            FRAME_HDR.unpack_from(frame)
+        ok = (magic == MAGIC and number == n and
+              used <= FRAME_SIZE - FRAME_HDR.size)
+        if ok:
+            frame[20:24] = bytes(4)
+            ok = zlib.crc32(frame[:FRAME_HDR.size + used]) == crc
+        if not ok:
+            sys.stderr.write("%s: frame %d is bad\n" % (path, n))
+            continue
+        pos, end = FRAME_HDR.size, FRAME_HDR.size + used
+        while pos + RECORD_HDR.size <= end:
+            time, size = RECORD_HDR.unpack_from(frame, pos)
+            pos += RECORD_HDR.size
+            yield time, bytes(frame[pos:pos + size])
+            pos += size
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-f", "--from", dest="first", type=int, default=0)
+    ap.add_argument("-t", "--to", dest="last", type=int, default=0xFFFFFFFF)
+    ap.add_argument("-x", "--hex", action="store_true",
+                    help="print the data in hex")
+    ap.add_argument("path", nargs="+")
+    args = ap.parse_args()
+
+    try:
+        for path in log_files(args.path):
+            for time, data in records(path):
+                if time < args.first or time > args.last:
+                    continue
+                text = data.hex() if args.hex else \
+                    data.decode("latin-1").rstrip("\0")
+                print("%10u %s" % (time, text))
+    except OSError as e:
+        sys.stderr.write("%s\n" % e)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
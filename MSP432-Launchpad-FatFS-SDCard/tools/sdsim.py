@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""Host tests of FatFs and the MMC port against simulated SD cards.
+
+    sdsim.py [-O] [-s NAME=VALUE]... [TEST]... [-- ARGS]
+
+Each TEST is a tools/sdsim/test_NAME.c, given as NAME or as its path; all of
+them run when none is given. A test is built with gcc from the sources of
+third_party/fatfs, spiBus.c, trace.c and tools/sdsim/sdsim.c, which stands in
+for driverlib and the cards, and then run with ARGS. It passes when it exits
+with 0. The build uses copies of the FatFs sources in a temporary directory,
+so that the settings of ffconf.h, diskio.h and the ports can be changed:
+
+    * sdsim: set NAME VALUE     in the header comment of a test, or -s on the
+                                command line, sets the #define of NAME
+    * sdsim: src FILE           also links FILE of the project, e.g. lzb.c
+    * sdsim: vary NAME V1 V2... builds and runs the test once for each value
+                                of NAME, to compare the builds
+
+f_mkfs() is always enabled, and the flash of the fast mount records and of
+the staging log is simulated. -O builds with optimization and without the
+sanitizers, for the timings that the tests print. Needs gcc.
+"""
+
+import argparse
+import glob
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+TOOLS = os.path.dirname(os.path.abspath(__file__))
+PROJECT = os.path.dirname(TOOLS)
+SIM = os.path.join(TOOLS, "sdsim")
+FATFS = os.path.join(PROJECT, "third_party", "fatfs")
+
+DIRECTIVE = re.compile(r"^\s*\*\s*sdsim:\s*(set|src|vary)\s+(\S+)\s*(.*?)\s*$")
+
+# Settings of every build, before those of the test
+DEFAULTS = [
+    ("_USE_MKFS", "1"),
+    ("FM_FLASH_ADDR", "((uintptr_t)sim_flash)"),
+    ("ST_FLASH_ADDR", "((uintptr_t)sim_stage)"),
+    ("ST_FLASH_BANK_ADDR", "(ST_FLASH_ADDR-0x17000)"),
+]
+
+CFLAGS = ["-std=gnu99", "-g", "-Wall", "-Wno-format", "-Wno-unused"]
+SANITIZE = ["-O1", "-fsanitize=address,undefined", "-fno-sanitize-recover"]
+
+
+def directives(path):
+    """(settings, sources, variants) of the header comment of a test"""
+    settings, sources, variants = [], [], [[]]
+    with open(path) as f:
+        for line in f:
+            m = DIRECTIVE.match(line)
+            if m and m.group(1) == "set":
+                settings.append((m.group(2), m.group(3)))
+            elif m and m.group(1) == "vary":
+                variants = [v + [(m.group(2), value)] for v in variants
+                            for value in m.group(3).split()]
+            elif m:
+                sources.append(m.group(2))
+            if line.startswith(" */"):
+                break
+    return settings, sources, variants
+
+
+def configure(build, settings):
+    """Copy FatFs into build and apply the settings"""
+    for sub in ("src", "port"):
+        shutil.copytree(os.path.join(FATFS, sub),
+                        os.path.join(build, "fatfs", sub))
+    files = sorted(glob.glob(os.path.join(build, "fatfs", "*", "*.[ch]")))
+    texts = {}
+    for path in files:
+        with open(path, newline="") as f:
+            texts[path] = f.read()
+    for name, value in settings:
+        define = re.compile(r"^(\s*#define[ \t]+%s[ \t]+)[^\s/]+" % re.escape(name),
+                            re.M)
+        hits = [p for p in files if define.search(texts[p])]
+        if not hits:
+            raise ValueError("no #define %s to set" % name)
+        for path in hits:
+            texts[path] = define.sub(lambda m: m.group(1) + value, texts[path])
+    for path in files:
+        with open(path, "w", newline="") as f:
+            f.write(texts[path])
+
+
+def run(test, settings, optimize, args):
+    """Build and run one test, once per variant; True when all pass"""
+    own, sources, variants = directives(test)
+    for variant in variants:
+        if len(variants) > 1:
+            print("-- %s" % " ".join("%s=%s" % v for v in variant))
+        if not build_and_run(test, own + variant + settings, sources,
+                             optimize, args):
+            return False
+    return True
+
+
+def build_and_run(test, settings, sources, optimize, args):
+    """Build and run one test with the settings; True when it passes"""
+    build = tempfile.mkdtemp(prefix="sdsim-")
+    try:
+        configure(build, DEFAULTS + settings)
+        exe = os.path.join(build, "test")
+        cmd = (["gcc"] + CFLAGS + (["-O2"] if optimize else SANITIZE) +
+               ["-include", "sdsim.h", "-I", SIM,
+                "-I", os.path.join(build, "fatfs", "src"), "-I", build,
+                "-I", PROJECT, "-o", exe,
+                os.path.join(build, "fatfs", "src", "ff.c")] +
+               sorted(glob.glob(os.path.join(build, "fatfs", "port", "*.c"))) +
+               [os.path.join(SIM, "sdsim.c"),
+                os.path.join(PROJECT, "spiBus.c"),
+                os.path.join(PROJECT, "trace.c")] +
+               [os.path.join(PROJECT, s) for s in sources] + [test])
+        if subprocess.call(cmd) != 0:
+            return False
+        sys.stdout.flush()
+        return subprocess.call([exe] + args, cwd=build) == 0
+    finally:
+        shutil.rmtree(build)
+
+
+def main():
+    argv = sys.argv[1:]
+    args = []
+    if "--" in argv:
+        args = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-O", "--optimize", action="store_true",
+                    help="optimize, no sanitizers")
+    ap.add_argument("-s", "--set", action="append", default=[],
+                    metavar="NAME=VALUE", help="change a #define")
+    ap.add_argument("tests", nargs="*")
+    opts = ap.parse_args(argv)
+
+    settings = []
+    for s in opts.set:
+        name, _, value = s.partition("=")
+        settings.append((name, value))
+
+    tests = []
+    for t in opts.tests or sorted(glob.glob(os.path.join(SIM, "test_*.c"))):
+        if not os.path.exists(t):
+            t = os.path.join(SIM, "test_%s.c" % t)
+        tests.append(t)
+
+    failed = []
+    for t in tests:
+        name = os.path.basename(t)[5:-2]
+        print("== %s" % name)
+        sys.stdout.flush()
+        try:
+            ok = run(t, settings, opts.optimize, args)
+        except (ValueError, OSError) as e:
+            sys.stderr.write("%s\n" % e)
+            ok = False
+        print("== %s %s" % (name, "ok" if ok else "FAILED"))
+        if not ok:
+            failed.append(name)
+
+    if failed:
+        print("failed: %s" % " ".join(failed))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
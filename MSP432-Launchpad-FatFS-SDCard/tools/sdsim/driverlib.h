@@ -0,0 +1,127 @@
+/*
+ * driverlib.h - the parts of MSP432 driverlib that the host tests need
+ *
+ * Declarations only, with the values of the SDK where they matter. sdsim.c
+ * implements the SPI, GPIO, interrupt and flash calls; a test that links a
+ * module using more brings its own definitions. UCB0TXBUF and UCB0RXBUF are
+ * the SPI data registers of the simulated bus: reading UCB0RXBUF exchanges
+ * the byte written to UCB0TXBUF.
+ */
+#ifndef __DRIVERLIB__H_
+#define __DRIVERLIB__H_
+#include <stdint.h>
+#include <stdbool.h>
+extern volatile uint32_t WDTCTL, UCA0IFG, UCA0TXBUF, UCA0RXBUF, P4OUT, UCA0IE, UCB0IE;
+extern volatile uint32_t sim_txbuf; uint8_t sim_rx(void);
+#define UCB0TXBUF sim_txbuf
+#define UCB0RXBUF sim_rx()
+#define UCB0IFG 3
+#define WDTPW 0x5A00
+#define WDTHOLD 0x80
+#define UCTXIFG 2
+#define UCRXIFG 1
+#define BIT0 1
+#define BIT6 0x40
+#define BIT7 0x80
+#define GPIO_PORT_P1 1
+#define GPIO_PORT_P2 2
+#define GPIO_PORT_P3 3
+#define GPIO_PORT_P4 4
+#define GPIO_PORT_P5 5
+#define GPIO_PORT_P6 6
+#define GPIO_PIN0 1
+#define GPIO_PIN1 2
+#define GPIO_PIN2 4
+#define GPIO_PIN3 8
+#define GPIO_PIN4 16
+#define GPIO_PIN5 32
+#define GPIO_PIN6 64
+#define GPIO_PIN7 128
+#define GPIO_PRIMARY_MODULE_FUNCTION 1
+#define EUSCI_A0_MODULE 0x40001000
+#define EUSCI_A0_BASE 0x40001000
+#define EUSCI_B0_MODULE 0x40002000
+#define EUSCI_B0_BASE 0x40002000
+#define INT_EUSCIA0 32
+#define INT_T32_INT1 41
+#define INT_T32_INT2 42
+#define EUSCI_A_UART_RECEIVE_INTERRUPT 1
+#define EUSCI_A_UART_CLOCKSOURCE_SMCLK 0x80
+#define EUSCI_A_UART_NO_PARITY 0
+#define EUSCI_A_UART_LSB_FIRST 0
+#define EUSCI_A_UART_ONE_STOP_BIT 0
+#define EUSCI_A_UART_MODE 0
+#define EUSCI_A_UART_LOW_FREQUENCY_BAUDRATE_GENERATION 0
+#define EUSCI_A_UART_OVERSAMPLING_BAUDRATE_GENERATION 1
+#define EUSCI_B_SPI_CLOCKSOURCE_SMCLK 0x80
+#define EUSCI_B_SPI_MSB_FIRST 0x2000
+#define EUSCI_B_SPI_PHASE_DATA_CHANGED_ONFIRST_CAPTURED_ON_NEXT 0
+#define EUSCI_B_SPI_PHASE_DATA_CAPTURED_ONFIRST_CHANGED_ON_NEXT 0x8000
+#define EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_HIGH 0x4000
+#define EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_LOW 0
+#define EUSCI_B_SPI_3PIN 0
+#define CS_DCO_FREQUENCY_1_5 0
+#define CS_DCO_FREQUENCY_3 1
+#define CS_DCO_FREQUENCY_6 2
+#define CS_DCO_FREQUENCY_12 3
+#define CS_DCO_FREQUENCY_24 4
+#define CS_DCO_FREQUENCY_48 5
+#define CS_MCLK 1
+#define CS_HSMCLK 2
+#define CS_SMCLK 4
+#define CS_DCOCLK_SELECT 3
+#define CS_CLOCK_DIVIDER_1 0
+#define CS_CLOCK_DIVIDER_2 1
+#define CS_CLOCK_DIVIDER_4 2
+#define PCM_AM_LDO_VCORE0 0
+#define PCM_AM_LDO_VCORE1 1
+#define FLASH_BANK0 0
+#define FLASH_BANK1 1
+#define FLASH_MAIN_MEMORY_SPACE_BANK1 1
+#define FLASH_SECTOR0 0x00000001
+#define FLASH_SECTOR31 0x80000000
+#define TIMER32_0_BASE 0x4000C000
+#define TIMER32_1_BASE 0x4000C040
+#define TIMER32_PRESCALER_1 0
+#define TIMER32_32BIT 1
+#define TIMER32_FREE_RUN_MODE 0
+#define TIMER32_PERIODIC_MODE 0x40
+typedef struct { uint_fast8_t selectClockSource; uint_fast16_t clockPrescalar; uint_fast8_t firstModReg; uint_fast8_t secondModReg; uint_fast8_t parity; uint_fast16_t msborLsbFirst; uint_fast16_t numberofStopBits; uint_fast16_t uartMode; uint_fast8_t overSampling; } eUSCI_UART_Config;
+typedef struct { uint_fast8_t selectClockSource; uint32_t clockSourceFrequency; uint32_t desiredSpiClock; uint_fast16_t msbFirst; uint_fast16_t clockPhase; uint_fast16_t clockPolarity; uint_fast16_t spiMode; } eUSCI_SPI_MasterConfig;
+void MAP_CS_setDCOCenteredFrequency(uint32_t); void CS_setDCOCenteredFrequency(uint32_t);
+void CS_initClockSignal(uint32_t, uint32_t, uint32_t);
+uint32_t CS_getMCLK(void); uint32_t CS_getSMCLK(void);
+void MAP_GPIO_setAsPeripheralModuleFunctionInputPin(uint_fast8_t, uint_fast16_t, uint_fast8_t);
+void GPIO_setAsPeripheralModuleFunctionInputPin(uint_fast8_t, uint_fast16_t, uint_fast8_t);
+void GPIO_setOutputLowOnPin(uint_fast8_t, uint_fast16_t); void GPIO_setOutputHighOnPin(uint_fast8_t, uint_fast16_t);
+void GPIO_setAsOutputPin(uint_fast8_t, uint_fast16_t); void GPIO_toggleOutputOnPin(uint_fast8_t, uint_fast16_t);
+uint8_t GPIO_getInputPinValue(uint_fast8_t, uint_fast16_t);
+bool MAP_UART_initModule(uint32_t, const eUSCI_UART_Config*); void MAP_UART_enableModule(uint32_t);
+bool UART_initModule(uint32_t, const eUSCI_UART_Config*); void UART_enableModule(uint32_t); void UART_disableModule(uint32_t);
+void UART_enableInterrupt(uint32_t, uint_fast8_t); void UART_disableInterrupt(uint32_t, uint_fast8_t);
+void EUSCI_A_UART_transmitData(uint32_t, uint_fast8_t); void UART_transmitData(uint32_t, uint_fast8_t);
+void Interrupt_enableInterrupt(uint32_t); void Interrupt_disableInterrupt(uint32_t); bool Interrupt_enableMaster(void); bool Interrupt_disableMaster(void);
+void Interrupt_setPriority(uint32_t, uint8_t);
+void SysTick_setPeriod(uint32_t); void SysTick_enableModule(void); void SysTick_disableModule(void); void SysTick_enableInterrupt(void); void SysTick_disableInterrupt(void); uint32_t SysTick_getValue(void);
+bool SPI_initMaster(uint32_t, const eUSCI_SPI_MasterConfig*); void SPI_enableModule(uint32_t); void SPI_disableModule(uint32_t);
+void SPI_transmitData(uint32_t, uint_fast8_t); uint8_t SPI_receiveData(uint32_t);
+void SPI_changeMasterClock(uint32_t, uint32_t, uint32_t);
+void SPI_changeClockPhasePolarity(uint32_t, uint_fast16_t, uint_fast16_t);
+bool PCM_setCoreVoltageLevel(uint_fast8_t); uint8_t PCM_getCoreVoltageLevel(void); bool MAP_PCM_gotoLPM0(void); bool PCM_gotoLPM0(void);
+bool FlashCtl_setWaitState(uint32_t, uint32_t);
+bool FlashCtl_unprotectSector(uint_fast8_t, uint32_t); bool FlashCtl_protectSector(uint_fast8_t, uint32_t);
+bool FlashCtl_eraseSector(uint32_t); bool FlashCtl_programMemory(void*, void*, uint32_t);
+void Timer32_initModule(uint32_t, uint32_t, uint32_t, uint32_t); void Timer32_setCount(uint32_t, uint32_t);
+void Timer32_startTimer(uint32_t, bool); uint32_t Timer32_getValue(uint32_t); void Timer32_enableInterrupt(uint32_t); void Timer32_clearInterruptFlag(uint32_t);
+uint32_t Timer32_getInterruptStatus(uint32_t); void Timer32_haltTimer(uint32_t);
+void __wfi(void);
+#define TIMER32_0_MODULE TIMER32_0_BASE
+#define TIMER32_1_MODULE TIMER32_1_BASE
+typedef struct { volatile uint32_t CTRL, LOAD, VAL, CALIB; } SysTick_Type;
+extern SysTick_Type *SysTick;
+#define PCM_VCORE0 0
+#define PCM_VCORE1 1
+#define EUSCI_A_UART_BUSY 1
+bool UART_queryStatusFlags(uint32_t, uint_fast8_t);
+void UART_enableInterrupt(uint32_t, uint_fast8_t);
+#endif
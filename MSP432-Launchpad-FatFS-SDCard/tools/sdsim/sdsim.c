@@ -0,0 +1,592 @@
+/*
+ * sdsim.c - SD cards in SPI mode simulated behind the driverlib calls
+ *
+ * Only what the ports and spiBus.c use is there: the SPI module of eUSCI_B0,
+ * the chip select pins, the flash controller for the sectors of the fast
+ * mount records and of the staging log, and the time base. See sdsim.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driverlib.h"
+#include "sdsim.h"
+
+SimCard sim_cards[SIM_NCARDS];
+unsigned long sim_clock, sim_bus_bytes, sim_nsleep, sim_sleep_bytes;
+void (*sim_gpio_hook)(uint_fast8_t port, uint_fast16_t pin, int level);
+uint8_t (*sim_byte_hook)(uint8_t in);
+void (*sim_time_hook)(void);
+
+uint32_t sim_mclk = 48000000, sim_smclk = 24000000, sim_div = 1;
+uint_fast16_t sim_phase = 0, sim_pol = EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_HIGH;
+static int g_iMasked;
+static uint8_t g_ui8LastOut = 0xFF;
+
+volatile uint32_t sim_txbuf;
+
+//*****************************************************************************
+//
+// Time
+//
+//*****************************************************************************
+static void
+tick(void)
+{
+    if (sim_time_hook) sim_time_hook();
+    sim_clock++;
+}
+
+void
+sim_idle(unsigned long bytes)
+{
+    while (bytes--) tick();
+}
+
+/* The time base of timebase.h. A test that links timebase.c itself brings
+ * its own Timer32 and SysTick. */
+__attribute__((weak)) uint64_t
+tb_Now(void)
+{
+    return (uint64_t)sim_clock * SIM_US_PER_BYTE;
+}
+
+__attribute__((weak)) uint64_t
+tb_Deadline(uint32_t ui32Us)
+{
+    return tb_Now() + ui32Us;
+}
+
+__attribute__((weak)) bool
+tb_Expired(uint64_t ui64Deadline)
+{
+    return tb_Now() >= ui64Deadline;
+}
+
+__attribute__((weak)) void
+tb_Sleep(uint32_t ui32Us)
+{
+    unsigned long b = (ui32Us + SIM_US_PER_BYTE - 1) / SIM_US_PER_BYTE;
+
+    sim_nsleep++;
+    sim_sleep_bytes += b;
+    sim_idle(b);
+}
+
+//*****************************************************************************
+//
+// Cards
+//
+//*****************************************************************************
+static SimCard *
+card_for(uint_fast8_t port, uint_fast16_t pin)
+{
+    int i;
+
+    for (i = 0; i < SIM_NCARDS; i++)
+        if (sim_cards[i].data && sim_cards[i].port == port &&
+            sim_cards[i].pin == pin)
+            return &sim_cards[i];
+    return 0;
+}
+
+static void
+q(SimCard *c, uint8_t b)
+{
+    c->q[c->qn++] = b;
+}
+
+/* Sector a, zeros if it is not kept */
+static const uint8_t *
+sector(SimCard *c, uint32_t a)
+{
+    static const uint8_t zeros[512];
+
+    return a < c->nstored ? c->data + a * 512 : zeros;
+}
+
+/* A data block with its start token and a CRC nobody checks */
+static void
+qblock(SimCard *c, const uint8_t *d, int n)
+{
+    q(c, 0xFF);
+    q(c, 0xFE);
+    while (n--) q(c, *d++);
+    q(c, 0xFF);
+    q(c, 0xFF);
+}
+
+static void
+do_cmd(SimCard *c)
+{
+    uint8_t cmd = c->cmd[0] & 0x3F;
+    uint32_t arg = (uint32_t)c->cmd[1] << 24 | c->cmd[2] << 16 |
+                   c->cmd[3] << 8 | c->cmd[4];
+    int app = c->app;
+    uint32_t a, b;
+
+    c->app = 0;
+    c->qn = c->qh = 0;
+    q(c, 0xFF);
+    c->log[c->nlog % SIM_LOG].cmd = cmd | (app ? 0x80 : 0);
+    c->log[c->nlog % SIM_LOG].arg = arg;
+    c->nlog++;
+
+    switch (cmd) {
+    case 0:     /* GO_IDLE_STATE */
+        c->idle = 1;
+        c->init_until = sim_clock + c->init_time;
+        q(c, 0x01);
+        break;
+    case 8:     /* SEND_IF_COND */
+        q(c, 0x01); q(c, 0); q(c, 0); q(c, 1); q(c, 0xAA);
+        break;
+    case 55:    /* APP_CMD */
+        c->app = 1;
+        q(c, c->idle);
+        break;
+    case 41:    /* ACMD41 */
+        if (sim_clock < c->init_until) {
+            q(c, 0x01);
+            break;
+        }
+        c->idle = 0;
+        q(c, 0x00);
+        break;
+    case 58:    /* READ_OCR */
+        q(c, 0); q(c, c->blockaddr ? 0xC0 : 0x80); q(c, 0xFF); q(c, 0x80);
+        q(c, 0);
+        break;
+    case 16:    /* SET_BLOCKLEN */
+        q(c, 0);
+        break;
+    case 23:    /* SET_WR_BLK_ERASE_COUNT */
+        q(c, 0);
+        c->precount = arg;
+        break;
+    case 9: {   /* SEND_CSD, version 2 */
+        uint8_t csd[16] = { 0x40 };
+        uint32_t cs = c->nsect / 1024 - 1;
+        csd[7] = cs >> 16; csd[8] = cs >> 8; csd[9] = cs;
+        q(c, 0);
+        qblock(c, csd, 16);
+        break;
+    }
+    case 10: {  /* SEND_CID */
+        uint8_t cid[16];
+        int i;
+        for (i = 0; i < 16; i++) cid[i] = c->id + i;
+        q(c, 0);
+        qblock(c, cid, 16);
+        break;
+    }
+    case 17:    /* READ_SINGLE_BLOCK */
+        if (arg >= c->nsect) {
+            q(c, 0x40);
+            break;
+        }
+        q(c, 0);
+        qblock(c, sector(c, arg), 512);
+        c->nrd++;
+        c->rdsect++;
+        break;
+    case 18:    /* READ_MULTIPLE_BLOCK */
+        q(c, 0);
+        c->rdmulti = 1;
+        c->addr = arg;
+        c->nrdm++;
+        break;
+    case 12:    /* STOP_TRANSMISSION */
+        c->rdmulti = 0;
+        q(c, 0xFF);
+        q(c, 0);
+        break;
+    case 24:    /* WRITE_BLOCK */
+        q(c, 0);
+        c->rxmode = 1;
+        c->addr = arg;
+        c->nwr++;
+        break;
+    case 25:    /* WRITE_MULTIPLE_BLOCK */
+        q(c, 0);
+        c->rxmode = 2;
+        c->addr = c->wr_start = arg;
+        c->nwrm++;
+        break;
+    case 32:    /* ERASE_WR_BLK_START */
+        q(c, 0);
+        c->er_start = arg;
+        break;
+    case 33:    /* ERASE_WR_BLK_END */
+        q(c, 0);
+        c->er_end = arg;
+        break;
+    case 38:    /* ERASE */
+        q(c, 0);
+        c->nerase++;
+        a = c->er_start;
+        b = c->er_end;
+        if (!c->blockaddr) {
+            a /= 512;
+            b /= 512;
+        }
+        if (b >= c->nstored && b < c->nsect) b = c->nstored - 1;
+        if (a <= b && b < c->nsect && (!c->wrcut || c->wrsect < c->wrcut)) {
+            memset(c->data + a * 512, 0, (b - a + 1) * 512);
+            memset(c->erased + a, 1, b - a + 1);
+        }
+        c->busy_until = sim_clock + c->erase_busy;
+        break;
+    case 13:    /* SEND_STATUS, ACMD13 SD_STATUS */
+        q(c, 0);
+        q(c, 0);
+        if (app) {
+            uint8_t st[64] = { 0 };
+            st[10] = c->au << 4;
+            qblock(c, st, 64);
+        }
+        break;
+    default:
+        q(c, 0x04);                     /* Illegal command */
+        break;
+    }
+}
+
+/* One byte in and out of a selected card */
+static uint8_t
+exchange(SimCard *c, uint8_t in)
+{
+    uint8_t out = 0xFF;
+    unsigned gc;
+
+    if (c->qh < c->qn) {
+        out = c->q[c->qh++];
+    } else if (sim_clock < c->busy_until) {
+        out = 0x00;
+    } else if (c->rdmulti) {
+        c->qn = c->qh = 0;
+        if (c->addr < c->nsect) {
+            qblock(c, sector(c, c->addr), 512);
+            c->addr++;
+            c->rdsect++;
+        }
+        out = c->q[c->qh++];
+    }
+
+    if (c->cmdn) {                      /* Receiving a command */
+        c->cmd[c->cmdn++] = in;
+        if (c->cmdn == 6) {
+            c->cmdn = 0;
+            do_cmd(c);
+        }
+        return out;
+    }
+    if (c->rxmode >= 10) {              /* Receiving a data block */
+        if (c->rxn < 512) c->blk[c->rxn] = in;
+        if (++c->rxn == 514) {
+            gc = 0;
+            if (c->rxmode == 10 && c->addr != c->wr_start &&
+                c->addr % (16u << c->au) == 0) {
+                gc += c->au_busy;       /* Into the next AU mid-command */
+                c->naucross++;
+            }
+            if (c->addr < c->nstored && (!c->wrcut || c->wrsect < c->wrcut)) {
+                memcpy(c->data + c->addr * 512, c->blk, 512);
+                if (c->gc_period ? ++c->gc_count % c->gc_period == 0
+                                 : !c->erased[c->addr]) {
+                    gc += c->gc_busy;
+                    c->ngc++;
+                }
+                c->erased[c->addr] = 0;
+            }
+            c->wrsect++;
+            c->addr++;
+            c->qn = c->qh = 0;
+            q(c, 0x05);                 /* Data accepted */
+            c->busy_until = sim_clock + 2 + gc +
+                (c->rxmode == 11 ? c->busy_single : c->busy_block);
+            c->rxmode = c->rxmode == 10 ? 2 : 0;
+        }
+        return out;
+    }
+    if (c->rxmode == 1 && in == 0xFE) {
+        c->rxmode = 11;
+        c->rxn = 0;
+        return out;
+    }
+    if (c->rxmode == 2 && in == 0xFC) {
+        c->rxmode = 10;
+        c->rxn = 0;
+        return out;
+    }
+    if (c->rxmode == 2 && in == 0xFD) { /* Stop token */
+        c->rxmode = 0;
+        c->qn = c->qh = 0;
+        q(c, 0xFF);
+        c->busy_until = sim_clock + 2 + c->busy_stop;
+        return out;
+    }
+    if ((in & 0xC0) == 0x40 && !c->rxmode) {
+        c->cmd[0] = in;
+        c->cmdn = 1;
+    }
+    return out;
+}
+
+void
+sim_init(int i, uint_fast8_t port, uint_fast16_t pin, uint32_t nsect,
+         unsigned busy_block, unsigned busy_stop)
+{
+    SimCard *c = &sim_cards[i];
+
+    free(c->data);
+    free(c->erased);
+    memset(c, 0, sizeof(*c));
+    c->port = port;
+    c->pin = pin;
+    c->nsect = nsect;
+    c->id = i * 16;
+    c->data = calloc(nsect, 512);
+    c->erased = calloc(nsect, 1);
+    c->nstored = nsect;
+    c->au = 7;                          /* 1 MB */
+    c->blockaddr = 1;
+    c->busy_block = busy_block;
+    c->busy_single = busy_stop;
+    c->busy_stop = busy_stop;
+    c->erase_busy = busy_stop;
+}
+
+//*****************************************************************************
+//
+// driverlib
+//
+//*****************************************************************************
+void
+GPIO_setOutputLowOnPin(uint_fast8_t port, uint_fast16_t pin)
+{
+    SimCard *c = card_for(port, pin);
+
+    if (sim_gpio_hook) sim_gpio_hook(port, pin, 0);
+    if (c) {
+        if (!c->sel) {
+            c->qn = c->qh = 0;
+            c->cmdn = 0;
+        }
+        c->sel = 1;
+    }
+}
+
+void
+GPIO_setOutputHighOnPin(uint_fast8_t port, uint_fast16_t pin)
+{
+    SimCard *c = card_for(port, pin);
+
+    if (sim_gpio_hook) sim_gpio_hook(port, pin, 1);
+    if (c) c->sel = 0;
+}
+
+void
+GPIO_setAsOutputPin(uint_fast8_t port, uint_fast16_t pin)
+{
+    (void)port;
+    (void)pin;
+}
+
+void
+GPIO_setAsPeripheralModuleFunctionInputPin(uint_fast8_t port,
+                                           uint_fast16_t pins,
+                                           uint_fast8_t mode)
+{
+    (void)port;
+    (void)pins;
+    (void)mode;
+}
+
+void
+SPI_transmitData(uint32_t module, uint_fast8_t data)
+{
+    int i;
+
+    (void)module;
+    sim_bus_bytes++;
+    tick();
+    g_ui8LastOut = 0xFF;
+    for (i = 0; i < SIM_NCARDS; i++)
+        if (sim_cards[i].sel) g_ui8LastOut &= exchange(&sim_cards[i], data);
+    if (sim_byte_hook) g_ui8LastOut &= sim_byte_hook(data);
+}
+
+uint8_t
+SPI_receiveData(uint32_t module)
+{
+    (void)module;
+    return g_ui8LastOut;
+}
+
+/* Reading UCB0RXBUF clocks out UCB0TXBUF. The cards run in mode 3 at no
+ * more than 12 MHz, anything else while one is selected is a bug. */
+uint8_t
+sim_rx(void)
+{
+    int i;
+
+    for (i = 0; i < SIM_NCARDS; i++) {
+        if (!sim_cards[i].sel) continue;
+        if (sim_phase != 0 ||
+            sim_pol != EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_HIGH) {
+            printf("card %d selected in wrong SPI mode\n", i);
+            abort();
+        }
+        if (sim_smclk / sim_div > 12000000) {
+            printf("card %d clocked too fast\n", i);
+            abort();
+        }
+    }
+    SPI_transmitData(0, (uint8_t)sim_txbuf);
+    return SPI_receiveData(0);
+}
+
+bool
+SPI_initMaster(uint32_t module, const eUSCI_SPI_MasterConfig *config)
+{
+    (void)module;
+    sim_phase = config->clockPhase;
+    sim_pol = config->clockPolarity;
+    sim_div = config->clockSourceFrequency / config->desiredSpiClock;
+    return true;
+}
+
+void
+SPI_enableModule(uint32_t module)
+{
+    (void)module;
+}
+
+void
+SPI_changeMasterClock(uint32_t module, uint32_t src, uint32_t hz)
+{
+    (void)module;
+    sim_div = src / hz;
+}
+
+void
+SPI_changeClockPhasePolarity(uint32_t module, uint_fast16_t phase,
+                             uint_fast16_t polarity)
+{
+    (void)module;
+    sim_phase = phase;
+    sim_pol = polarity;
+}
+
+__attribute__((weak)) uint32_t
+CS_getMCLK(void)
+{
+    return sim_mclk;
+}
+
+__attribute__((weak)) uint32_t
+CS_getSMCLK(void)
+{
+    return sim_smclk;
+}
+
+bool
+Interrupt_disableMaster(void)
+{
+    int iWas = g_iMasked;
+
+    g_iMasked = 1;
+    return iWas;
+}
+
+bool
+Interrupt_enableMaster(void)
+{
+    g_iMasked = 0;
+    return true;
+}
+
+int
+sim_irq_masked(void)
+{
+    return g_iMasked;
+}
+
+//*****************************************************************************
+//
+// Flash: a sector for the fast mount records, eight for the staging log.
+// Erasing a sector of the log takes about 15 ms and programming 2 us a byte.
+//
+//*****************************************************************************
+unsigned char sim_flash[4096];
+unsigned char sim_stage[32768] __attribute__((aligned(4096)));
+unsigned long sim_nerase, sim_nprog, sim_flash_cost = 1;
+
+static bool
+in_stage(const void *p)
+{
+    const unsigned char *pc = p;
+
+    return pc >= sim_stage && pc < sim_stage + sizeof(sim_stage);
+}
+
+bool
+FlashCtl_unprotectSector(uint_fast8_t bank, uint32_t sectors)
+{
+    (void)bank;
+    (void)sectors;
+    return true;
+}
+
+bool
+FlashCtl_protectSector(uint_fast8_t bank, uint32_t sectors)
+{
+    (void)bank;
+    (void)sectors;
+    return true;
+}
+
+/* The address comes as 32 bits, which only the offset survives on a 64-bit
+ * host */
+bool
+FlashCtl_eraseSector(uint32_t addr)
+{
+    uint32_t off = addr - (uint32_t)(uintptr_t)sim_stage;
+
+    if (off < sizeof(sim_stage)) {
+        memset(sim_stage + (off & ~4095), 0xFF, 4096);
+        sim_nerase++;
+        if (sim_flash_cost) sim_idle(940);
+        return true;
+    }
+    memset(sim_flash, 0xFF, sizeof(sim_flash));
+    return true;
+}
+
+/* Programming clears bits only */
+bool
+FlashCtl_programMemory(void *src, void *dest, uint32_t length)
+{
+    unsigned char *pd = dest;
+    const unsigned char *ps = src;
+
+    if (in_stage(pd)) {
+        sim_nprog++;
+        if (sim_flash_cost) sim_idle(length / 8 + 1);
+    }
+    while (length--) *pd++ &= *ps++;
+    return true;
+}
+
+void sb_Init(void);
+
+__attribute__((constructor)) static void
+sim_start(void)
+{
+    memset(sim_flash, 0xFF, sizeof(sim_flash));
+    memset(sim_stage, 0xFF, sizeof(sim_stage));
+    sb_Init();
+}
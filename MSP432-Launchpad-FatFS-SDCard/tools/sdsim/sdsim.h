@@ -0,0 +1,106 @@
+/*
+ * sdsim.h - SD cards in SPI mode simulated behind the driverlib calls
+ *
+ * The host tests link FatFs and the ports of third_party/fatfs/port against
+ * sdsim.c instead of driverlib. The cards answer the commands of the MMC
+ * port, keep their data in RAM and stay busy after writes and erases for a
+ * set number of bus bytes. Time is counted in bus bytes as well: sim_clock
+ * goes up by one for each byte on the bus and for each byte time spent idle,
+ * and the time base of timebase.h runs from it at SIM_US_PER_BYTE.
+ */
+
+#ifndef __SDSIM_H__
+#define __SDSIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_NCARDS      2
+#define SIM_LOG         4096            /* Commands kept in SimCard.log */
+#define SIM_US_PER_BYTE 16              /* tb_Now() per sim_clock */
+
+typedef struct {
+    uint8_t cmd;                        /* Command index, 0x80 for ACMDx */
+    uint32_t arg;
+} SimLog;
+
+typedef struct {
+    /* Set up by sim_init() */
+    uint_fast8_t port;                  /* Chip select pin */
+    uint_fast16_t pin;
+    int id;                             /* First byte of the CID */
+    uint8_t *data;                      /* nstored sectors */
+    uint8_t *erased;                    /* Sectors not written since erase */
+    uint32_t nsect;
+    uint32_t nstored;                   /* Sectors kept, nsect unless set
+                                           lower: the others read as zeros
+                                           and writes to them are lost */
+    uint8_t au;                         /* AU_SIZE of the SD status */
+    int blockaddr;                      /* SDHC: sector addresses */
+    unsigned busy_block;                /* Busy after a block of CMD25 */
+    unsigned busy_single;               /* Busy after CMD24 */
+    unsigned busy_stop;                 /* Busy after the stop token */
+    unsigned erase_busy;                /* Busy after CMD38 */
+    unsigned gc_busy;                   /* Extra busy for a sector not erased */
+    unsigned gc_period;                 /* ...or for every gc_period-th write */
+    unsigned au_busy;                   /* Extra busy for a block of CMD25
+                                           that enters another AU */
+    unsigned init_time;                 /* ACMD41 answers idle this long */
+    unsigned long wrcut;                /* Sectors written once wrsect is at
+                                           this are lost, as on a power loss
+                                           (0: none) */
+
+    /* State of the SPI exchange */
+    int sel, idle, app;
+    uint8_t q[1100];                    /* Bytes to send */
+    int qn, qh;
+    uint8_t cmd[6];
+    int cmdn;
+    int rxmode, rxn, rdmulti;
+    uint8_t blk[514];
+    uint32_t addr, wr_start, precount, er_start, er_end;
+    unsigned long busy_until, init_until, gc_count;
+
+    /* Counters */
+    unsigned long nrd, nrdm;            /* CMD17 and CMD18 */
+    unsigned long nwr, nwrm;            /* CMD24 and CMD25 */
+    unsigned long rdsect, wrsect;       /* Sectors moved */
+    unsigned long nerase, ngc;
+    unsigned long naucross;             /* Blocks that paid au_busy */
+    SimLog log[SIM_LOG];
+    unsigned long nlog;
+} SimCard;
+
+extern SimCard sim_cards[SIM_NCARDS];
+extern unsigned long sim_clock;         /* Bus bytes and idle byte times */
+extern unsigned long sim_bus_bytes;     /* Bus bytes only */
+extern unsigned long sim_nsleep, sim_sleep_bytes;   /* tb_Sleep() calls */
+extern uint32_t sim_mclk, sim_smclk, sim_div;
+extern uint_fast16_t sim_phase, sim_pol;
+
+/* Hooks of the tests: a chip select changes, a byte is exchanged (the
+ * result is ANDed into the byte read), time goes on */
+extern void (*sim_gpio_hook)(uint_fast8_t port, uint_fast16_t pin, int level);
+extern uint8_t (*sim_byte_hook)(uint8_t in);
+extern void (*sim_time_hook)(void);
+
+/* On-chip flash of the fast mount records and of the staging log; erasing
+ * and programming the staging log takes time unless sim_flash_cost is 0 */
+extern unsigned char sim_flash[4096];
+extern unsigned char sim_stage[32768];
+extern unsigned long sim_nerase, sim_nprog, sim_flash_cost;
+
+/* Card i, selected by port and pin, of nsect sectors. Blocks of a multiple
+ * block write leave it busy for busy_block bus bytes, single writes and the
+ * end of multiple ones for busy_stop. A card bigger than memory allows is
+ * made with fewer sectors, and nsect set to its size afterwards. */
+void sim_init(int i, uint_fast8_t port, uint_fast16_t pin, uint32_t nsect,
+              unsigned busy_block, unsigned busy_stop);
+
+/* Let bytes byte times pass without bus traffic */
+void sim_idle(unsigned long bytes);
+
+/* Whether the interrupts are masked with Interrupt_disableMaster() */
+int sim_irq_masked(void);
+
+#endif /* __SDSIM_H__ */
@@ -0,0 +1,160 @@
+/*
+ * test_async.c - request queue of disk_submit() and disk_poll()
+ *
+ * Adjacent writes are merged into one multiple block write, the queue is
+ * served in elevator order, requests on the same sector keep their order,
+ * and the caller gets control back while a card is busy. A card busy for
+ * longer than 500ms after its write is given up on even while the other
+ * card keeps being written.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "diskio.h"
+
+static DWORD g_pui32Order[64];
+static int g_iOrder;
+static BYTE g_ppui8Bufs[16][512];
+static BYTE g_pui8Read[512 * 8];
+
+static void
+done(DREQ *req)
+{
+    g_pui32Order[g_iOrder++] = req->sector;
+}
+
+static unsigned long
+count_cmd(int c, int cmd)
+{
+    unsigned long i, n = 0;
+
+    for (i = 0; i < sim_cards[c].nlog; i++)
+        if (sim_cards[c].log[i].cmd == cmd) n++;
+    return n;
+}
+
+static void
+submit(DREQ *req, BYTE pdrv, BYTE op, DWORD sector, BYTE *buff)
+{
+    memset(req, 0, sizeof(*req));
+    req->done = done;
+    req->buff = buff;
+    req->sector = sector;
+    req->pdrv = pdrv;
+    req->op = op;
+    req->count = 1;
+    assert(disk_submit(req) == RES_OK);
+}
+
+int
+main(void)
+{
+    static const DWORD pui32Secs[4] = { 300, 50, 200, 10 };
+    DREQ psReq[16], sFull;
+    unsigned long w24, w25, polls, t, fail;
+    DWORD n;
+    int i, k;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 8192, 300, 3000);
+    sim_init(1, GPIO_PORT_P4, GPIO_PIN7, 8192, 900, 9000);
+    assert(disk_initialize(0) == 0);
+    assert(disk_initialize(1) == 0);
+    assert(disk_ioctl(0, GET_SECTOR_COUNT, &n) == RES_OK && n == 8192);
+
+    /* Eight adjacent single sector writes go in one CMD25 */
+    w24 = count_cmd(0, 24);
+    w25 = count_cmd(0, 25);
+    for (i = 0; i < 8; i++) {
+        memset(g_ppui8Bufs[i], 0xA0 + i, 512);
+        submit(&psReq[i], 0, DREQ_WRITE, 100 + i, g_ppui8Bufs[i]);
+    }
+    memset(&sFull, 0, sizeof(sFull));
+    sFull.buff = g_ppui8Bufs[9];
+    sFull.sector = 1;
+    sFull.count = 1;
+    sFull.op = DREQ_WRITE;
+    assert(disk_submit(&sFull) == RES_NOTRDY);      /* Queue full */
+    while (disk_poll()) ;
+    assert(count_cmd(0, 25) - w25 == 1 && count_cmd(0, 24) == w24);
+    assert(disk_read(0, g_pui8Read, 100, 8) == RES_OK);
+    for (i = 0; i < 8; i++) {
+        assert(g_pui8Read[i * 512] == 0xA0 + i);
+        assert(g_pui8Read[i * 512 + 511] == 0xA0 + i);
+    }
+
+    /* Elevator: after the head at 108, 200 and 300 go first */
+    g_iOrder = 0;
+    for (i = 0; i < 4; i++) {
+        submit(&psReq[i], 0, DREQ_WRITE, pui32Secs[i], g_ppui8Bufs[i]);
+    }
+    while (disk_poll()) ;
+    assert(g_iOrder == 4);
+    assert(g_pui32Order[0] == 200 && g_pui32Order[1] == 300 &&
+           g_pui32Order[2] == 10 && g_pui32Order[3] == 50);
+
+    /* Write A, read, write B on one sector: the read sees A, B stays */
+    memset(g_ppui8Bufs[0], 'A', 512);
+    memset(g_ppui8Bufs[1], 0, 512);
+    memset(g_ppui8Bufs[2], 'B', 512);
+    submit(&psReq[0], 0, DREQ_WRITE, 5, g_ppui8Bufs[0]);
+    submit(&psReq[1], 0, DREQ_READ, 5, g_ppui8Bufs[1]);
+    submit(&psReq[2], 0, DREQ_WRITE, 5, g_ppui8Bufs[2]);
+    while (disk_poll()) ;
+    for (i = 0; i < 3; i++) assert(!psReq[i].busy && psReq[i].res == RES_OK);
+    assert(g_ppui8Bufs[1][0] == 'A' && g_ppui8Bufs[1][511] == 'A');
+    assert(disk_read(0, g_pui8Read, 5, 1) == RES_OK && g_pui8Read[0] == 'B');
+
+    /* The caller runs while the card programs */
+    polls = 0;
+    t = sim_clock;
+    memset(g_ppui8Bufs[3], 7, 512);
+    for (k = 0; k < 20; k++) {
+        submit(&psReq[0], 0, DREQ_WRITE, 1000 + k * 64, g_ppui8Bufs[3]);
+        while (psReq[0].busy) {
+            disk_poll();
+            polls++;
+            sim_idle(50);
+        }
+    }
+    assert(polls > 20);
+    printf("20 writes: %lu polls over %lu us\n", polls,
+           (sim_clock - t) * SIM_US_PER_BYTE);
+
+    /* Writes to both cards in turns */
+    t = sim_clock;
+    for (k = 0; k < 8; k++) {
+        submit(&psReq[k], k & 1, DREQ_WRITE, 2000 + k * 16, g_ppui8Bufs[k]);
+    }
+    while (disk_poll()) ;
+    assert(disk_ioctl(0, CTRL_SYNC, 0) == RES_OK);
+    assert(disk_ioctl(1, CTRL_SYNC, 0) == RES_OK);
+    assert(disk_read(1, g_pui8Read, 2000 + 16, 1) == RES_OK);
+    assert(g_pui8Read[0] == g_ppui8Bufs[1][0]);
+    assert(disk_read(0, g_pui8Read, 2000 + 16, 1) == RES_OK && g_pui8Read[0] == 0);
+    printf("8 writes to two cards: %lu us\n",
+           (sim_clock - t) * SIM_US_PER_BYTE);
+
+    /* Card 0 stays busy for 5s after a write. The writes to card 1 do not
+     * put off its 500ms deadline, and the read queued behind it fails. */
+    sim_cards[0].busy_single = 5000000 / SIM_US_PER_BYTE;
+    sim_cards[0].busy_stop = 5000000 / SIM_US_PER_BYTE;
+    g_iOrder = 0;
+    submit(&psReq[0], 0, DREQ_WRITE, 3000, g_ppui8Bufs[0]);
+    while (psReq[0].busy) disk_poll();
+    submit(&psReq[1], 0, DREQ_READ, 3000, g_pui8Read);
+    t = sim_clock;
+    fail = 0;
+    for (k = 0; k < 30; k++) {
+        submit(&psReq[2], 1, DREQ_WRITE, 3000 + k, g_ppui8Bufs[2]);
+        while (psReq[2].busy) disk_poll();
+        if (!psReq[1].busy && !fail) fail = sim_clock - t;
+        sim_idle(100000 / SIM_US_PER_BYTE);
+    }
+    assert(!psReq[1].busy && psReq[1].res != RES_OK);
+    printf("read behind a stuck card failed after %lu us\n",
+           fail * SIM_US_PER_BYTE);
+    return 0;
+}
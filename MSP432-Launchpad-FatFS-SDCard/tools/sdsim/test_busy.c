@@ -0,0 +1,84 @@
+/*
+ * test_busy.c - sleeping while a card is busy (SDC_POLL_MIN_US)
+ *
+ * A card that is slow to program, and slower still on sectors that were not
+ * erased, is written in small synced appends, in sectors and in 8 KB
+ * pieces. The CPU sleeps between the polls of the busy card, a sleep is
+ * never longer than SDC_POLL_MAX_US, and the bus is idle for much of the
+ * elapsed time. -s SDC_POLL_MIN_US=0 polls back to back; the test then only
+ * checks the data and prints the bus share for comparison.
+ *
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define POLL_MAX_US     500             /* SDC_POLL_MAX_US of the port */
+
+static FATFS g_sFs;
+static FIL g_sFil;
+static BYTE g_pui8Buf[8192];
+
+/* Write n pieces of a size and read them back. When the port sleeps, the
+ * bus takes at most max percent of the elapsed time. */
+static void
+run(const char *name, UINT size, int n, unsigned long max)
+{
+    unsigned long t, bus, sleep, nsleep;
+    UINT bw, k;
+    int i;
+
+    t = sim_clock;
+    bus = sim_bus_bytes;
+    sleep = sim_sleep_bytes;
+    nsleep = sim_nsleep;
+    assert(f_open(&g_sFil, name, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (i = 0; i < n; i++) {
+        memset(g_pui8Buf, i, size);
+        assert(f_write(&g_sFil, g_pui8Buf, size, &bw) == FR_OK && bw == size);
+        if (size < 512) assert(f_sync(&g_sFil) == FR_OK);
+    }
+    assert(f_close(&g_sFil) == FR_OK);
+    t = sim_clock - t;
+    bus = sim_bus_bytes - bus;
+    sleep = sim_sleep_bytes - sleep;
+    nsleep = sim_nsleep - nsleep;
+    printf("%-8s %4u x %4d: %7lu us, bus %3lu%%, %5lu sleeps of %3lu us\n",
+           name, size, n, t * SIM_US_PER_BYTE, bus * 100 / t, nsleep,
+           nsleep ? sleep * SIM_US_PER_BYTE / nsleep : 0);
+    if (nsleep) {
+        assert(sleep <= nsleep * ((POLL_MAX_US + SIM_US_PER_BYTE - 1) /
+                                  SIM_US_PER_BYTE));
+        assert(bus + sleep <= t);
+        assert(bus * 100 <= t * max);
+    }
+
+    assert(f_open(&g_sFil, name, FA_READ) == FR_OK);
+    for (i = 0; i < n; i++) {
+        assert(f_read(&g_sFil, g_pui8Buf, size, &bw) == FR_OK && bw == size);
+        for (k = 0; k < size; k++) assert(g_pui8Buf[k] == (BYTE)i);
+    }
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+int
+main(void)
+{
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 131072, 300, 3000);
+    sim_cards[0].gc_busy = 20000;
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 0) == FR_OK);
+    memset(sim_cards[0].erased, 0, sim_cards[0].nsect);
+
+    run("LOG.TXT", 64, 400, 15);
+    run("BLK.BIN", 512, 1024, 30);
+    run("BIG.BIN", 8192, 128, 70);
+    return 0;
+}
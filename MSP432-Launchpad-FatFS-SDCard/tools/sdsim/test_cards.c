@@ -0,0 +1,149 @@
+/*
+ * test_cards.c - two SD cards on one SPI bus (mmc-msp432P401r.c)
+ *
+ * Each card is a drive of its own with SDC_ARRAY_MODE 0, and drive 0 is the
+ * mirror or the stripe set of both with 1 and 2; the test finds out which
+ * from the drive sizes. Only one card may be selected at a time, and a
+ * missing card must not get in the way of the other.
+ *
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define SIZE    100000
+
+static FATFS g_psFs[2];
+static FIL g_psFil[2];
+static BYTE g_pui8Buf[4096];
+
+static BYTE
+pat(int f, DWORD o)
+{
+    return (BYTE)(o * 5 + f * 77 + (o >> 9));
+}
+
+/* Chip selects go low one card at a time */
+static void
+gpio(uint_fast8_t port, uint_fast16_t pin, int level)
+{
+    int i;
+
+    (void)port;
+    (void)pin;
+    if (!level) {
+        for (i = 0; i < SIM_NCARDS; i++) assert(!sim_cards[i].sel);
+    }
+}
+
+/* Write two files in turns, one on each volume */
+static void
+write2(const char *a, const char *b)
+{
+    const char *name[2] = { a, b };
+    DWORD o;
+    UINT n, k, bw;
+    int f;
+
+    for (f = 0; f < 2; f++) {
+        assert(f_open(&g_psFil[f], name[f], FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    }
+    for (o = 0; o < SIZE; o += n) {
+        n = SIZE - o < 3000 ? SIZE - o : 3000;
+        for (f = 0; f < 2; f++) {
+            for (k = 0; k < n; k++) g_pui8Buf[k] = pat(f, o + k);
+            assert(f_write(&g_psFil[f], g_pui8Buf, n, &bw) == FR_OK && bw == n);
+        }
+    }
+    for (f = 0; f < 2; f++) assert(f_close(&g_psFil[f]) == FR_OK);
+}
+
+static void
+check(const char *name, int f)
+{
+    DWORD o = 0;
+    UINT br, k;
+
+    assert(f_open(&g_psFil[0], name, FA_READ) == FR_OK);
+    assert(f_size(&g_psFil[0]) == SIZE);
+    do {
+        assert(f_read(&g_psFil[0], g_pui8Buf, sizeof(g_pui8Buf), &br) == FR_OK);
+        for (k = 0; k < br; k++) assert(g_pui8Buf[k] == pat(f, o + k));
+        o += br;
+    } while (br);
+    assert(o == SIZE);
+    assert(f_close(&g_psFil[0]) == FR_OK);
+}
+
+int
+main(void)
+{
+    DWORD n0, n1;
+    unsigned long t;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 30, 300);
+    sim_init(1, GPIO_PORT_P4, GPIO_PIN7, 32768, 60, 600);
+    sim_cards[1].id = 0x40;
+    sim_gpio_hook = gpio;
+
+    /* Card 1 is not in its socket yet. With the cards as drives of their
+     * own, card 0 works without it and drive 1 times out; an array needs
+     * both. */
+    sim_cards[1].pin = 0;
+    if (!disk_initialize(0)) {
+        t = sim_clock;
+        assert(disk_initialize(1) & STA_NOINIT);
+        printf("empty socket given up after %lu us\n",
+               (sim_clock - t) * SIM_US_PER_BYTE);
+        assert(disk_ioctl(0, GET_SECTOR_COUNT, &n0) == RES_OK && n0 == 65536);
+    }
+    sim_cards[1].pin = GPIO_PIN7;
+    assert(disk_initialize(0) == 0);
+    assert(disk_ioctl(0, GET_SECTOR_COUNT, &n0) == RES_OK);
+
+    if (!disk_initialize(1)) {
+        /* Two drives */
+        assert(n0 == 65536);
+        assert(disk_ioctl(1, GET_SECTOR_COUNT, &n1) == RES_OK && n1 == 32768);
+        f_mount(0, &g_psFs[0]);
+        f_mount(1, &g_psFs[1]);
+        assert(f_mkfs(0, 0, 4096) == FR_OK);
+        assert(f_mkfs(1, 0, 2048) == FR_OK);
+        write2("0:A.BIN", "1:B.BIN");
+        check("0:A.BIN", 0);
+        check("1:B.BIN", 1);
+        assert(f_open(&g_psFil[0], "1:A.BIN", FA_READ) == FR_NO_FILE);
+        assert(f_open(&g_psFil[0], "0:B.BIN", FA_READ) == FR_NO_FILE);
+        printf("two drives of %lu and %lu sectors\n",
+               (unsigned long)n0, (unsigned long)n1);
+    } else {
+        /* One drive over both cards */
+        f_mount(0, &g_psFs[0]);
+        assert(f_mkfs(0, 0, 4096) == FR_OK);
+        write2("A.BIN", "B.BIN");
+        check("A.BIN", 0);
+        check("B.BIN", 1);
+        assert(sim_cards[0].wrsect && sim_cards[1].wrsect);
+        if (n0 == 32768) {
+            /* Mirror: the same data on both */
+            assert(!memcmp(sim_cards[0].data, sim_cards[1].data, 32768 * 512));
+            printf("mirror of %lu sectors\n", (unsigned long)n0);
+        } else {
+            /* Stripe: twice the smaller card, each card gets half */
+            assert(n0 == 65536);
+            assert(sim_cards[0].wrsect < sim_cards[1].wrsect * 2 &&
+                   sim_cards[1].wrsect < sim_cards[0].wrsect * 2);
+            printf("stripe of %lu sectors, %lu and %lu written\n",
+                   (unsigned long)n0, sim_cards[0].wrsect,
+                   sim_cards[1].wrsect);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * test_clock.c - clock profiles (clock.c)
+ *
+ * The UART dividers match the recommended settings of the eUSCI chapter of
+ * the user's guide. The power and clock system is emulated here: every
+ * step of a profile switch must keep MCLK within what the core voltage and
+ * the flash wait states allow and SMCLK at 24 MHz at most. After a switch
+ * the console UART, the SPI clock of the cards and the time base follow
+ * the new frequencies.
+ *
+ * sdsim: src clock.c
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "diskio.h"
+#include "clock.h"
+
+//*****************************************************************************
+//
+// PCM, flash controller, CS and UART
+//
+//*****************************************************************************
+static uint_fast8_t g_ui8Vcore = PCM_VCORE0;
+static uint32_t g_pui32Wait[2];
+static uint32_t g_ui32Dco = 3000000;
+static uint32_t g_ui32SmclkDiv = 1;
+static eUSCI_UART_Config g_sUart;
+static int g_iUartInits, g_iUartBusy, g_iRebases;
+
+/* The limits of the datasheet hold after every step */
+static void
+check(void)
+{
+    uint32_t ui32Mclk = g_ui32Dco;
+    uint32_t ui32Wait = g_pui32Wait[0] < g_pui32Wait[1] ? g_pui32Wait[0]
+                                                        : g_pui32Wait[1];
+
+    assert(ui32Mclk <= (g_ui8Vcore == PCM_VCORE1 ? 48000000 : 24000000));
+    assert(g_ui32Dco / g_ui32SmclkDiv <= 24000000);
+    assert(ui32Mclk <= 16000000 || ui32Wait >= 1);
+    assert(ui32Mclk <= 32000000 || ui32Wait >= 2);
+    sim_mclk = ui32Mclk;
+    sim_smclk = g_ui32Dco / g_ui32SmclkDiv;
+}
+
+bool
+PCM_setCoreVoltageLevel(uint_fast8_t level)
+{
+    g_ui8Vcore = level;
+    check();
+    return true;
+}
+
+bool
+FlashCtl_setWaitState(uint32_t bank, uint32_t ws)
+{
+    g_pui32Wait[bank] = ws;
+    check();
+    return true;
+}
+
+void
+CS_setDCOCenteredFrequency(uint32_t dco)
+{
+    static const uint32_t pui32Hz[] = {
+        1500000, 3000000, 6000000, 12000000, 24000000, 48000000
+    };
+
+    g_ui32Dco = pui32Hz[dco];
+    check();
+}
+
+void
+CS_initClockSignal(uint32_t sig, uint32_t src, uint32_t div)
+{
+    assert(src == CS_DCOCLK_SELECT);
+    if (sig == CS_SMCLK) g_ui32SmclkDiv = 1 << div;
+    else assert(div == CS_CLOCK_DIVIDER_1);
+    check();
+}
+
+bool
+UART_initModule(uint32_t module, const eUSCI_UART_Config *config)
+{
+    g_sUart = *config;
+    g_iUartInits++;
+    return true;
+}
+
+void UART_enableModule(uint32_t module) { }
+void UART_enableInterrupt(uint32_t module, uint_fast8_t mask) { }
+void Interrupt_enableInterrupt(uint32_t n) { }
+
+bool
+UART_queryStatusFlags(uint32_t module, uint_fast8_t mask)
+{
+    return g_iUartBusy && g_iUartBusy--;
+}
+
+void
+tb_Rebase(void)
+{
+    assert(sim_irq_masked());
+    g_iRebases++;
+}
+
+void prof_ClockChanged(void) { }
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+
+/* UCBRx, UCBRFx, UCBRSx and UCOS16 of the user's guide for a clock and baud
+ * rate */
+static const struct {
+    uint32_t ui32Clock, ui32Baud;
+    uint16_t ui16BR;
+    uint8_t ui8BRF, ui8BRS, ui8OS16;
+} g_psBaud[] = {
+    {    32768,   9600,   3,  0, 0x92, 0 },
+    {  3000000,   9600,  19,  8, 0x55, 1 },
+    {  3000000, 115200,   1, 10, 0x00, 1 },
+    { 12000000,   9600,  78,  2, 0x00, 1 },
+    { 12000000, 115200,   6,  8, 0x20, 1 },
+    { 24000000,   9600, 156,  4, 0x00, 1 },
+    { 24000000, 115200,  13,  0, 0x25, 1 },
+    { 24000000, 460800,   3,  4, 0x02, 1 },
+};
+
+static void
+check_switch(tClockProfile eProfile, uint32_t ui32Mclk, uint32_t ui32Smclk)
+{
+    eUSCI_UART_Config sWant;
+    BYTE pui8Sect[512];
+    int iInits = g_iUartInits, iRebases = g_iRebases;
+
+    g_iUartBusy = 3;
+    clk_SetProfile(eProfile);
+    assert(!g_iUartBusy);                       /* Waited for the UART */
+    assert(clk_GetProfile() == eProfile);
+    assert(CS_getMCLK() == ui32Mclk && CS_getSMCLK() == ui32Smclk);
+    assert(!sim_irq_masked());
+    assert(g_iRebases == iRebases + 1);
+
+    /* The console UART at 115200 baud from the new SMCLK */
+    assert(g_iUartInits == iInits + 1);
+    clk_UARTConfig(&sWant, ui32Smclk, 115200);
+    assert(g_sUart.clockPrescalar == sWant.clockPrescalar);
+    assert(g_sUart.firstModReg == sWant.firstModReg);
+    assert(g_sUart.secondModReg == sWant.secondModReg);
+
+    /* The cards at the fastest SPI clock up to 12 MHz */
+    assert(disk_read(0, pui8Sect, 0, 1) == RES_OK);
+    assert(sim_smclk / sim_div <= 12000000);
+    assert(sim_div == 1 || sim_smclk / (sim_div - 1) > 12000000);
+    printf("MCLK %2lu MHz, SMCLK %2lu MHz, SPI %5lu kHz\n",
+           (unsigned long)ui32Mclk / 1000000,
+           (unsigned long)ui32Smclk / 1000000,
+           (unsigned long)(sim_smclk / sim_div / 1000));
+}
+
+int
+main(void)
+{
+    eUSCI_UART_Config sConfig;
+    unsigned i;
+
+    for (i = 0; i < sizeof(g_psBaud) / sizeof(g_psBaud[0]); i++) {
+        memset(&sConfig, 0, sizeof(sConfig));
+        clk_UARTConfig(&sConfig, g_psBaud[i].ui32Clock, g_psBaud[i].ui32Baud);
+        assert(sConfig.clockPrescalar == g_psBaud[i].ui16BR);
+        assert(sConfig.firstModReg == g_psBaud[i].ui8BRF);
+        assert(sConfig.secondModReg == g_psBaud[i].ui8BRS);
+        assert(sConfig.overSampling == (g_psBaud[i].ui8OS16 ?
+               EUSCI_A_UART_OVERSAMPLING_BAUDRATE_GENERATION :
+               EUSCI_A_UART_LOW_FREQUENCY_BAUDRATE_GENERATION));
+    }
+
+    /* Starting from reset: 3 MHz, VCORE0, no wait states */
+    sim_mclk = sim_smclk = 3000000;
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 8192, 20, 200);
+    clk_ConsoleInit(115200);
+    assert(disk_initialize(0) == 0);
+
+    /* Up one step at a time, down at once, up at once, down in steps */
+    check_switch(CLK_PROFILE_BALANCED, 12000000, 12000000);
+    check_switch(CLK_PROFILE_MAX, 48000000, 24000000);
+    check_switch(CLK_PROFILE_LOW_POWER, 3000000, 3000000);
+    check_switch(CLK_PROFILE_MAX, 48000000, 24000000);
+    check_switch(CLK_PROFILE_BALANCED, 12000000, 12000000);
+    check_switch(CLK_PROFILE_LOW_POWER, 3000000, 3000000);
+    assert(g_ui8Vcore == PCM_VCORE0 && !g_pui32Wait[0] && !g_pui32Wait[1]);
+    return 0;
+}
@@ -0,0 +1,454 @@
+/*
+ * test_defrag.c - moving a file into contiguous clusters (f_defrag and
+ * f_defragstep of ff.c)
+ *
+ * A file is fragmented by writing it in turn with another one, a cluster at
+ * a time, and deleting the other one, while other files hold all the claims
+ * of clusters ahead of a file. It is then moved in steps while open, and
+ * read with fewer commands, and the open file object follows the move. For
+ * 1KB, 4KB and 32KB clusters, the test also covers:
+ *
+ *   - a power loss at points all through a move, and at each sector write
+ *     of its end, after which the file reads back whole, in its old or its
+ *     new clusters, and clusters are lost only by a power loss in the last
+ *     step, from linking the new clusters until the old ones are freed
+ *   - another file written during a move, which keeps off the clusters
+ *     claimed for it (with -s _FS_RESERVE=0 it takes them, and the move is
+ *     given up)
+ *   - a move cancelled, given up as the file is written or truncated in
+ *     between, or without room, which leaves the free clusters as they were
+ *   - a file that is contiguous already, and a read only file object
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+static FATFS g_sFs;
+static FIL g_sFa, g_sFb, g_psHold[_FS_RSVFILES];
+static DEFRAG g_sDg;
+static BYTE g_pui8Buf[65536];
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static BYTE
+pattern(const char *pcName, DWORD ui32Ofs)
+{
+    return (BYTE)(ui32Ofs * 7 + (ui32Ofs >> 9) * 13 + pcName[0]);
+}
+
+static void
+fill(const char *pcName, DWORD ui32Ofs, BYTE *pui8Buf, UINT n)
+{
+    UINT k;
+
+    for (k = 0; k < n; k++) pui8Buf[k] = pattern(pcName, ui32Ofs + k);
+}
+
+static void
+check(const char *pcName, DWORD ui32Size)
+{
+    FIL sFil;
+    UINT br, k;
+    DWORD ui32Ofs;
+
+    assert(f_open(&sFil, pcName, FA_READ) == FR_OK);
+    assert(sFil.fsize == ui32Size);
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += br) {
+        assert(f_read(&sFil, g_pui8Buf, sizeof(g_pui8Buf), &br) == FR_OK);
+        assert(br);
+        for (k = 0; k < br; k++) {
+            assert(g_pui8Buf[k] == pattern(pcName, ui32Ofs + k));
+        }
+    }
+    assert(f_close(&sFil) == FR_OK);
+}
+
+/* Multiple and single block read commands of reading a file 32KB at a
+ * time */
+static void
+read_cost(const char *pcName, unsigned long *pulMulti,
+          unsigned long *pulSingle)
+{
+    FIL sFil;
+    UINT br;
+    unsigned long ulMulti = sim_cards[0].nrdm, ulSingle = sim_cards[0].nrd;
+
+    assert(f_open(&sFil, pcName, FA_READ) == FR_OK);
+    do {
+        assert(f_read(&sFil, g_pui8Buf, 32768, &br) == FR_OK);
+    } while (br);
+    assert(f_close(&sFil) == FR_OK);
+    *pulMulti = sim_cards[0].nrdm - ulMulti;
+    *pulSingle = sim_cards[0].nrd - ulSingle;
+}
+
+static DWORD
+free_clusters(void)
+{
+    FATFS *psFs;
+    DWORD ui32Free;
+    FRESULT iRes;
+
+    while ((iRes = f_getfree("0:", &ui32Free, &psFs)) == FR_IN_PROGRESS) ;
+    assert(iRes == FR_OK);
+    return ui32Free;
+}
+
+/* Free clusters as the FAT on the card has them, whatever FSInfo says */
+static DWORD
+fat_free(void)
+{
+    const BYTE *pui8Fat = sim_cards[0].data + g_sFs.fatbase * 512;
+    DWORD ui32Cl, ui32Ent, ui32Free = 0;
+
+    for (ui32Cl = 2; ui32Cl < g_sFs.n_fatent; ui32Cl++) {
+        switch (g_sFs.fs_type) {
+        case FS_FAT12:
+            ui32Ent = LD_WORD(pui8Fat + ui32Cl + ui32Cl / 2);
+            ui32Ent = (ui32Cl & 1) ? ui32Ent >> 4 : ui32Ent & 0xFFF;
+            break;
+        case FS_FAT16:
+            ui32Ent = LD_WORD(pui8Fat + ui32Cl * 2);
+            break;
+        default:
+            ui32Ent = LD_DWORD(pui8Fat + ui32Cl * 4) & 0x0FFFFFFF;
+            break;
+        }
+        ui32Free += !ui32Ent;
+    }
+    return ui32Free;
+}
+
+/* Runs of contiguous clusters of a file */
+static DWORD
+runs(const char *pcName)
+{
+    FIL sFil;
+    UINT br;
+    BYTE c;
+    DWORD ui32Ofs, ui32Runs = 0, ui32Last = 0;
+
+    assert(f_open(&sFil, pcName, FA_READ) == FR_OK);
+    for (ui32Ofs = 0; ui32Ofs < sFil.fsize; ui32Ofs += g_sFs.csize * 512) {
+        assert(f_lseek(&sFil, ui32Ofs) == FR_OK);
+        assert(f_read(&sFil, &c, 1, &br) == FR_OK && br == 1);
+        if (sFil.clust != ui32Last + 1) ui32Runs++;
+        ui32Last = sFil.clust;
+    }
+    assert(f_close(&sFil) == FR_OK);
+    return ui32Runs;
+}
+
+/* Forget all that is held in RAM, as a reset does */
+static void
+remount(void)
+{
+    memset(&g_sFs, 0x5A, sizeof(g_sFs));
+    memset(&g_sFa, 0, sizeof(g_sFa));
+    memset(&g_sDg, 0, sizeof(g_sDg));
+    f_mount(0, 0);
+    f_mount(0, &g_sFs);
+}
+
+static void
+format(UINT uAu)
+{
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, uAu) == FR_OK);
+    remount();
+}
+
+/* Take up all the claims of clusters ahead of a file, so that the files
+ * written next take turns cluster by cluster */
+static void
+hold_claims(void)
+{
+    char pcName[16];
+    UINT bw;
+    int i;
+
+    for (i = 0; i < _FS_RSVFILES; i++) {
+        sprintf(pcName, "H%d.BIN", i);
+        assert(f_open(&g_psHold[i], pcName, FA_CREATE_ALWAYS | FA_WRITE) ==
+               FR_OK);
+        assert(f_write(&g_psHold[i], "h", 1, &bw) == FR_OK && bw == 1);
+    }
+}
+
+static void
+release_claims(void)
+{
+    char pcName[16];
+    int i;
+
+    for (i = 0; i < _FS_RSVFILES; i++) {
+        assert(f_close(&g_psHold[i]) == FR_OK);
+        sprintf(pcName, "H%d.BIN", i);
+        assert(f_unlink(pcName) == FR_OK);
+    }
+}
+
+/* Write pcName in turn with B.BIN a cluster at a time, and delete B.BIN */
+static void
+make_fragmented(const char *pcName, DWORD ui32Size)
+{
+    UINT uClust = g_sFs.csize * 512, n, bw;
+    DWORD ui32Ofs;
+
+    hold_claims();
+    assert(f_open(&g_sFa, pcName, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_open(&g_sFb, "B.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += n) {
+        n = ui32Size - ui32Ofs < uClust ? ui32Size - ui32Ofs : uClust;
+        fill(pcName, ui32Ofs, g_pui8Buf, n);
+        assert(f_write(&g_sFa, g_pui8Buf, n, &bw) == FR_OK && bw == n);
+        assert(f_write(&g_sFb, g_pui8Buf, uClust, &bw) == FR_OK);
+    }
+    assert(f_close(&g_sFa) == FR_OK && f_close(&g_sFb) == FR_OK);
+    assert(f_unlink("B.BIN") == FR_OK);
+    release_claims();
+}
+
+/* Step the move to its end; returns the result and the number of steps */
+static FRESULT
+finish(UINT uSect, unsigned long *pulSteps)
+{
+    FRESULT iRes;
+    unsigned long ulSteps = 0;
+
+    while ((iRes = f_defragstep(&g_sDg, uSect)) == FR_IN_PROGRESS) ulSteps++;
+    if (pulSteps) *pulSteps = ulSteps;
+    return iRes;
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+static void
+suite(UINT uAu, DWORD ui32Size)
+{
+    DWORD ui32Half = ui32Size / 2, ui32Runs, ui32Free, ui32Lost, ui32Start;
+    DWORD ui32Clusters;
+    unsigned long ulMulti, ulSingle, ulMulti2, ulSingle2, ulSteps, ulWritten;
+    unsigned long ulCut, ulUs, ulWrites, ulEnd, ulLeak = 0;
+    unsigned uOld = 0, uNew = 0, uLeaks = 0;
+    UINT br, bw, n, k;
+    FRESULT iRes;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 262144, 60, 100);
+    assert(disk_initialize(0) == 0);
+    format(uAu);
+    free_clusters();
+    printf("%u-byte clusters, %lu of them\n", g_sFs.csize * 512,
+           (unsigned long)(g_sFs.n_fatent - 2));
+
+    /* A fragmented file, moved while open at the middle of a sector */
+    make_fragmented("A.BIN", ui32Size);
+    ui32Runs = runs("A.BIN");
+    read_cost("A.BIN", &ulMulti, &ulSingle);
+    ui32Free = free_clusters();
+    ulWritten = sim_cards[0].wrsect;
+    assert(f_open(&g_sFa, "A.BIN", FA_READ | FA_WRITE) == FR_OK);
+    assert(f_lseek(&g_sFa, 1000) == FR_OK);
+    assert(f_read(&g_sFa, g_pui8Buf, 10, &br) == FR_OK);
+    assert(f_defrag(&g_sDg, &g_sFa) == FR_IN_PROGRESS);
+    ulUs = (unsigned long)tb_Now();
+    assert(finish(8, &ulSteps) == FR_OK);
+    ulUs = (unsigned long)tb_Now() - ulUs;
+    ulWritten = sim_cards[0].wrsect - ulWritten;
+
+    /* The file object reads on from where it was */
+    assert(f_read(&g_sFa, g_pui8Buf, 3000, &br) == FR_OK && br == 3000);
+    for (k = 0; k < br; k++) {
+        assert(g_pui8Buf[k] == pattern("A.BIN", 1010 + k));
+    }
+    assert(f_lseek(&g_sFa, 4096) == FR_OK);
+    assert(f_read(&g_sFa, g_pui8Buf, 512, &br) == FR_OK && br == 512);
+    for (k = 0; k < br; k++) {
+        assert(g_pui8Buf[k] == pattern("A.BIN", 4096 + k));
+    }
+    assert(f_close(&g_sFa) == FR_OK);
+    read_cost("A.BIN", &ulMulti2, &ulSingle2);
+    assert(runs("A.BIN") == 1 && free_clusters() == ui32Free);
+    check("A.BIN", ui32Size);
+    remount();
+    check("A.BIN", ui32Size);
+    assert(free_clusters() == ui32Free);
+    printf("  %lu KB in %lu runs: %lu multiple + %lu single block reads; "
+           "moved in %lu steps of 8 sectors, %lu sectors written, %lu ms: "
+           "%lu + %lu reads\n", (unsigned long)ui32Size / 1024,
+           (unsigned long)ui32Runs, ulMulti, ulSingle, ulSteps, ulWritten,
+           ulUs / 1000, ulMulti2, ulSingle2);
+    assert(ui32Runs > 8 && ulMulti2 + ulSingle2 <= ulMulti + ulSingle);
+
+    /* Contiguous already; read only */
+    assert(f_open(&g_sFa, "A.BIN", FA_READ | FA_WRITE) == FR_OK);
+    assert(f_defrag(&g_sDg, &g_sFa) == FR_OK && !g_sDg.fp);
+    assert(f_defragstep(&g_sDg, 8) == FR_OK);
+    assert(f_close(&g_sFa) == FR_OK);
+    assert(f_open(&g_sFa, "A.BIN", FA_READ) == FR_OK);
+    assert(f_defrag(&g_sDg, &g_sFa) == FR_DENIED);
+    assert(f_close(&g_sFa) == FR_OK);
+
+    /* Steps and sector writes of a whole move of half the size */
+    format(uAu);
+    make_fragmented("C.BIN", ui32Half);
+    assert(f_open(&g_sFa, "C.BIN", FA_READ | FA_WRITE) == FR_OK);
+    assert(f_defrag(&g_sDg, &g_sFa) == FR_IN_PROGRESS);
+    ui32Clusters = g_sDg.nclst;
+    ulWrites = sim_cards[0].wrsect;
+    for (ulSteps = 0; ; ulSteps++) {
+        ulEnd = sim_cards[0].wrsect;
+        if ((iRes = f_defragstep(&g_sDg, 4)) != FR_IN_PROGRESS) break;
+    }
+    assert(iRes == FR_OK);
+    ulEnd = sim_cards[0].wrsect - ulEnd;
+    ulWrites = sim_cards[0].wrsect - ulWrites;
+    assert(f_close(&g_sFa) == FR_OK);
+
+    /* Power loss after ulCut of the sector writes, at points all through
+     * the move and at each of the ulEnd writes of its last step, which
+     * links the new clusters, switches the directory entry over and frees
+     * the old clusters */
+    for (ulCut = 0; ; ) {
+        format(uAu);
+        make_fragmented("C.BIN", ui32Half);
+        ui32Free = fat_free();
+        assert(f_open(&g_sFa, "C.BIN", FA_READ | FA_WRITE) == FR_OK);
+        ui32Start = g_sFa.sclust;
+        assert(f_defrag(&g_sDg, &g_sFa) == FR_IN_PROGRESS);
+        sim_cards[0].wrcut = sim_cards[0].wrsect + ulCut;
+        finish(4, 0);
+        remount();
+        sim_cards[0].wrcut = 0;
+        check("C.BIN", ui32Half);
+        ui32Lost = ui32Free - fat_free();
+        assert(ui32Lost <= ui32Clusters);
+        if (ui32Lost) {
+            assert(!uLeaks || ulLeak == ulCut - 1);
+            ulLeak = ulCut;
+            uLeaks++;
+        }
+        assert(f_open(&g_sFa, "C.BIN", FA_READ) == FR_OK);
+        if (g_sFa.sclust == ui32Start) uOld++; else uNew++;
+        assert(f_close(&g_sFa) == FR_OK);
+        if (ulCut == ulWrites) break;
+        if (ulCut >= ulWrites - ulEnd) ulCut++;
+        else if ((ulCut += 1 + ulWrites / 20) > ulWrites - ulEnd)
+            ulCut = ulWrites - ulEnd;
+    }
+    printf("  power loss at %u points of %lu writes: whole every time, %u in "
+           "the old clusters, %u in the new, %u with lost clusters, all in "
+           "the %lu writes of the last step\n", uOld + uNew, ulWrites, uOld,
+           uNew, uLeaks, ulEnd);
+    assert(uOld && uNew);
+    assert(uLeaks < ulEnd);
+    assert(!uLeaks || ulLeak - uLeaks >= ulWrites - ulEnd);
+
+    /* Another file written during a move keeps off the claimed clusters */
+    format(uAu);
+    make_fragmented("C.BIN", ui32Half);
+    assert(f_open(&g_sFa, "C.BIN", FA_READ | FA_WRITE) == FR_OK);
+    assert(f_defrag(&g_sDg, &g_sFa) == FR_IN_PROGRESS);
+    while (!g_sDg.dclust) {
+        assert(f_defragstep(&g_sDg, 4) == FR_IN_PROGRESS);
+    }
+    assert(f_open(&g_sFb, "X.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (k = 0; k < 8; k++) {
+        fill("X.BIN", k * 4096, g_pui8Buf, 4096);
+        assert(f_write(&g_sFb, g_pui8Buf, 4096, &bw) == FR_OK && bw == 4096);
+    }
+    assert(f_close(&g_sFb) == FR_OK);
+    iRes = finish(4, 0);
+#if _FS_RESERVE
+    assert(iRes == FR_OK);
+#else
+    assert(iRes == FR_DENIED);
+#endif
+    assert(f_close(&g_sFa) == FR_OK);
+    check("C.BIN", ui32Half);
+    check("X.BIN", 8 * 4096);
+    if (iRes == FR_OK) assert(runs("C.BIN") == 1);
+
+    /* Cancelled: the clusters claimed are free again */
+    format(uAu);
+    make_fragmented("C.BIN", ui32Half);
+    ui32Free = free_clusters();
+    assert(f_open(&g_sFa, "C.BIN", FA_READ | FA_WRITE) == FR_OK);
+    assert(f_defrag(&g_sDg, &g_sFa) == FR_IN_PROGRESS);
+    for (k = 0; k < 6; k++) {
+        assert(f_defragstep(&g_sDg, 4) == FR_IN_PROGRESS);
+    }
+    assert(g_sDg.dclust);
+    assert(f_defragstep(&g_sDg, 0) == FR_OK && !g_sDg.fp);
+    assert(free_clusters() == ui32Free);
+
+    /* Given up when the file is written in between */
+    assert(f_defrag(&g_sDg, &g_sFa) == FR_IN_PROGRESS);
+    for (k = 0; k < 6; k++) {
+        assert(f_defragstep(&g_sDg, 4) == FR_IN_PROGRESS);
+    }
+    assert(f_lseek(&g_sFa, 100) == FR_OK);
+    fill("C.BIN", 100, g_pui8Buf, 50);
+    assert(f_write(&g_sFa, g_pui8Buf, 50, &bw) == FR_OK && bw == 50);
+    assert(f_defragstep(&g_sDg, 4) == FR_DENIED && !g_sDg.fp);
+    assert(f_close(&g_sFa) == FR_OK);
+    assert(free_clusters() == ui32Free);
+    check("C.BIN", ui32Half);
+
+    /* or truncated through another file object */
+    assert(f_open(&g_sFa, "C.BIN", FA_READ | FA_WRITE) == FR_OK);
+    assert(f_defrag(&g_sDg, &g_sFa) == FR_IN_PROGRESS);
+    for (k = 0; k < 3; k++) {
+        assert(f_defragstep(&g_sDg, 4) == FR_IN_PROGRESS);
+    }
+    assert(f_open(&g_sFb, "C.BIN", FA_READ | FA_WRITE) == FR_OK);
+    assert(f_lseek(&g_sFb, 5000) == FR_OK && f_truncate(&g_sFb) == FR_OK);
+    assert(f_close(&g_sFb) == FR_OK);
+    iRes = finish(64, 0);
+    assert(iRes == FR_DENIED || iRes == FR_INT_ERR);
+    assert(f_close(&g_sFa) == FR_OK);
+    check("C.BIN", 5000);
+
+    /* Without a free run to take the file */
+    format(uAu);
+    make_fragmented("C.BIN", ui32Half);
+    n = g_sFs.csize * 512;
+    hold_claims();
+    assert(f_open(&g_sFa, "F.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_open(&g_sFb, "G.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    while (f_write(&g_sFa, g_pui8Buf, n, &bw) == FR_OK && bw == n &&
+           f_write(&g_sFb, g_pui8Buf, n, &bw) == FR_OK && bw == n) ;
+    assert(f_close(&g_sFa) == FR_OK && f_close(&g_sFb) == FR_OK);
+    assert(f_unlink("G.BIN") == FR_OK);
+    release_claims();
+    ui32Free = free_clusters();
+    assert(f_open(&g_sFa, "C.BIN", FA_READ | FA_WRITE) == FR_OK);
+    iRes = f_defrag(&g_sDg, &g_sFa);
+    if (iRes == FR_IN_PROGRESS) iRes = finish(64, 0);
+    assert(iRes == FR_DENIED);
+    assert(f_close(&g_sFa) == FR_OK);
+    assert(free_clusters() == ui32Free);
+    check("C.BIN", ui32Half);
+}
+
+int
+main(void)
+{
+    suite(1024, 600 * 1024);
+    suite(4096, 1024 * 1024);
+    suite(32768, 2048 * 1024);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*
+ * test_erase.c - erase blocks erased ahead of file writes (_USE_ERASE)
+ *
+ * Files are written in large pieces to a card of 1 MB erase blocks where a
+ * sector written without an erase costs garbage collection. Every erase
+ * sent to the card covers whole blocks, starts at the top of a block the
+ * file enters and leaves alone the blocks holding clusters of other files;
+ * a file that starts in the middle of a block erases the blocks after it
+ * only. The writes that still needed garbage collection are printed with
+ * the time taken; run with -s _USE_ERASE=0 for the numbers without erases.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+#define AU_SECTORS      2048            /* AU_SIZE 7 of the simulated card */
+
+static FATFS g_sFs;
+static FIL g_sFil;
+static BYTE g_pui8Buf[65536];
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static BYTE
+pattern(int iSeed, DWORD ui32Ofs)
+{
+    return (BYTE)(ui32Ofs * 7 + (ui32Ofs >> 9) * 13 + iSeed);
+}
+
+static void
+make_file(const char *pcName, int iSeed, DWORD ui32Size)
+{
+    UINT n, k, bw;
+    DWORD ui32Ofs;
+
+    assert(f_open(&g_sFil, pcName, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += n) {
+        n = ui32Size - ui32Ofs < sizeof(g_pui8Buf) ? ui32Size - ui32Ofs :
+            sizeof(g_pui8Buf);
+        for (k = 0; k < n; k++) g_pui8Buf[k] = pattern(iSeed, ui32Ofs + k);
+        assert(f_write(&g_sFil, g_pui8Buf, n, &bw) == FR_OK && bw == n);
+    }
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+static void
+check(const char *pcName, int iSeed, DWORD ui32Size)
+{
+    UINT br, k;
+    DWORD ui32Ofs;
+
+    assert(f_open(&g_sFil, pcName, FA_READ) == FR_OK);
+    assert(g_sFil.fsize == ui32Size);
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += br) {
+        assert(f_read(&g_sFil, g_pui8Buf, sizeof(g_pui8Buf), &br) == FR_OK);
+        assert(br);
+        for (k = 0; k < br; k++) {
+            assert(g_pui8Buf[k] == pattern(iSeed, ui32Ofs + k));
+        }
+    }
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+/* First and last sector of a file */
+static void
+extent(const char *pcName, DWORD *pui32First, DWORD *pui32Last)
+{
+    BYTE c;
+    UINT br;
+
+    assert(f_open(&g_sFil, pcName, FA_READ) == FR_OK);
+    assert(f_read(&g_sFil, &c, 1, &br) == FR_OK && br == 1);
+    *pui32First = g_sFil.dsect;
+    assert(f_lseek(&g_sFil, g_sFil.fsize - 1) == FR_OK);
+    assert(f_read(&g_sFil, &c, 1, &br) == FR_OK && br == 1);
+    *pui32Last = g_sFil.dsect;
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+/* The erases logged on the card since command ulFrom: each one of whole
+ * blocks, none touching the sectors ui32Keep to ui32KeepEnd. Returns the
+ * number of blocks erased, and the first erased sector. */
+static unsigned long
+erases(unsigned long ulFrom, DWORD ui32Keep, DWORD ui32KeepEnd,
+       DWORD *pui32First)
+{
+    SimCard *psCard = &sim_cards[0];
+    unsigned long i, ulBlocks = 0;
+    uint32_t ui32Start = 0, ui32End = 0;
+
+    assert(psCard->nlog - ulFrom < SIM_LOG);
+    *pui32First = 0;
+    for (i = ulFrom; i < psCard->nlog; i++) {
+        SimLog *psLog = &psCard->log[i % SIM_LOG];
+
+        if (psLog->cmd == 32) ui32Start = psLog->arg;
+        if (psLog->cmd == 33) ui32End = psLog->arg;
+        if (psLog->cmd != 38) continue;
+        assert(ui32Start % AU_SECTORS == 0);
+        assert((ui32End + 1) % AU_SECTORS == 0);
+        assert(ui32End < ui32Keep || ui32Start > ui32KeepEnd);
+        if (!ulBlocks) *pui32First = ui32Start;
+        ulBlocks += (ui32End + 1 - ui32Start) / AU_SECTORS;
+    }
+    return ulBlocks;
+}
+
+static void
+report(const char *pcWhat, unsigned long ulBlocks, unsigned long ulGc,
+       unsigned long ulSectors, uint64_t ui64Us)
+{
+    printf("  %-28s %3lu blocks erased, %5lu of %5lu sectors with gc, "
+           "%8lu us\n", pcWhat, ulBlocks, ulGc, ulSectors,
+           (unsigned long)ui64Us);
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    SimCard *psCard = &sim_cards[0];
+    unsigned long ulLog, ulGc, ulWr, ulBlocks;
+    DWORD ui32First, ui32Last, ui32Erased, ui32Keep, ui32KeepEnd;
+    uint64_t ui64Start;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 131072, 20, 375);
+    psCard->gc_busy = 2000;
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 16384) == FR_OK);
+    memset(psCard->erased, 0, psCard->nsect);
+
+    /* A file from the top of a block */
+    ulLog = psCard->nlog;
+    ulGc = psCard->ngc;
+    ulWr = psCard->wrsect;
+    ui64Start = tb_Now();
+    make_file("A.BIN", 1, 3 * 1024 * 1024 + 12345);
+    ulBlocks = erases(ulLog, 0, 0, &ui32Erased);
+    report("3MB from a block top", ulBlocks, psCard->ngc - ulGc,
+           psCard->wrsect - ulWr, tb_Now() - ui64Start);
+    extent("A.BIN", &ui32First, &ui32Last);
+    check("A.BIN", 1, 3 * 1024 * 1024 + 12345);
+#if _USE_ERASE
+    assert(g_sFs.au_size == AU_SECTORS);
+    assert(ui32First % AU_SECTORS == 0);
+    assert(ulBlocks == ui32Last / AU_SECTORS - ui32First / AU_SECTORS + 1);
+    assert(ui32Erased == ui32First);
+    assert(psCard->ngc - ulGc < (psCard->wrsect - ulWr) / 8);
+#endif
+
+    /* After a remount, a file from the middle of a block: the block it
+     * starts in keeps the sectors of A.BIN and is not erased */
+    f_mount(0, 0);
+    f_mount(0, &g_sFs);
+    ulLog = psCard->nlog;
+    ulGc = psCard->ngc;
+    ulWr = psCard->wrsect;
+    ui64Start = tb_Now();
+    make_file("B.BIN", 2, 2 * 1024 * 1024);
+    ulBlocks = erases(ulLog, 0, ui32Last, &ui32Erased);
+    report("2MB from a block middle", ulBlocks, psCard->ngc - ulGc,
+           psCard->wrsect - ulWr, tb_Now() - ui64Start);
+    extent("B.BIN", &ui32First, &ui32Last);
+    check("A.BIN", 1, 3 * 1024 * 1024 + 12345);
+    check("B.BIN", 2, 2 * 1024 * 1024);
+#if _USE_ERASE
+    assert(ui32First % AU_SECTORS);
+    assert(ulBlocks == ui32Last / AU_SECTORS - ui32First / AU_SECTORS);
+    assert(ui32Erased == (ui32First / AU_SECTORS + 1) * AU_SECTORS);
+#endif
+
+    /* A.BIN removed, a small file behind B.BIN, and a file filling the
+     * room of A.BIN: the blocks of B.BIN and of the small file are kept */
+    ui32Keep = ui32First;
+    make_file("C.BIN", 3, 1000);
+    extent("C.BIN", &ui32First, &ui32KeepEnd);
+    assert(ui32First > ui32Last);
+    assert(f_unlink("A.BIN") == FR_OK);
+    ulLog = psCard->nlog;
+    ulGc = psCard->ngc;
+    ulWr = psCard->wrsect;
+    ui64Start = tb_Now();
+    make_file("D.BIN", 4, 4 * 1024 * 1024);
+    ulBlocks = erases(ulLog, ui32Keep, ui32KeepEnd, &ui32Erased);
+    report("4MB around other files", ulBlocks, psCard->ngc - ulGc,
+           psCard->wrsect - ulWr, tb_Now() - ui64Start);
+    check("B.BIN", 2, 2 * 1024 * 1024);
+    check("C.BIN", 3, 1000);
+    check("D.BIN", 4, 4 * 1024 * 1024);
+#if _USE_ERASE
+    assert(ulBlocks >= 2);
+#else
+    assert(!ulBlocks);
+#endif
+    return 0;
+}
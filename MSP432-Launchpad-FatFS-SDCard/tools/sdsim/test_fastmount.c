@@ -0,0 +1,112 @@
+/*
+ * test_fastmount.c - mount from the saved mount record (_FS_FASTMOUNT)
+ *
+ * The second mount of a card reads the boot sector and FSInfo only. The
+ * free space comes from FSInfo and not from the record, so that it holds
+ * after the card has been written elsewhere. A re-formatted card is
+ * mounted from scratch.
+ *
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+
+static FATFS g_sFs;
+static FIL g_sFil;
+static unsigned char g_pucFlash[sizeof(sim_flash)];
+
+/* Power the card up again and mount it; the number of reads it took */
+static unsigned long
+boot(const char *what, const char *text)
+{
+    unsigned long t, rd;
+    char buf[16];
+    UINT br;
+
+    sim_cards[0].idle = 1;
+    t = sim_clock;
+    rd = sim_cards[0].nrd + sim_cards[0].nrdm;
+    f_mount(0, &g_sFs);
+    assert(f_open(&g_sFil, "A.TXT", FA_READ) == FR_OK);
+    rd = sim_cards[0].nrd + sim_cards[0].nrdm - rd - 1;
+    assert(f_read(&g_sFil, buf, sizeof(buf), &br) == FR_OK);
+    assert(br == strlen(text) && !memcmp(buf, text, br));
+    assert(f_close(&g_sFil) == FR_OK);
+    printf("%-20s %lu reads, first data after %lu us\n", what, rd,
+           (sim_clock - t) * SIM_US_PER_BYTE);
+    return rd;
+}
+
+static void
+put(const char *name, const char *text, UINT n)
+{
+    static char buf[4096];
+    UINT bw;
+
+    memset(buf, 'x', sizeof(buf));
+    memcpy(buf, text, strlen(text));
+    assert(f_open(&g_sFil, name, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_write(&g_sFil, buf, n, &bw) == FR_OK && bw == n);
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+static DWORD
+nfree(void)
+{
+    DWORD n;
+    FATFS *fs;
+    FRESULT res;
+
+    /* With _FS_SCANFREE an unknown count takes several calls */
+    while ((res = f_getfree("", &n, &fs)) == FR_IN_PROGRESS) ;
+    assert(res == FR_OK);
+    return n;
+}
+
+int
+main(void)
+{
+    unsigned long cold, fast;
+    DWORD before, after;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 131072, 30, 300);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 512) == FR_OK);         /* FAT32 with FSInfo */
+    put("A.TXT", "hello", 5);
+
+    /* Without a record, then from the record made by the first mount */
+    memset(sim_flash, 0xFF, sizeof(sim_flash));
+    cold = boot("cold", "hello");
+    fast = boot("fast", "hello");
+    assert(fast < cold);
+    before = nfree();
+
+    /* Another host writes the card: the record stays as it was */
+    memcpy(g_pucFlash, sim_flash, sizeof(sim_flash));
+    put("B.TXT", "pc", 4096);
+    assert(f_mount(0, 0) == FR_OK);
+    memcpy(sim_flash, g_pucFlash, sizeof(sim_flash));
+    boot("after a write", "hello");
+    after = nfree();
+    assert(after == before - 8);
+    put("C.TXT", "c", 512);
+    assert(nfree() == after - 1);
+
+    /* A volume of another layout (FAT16) is not mounted from the old
+     * record, and then gets a record of its own */
+    memcpy(g_pucFlash, sim_flash, sizeof(sim_flash));
+    assert(f_mkfs(0, 0, 1024) == FR_OK);
+    put("A.TXT", "again", 5);
+    memcpy(sim_flash, g_pucFlash, sizeof(sim_flash));
+    assert(boot("after mkfs", "again") > fast);
+    assert(boot("fast again", "again") <= fast);
+    assert(nfree() == g_sFs.n_fatent - 2 - 1);
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * test_fattypes.c - FAT access built for all sub-types or FAT32 alone
+ *                   (_FS_FATTYPES of ff.c)
+ *
+ * The same FAT32 volume is used by a build for all FAT sub-types and by one
+ * for FAT32 alone. Both count the free clusters of the whole FAT, search
+ * past 127 taken clusters for a free one, allocate and release a chain of
+ * 120 clusters and walk it, and get the same results. Apart from the count,
+ * each works in one FAT sector that stays in the window, so that no sector
+ * is read or written and the host time is that of the FAT access alone;
+ * the count reads the whole FAT, the same sectors in both builds. The host
+ * time per cluster of each is printed; run with -O for the numbers.
+ *
+ * sdsim: set _USE_STAGE 0
+ * sdsim: set _FS_FASTMOUNT 0
+ * sdsim: set _FS_RESERVE 0
+ * sdsim: set _USE_ERASE 0
+ * sdsim: vary _FS_FATTYPES 7 4
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+#define SECTORS         262144          /* 512-byte clusters, over 65525 */
+#define TAKEN           127             /* Clusters 128 to 254 */
+#define CHAIN           120             /* Clusters 256 on */
+#define ROUNDS          1000
+#define BATCHES         5               /* Of ROUNDS, the best one counts */
+
+static FATFS g_sFs;
+static FIL g_sFil;
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static double
+seconds(void)
+{
+    struct timespec sTs;
+
+    clock_gettime(CLOCK_MONOTONIC, &sTs);
+    return sTs.tv_sec + sTs.tv_nsec * 1e-9;
+}
+
+/* Free clusters counted in the FAT on the card */
+static DWORD
+fat_free(void)
+{
+    const BYTE *pui8Fat = sim_cards[0].data + g_sFs.fatbase * 512;
+    DWORD ui32Cl, ui32Free = 0;
+
+    for (ui32Cl = 2; ui32Cl < g_sFs.n_fatent; ui32Cl++)
+        ui32Free += !(LD_DWORD(pui8Fat + ui32Cl * 4) & 0x0FFFFFFF);
+    return ui32Free;
+}
+
+/* Forget the free count, on the card and in RAM */
+static void
+remount_unknown(void)
+{
+    BYTE *pui8Fsi = sim_cards[0].data + g_sFs.fsi_sector * 512;
+
+    ST_DWORD(pui8Fsi + 488, 0xFFFFFFFF);           /* FSI_Free_Count */
+    memset(&g_sFs, 0, sizeof(g_sFs));
+    f_mount(0, 0);
+    f_mount(0, &g_sFs);
+}
+
+/* The sectors moved since ulFrom */
+static unsigned long
+moved(unsigned long ulFrom)
+{
+    return sim_cards[0].rdsect + sim_cards[0].wrsect - ulFrom;
+}
+
+/* Keeps in *pdBest the lower of it and the host time per cluster in ns
+ * since dStart */
+static void
+best(double *pdBest, double dStart, unsigned long ulClusters)
+{
+    double dNs = (seconds() - dStart) * 1e9 / ulClusters;
+
+    if (dNs < *pdBest) *pdBest = dNs;
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    BYTE *pui8Fat;
+    FATFS *psFs;
+    FRESULT iRes;
+    DWORD ui32Free, ui32Cl;
+    unsigned long ulMoved, ulRead;
+    double dStart, dCount = 1e9, dSearch = 1e9, dAlloc = 1e9, dWalk = 1e9;
+    int i, b;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, SECTORS, 1, 1);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 512) == FR_OK);
+    assert(f_getfree("0:", &ui32Free, &psFs) == FR_OK);
+    assert(g_sFs.fs_type == FS_FAT32);
+
+    /* Clusters 128 to 254 taken, each a chain of its own */
+    pui8Fat = sim_cards[0].data + g_sFs.fatbase * 512;
+    for (ui32Cl = 128; ui32Cl < 128 + TAKEN; ui32Cl++) {
+        ST_DWORD(pui8Fat + ui32Cl * 4, 0x0FFFFFFF);
+    }
+
+    /* Counting the free clusters of the whole FAT */
+    for (b = 0; b < BATCHES; b++) {
+        remount_unknown();
+        ulRead = sim_cards[0].rdsect;
+        dStart = seconds();
+        while ((iRes = f_getfree("0:", &ui32Free, &psFs)) == FR_IN_PROGRESS) ;
+        best(&dCount, dStart, g_sFs.n_fatent - 2);
+        assert(iRes == FR_OK && ui32Free == fat_free());
+        assert(ui32Free == g_sFs.n_fatent - 3 - TAKEN);
+    }
+    ulRead = sim_cards[0].rdsect - ulRead;
+
+    /* Searching past the taken clusters: a cluster taken and let go */
+    assert(f_open(&g_sFil, "A.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_sync(&g_sFil) == FR_OK);
+    for (b = -1; b < BATCHES; b++) {
+        if (!b) ulMoved = moved(0);
+        dStart = seconds();
+        for (i = 0; i < ROUNDS; i++) {
+            g_sFs.last_clust = 127;
+            assert(f_lseek(&g_sFil, 512) == FR_OK);
+            assert(g_sFil.sclust == 128 + TAKEN);
+            assert(f_lseek(&g_sFil, 0) == FR_OK &&
+                   f_truncate(&g_sFil) == FR_OK);
+        }
+        if (b >= 0) best(&dSearch, dStart, ROUNDS * TAKEN);
+    }
+    assert(!moved(ulMoved));
+
+    /* Allocating a chain of CHAIN clusters and releasing it */
+    for (b = -1; b < BATCHES; b++) {
+        if (!b) ulMoved = moved(0);
+        dStart = seconds();
+        for (i = 0; i < ROUNDS; i++) {
+            g_sFs.last_clust = 255;
+            assert(f_lseek(&g_sFil, CHAIN * 512) == FR_OK);
+            assert(g_sFil.sclust == 256 && g_sFil.clust == 256 + CHAIN - 1);
+            assert(f_lseek(&g_sFil, 0) == FR_OK &&
+                   f_truncate(&g_sFil) == FR_OK);
+        }
+        if (b >= 0) best(&dAlloc, dStart, ROUNDS * CHAIN);
+    }
+    assert(!moved(ulMoved));
+
+    /* Walking the chain */
+    g_sFs.last_clust = 255;
+    assert(f_lseek(&g_sFil, CHAIN * 512) == FR_OK);
+    for (b = -1; b < BATCHES; b++) {
+        if (!b) ulMoved = moved(0);
+        dStart = seconds();
+        for (i = 0; i < ROUNDS; i++) {
+            assert(f_lseek(&g_sFil, 0) == FR_OK);
+            assert(f_lseek(&g_sFil, CHAIN * 512) == FR_OK);
+            assert(g_sFil.clust == 256 + CHAIN - 1);
+        }
+        if (b >= 0) best(&dWalk, dStart, ROUNDS * CHAIN);
+    }
+    assert(!moved(ulMoved));
+    assert(f_close(&g_sFil) == FR_OK);
+    assert(g_sFs.free_clust == fat_free());
+
+    printf("  _FS_FATTYPES %d, ns per cluster: free count %.1f (%lu sectors "
+           "read), search %.2f, allocation and release %.1f, chain walk "
+           "%.2f\n", _FS_FATTYPES, dCount, ulRead, dSearch, dAlloc, dWalk);
+    return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * test_fcopy.c - copying and moving files (fcopy.c)
+ *
+ * Copies replace the file of the new name, on the same card and on the
+ * other one, and are refused onto themselves. A copy that does not fit, or
+ * whose old file cannot be removed, leaves the old file as it was and no
+ * FCOPY.$$$ behind. Moves rename on the same volume, directories too, and
+ * to the other card copy with the time stamp and attributes, but not over
+ * a file, nor a directory or a read-only file. The time and the commands
+ * of a copy are printed next to those of 512-byte f_read() and f_write().
+ *
+ * sdsim: src fcopy.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+#include "fcopy.h"
+
+static FATFS g_sFs0, g_sFs1;
+static FIL g_sFa, g_sFb;
+static BYTE g_pui8Buf[65536];
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static BYTE
+pattern(int iSeed, DWORD ui32Ofs)
+{
+    return (BYTE)(ui32Ofs * 7 + (ui32Ofs >> 9) * 13 + iSeed);
+}
+
+static void
+make_file(const char *pcName, int iSeed, DWORD ui32Size)
+{
+    UINT n, k, bw;
+    DWORD ui32Ofs;
+
+    assert(f_open(&g_sFa, pcName, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += n) {
+        n = ui32Size - ui32Ofs < sizeof(g_pui8Buf) ? ui32Size - ui32Ofs :
+            sizeof(g_pui8Buf);
+        for (k = 0; k < n; k++) g_pui8Buf[k] = pattern(iSeed, ui32Ofs + k);
+        assert(f_write(&g_sFa, g_pui8Buf, n, &bw) == FR_OK && bw == n);
+    }
+    assert(f_close(&g_sFa) == FR_OK);
+}
+
+static void
+check(const char *pcName, int iSeed, DWORD ui32Size)
+{
+    UINT br, k;
+    DWORD ui32Ofs;
+
+    assert(f_open(&g_sFa, pcName, FA_READ) == FR_OK);
+    assert(g_sFa.fsize == ui32Size);
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += br) {
+        assert(f_read(&g_sFa, g_pui8Buf, sizeof(g_pui8Buf), &br) == FR_OK);
+        assert(br);
+        for (k = 0; k < br; k++) {
+            assert(g_pui8Buf[k] == pattern(iSeed, ui32Ofs + k));
+        }
+    }
+    assert(f_close(&g_sFa) == FR_OK);
+}
+
+static DWORD
+free_clusters(const char *pcDrive)
+{
+    FATFS *psFs;
+    DWORD ui32Free;
+    FRESULT iRes;
+
+    while ((iRes = f_getfree(pcDrive, &ui32Free, &psFs)) == FR_IN_PROGRESS) ;
+    assert(iRes == FR_OK);
+    return ui32Free;
+}
+
+static bool
+exists(const char *pcPath)
+{
+    FILINFO sInfo;
+
+    memset(&sInfo, 0, sizeof(sInfo));
+    return f_stat(pcPath, &sInfo) == FR_OK;
+}
+
+/* Copy as an application would, 512 bytes at a time */
+static void
+copy_by_sector(const char *pcFrom, const char *pcTo)
+{
+    UINT br, bw;
+
+    assert(f_open(&g_sFa, pcFrom, FA_READ) == FR_OK);
+    assert(f_open(&g_sFb, pcTo, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    do {
+        assert(f_read(&g_sFa, g_pui8Buf, 512, &br) == FR_OK);
+        assert(f_write(&g_sFb, g_pui8Buf, br, &bw) == FR_OK && bw == br);
+    } while (br == 512);
+    assert(f_close(&g_sFa) == FR_OK && f_close(&g_sFb) == FR_OK);
+}
+
+typedef struct {
+    uint64_t ui64Us;
+    unsigned long ulRead, ulReadMulti, ulWrite, ulWriteMulti;
+} tCost;
+
+static tCost
+cost(void)
+{
+    tCost sCost;
+
+    sCost.ui64Us = tb_Now();
+    sCost.ulRead = sim_cards[0].nrd;
+    sCost.ulReadMulti = sim_cards[0].nrdm;
+    sCost.ulWrite = sim_cards[0].nwr;
+    sCost.ulWriteMulti = sim_cards[0].nwrm;
+    return sCost;
+}
+
+static unsigned long
+report(const char *pcWhat, tCost sFrom)
+{
+    tCost sTo = cost();
+
+    printf("  %-22s %8lu us, read %5lu + %4lu, write %5lu + %4lu "
+           "commands\n", pcWhat, (unsigned long)(sTo.ui64Us - sFrom.ui64Us),
+           sTo.ulRead - sFrom.ulRead, sTo.ulReadMulti - sFrom.ulReadMulti,
+           sTo.ulWrite - sFrom.ulWrite,
+           sTo.ulWriteMulti - sFrom.ulWriteMulti);
+    return (unsigned long)(sTo.ui64Us - sFrom.ui64Us);
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    FILINFO sInfo;
+    uint32_t n;
+    DWORD ui32Free;
+    WORD ui16Date, ui16Time;
+    unsigned long ulBySector, ulCopy;
+    tCost sCost;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 2 * 262144, 20, 375);
+    sim_init(1, GPIO_PORT_P4, GPIO_PIN7, 65536, 20, 375);
+    assert(disk_initialize(0) == 0 && disk_initialize(1) == 0);
+    f_mount(0, &g_sFs0);
+    assert(f_mkfs(0, 0, 4096) == FR_OK);
+    f_mount(1, &g_sFs1);
+    assert(f_mkfs(1, 0, 4096) == FR_OK);
+    memset(&sInfo, 0, sizeof(sInfo));
+
+    /* Onto itself; over a bigger file; from nothing */
+    make_file("A.BIN", 1, 300000);
+    assert(fc_Copy(&g_sFa, &g_sFb, "A.BIN", "0:/A.BIN", &n) == FR_DENIED);
+    check("A.BIN", 1, 300000);
+    make_file("BIG.BIN", 2, 900000);
+    assert(fc_Copy(&g_sFa, &g_sFb, "A.BIN", "BIG.BIN", &n) == FR_OK);
+    assert(n == 300000);
+    check("BIG.BIN", 1, 300000);
+    assert(fc_Copy(&g_sFa, &g_sFb, "NONE.BIN", "X.BIN", &n) == FR_NO_FILE);
+    assert(!exists("X.BIN") && !exists("FCOPY.$$$"));
+
+    /* Moves on the same volume */
+    assert(f_mkdir("D") == FR_OK);
+    assert(fc_Move(&g_sFa, &g_sFb, "A.BIN", "BIG.BIN", &n) == FR_EXIST);
+    assert(fc_Move(&g_sFa, &g_sFb, "A.BIN", "/D/A.BIN", &n) == FR_OK && !n);
+    check("D/A.BIN", 1, 300000);
+    assert(fc_Move(&g_sFa, &g_sFb, "D", "0:/E", &n) == FR_OK);
+    check("E/A.BIN", 1, 300000);
+
+    /* Moves to the other card: not a directory, not a read-only file, not
+     * over a file; else with the time stamp and attributes */
+    assert(f_chmod("E/A.BIN", AM_RDO, AM_RDO) == FR_OK);
+    assert(f_stat("E/A.BIN", &sInfo) == FR_OK);
+    ui16Date = sInfo.fdate;
+    ui16Time = sInfo.ftime;
+    assert(fc_Move(&g_sFa, &g_sFb, "E", "1:/E", &n) == FR_DENIED);
+    assert(fc_Move(&g_sFa, &g_sFb, "E/A.BIN", "1:/A.BIN", &n) == FR_DENIED);
+    check("E/A.BIN", 1, 300000);
+    assert(!exists("1:/A.BIN"));
+    assert(f_chmod("E/A.BIN", AM_HID, AM_RDO | AM_HID) == FR_OK);
+    make_file("1:/OLD.BIN", 3, 1000);
+    assert(fc_Move(&g_sFa, &g_sFb, "E/A.BIN", "1:/OLD.BIN", &n) == FR_EXIST);
+    assert(!n && !exists("1:/FCOPY.$$$"));
+    check("1:/OLD.BIN", 3, 1000);
+    assert(fc_Move(&g_sFa, &g_sFb, "E/A.BIN", "1:/A.BIN", &n) == FR_OK);
+    assert(n == 300000 && !exists("E/A.BIN"));
+    assert(f_stat("1:/A.BIN", &sInfo) == FR_OK);
+    assert(sInfo.fdate == ui16Date && sInfo.ftime == ui16Time);
+    assert(sInfo.fattrib & AM_HID);
+    check("1:/A.BIN", 1, 300000);
+    assert(fc_Copy(&g_sFa, &g_sFb, "1:/A.BIN", "0:/C.BIN", &n) == FR_OK);
+    check("C.BIN", 1, 300000);
+
+    /* Too big for the other card: the copy is refused, and the file of the
+     * new name is kept */
+    make_file("HUGE.BIN", 4, 40 * 1024 * 1024);
+    ui32Free = free_clusters("1:");
+    assert(fc_Copy(&g_sFa, &g_sFb, "HUGE.BIN", "1:/OLD.BIN", &n) ==
+           FR_DENIED);
+    assert(!n && !exists("1:/FCOPY.$$$") && free_clusters("1:") == ui32Free);
+    check("1:/OLD.BIN", 3, 1000);
+    assert(fc_Move(&g_sFa, &g_sFb, "HUGE.BIN", "1:/HUGE.BIN", &n) ==
+           FR_DENIED);
+    assert(!exists("1:/HUGE.BIN") && exists("HUGE.BIN"));
+    assert(f_unlink("HUGE.BIN") == FR_OK);
+
+    /* A read-only file of the new name is not replaced */
+    assert(f_chmod("1:/OLD.BIN", AM_RDO, AM_RDO) == FR_OK);
+    assert(fc_Copy(&g_sFa, &g_sFb, "C.BIN", "1:/OLD.BIN", &n) == FR_DENIED);
+    assert(!exists("1:/FCOPY.$$$") && free_clusters("1:") == ui32Free);
+    check("1:/OLD.BIN", 3, 1000);
+
+    /* An empty file */
+    make_file("Z.BIN", 5, 0);
+    assert(fc_Copy(&g_sFa, &g_sFb, "Z.BIN", "Z2.BIN", &n) == FR_OK && !n);
+    check("Z2.BIN", 5, 0);
+
+    /* Cost of a copy of 1MB */
+    make_file("SRC.BIN", 6, 1024 * 1024);
+    sCost = cost();
+    copy_by_sector("SRC.BIN", "N512.BIN");
+    ulBySector = report("512-byte copy", sCost);
+    check("N512.BIN", 6, 1024 * 1024);
+    sCost = cost();
+    assert(fc_Copy(&g_sFa, &g_sFb, "SRC.BIN", "DST.BIN", &n) == FR_OK);
+    ulCopy = report("fc_Copy", sCost);
+    assert(sim_cards[0].nwr + sim_cards[0].nwrm - sCost.ulWrite -
+           sCost.ulWriteMulti < 2 * 1024 * 1024 / FC_BUF_SIZE);
+    check("DST.BIN", 6, 1024 * 1024);
+    sCost = cost();
+    assert(fc_Move(&g_sFa, &g_sFb, "DST.BIN", "/MOVED.BIN", &n) == FR_OK);
+    report("fc_Move, same volume", sCost);
+    check("MOVED.BIN", 6, 1024 * 1024);
+    assert(ulCopy < ulBySector);
+    return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * test_lzb.c - block compressed files (lzb.c)
+ *
+ * CSV telemetry, text, random bytes and a run of one byte are packed and
+ * unpacked block by block, with the ratio and the host time per byte
+ * printed. Random blocks of all kinds make the round trip, and damaged or
+ * made up blocks never unpack past the buffer. Through FatFs, a packed CSV
+ * file writes fewer sectors than the plain one, reads back in odd sizes and
+ * from random offsets, is added to after a block torn by a reset, and a
+ * damaged block is not passed off as data. Plain files are read as they
+ * are.
+ *
+ * sdsim: src lzb.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+#include "lzb.h"
+
+#define ROUNDS          20000
+
+static uint8_t g_pui8Src[1 << 20], g_pui8Out[1 << 20];
+static uint8_t g_pui8Packed[LZB_BOUND(LZB_BLOCK)];
+static FATFS g_sFs;
+static FIL g_sFil;
+static tLzbFile g_sLzb;
+
+//*****************************************************************************
+//
+// Data
+//
+//*****************************************************************************
+static uint64_t g_ui64Rng = 88172645463325252ull;
+
+static uint32_t
+rnd(void)
+{
+    g_ui64Rng ^= g_ui64Rng << 13;
+    g_ui64Rng ^= g_ui64Rng >> 7;
+    g_ui64Rng ^= g_ui64Rng << 17;
+    return (uint32_t)g_ui64Rng;
+}
+
+/* Telemetry as a logger writes it */
+static size_t
+make_csv(char *pcBuf, size_t uCap)
+{
+    size_t n = 0;
+    uint32_t ui32Time = 0;
+    int iTemp = 2150, iHum = 4100, iPress = 101325;
+
+    while (n + 80 < uCap) {
+        ui32Time += 100 + rnd() % 3;
+        iTemp += (int)(rnd() % 7) - 3;
+        iHum += (int)(rnd() % 5) - 2;
+        iPress += (int)(rnd() % 9) - 4;
+        n += sprintf(pcBuf + n, "%lu,%d.%02d,%d.%02d,%d,%s\n",
+                     (unsigned long)ui32Time, iTemp / 100, iTemp % 100,
+                     iHum / 100, iHum % 100, iPress,
+                     (rnd() % 50) ? "OK" : "WARN");
+    }
+    return n;
+}
+
+static size_t
+make_text(char *pcBuf, size_t uCap)
+{
+    static const char *ppcWords[] = {
+        "the", "card", "sector", "write", "busy", "cluster", "file",
+        "system", "log", "record", "of", "and", "a", "to", "in", "FatFs",
+        "block"
+    };
+    size_t n = 0;
+
+    while (n + 16 < uCap) {
+        n += sprintf(pcBuf + n, "%s%s", ppcWords[rnd() % 17],
+                     (rnd() % 12) ? " " : ".\n");
+    }
+    return n;
+}
+
+/* A block of uLen bytes: random over an alphabet, with short repeats, or
+ * with long matches */
+static void
+make_block(uint8_t *pui8Buf, size_t uLen)
+{
+    unsigned uAlpha = 1 + rnd() % (rnd() % 2 ? 4 : 256);
+    unsigned uMode = rnd() % 3;
+    size_t k, uDist, uRun;
+
+    for (k = 0; k < uLen; k++) {
+        if (uMode == 1 && k > 8 && rnd() % 4) {
+            pui8Buf[k] = pui8Buf[k - 1 - rnd() % 8];
+        } else if (uMode == 2 && k > 300 && rnd() % 2) {
+            uDist = 1 + rnd() % 300;
+            for (uRun = 4 + rnd() % 300; uRun && k < uLen; uRun--, k++) {
+                pui8Buf[k] = pui8Buf[k - uDist];
+            }
+            k--;
+        } else {
+            pui8Buf[k] = rnd() % uAlpha;
+        }
+    }
+}
+
+static double
+seconds(void)
+{
+    struct timespec sTs;
+
+    clock_gettime(CLOCK_MONOTONIC, &sTs);
+    return sTs.tv_sec + sTs.tv_nsec * 1e-9;
+}
+
+/* Ratio and host time per byte, of blocks of 4 header bytes and the packed
+ * data or the data as it is */
+static void
+bench(const char *pcName, const uint8_t *pui8Data, size_t n)
+{
+    size_t uOfs, uLen, uPacked = 0, uBlock;
+    double dPack = 0, dUnpack = 0, dStart;
+
+    for (uOfs = 0; uOfs < n; uOfs += LZB_BLOCK) {
+        uLen = n - uOfs < LZB_BLOCK ? n - uOfs : LZB_BLOCK;
+        dStart = seconds();
+        uBlock = lzb_Pack(pui8Data + uOfs, uLen, g_pui8Packed);
+        dPack += seconds() - dStart;
+        dStart = seconds();
+        assert(lzb_Unpack(g_pui8Packed, uBlock, g_pui8Out + uOfs,
+                          LZB_BLOCK) == uLen);
+        dUnpack += seconds() - dStart;
+        assert(!memcmp(g_pui8Out + uOfs, pui8Data + uOfs, uLen));
+        uPacked += 4 + (uBlock < uLen ? uBlock : uLen);
+    }
+    printf("%-8s %7lu -> %7lu bytes (%.1f%%), pack %.1f ns/byte, "
+           "unpack %.1f ns/byte (host)\n", pcName, (unsigned long)n,
+           (unsigned long)uPacked, 100.0 * uPacked / n, dPack * 1e9 / n,
+           dUnpack * 1e9 / n);
+}
+
+/* Unpack a block into a buffer of exactly uCap bytes, so that a write past
+ * it is caught by a checker of the heap */
+static void
+unpack_damaged(const uint8_t *pui8Block, size_t uLen, size_t uCap)
+{
+    uint8_t *pui8Buf = malloc(uCap ? uCap : 1);
+
+    assert(pui8Buf);
+    assert(lzb_Unpack(pui8Block, uLen, pui8Buf, uCap) <= uCap);
+    free(pui8Buf);
+}
+
+static DWORD
+file_size(const char *pcPath)
+{
+    FILINFO sInfo;
+
+    memset(&sInfo, 0, sizeof(sInfo));
+    assert(f_stat(pcPath, &sInfo) == FR_OK);
+    return sInfo.fsize;
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    uint8_t pui8Bad[sizeof(g_pui8Packed)], pui8Buf[64];
+    size_t n, uLen, uBlock, uBad, uGot, uExp;
+    unsigned long ulUsPlain, ulUsPacked, ulPlain, ulPacked, ulRead;
+    uint64_t ui64Start;
+    uint32_t ui32Ofs;
+    DWORD ui32Good;
+    FRESULT iRes;
+    UINT bw, br, uSize;
+    int i, m;
+
+    /* Ratio and speed */
+    n = make_csv((char *)g_pui8Src, sizeof(g_pui8Src));
+    bench("csv", g_pui8Src, n);
+    n = make_text((char *)g_pui8Src, sizeof(g_pui8Src));
+    bench("text", g_pui8Src, n);
+    for (n = 0; n < 65536; n++) g_pui8Src[n] = rnd();
+    bench("random", g_pui8Src, 65536);
+    memset(g_pui8Src, 'z', 65536);
+    bench("zeros", g_pui8Src, 65536);
+
+    /* Round trips of blocks of 1 to LZB_BLOCK bytes, and the same blocks
+     * damaged, cut short or unpacked into less room */
+    for (i = 0; i < ROUNDS; i++) {
+        uLen = 1 + rnd() % LZB_BLOCK;
+        make_block(g_pui8Src, uLen);
+        uBlock = lzb_Pack(g_pui8Src, uLen, g_pui8Packed);
+        assert(uBlock <= LZB_BOUND(uLen));
+        assert(lzb_Unpack(g_pui8Packed, uBlock, g_pui8Out, LZB_BLOCK) ==
+               uLen);
+        assert(!memcmp(g_pui8Src, g_pui8Out, uLen));
+        for (m = 0; m < 4; m++) {
+            memcpy(pui8Bad, g_pui8Packed, uBlock);
+            uBad = uBlock;
+            switch (rnd() % 3) {
+            case 0:
+                pui8Bad[rnd() % uBlock] ^= 1 << (rnd() % 8);
+                break;
+            case 1:
+                uBad = rnd() % uBlock;
+                break;
+            default:
+                pui8Bad[rnd() % uBlock] = rnd();
+                pui8Bad[rnd() % uBlock] = rnd();
+                pui8Bad[rnd() % uBlock] = rnd();
+                break;
+            }
+            unpack_damaged(pui8Bad, uBad, rnd() % 2 ? LZB_BLOCK : uLen - 1);
+        }
+    }
+
+    /* Made up blocks */
+    for (i = 0; i < ROUNDS; i++) {
+        uBad = rnd() % 64;
+        for (n = 0; n < uBad; n++) pui8Bad[n] = rnd();
+        unpack_damaged(pui8Bad, uBad, LZB_BLOCK);
+    }
+    printf("%u round trips, %u damaged and %u made up blocks\n", ROUNDS,
+           4 * ROUNDS, ROUNDS);
+
+    /* CSV written 64 bytes at a time, plain and packed */
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 60, 100);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 0) == FR_OK);
+    n = make_csv((char *)g_pui8Src, 200000);
+
+    ui64Start = tb_Now();
+    ulPlain = sim_cards[0].wrsect;
+    assert(f_open(&g_sFil, "PLAIN.CSV", FA_CREATE_ALWAYS | FA_WRITE) ==
+           FR_OK);
+    for (uLen = 0; uLen < n; uLen += bw) {
+        uSize = n - uLen < 64 ? n - uLen : 64;
+        assert(f_write(&g_sFil, g_pui8Src + uLen, uSize, &bw) == FR_OK &&
+               bw == uSize);
+    }
+    assert(f_close(&g_sFil) == FR_OK);
+    ulUsPlain = (unsigned long)(tb_Now() - ui64Start);
+    ulPlain = sim_cards[0].wrsect - ulPlain;
+
+    ui64Start = tb_Now();
+    ulPacked = sim_cards[0].wrsect;
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PACKED.LZB",
+                    FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (uLen = 0; uLen < n; uLen += bw) {
+        uSize = n - uLen < 64 ? n - uLen : 64;
+        assert(lzb_Write(&g_sLzb, g_pui8Src + uLen, uSize, &bw) == FR_OK &&
+               bw == uSize);
+    }
+    assert(lzb_Tell(&g_sLzb) == n);
+    assert(lzb_Close(&g_sLzb) == FR_OK);
+    ulUsPacked = (unsigned long)(tb_Now() - ui64Start);
+    ulPacked = sim_cards[0].wrsect - ulPacked;
+    printf("%lu bytes of CSV: plain %lu sectors %lu us, packed to %lu bytes "
+           "%lu sectors %lu us\n", (unsigned long)n, ulPlain, ulUsPlain,
+           (unsigned long)file_size("PACKED.LZB"), ulPacked, ulUsPacked);
+    assert(ulPacked * 3 < ulPlain * 2 && ulUsPacked < ulUsPlain);
+
+    /* Read back in odd sizes */
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PACKED.LZB", FA_READ) == FR_OK);
+    assert(g_sLzb.bPacked);
+    for (uGot = 0; ; uGot += br) {
+        uSize = 1 + rnd() % 700;
+        assert(lzb_Read(&g_sLzb, g_pui8Out + uGot, uSize, &br) == FR_OK);
+        if (br < uSize) break;
+    }
+    assert(uGot + br == n && !memcmp(g_pui8Out, g_pui8Src, n));
+
+    /* Random access, past the end too */
+    ulRead = sim_cards[0].rdsect;
+    for (i = 0; i < 2000; i++) {
+        ui32Ofs = rnd() % (n + 100);
+        assert(lzb_Seek(&g_sLzb, ui32Ofs) == FR_OK);
+        assert(lzb_Tell(&g_sLzb) == (ui32Ofs < n ? ui32Ofs : n));
+        assert(lzb_Read(&g_sLzb, pui8Buf, 50, &br) == FR_OK);
+        uExp = ui32Ofs >= n ? 0 : n - ui32Ofs < 50 ? n - ui32Ofs : 50;
+        assert(br == uExp && !memcmp(pui8Buf, g_pui8Src + ui32Ofs, br));
+    }
+    printf("2000 seeks and reads: %lu sectors read\n",
+           sim_cards[0].rdsect - ulRead);
+    assert(lzb_Close(&g_sLzb) == FR_OK);
+
+    /* Plain files are read as they are, and not added to */
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PLAIN.CSV", FA_READ) == FR_OK);
+    assert(!g_sLzb.bPacked);
+    assert(lzb_Read(&g_sLzb, g_pui8Out, 100, &br) == FR_OK && br == 100);
+    assert(!memcmp(g_pui8Out, g_pui8Src, 100));
+    assert(lzb_Close(&g_sLzb) == FR_OK);
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PLAIN.CSV",
+                    FA_OPEN_ALWAYS | FA_WRITE) == FR_DENIED);
+
+    /* Added to with syncs, and the last block torn by a reset */
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PACKED.LZB",
+                    FA_OPEN_ALWAYS | FA_WRITE) == FR_OK);
+    assert(lzb_Tell(&g_sLzb) == n);
+    assert(lzb_Write(&g_sLzb, "tail one\n", 9, &bw) == FR_OK);
+    assert(lzb_Sync(&g_sLzb) == FR_OK);
+    assert(lzb_Write(&g_sLzb, g_pui8Src, 3000, &bw) == FR_OK);
+    assert(lzb_Sync(&g_sLzb) == FR_OK);
+    ui32Good = g_sFil.fsize;
+    assert(lzb_Write(&g_sLzb, g_pui8Src + 5000, 1000, &bw) == FR_OK);
+    assert(lzb_Sync(&g_sLzb) == FR_OK);
+    assert(f_lseek(&g_sFil, g_sFil.fsize - 7) == FR_OK);
+    assert(f_truncate(&g_sFil) == FR_OK && f_close(&g_sFil) == FR_OK);
+
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PACKED.LZB", FA_READ) == FR_OK);
+    for (uGot = 0; lzb_Read(&g_sLzb, g_pui8Out + uGot, 4096, &br) == FR_OK &&
+         br; uGot += br) ;
+    assert(uGot == n + 9 + 3000);
+    assert(!memcmp(g_pui8Out + n, "tail one\n", 9));
+    assert(!memcmp(g_pui8Out + n + 9, g_pui8Src, 3000));
+    assert(lzb_Close(&g_sLzb) == FR_OK);
+
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PACKED.LZB",
+                    FA_OPEN_ALWAYS | FA_WRITE) == FR_OK);
+    assert(g_sFil.fsize == ui32Good && lzb_Tell(&g_sLzb) == n + 3009);
+    assert(lzb_Write(&g_sLzb, "after\n", 6, &bw) == FR_OK);
+    assert(lzb_Close(&g_sLzb) == FR_OK);
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PACKED.LZB", FA_READ) == FR_OK);
+    assert(lzb_Seek(&g_sLzb, n + 3009) == FR_OK);
+    assert(lzb_Read(&g_sLzb, g_pui8Out, 100, &br) == FR_OK && br == 6);
+    assert(!memcmp(g_pui8Out, "after\n", 6));
+
+    /* A damaged first block is an error, not data */
+    assert(f_lseek(&g_sFil, 100) == FR_OK);
+    assert(f_read(&g_sFil, pui8Buf, 1, &br) == FR_OK && br == 1);
+    sim_cards[0].data[g_sFil.dsect * 512 + 100] ^= 0x55;
+    assert(lzb_Close(&g_sLzb) == FR_OK);
+    f_mount(0, &g_sFs);
+    assert(lzb_Open(&g_sLzb, &g_sFil, "PACKED.LZB", FA_READ) == FR_OK);
+    iRes = lzb_Read(&g_sLzb, g_pui8Out, 4096, &br);
+    assert(iRes == FR_INT_ERR || memcmp(g_pui8Out, g_pui8Src, br));
+    assert(lzb_Close(&g_sLzb) == FR_OK);
+    return 0;
+}
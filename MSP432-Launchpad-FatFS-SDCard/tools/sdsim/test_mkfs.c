@@ -0,0 +1,160 @@
+/*
+ * test_mkfs.c - volumes formatted to the allocation unit (f_mkfs of ff.c)
+ *
+ * Cards of 32MB to 32GB, each with the largest AU the SD spec allows for its
+ * size, are formatted with the default cluster size of the spec. The
+ * partition, the FAT and the data area start on AU boundaries, the FAT type
+ * and cluster size follow from the size, and the volume mounts with the
+ * clusters it was made with. Above 128MB only the first 128MB of the card
+ * are kept, which holds the FAT and the files written.
+ *
+ * The card is busy 100ms more when a multiple block write runs into the
+ * next AU. An 8MB file written in 32KB pieces never does, and the time it
+ * takes is printed next to that of 32KB writes made straight to the card on
+ * and off the AU boundaries, which pay it once per AU.
+ *
+ * sdsim: set _USE_STAGE 0
+ * sdsim: set _FS_FASTMOUNT 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+#define MB              2048UL          /* Sectors */
+#define STORED          (128 * MB)
+#define WRITE_SIZE      (8 * 1024 * 1024)
+#define AU_BUSY         6250            /* Bytes, 100ms */
+
+static FATFS g_sFs;
+static FIL g_sFil;
+static BYTE g_pui8Buf[32768];
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+/* AU_SIZE of the SD status: the largest the spec allows for the size */
+static uint8_t
+au_size(DWORD ui32Sectors)
+{
+    if (ui32Sectors <= 64 * MB) return 6;               /* 512KB */
+    if (ui32Sectors <= 256 * MB) return 7;              /* 1MB */
+    if (ui32Sectors <= 512 * MB) return 8;              /* 2MB */
+    return 9;                                           /* 4MB */
+}
+
+/* The FAT type of a volume of ui32Clusters clusters */
+static BYTE
+fat_type(DWORD ui32Clusters)
+{
+    if (ui32Clusters < 4086) return FS_FAT12;
+    if (ui32Clusters < 65526) return FS_FAT16;
+    return FS_FAT32;
+}
+
+/* A file written in 32KB pieces. Returns the time it took. */
+static unsigned long
+write_file(unsigned long *pulCross)
+{
+    SimCard *psCard = &sim_cards[0];
+    unsigned long ulCross = psCard->naucross;
+    uint64_t ui64Start = tb_Now();
+    UINT bw, i;
+
+    assert(f_open(&g_sFil, "F.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (i = 0; i < WRITE_SIZE / sizeof(g_pui8Buf); i++) {
+        assert(f_write(&g_sFil, g_pui8Buf, sizeof(g_pui8Buf), &bw) == FR_OK &&
+               bw == sizeof(g_pui8Buf));
+    }
+    assert(f_close(&g_sFil) == FR_OK);
+    *pulCross = psCard->naucross - ulCross;
+    return (unsigned long)(tb_Now() - ui64Start);
+}
+
+/* The same in 32KB writes straight to the card from ui32Sect on */
+static unsigned long
+write_raw(DWORD ui32Sect, unsigned long *pulCross)
+{
+    SimCard *psCard = &sim_cards[0];
+    unsigned long ulCross = psCard->naucross;
+    uint64_t ui64Start = tb_Now();
+    UINT i, n = sizeof(g_pui8Buf) / 512;
+
+    for (i = 0; i < WRITE_SIZE / sizeof(g_pui8Buf); i++, ui32Sect += n)
+        assert(disk_write(0, g_pui8Buf, ui32Sect, n) == RES_OK);
+    assert(disk_ioctl(0, CTRL_SYNC, 0) == RES_OK);
+    *pulCross = psCard->naucross - ulCross;
+    return (unsigned long)(tb_Now() - ui64Start);
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    SimCard *psCard = &sim_cards[0];
+    FATFS *psFs;
+    FRESULT iRes;
+    DWORD ui32Size, ui32Au, ui32Vol, ui32Free, ui32Raw;
+    unsigned long ulFile, ulOn, ulOff, ulFileUs, ulOnUs, ulOffUs;
+    UINT uCluster;
+
+    memset(g_pui8Buf, 0x5A, sizeof(g_pui8Buf));
+    printf("   card     AU  type cluster  8MB file    on AU        off AU\n");
+    for (ui32Size = 32 * MB; ui32Size <= 32768 * MB; ui32Size *= 2) {
+        sim_init(0, GPIO_PORT_P4, GPIO_PIN6,
+                 ui32Size < STORED ? ui32Size : STORED, 20, 375);
+        psCard->nsect = ui32Size;
+        psCard->au = au_size(ui32Size);
+        ui32Au = 16UL << psCard->au;
+        assert(disk_initialize(0) == 0);
+
+        /* The layout */
+        memset(&g_sFs, 0, sizeof(g_sFs));
+        f_mount(0, &g_sFs);
+        assert(f_mkfs(0, 0, 0) == FR_OK);
+        ui32Vol = LD_DWORD(psCard->data + 446 + 8);
+        while ((iRes = f_getfree("0:", &ui32Free, &psFs)) == FR_IN_PROGRESS) ;
+        assert(iRes == FR_OK);
+        assert(g_sFs.volbase == ui32Vol);
+        assert(ui32Vol % ui32Au == 0);
+        assert(g_sFs.fatbase % ui32Au == 0);
+        assert(g_sFs.database % ui32Au == 0);
+        uCluster = g_sFs.csize * 512;
+        assert(uCluster == ((ui32Size - ui32Vol) / 2000 < 1024 ? 16384 : 32768));
+        assert(g_sFs.fs_type == fat_type(g_sFs.n_fatent - 2));
+        assert(ui32Free == g_sFs.n_fatent - 2 - (g_sFs.fs_type == FS_FAT32));
+        assert(g_sFs.database + (g_sFs.n_fatent - 2) * g_sFs.csize <=
+               ui32Size);
+        assert(g_sFs.database + (g_sFs.n_fatent - 1) * g_sFs.csize >
+               ui32Size - ui32Au - ui32Vol);
+
+        /* Writes running into the next AU */
+        psCard->au_busy = AU_BUSY;
+        ulFileUs = write_file(&ulFile);
+        assert(!ulFile);
+        ui32Raw = g_sFs.database + WRITE_SIZE / 512 + ui32Au;
+        ui32Raw -= ui32Raw % ui32Au;                    /* Past the file */
+        assert(ui32Raw + 2 * (WRITE_SIZE / 512 + ui32Au) <= psCard->nstored);
+        ulOnUs = write_raw(ui32Raw, &ulOn);
+        ulOffUs = write_raw(ui32Raw + WRITE_SIZE / 512 + ui32Au + 8, &ulOff);
+        assert(!ulOn && ulOff == WRITE_SIZE / 512 / ui32Au);
+        assert(ulOffUs >= ulOnUs + ulOff * AU_BUSY * SIM_US_PER_BYTE);
+        printf("  %5luM %5luK %s %5uK %7.2f s %7.2f s %7.2f s, %2lu AUs\n",
+               (unsigned long)(ui32Size / MB), (unsigned long)(ui32Au / 2),
+               g_sFs.fs_type == FS_FAT32 ? "FAT32" :
+               g_sFs.fs_type == FS_FAT16 ? "FAT16" : "FAT12", uCluster / 1024,
+               ulFileUs * 1e-6, ulOnUs * 1e-6, ulOffUs * 1e-6, ulOff);
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * test_pool.c - shared file buffers (_FS_BUFPOOL)
+ *
+ * Sixteen files are written in turns through the buffers of the pool, in
+ * pieces that end in the middle of sectors, and read back. The RAM of the
+ * file objects and the pool is printed next to that of a buffer in each
+ * FIL, and so are the disk_read() and disk_write() calls the files take;
+ * -s _FS_BUFPOOL=0 prints them for a buffer in each FIL. One file is
+ * dropped without f_close(): the file that takes its buffer over has to
+ * write the sector back from what the pool knows, without looking at the
+ * freed FIL.
+ *
+ * sdsim: set _FS_BUFPOOL 2
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define NFILES  16
+#define SIZE    20000
+
+static FATFS g_sFs;
+static FIL g_psFil[NFILES];
+static BYTE g_pui8Buf[SIZE];
+
+/* disk_read() and disk_write() calls to drive 0 */
+static unsigned long
+reads(void)
+{
+    return sim_cards[0].nrd + sim_cards[0].nrdm;
+}
+
+static unsigned long
+writes(void)
+{
+    return sim_cards[0].nwr + sim_cards[0].nwrm;
+}
+
+static BYTE
+pat(int f, DWORD o)
+{
+    return (BYTE)(o * 3 + f * 41 + (o >> 8));
+}
+
+static void
+check(const char *name, int f, DWORD size)
+{
+    FIL *fp = &g_psFil[0];
+    UINT br;
+    DWORD o;
+
+    assert(f_open(fp, name, FA_READ) == FR_OK);
+    assert(f_size(fp) == size);
+    assert(f_read(fp, g_pui8Buf, SIZE, &br) == FR_OK && br == size);
+    for (o = 0; o < size; o++) assert(g_pui8Buf[o] == pat(f, o));
+    assert(f_close(fp) == FR_OK);
+}
+
+int
+main(void)
+{
+    char name[16];
+    DWORD o[NFILES] = { 0 };
+    UINT bw, n, k;
+    int f, round, more;
+    unsigned long ulReads, ulWrites;
+    size_t uFil;
+    FIL *fp;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 20, 200);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 4096) == FR_OK);
+
+    /* Files written in turns, each piece ending in another sector */
+    ulReads = reads();
+    ulWrites = writes();
+    for (f = 0; f < NFILES; f++) {
+        sprintf(name, "F%d.BIN", f);
+        assert(f_open(&g_psFil[f], name, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    }
+    srand(1);
+    for (round = 0, more = 1; more; round++) {
+        for (f = 0, more = 0; f < NFILES; f++) {
+            n = 1 + rand() % 700;
+            if (n > SIZE - o[f]) n = SIZE - o[f];
+            for (k = 0; k < n; k++) g_pui8Buf[k] = pat(f, o[f] + k);
+            assert(f_write(&g_psFil[f], g_pui8Buf, n, &bw) == FR_OK && bw == n);
+            o[f] += n;
+            more |= o[f] < SIZE;
+        }
+        if (round % 7 == 3) assert(f_sync(&g_psFil[round % NFILES]) == FR_OK);
+    }
+    for (f = 0; f < NFILES; f++) {
+        assert(f_close(&g_psFil[f]) == FR_OK);
+    }
+    printf("%d files of %d bytes written in turns: %lu disk_read(), "
+           "%lu disk_write()\n", NFILES, SIZE, reads() - ulReads,
+           writes() - ulWrites);
+    ulReads = reads();
+    for (f = 0; f < NFILES; f++) {
+        sprintf(name, "F%d.BIN", f);
+        check(name, f, SIZE);
+    }
+    printf("and read back one by one: %lu disk_read()\n", reads() - ulReads);
+
+    /* Overwrites in the middle while the other files read */
+    assert(f_open(&g_psFil[1], "F1.BIN", FA_READ | FA_WRITE) == FR_OK);
+    assert(f_open(&g_psFil[2], "F2.BIN", FA_READ) == FR_OK);
+    assert(f_open(&g_psFil[3], "F3.BIN", FA_READ) == FR_OK);
+    assert(f_lseek(&g_psFil[1], 1000) == FR_OK);
+    for (k = 0; k < 300; k++) g_pui8Buf[k] = pat(1, 1000 + k);
+    assert(f_write(&g_psFil[1], g_pui8Buf, 300, &bw) == FR_OK && bw == 300);
+    assert(f_read(&g_psFil[2], g_pui8Buf, 100, &bw) == FR_OK && bw == 100);
+    assert(f_read(&g_psFil[3], g_pui8Buf + 100, 100, &bw) == FR_OK && bw == 100);
+    for (k = 0; k < 100; k++) {
+        assert(g_pui8Buf[k] == pat(2, k) && g_pui8Buf[100 + k] == pat(3, k));
+    }
+    for (f = 1; f <= 3; f++) assert(f_close(&g_psFil[f]) == FR_OK);
+    check("F1.BIN", 1, SIZE);
+
+#if _FS_BUFPOOL
+    {
+        /* A file left dirty and freed: its sector still reaches the card
+         * when the buffer is taken over by files that keep the others
+         * dirty */
+        BYTE sect[512];
+        DWORD dsect;
+
+        fp = malloc(sizeof(*fp));
+        assert(f_open(fp, "LOST.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+        for (k = 0; k < 100; k++) g_pui8Buf[k] = pat(9, k);
+        assert(f_write(fp, g_pui8Buf, 100, &bw) == FR_OK && bw == 100);
+        dsect = fp->dsect;
+        memset(fp, 0xA5, sizeof(*fp));
+        free(fp);
+
+        for (f = 0; f < _FS_BUFPOOL + 1; f++) {
+            sprintf(name, "W%d.BIN", f);
+            assert(f_open(&g_psFil[f], name, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+            assert(f_write(&g_psFil[f], g_pui8Buf, 10, &bw) == FR_OK);
+        }
+        for (f = 0; f < _FS_BUFPOOL + 1; f++) {
+            assert(f_close(&g_psFil[f]) == FR_OK);
+        }
+        assert(disk_read(0, sect, dsect, 1) == RES_OK);
+        for (k = 0; k < 100; k++) assert(sect[k] == pat(9, k));
+    }
+#endif
+
+    /* RAM of the open files, against a sector buffer in each FIL */
+#if _FS_BUFPOOL
+    uFil = sizeof(FIL) - sizeof(BYTE *) + _MAX_SS;
+#else
+    uFil = sizeof(FIL);
+#endif
+    printf("%d files through %d buffers: %lu bytes of FIL and pooled sectors, "
+           "%lu with a buffer in each FIL\n", NFILES, _FS_BUFPOOL,
+           (unsigned long)(NFILES * sizeof(FIL) + _FS_BUFPOOL * _MAX_SS),
+           (unsigned long)(NFILES * uFil));
+    return 0;
+}
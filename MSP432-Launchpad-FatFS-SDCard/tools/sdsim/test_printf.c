@@ -0,0 +1,143 @@
+/*
+ * test_printf.c - the formatter of printfOverride.c against the C library
+ *
+ * printfOverride.c is built in here under other names, so that its output
+ * can be compared with snprintf() of the host for every combination of
+ * flag, width, precision, length modifier and conversion over a set of
+ * values, and for strings and truncation. printf() must send the same to
+ * the UART, also when it is longer than the buffer of the formatter.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include "driverlib.h"
+
+/* The UART transmit register takes the characters in order */
+static char g_pcTx[4096];
+static size_t g_iTx;
+volatile uint32_t UCA0IFG = UCTXIFG;
+#define UCA0TXBUF       g_pcTx[g_iTx++]
+
+#define printf          pf_printf
+#define vprintf         pf_vprintf
+#define snprintf        pf_snprintf
+#define vsnprintf       pf_vsnprintf
+#define fputc           pf_fputc
+#define fputs           pf_fputs
+#include "printfOverride.c"
+#undef printf
+#undef vprintf
+#undef snprintf
+#undef vsnprintf
+#undef fputc
+#undef fputs
+
+static int g_iCases, g_iFails;
+
+/* Format with both and compare the text and the count */
+static void
+compare(const char *fmt, ...)
+{
+    char pcWant[256], pcGot[256];
+    va_list ap;
+    int iWant, iGot;
+
+    va_start(ap, fmt);
+    iWant = vsnprintf(pcWant, sizeof(pcWant), fmt, ap);
+    va_end(ap);
+    va_start(ap, fmt);
+    iGot = pf_vsnprintf(pcGot, sizeof(pcGot), fmt, ap);
+    va_end(ap);
+
+    g_iCases++;
+    if (iWant != iGot || strcmp(pcWant, pcGot)) {
+        if (g_iFails++ < 20)
+            printf("\"%s\": \"%s\" (%d) instead of \"%s\" (%d)\n", fmt,
+                   pcGot, iGot, pcWant, iWant);
+    }
+}
+
+int
+main(void)
+{
+    static const char *ppcFlags[] = {
+        "", "-", "0", "+", " ", "#", "-0", "+0", "#0", "- ", "+ "
+    };
+    static const char *ppcWidths[] = { "", "1", "5", "12", "*" };
+    static const char *ppcPrecs[] = { "", ".", ".0", ".1", ".3", ".10", ".*" };
+    static const char *ppcLens[] = { "", "h", "hh", "l", "ll", "j", "z" };
+    static const long long pllValues[] = {
+        0, 1, -1, 7, -7, 42, 255, 256, -128, 65535, 65536, 2147483647LL,
+        -2147483647LL - 1, 4294967295LL, 123456789012LL,
+        9223372036854775807LL, -9223372036854775807LL - 1
+    };
+    static const char *ppcStrings[] = { "", "a", "hello world" };
+    static const char *ppcStrFmts[] = {
+        "%s", "%5s", "%-5s", "%.3s", "%10.2s", "%-10.0s", "%.*s", "%*s"
+    };
+    char pcFmt[32], pcBuf[8];
+    const char *pc;
+    unsigned f, w, p, l, v, i;
+    int iStars, n;
+    long long x;
+
+    for (f = 0; f < sizeof(ppcFlags) / sizeof(ppcFlags[0]); f++)
+    for (w = 0; w < sizeof(ppcWidths) / sizeof(ppcWidths[0]); w++)
+    for (p = 0; p < sizeof(ppcPrecs) / sizeof(ppcPrecs[0]); p++)
+    for (l = 0; l < sizeof(ppcLens) / sizeof(ppcLens[0]); l++)
+    for (pc = "diuxXoc"; *pc; pc++)
+    for (v = 0; v < sizeof(pllValues) / sizeof(pllValues[0]); v++) {
+        if (*pc == 'c' && (l || p)) continue;
+        sprintf(pcFmt, "[%%%s%s%s%s%c]", ppcFlags[f], ppcWidths[w],
+                ppcPrecs[p], ppcLens[l], *pc);
+        iStars = (w == 4) + (p == 6);
+        x = pllValues[v];
+        if (l >= 3) {
+            if (iStars == 2) compare(pcFmt, -9, 3, x);
+            else if (iStars) compare(pcFmt, 9, x);
+            else compare(pcFmt, x);
+        } else {
+            if (iStars == 2) compare(pcFmt, -9, 3, (int)x);
+            else if (iStars) compare(pcFmt, 9, (int)x);
+            else compare(pcFmt, (int)x);
+        }
+    }
+
+    for (i = 0; i < sizeof(ppcStrings) / sizeof(ppcStrings[0]); i++) {
+        for (f = 0; f < sizeof(ppcStrFmts) / sizeof(ppcStrFmts[0]); f++) {
+            if (strchr(ppcStrFmts[f], '*'))
+                compare(ppcStrFmts[f], 4, ppcStrings[i]);
+            else
+                compare(ppcStrFmts[f], ppcStrings[i]);
+        }
+    }
+    compare("%s %c%%%c", (char *)0, 'x', 'y');
+    compare("%p %p", (void *)0, (void *)0x1234);
+
+    /* The lines of the ls command */
+    compare("%c%c%c%c%c %u/%02u/%02u %02u:%02u %9u  %s\n", 'D', '-', '-', 'H',
+            '-', 2015, 5, 27, 9, 3, 123456789u, "LOGFILE.TXT");
+    compare("\n%4u File(s),%10u bytes total\n%4u Dir(s)", 12, 4000000000u, 3);
+
+    /* Output cut to the buffer, with the full count */
+    n = pf_snprintf(pcBuf, sizeof(pcBuf), "%d-%s", 12345, "abc");
+    assert(n == 9 && !strcmp(pcBuf, "12345-a"));
+    assert(pf_snprintf(pcBuf, 1, "%s", "abc") == 3 && !pcBuf[0]);
+    assert(pf_snprintf(0, 0, "%d", -42) == 3);
+
+    /* printf() goes to the UART in pieces of the formatter buffer */
+    g_iTx = 0;
+    n = pf_printf("%s|%-40d|%08X\r\n", "text longer than the buffer of the "
+                  "formatter", -5, 0xBEEFu);
+    assert(n == (int)g_iTx && n == 44 + 1 + 40 + 1 + 8 + 2);
+    assert(!memcmp(g_pcTx, "text longer than the buffer of the formatter|-5 ", 48));
+    assert(!memcmp(g_pcTx + n - 12, " |0000BEEF\r\n", 12));
+    g_iTx = 0;
+    assert(pf_fputs("abc", stdout) == 3 && pf_fputc('d', stdout) == 'd');
+    assert(g_iTx == 4 && !memcmp(g_pcTx, "abcd", 4));
+
+    printf("%d of %d formats differ\n", g_iFails, g_iCases);
+    return g_iFails != 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * test_profiler.c - sample table and dump of the profiler (profiler.c)
+ *
+ * Exception frames made up here are fed to prof_Sample(). Each PC and LR
+ * pair gets a line of its own in the dump with its count, samples whose
+ * hash slots are all taken are counted as dropped, and the sampling timer
+ * is loaded for the rate at the MCLK of the moment.
+ *
+ * sdsim: src profiler.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "profiler.h"
+
+#define SLOTS_LOG2      9               /* PROF_SLOTS_LOG2 of profiler.c */
+#define PROBES          8               /* PROF_PROBES */
+
+//*****************************************************************************
+//
+// Timer32 module 1
+//
+//*****************************************************************************
+static uint32_t g_ui32Count;
+static bool g_bRunning, g_bIrq;
+
+void
+Timer32_initModule(uint32_t m, uint32_t pre, uint32_t res, uint32_t mode)
+{
+    assert(m == TIMER32_1_MODULE && mode == TIMER32_PERIODIC_MODE);
+}
+
+void
+Timer32_setCount(uint32_t m, uint32_t count)
+{
+    assert(m == TIMER32_1_MODULE);
+    g_ui32Count = count;
+}
+
+void
+Timer32_startTimer(uint32_t m, bool oneshot)
+{
+    assert(!oneshot);
+    g_bRunning = true;
+}
+
+void
+Timer32_haltTimer(uint32_t m)
+{
+    g_bRunning = false;
+}
+
+void Timer32_clearInterruptFlag(uint32_t m) { }
+void Timer32_enableInterrupt(uint32_t m) { }
+
+void
+Interrupt_enableInterrupt(uint32_t n)
+{
+    assert(n == INT_T32_INT2);
+    g_bIrq = true;
+}
+
+void
+Interrupt_disableInterrupt(uint32_t n)
+{
+    assert(n == INT_T32_INT2);
+    g_bIrq = false;
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+static void
+sample(uint32_t ui32PC, uint32_t ui32LR, int n)
+{
+    uint32_t pui32Frame[8] = { 0 };
+
+    pui32Frame[5] = ui32LR;
+    pui32Frame[6] = ui32PC;
+    while (n--) prof_Sample(pui32Frame);
+}
+
+static uint32_t
+slot(uint32_t ui32PC)
+{
+    return ((ui32PC >> 1) * 2654435761u) >> (32 - SLOTS_LOG2);
+}
+
+/* The dump, as printed to stdout */
+static char g_pcDump[65536];
+
+static void
+dump(void)
+{
+    FILE *psFile = tmpfile();
+    int iOut = dup(1);
+    size_t n;
+
+    fflush(stdout);
+    dup2(fileno(psFile), 1);
+    prof_Dump();
+    fflush(stdout);
+    dup2(iOut, 1);
+    close(iOut);
+    rewind(psFile);
+    n = fread(g_pcDump, 1, sizeof(g_pcDump) - 1, psFile);
+    g_pcDump[n] = 0;
+    fclose(psFile);
+}
+
+/* The count of a PC and LR in the dump, 0 if not there */
+static unsigned
+count(uint32_t ui32PC, uint32_t ui32LR)
+{
+    char pcLine[32];
+    const char *pc;
+
+    sprintf(pcLine, "\n%08x %08x ", ui32PC, ui32LR);
+    pc = strstr(g_pcDump, pcLine);
+    return pc ? strtoul(pc + strlen(pcLine), 0, 10) : 0;
+}
+
+int
+main(void)
+{
+    uint32_t pui32Same[PROBES + 1], ui32PC;
+    unsigned n, lines, samples, dropped, hz;
+    const char *pc;
+    int i;
+
+    /* The timer period follows MCLK */
+    sim_mclk = 48000000;
+    prof_Start(1000);
+    assert(prof_Running() && g_bRunning && g_bIrq && g_ui32Count == 48000);
+    sim_mclk = 12000000;
+    prof_ClockChanged();
+    assert(g_ui32Count == 12000);
+    prof_Stop();
+    assert(!prof_Running() && !g_bRunning && !g_bIrq);
+    sim_mclk = 3000000;
+    prof_ClockChanged();
+    assert(g_ui32Count == 12000);
+
+    /* Counts by PC and LR */
+    prof_Clear();
+    sample(0x00001234, 0x00000501, 5);
+    sample(0x00001234, 0x00000701, 3);
+    sample(0x00002000, 0x00000501, 1);
+    for (i = 0; i < 100; i++) sample(0x00010000 + i * 2, 0x00000901, 1);
+
+    dump();
+    assert(!prof_Running());
+    assert(sscanf(g_pcDump, "prof %u Hz %u samples %u dropped", &hz,
+                  &samples, &dropped) == 3);
+    assert(hz == 1000 && samples == 5 + 3 + 1 + 100 && !dropped);
+    assert(count(0x00001234, 0x00000501) == 5);
+    assert(count(0x00001234, 0x00000701) == 3);
+    assert(count(0x00002000, 0x00000501) == 1);
+    for (i = 0; i < 100; i++) {
+        assert(count(0x00010000 + i * 2, 0x00000901) == 1);
+    }
+    for (lines = 0, pc = g_pcDump; (pc = strchr(pc, '\n')); pc++) lines++;
+    assert(lines == 1 + 3 + 100 + 1);
+    assert(strstr(g_pcDump, "\r\nprof end\r\n"));
+
+    /* Nine PCs of the same slot: the last one finds no free slot */
+    prof_Clear();
+    for (ui32PC = 0x00020000, n = 0; n < PROBES + 1; ui32PC += 2) {
+        if (slot(ui32PC) == slot(0x00030000)) pui32Same[n++] = ui32PC;
+    }
+    for (n = 0; n < PROBES + 1; n++) sample(pui32Same[n], 0, 2);
+    dump();
+    assert(sscanf(g_pcDump, "prof %u Hz %u samples %u dropped", &hz,
+                  &samples, &dropped) == 3);
+    assert(samples == 2 * (PROBES + 1) && dropped == 2);
+    for (n = 0; n < PROBES; n++) assert(count(pui32Same[n], 0) == 2);
+    assert(!count(pui32Same[PROBES], 0));
+
+    /* A dump while sampling goes on sampling; clearing forgets it all */
+    prof_Start(250);
+    dump();
+    assert(prof_Running() && g_bRunning && g_ui32Count == 3000000 / 250);
+    prof_Clear();
+    dump();
+    assert(!strncmp(g_pcDump, "prof 250 Hz 0 samples 0 dropped\r\nprof end",
+                    41));
+    prof_Stop();
+    return 0;
+}
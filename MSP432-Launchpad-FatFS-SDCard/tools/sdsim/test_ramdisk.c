@@ -0,0 +1,143 @@
+/*
+ * test_ramdisk.c - the RAM disk of drive 2 (ramdisk-msp432P401r.c)
+ *
+ * The drive comes up formatted as a FAT12 volume of 29 free clusters,
+ * which f_mkfs() could not make that small. Files are written, read and
+ * copied to and from the card without a byte on the SPI bus for the RAM
+ * disk, requests outside the drive fail, a full drive does not overflow,
+ * and initializing the drive again keeps what is on it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+#define SIZE            (12 * 1024)
+
+static BYTE g_pui8Buf[4096], g_pui8Read[4096];
+
+static void
+fill(BYTE *pui8Buf, UINT n, int iSeed)
+{
+    UINT i;
+
+    for (i = 0; i < n; i++) pui8Buf[i] = (BYTE)(iSeed * 31 + i * 7);
+}
+
+/* Write a file in small pieces; returns the time it took */
+static unsigned long
+write_file(const char *pcName)
+{
+    FIL sFil;
+    UINT bw, i;
+    uint64_t ui64Start = tb_Now();
+
+    assert(f_open(&sFil, pcName, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (i = 0; i < SIZE; i += 64) {
+        fill(g_pui8Buf, 64, i / 64);
+        assert(f_write(&sFil, g_pui8Buf, 64, &bw) == FR_OK && bw == 64);
+    }
+    assert(f_close(&sFil) == FR_OK);
+    return (unsigned long)(tb_Now() - ui64Start);
+}
+
+static void
+check_file(const char *pcName)
+{
+    FIL sFil;
+    UINT br, i;
+
+    assert(f_open(&sFil, pcName, FA_READ) == FR_OK);
+    assert(sFil.fsize == SIZE);
+    for (i = 0; i < SIZE; i += 64) {
+        fill(g_pui8Buf, 64, i / 64);
+        assert(f_read(&sFil, g_pui8Read, 64, &br) == FR_OK && br == 64);
+        assert(!memcmp(g_pui8Read, g_pui8Buf, 64));
+    }
+    assert(f_close(&sFil) == FR_OK);
+}
+
+static void
+copy(const char *pcFrom, const char *pcTo)
+{
+    FIL sFrom, sTo;
+    UINT br, bw;
+
+    assert(f_open(&sFrom, pcFrom, FA_READ) == FR_OK);
+    assert(f_open(&sTo, pcTo, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    do {
+        assert(f_read(&sFrom, g_pui8Read, sizeof(g_pui8Read), &br) == FR_OK);
+        assert(f_write(&sTo, g_pui8Read, br, &bw) == FR_OK && bw == br);
+    } while (br);
+    assert(f_close(&sFrom) == FR_OK);
+    assert(f_close(&sTo) == FR_OK);
+}
+
+int
+main(void)
+{
+    FATFS sFs0, sFs2, *psFs;
+    FIL sFil;
+    DWORD ui32Free;
+    UINT bw;
+    unsigned long ulCard, ulRam, ulBytes;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 60, 100);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &sFs0);
+    assert(f_mkfs(0, 0, 0) == FR_OK);
+
+    /* Formatted by the driver, too small for f_mkfs() */
+    f_mount(2, &sFs2);
+    assert(f_mkfs(2, 0, 0) != FR_OK);
+    assert(f_getfree("2:", &ui32Free, &psFs) == FR_OK);
+    assert(psFs->fs_type == FS_FAT12 && psFs->csize == 1 && ui32Free == 29);
+
+    /* Scratch files, written much faster than to the card and without any
+     * bus traffic */
+    ulCard = write_file("0:TMP.BIN");
+    ulBytes = sim_bus_bytes;
+    ulRam = write_file("2:TMP.BIN");
+    check_file("2:TMP.BIN");
+    assert(sim_bus_bytes == ulBytes);
+    printf("%u bytes in 64-byte writes: card %lu us, RAM disk %lu us\n", SIZE,
+           ulCard, ulRam);
+    assert(ulRam * 10 < ulCard);
+
+    /* To the card and back */
+    copy("2:TMP.BIN", "0:MOVED.BIN");
+    check_file("0:MOVED.BIN");
+    assert(f_unlink("2:TMP.BIN") == FR_OK);
+    copy("0:MOVED.BIN", "2:BACK.BIN");
+    check_file("2:BACK.BIN");
+
+    /* Requests of several sectors in one go; none outside the drive */
+    assert(disk_read(RAMDISK_DRV, g_pui8Read, 0, 8) == RES_OK);
+    assert(g_pui8Read[510] == 0x55 && g_pui8Read[511] == 0xAA);
+    assert(disk_read(RAMDISK_DRV, g_pui8Read, 30, 3) == RES_PARERR);
+    assert(disk_read(RAMDISK_DRV, g_pui8Read, 31, 0) == RES_PARERR);
+    assert(disk_write(RAMDISK_DRV, g_pui8Read, 32, 1) == RES_PARERR);
+    assert(disk_write(RAMDISK_DRV, g_pui8Read, 0xFFFFFFFF, 2) == RES_PARERR);
+
+    /* Filling up: what fits of the 29 sectors is written, and the rest is
+     * refused */
+    memset(g_pui8Buf, 0xA5, sizeof(g_pui8Buf));
+    assert(f_open(&sFil, "2:FULL.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_write(&sFil, g_pui8Buf, 4096, &bw) == FR_OK);
+    assert(bw == (29 - SIZE / 512) * 512);
+    assert(f_write(&sFil, g_pui8Buf, 1, &bw) == FR_OK && !bw);
+    assert(f_close(&sFil) == FR_OK);
+    assert(f_getfree("2:", &ui32Free, &psFs) == FR_OK && !ui32Free);
+    check_file("2:BACK.BIN");
+
+    /* Initializing it again does not format it again */
+    assert(disk_initialize(RAMDISK_DRV) == 0);
+    f_mount(2, &sFs2);
+    check_file("2:BACK.BIN");
+    return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ * test_readdirs.c - directory items read in batches (f_readdirs of ff.c)
+ *
+ * Directories of 10 to 10,000 items, some hidden, system or subdirectories
+ * and some deleted, are read with f_readdirs() in batches of several sizes,
+ * with and without attribute filters and name patterns, and give the items
+ * that f_readdir() gives once filtered the same way; a batch short of its
+ * size ends the directory. The patterns mix ? and * over names of few
+ * letters so that a * has to give back characters it took. The host time
+ * per item of both is printed; run with -O for the numbers.
+ *
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+#define ITEMS           10000
+
+static FATFS g_sFs;
+static FIL g_sFil;
+static DIR g_sDir;
+static FILINFO g_psWant[ITEMS], g_psGot[ITEMS + 64];
+static BYTE g_pui8Ent[32 * (ITEMS + 2) + 65536];
+
+static const char *g_ppcPatterns[] =
+{
+    "*", "*.*", "*.TXT", "b*", "*a*b?c*", "?a*.log", "*ab*ab*", "a*a.?sv",
+    "???", "*d?", "C*D*.C?V", "*.", "BAD", 0
+};
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static double
+seconds(void)
+{
+    struct timespec sTs;
+
+    clock_gettime(CLOCK_MONOTONIC, &sTs);
+    return sTs.tv_sec + sTs.tv_nsec * 1e-9;
+}
+
+/* The pattern, case insensitive, as the plain recursive definition */
+static bool
+wild(const char *pcPat, const char *pcName)
+{
+    if (*pcPat == '*')
+        return wild(pcPat + 1, pcName) || (*pcName && wild(pcPat, pcName + 1));
+    if (!*pcName) return !*pcPat;
+    if (*pcPat == '?' || toupper(*pcPat) == toupper(*pcName))
+        return wild(pcPat + 1, pcName + 1);
+    return false;
+}
+
+/* The 8.3 name of item i in directory entry form: its number in base 4 in
+ * the letters A to D, so that all names differ, and one of four extensions */
+static void
+item_name(int i, BYTE *pui8Name)
+{
+    static const char *ppcExt[4] = { "TXT", "LOG", "CSV", "   " };
+    char pcDigits[8];
+    int n = 0, k = 0;
+
+    memset(pui8Name, ' ', 8);
+    memcpy(pui8Name + 8, ppcExt[i % 4], 3);
+    do {
+        pcDigits[n++] = 'A' + i % 4;
+        i /= 4;
+    } while (i && n < 8);
+    while (n--) pui8Name[k++] = pcDigits[n];
+}
+
+static void
+put_entry(BYTE *pui8Ent, const char *pcName, BYTE ui8Attr, DWORD ui32Clust,
+          DWORD ui32Size, int i)
+{
+    memset(pui8Ent, 0, 32);
+    memcpy(pui8Ent, pcName, 11);
+    pui8Ent[11] = ui8Attr;
+    pui8Ent[20] = (BYTE)(ui32Clust >> 16);
+    pui8Ent[21] = (BYTE)(ui32Clust >> 24);
+    pui8Ent[22] = (BYTE)i;                              /* Time */
+    pui8Ent[23] = (BYTE)(i >> 8);
+    pui8Ent[24] = (BYTE)(0x21 + i % 28);                /* Date */
+    pui8Ent[25] = 0x3C;
+    pui8Ent[26] = (BYTE)ui32Clust;
+    pui8Ent[27] = (BYTE)(ui32Clust >> 8);
+    pui8Ent[28] = (BYTE)ui32Size;
+    pui8Ent[29] = (BYTE)(ui32Size >> 8);
+    pui8Ent[30] = (BYTE)(ui32Size >> 16);
+    pui8Ent[31] = (BYTE)(ui32Size >> 24);
+}
+
+/* A fresh volume with directory D of iItems items. Making that many files
+ * with f_open() takes a search of the directory each, so the entries are
+ * written as the data of file D, which is then turned into a directory. */
+static void
+make_dir(int iItems)
+{
+    SimCard *psCard = &sim_cards[0];
+    BYTE pui8Name[11], *pui8Sect;
+    DWORD ui32Clust, ui32Len;
+    UINT bw, k;
+    int i;
+
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 4096) == FR_OK);
+    assert(f_open(&g_sFil, "D", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_write(&g_sFil, "", 1, &bw) == FR_OK && bw == 1);
+    ui32Clust = g_sFil.sclust;
+    assert(ui32Clust);
+
+    put_entry(g_pui8Ent, ".          ", AM_DIR, ui32Clust, 0, 0);
+    put_entry(g_pui8Ent + 32, "..         ", AM_DIR, 0, 0, 0);
+    for (i = 0; i < iItems; i++) {
+        BYTE ui8Attr = AM_ARC;
+
+        item_name(i, pui8Name);
+        if (i % 7 == 3) ui8Attr = AM_DIR;
+        else if (i % 11 == 5) ui8Attr |= AM_HID;
+        else if (i % 13 == 0) ui8Attr |= AM_RDO | AM_SYS;
+        put_entry(g_pui8Ent + 32 * (i + 2), (const char *)pui8Name, ui8Attr,
+                  0, ui8Attr & AM_DIR ? 0 : i * 3, i);
+        if (i % 17 == 9) g_pui8Ent[32 * (i + 2)] = 0xE5;   /* Deleted */
+    }
+
+    /* Zeros to the end of the last cluster end the directory */
+    ui32Len = 32 * (iItems + 2);
+    ui32Len = (ui32Len + 4095) / 4096 * 4096;
+    memset(g_pui8Ent + 32 * (iItems + 2), 0, ui32Len - 32 * (iItems + 2));
+    assert(f_lseek(&g_sFil, 0) == FR_OK);
+    assert(f_write(&g_sFil, g_pui8Ent, ui32Len, &bw) == FR_OK &&
+           bw == ui32Len);
+    assert(f_close(&g_sFil) == FR_OK);
+
+    /* Its entry in the root directory becomes that of a directory */
+    pui8Sect = psCard->data + g_sFil.dir_sect * 512;
+    for (k = 0; k < 512; k += 32)
+        if (!memcmp(pui8Sect + k, "D          ", 11)) break;
+    assert(k < 512);
+    pui8Sect[k + 11] = AM_DIR;
+    memset(pui8Sect + k + 28, 0, 4);
+
+    memset(&g_sFs, 0, sizeof(g_sFs));
+    f_mount(0, 0);
+    f_mount(0, &g_sFs);
+}
+
+/* The items f_readdir() gives without the attributes and matching the
+ * pattern */
+static int
+want(BYTE ui8Attr, const char *pcPat)
+{
+    FILINFO sInfo;
+    int n = 0;
+
+    memset(&sInfo, 0, sizeof(sInfo));
+    assert(f_opendir(&g_sDir, "D") == FR_OK);
+    for (;;) {
+        assert(f_readdir(&g_sDir, &sInfo) == FR_OK);
+        if (!sInfo.fname[0]) break;
+        if (sInfo.fattrib & ui8Attr) continue;
+        if (pcPat && !wild(pcPat, sInfo.fname)) continue;
+        g_psWant[n++] = sInfo;
+    }
+    return n;
+}
+
+/* The same with f_readdirs() in batches of uBatch */
+static int
+got(UINT uBatch, BYTE ui8Attr, const char *pcPat)
+{
+    UINT uRead;
+    int n = 0;
+
+    assert(f_opendir(&g_sDir, "D") == FR_OK);
+    do {
+        assert(n + uBatch <= sizeof(g_psGot) / sizeof(g_psGot[0]));
+        assert(f_readdirs(&g_sDir, &g_psGot[n], uBatch, &uRead, ui8Attr,
+                          pcPat) == FR_OK);
+        assert(uRead <= uBatch);
+        n += uRead;
+    } while (uRead == uBatch);
+
+    /* The end stays the end */
+    assert(f_readdirs(&g_sDir, g_psGot + n, uBatch, &uRead, ui8Attr,
+                      pcPat) == FR_OK && !uRead);
+    return n;
+}
+
+static void
+compare(int iItems, UINT uBatch, BYTE ui8Attr, const char *pcPat)
+{
+    int n = want(ui8Attr, pcPat), i;
+
+    assert(got(uBatch, ui8Attr, pcPat) == n);
+    for (i = 0; i < n; i++) {
+        assert(!strcmp(g_psGot[i].fname, g_psWant[i].fname));
+        assert(g_psGot[i].fattrib == g_psWant[i].fattrib);
+        assert(g_psGot[i].fsize == g_psWant[i].fsize);
+        assert(g_psGot[i].fdate == g_psWant[i].fdate);
+        assert(g_psGot[i].ftime == g_psWant[i].ftime);
+    }
+    if (!pcPat && !ui8Attr)
+        assert(n == iItems - (iItems + 7) / 17);
+}
+
+/* Host time per item of a whole directory, one at a time and in batches
+ * of 16 as ls reads it, and the time per item on the bus. The host time
+ * includes the simulation of the sectors read, the same for both. */
+static void
+bench(int iItems)
+{
+    FILINFO sInfo;
+    UINT uRead;
+    int iRounds = 200000 / iItems + 1, r, n;
+    double dStart, dOne, dBatch;
+    uint64_t ui64Start, ui64One, ui64Batch;
+
+    memset(&sInfo, 0, sizeof(sInfo));
+    dStart = seconds();
+    ui64Start = tb_Now();
+    for (r = 0; r < iRounds; r++) {
+        assert(f_opendir(&g_sDir, "D") == FR_OK);
+        do {
+            assert(f_readdir(&g_sDir, &sInfo) == FR_OK);
+        } while (sInfo.fname[0]);
+    }
+    dOne = seconds() - dStart;
+    ui64One = tb_Now() - ui64Start;
+
+    dStart = seconds();
+    ui64Start = tb_Now();
+    for (r = 0; r < iRounds; r++) {
+        assert(f_opendir(&g_sDir, "D") == FR_OK);
+        do {
+            assert(f_readdirs(&g_sDir, g_psGot, 16, &uRead, 0, 0) == FR_OK);
+        } while (uRead == 16);
+    }
+    dBatch = seconds() - dStart;
+    ui64Batch = tb_Now() - ui64Start;
+
+    n = iRounds * (iItems - (iItems + 7) / 17);
+    printf("  %5d items: f_readdir %6.1f ns, f_readdirs %6.1f ns per item "
+           "on the host, %5.1f and %5.1f us on the bus\n", iItems,
+           dOne * 1e9 / n, dBatch * 1e9 / n, (double)ui64One / n,
+           (double)ui64Batch / n);
+    assert(ui64Batch <= ui64One);
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    static const int piItems[] = { 10, 100, 1000, ITEMS };
+    static const UINT puBatch[] = { 1, 7, 16, 64 };
+    static const BYTE pui8Attr[] = { 0, AM_HID, AM_DIR | AM_SYS };
+    unsigned i, b, a, p;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 1, 1);
+    assert(disk_initialize(0) == 0);
+
+    /* Names the plain definition and the matcher of ff.c must agree on */
+    assert(wild("*ab*ab*", "XABYAB.TXT") && !wild("*ab*ab*", "ABA.TXT"));
+    assert(wild("a*a.?sv", "ABBAA.CSV") && !wild("a*a.?sv", "ABBAB.CSV"));
+
+    for (i = 0; i < sizeof(piItems) / sizeof(piItems[0]); i++) {
+        make_dir(piItems[i]);
+        for (b = 0; b < sizeof(puBatch) / sizeof(puBatch[0]); b++)
+            for (a = 0; a < sizeof(pui8Attr); a++) {
+                compare(piItems[i], puBatch[b], pui8Attr[a], 0);
+                for (p = 0; g_ppcPatterns[p]; p++)
+                    compare(piItems[i], puBatch[b], pui8Attr[a],
+                            g_ppcPatterns[p]);
+            }
+        bench(piItems[i]);
+    }
+    return 0;
+}
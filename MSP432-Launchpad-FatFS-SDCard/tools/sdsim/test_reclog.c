@@ -0,0 +1,328 @@
+/*
+ * test_reclog.c - the record log (reclog.c)
+ *
+ * Records of 8 to 63 bytes, 10 ms apart, are logged and read back by time
+ * range, with the ingest rate and the sectors and time a query takes
+ * printed. The frames carry the CRC-32 of zlib. The log is then opened
+ * again as after a reset: with the last frame synced, with it torn, with a
+ * part frame past the end of the data and the index short, and with stale
+ * index entries. Files are rotated by time, and a query spans them.
+ *
+ * sdsim: src reclog.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+#include "reclog.h"
+
+#define FILE_BYTES      (256 * 1024)
+
+static const tRecLogConfig g_sConfig = { "0:/LOG", FILE_BYTES, 3600000 };
+static const tRecLogConfig g_sByTime = { "0:/T", 0, 1000 };
+
+static FATFS g_sFs;
+static tRecLog g_sLog;
+static FIL g_sQuery;
+static BYTE g_pui8Big[RL_MAX_RECORD + 1];
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+/* Bitwise CRC-32 of zlib */
+static uint32_t
+crc32(const uint8_t *pui8Data, uint32_t n)
+{
+    uint32_t ui32Crc = 0xFFFFFFFF;
+    int k;
+
+    while (n--) {
+        ui32Crc ^= *pui8Data++;
+        for (k = 0; k < 8; k++) {
+            ui32Crc = (ui32Crc >> 1) ^ (0xEDB88320 & -(ui32Crc & 1));
+        }
+    }
+    return ~ui32Crc;
+}
+
+/* Record i is stamped i * 10 */
+static UINT
+rsize(uint32_t i)
+{
+    return 8 + (i * 37) % 56;
+}
+
+static void
+rfill(uint8_t *pui8Buf, uint32_t i)
+{
+    UINT k;
+
+    for (k = 0; k < rsize(i); k++) pui8Buf[k] = (uint8_t)(i + k * 13);
+}
+
+typedef struct {
+    uint32_t n, ui32Next, ui32Bad;
+} tQuery;
+
+static bool
+visit(uint32_t ui32Time, const uint8_t *pui8Data, uint_fast16_t ui16Size,
+      void *pvArg)
+{
+    tQuery *psQ = pvArg;
+    uint8_t pui8Buf[64];
+    uint32_t i = ui32Time / 10;
+
+    if (!psQ->n) psQ->ui32Next = i;
+    if (ui32Time != i * 10 || i != psQ->ui32Next || ui16Size != rsize(i)) {
+        psQ->ui32Bad++;
+    } else {
+        rfill(pui8Buf, i);
+        if (memcmp(pui8Buf, pui8Data, ui16Size)) psQ->ui32Bad++;
+    }
+    psQ->ui32Next = i + 1;
+    psQ->n++;
+    return true;
+}
+
+/* Query a range; the time and sectors read it took go to pulUs and pulRead
+ * if given */
+static tQuery
+query(uint32_t ui32From, uint32_t ui32To, unsigned long *pulUs,
+      unsigned long *pulRead)
+{
+    tQuery sQ = { 0 };
+    uint64_t ui64Start = tb_Now();
+    unsigned long ulRead = sim_cards[0].rdsect;
+
+    assert(rl_Query(&g_sLog, &g_sQuery, ui32From, ui32To, visit, &sQ) ==
+           FR_OK);
+    assert(!sQ.ui32Bad);
+    if (pulUs) *pulUs = (unsigned long)(tb_Now() - ui64Start);
+    if (pulRead) *pulRead = sim_cards[0].rdsect - ulRead;
+    return sQ;
+}
+
+/* Append records i0 on, syncing every ui32Sync of them if not 0; returns
+ * the next record */
+static uint32_t
+append(uint32_t i0, uint32_t n, uint32_t ui32Sync, unsigned long *pulUs)
+{
+    uint8_t pui8Buf[64];
+    uint64_t ui64Start = tb_Now();
+    uint32_t i;
+
+    for (i = i0; i < i0 + n; i++) {
+        rfill(pui8Buf, i);
+        assert(rl_Append(&g_sLog, i * 10, pui8Buf, rsize(i)) == FR_OK);
+        if (ui32Sync && (i + 1) % ui32Sync == 0) {
+            assert(rl_Sync(&g_sLog) == FR_OK);
+        }
+    }
+    if (pulUs) *pulUs = (unsigned long)(tb_Now() - ui64Start);
+    return i;
+}
+
+static DWORD
+fsize(const char *pcPath)
+{
+    FILINFO sInfo;
+
+    memset(&sInfo, 0, sizeof(sInfo));
+    assert(f_stat(pcPath, &sInfo) == FR_OK);
+    return sInfo.fsize;
+}
+
+/* Sector holding a byte of a file */
+static DWORD
+lba(const char *pcPath, DWORD ui32Ofs)
+{
+    FIL sFil;
+    UINT br;
+    BYTE c;
+
+    assert(f_open(&sFil, pcPath, FA_READ) == FR_OK);
+    assert(f_lseek(&sFil, ui32Ofs) == FR_OK);
+    assert(f_read(&sFil, &c, 1, &br) == FR_OK && br == 1);
+    assert(f_close(&sFil) == FR_OK);
+    return sFil.dsect;
+}
+
+/* Add bytes at the end of a file */
+static void
+extend(const char *pcPath, const void *pvData, UINT n)
+{
+    FIL sFil;
+    UINT bw;
+
+    assert(f_open(&sFil, pcPath, FA_WRITE) == FR_OK);
+    assert(f_lseek(&sFil, sFil.fsize) == FR_OK);
+    assert(f_write(&sFil, pvData, n, &bw) == FR_OK && bw == n);
+    assert(f_close(&sFil) == FR_OK);
+}
+
+/* Forget all that is held in RAM, and open the log again */
+static void
+reset(void)
+{
+    memset(&g_sLog, 0xA5, sizeof(g_sLog));
+    f_mount(0, &g_sFs);
+    assert(rl_Open(&g_sLog, &g_sConfig) == FR_OK);
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    static const struct {
+        uint32_t ui32From, ui32To;
+    } psRanges[] = {
+        { 0, 999 }, { 50000, 51000 }, { 150000, 150500 },
+        { 219000, 219990 }, { 219995, 219999 }, { 500000, 600000 }
+    };
+    static BYTE pui8Frame[512];
+    const uint32_t pui32Stale[2] = { 0xFFFFFF00, 100000 };
+    char pcPath[32], pcIndex[32];
+    unsigned long ulUs, ulRead;
+    uint64_t ui64Bytes = 0;
+    uint32_t n, n2, i, ui32Lo, ui32Hi, ui32File, ui32Frame, ui32Crc;
+    uint16_t ui16Last;
+    tQuery sQ;
+    FIL sFil;
+    UINT br;
+    DWORD ui32Index;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 262144, 60, 100);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 0) == FR_OK);
+
+    assert(rl_Open(&g_sLog, &g_sConfig) == FR_OK);
+    assert(g_sLog.ui32File == 1 && g_sLog.ui32Frame == 0);
+    assert(rl_Append(&g_sLog, 0, g_pui8Big, RL_MAX_RECORD + 1) ==
+           FR_INVALID_PARAMETER);
+
+    /* Ingest, synced as frames fill up and then every 10 records */
+    n = append(0, 20000, 0, &ulUs);
+    assert(rl_Sync(&g_sLog) == FR_OK);
+    for (i = 0; i < n; i++) ui64Bytes += rsize(i);
+    printf("ingest: %lu records, %llu bytes in %lu us: %.0f records/s, "
+           "%.0f KB/s, %lu frames in %lu files\n", (unsigned long)n,
+           (unsigned long long)ui64Bytes, ulUs, n * 1e6 / ulUs,
+           ui64Bytes * 1e6 / 1024 / ulUs, (unsigned long)g_sLog.ui32Frame,
+           (unsigned long)g_sLog.ui32File);
+    n2 = append(n, 2000, 10, &ulUs);
+    printf("ingest, sync every 10: %.0f records/s\n", (n2 - n) * 1e6 / ulUs);
+    n = n2;
+
+    /* Older than the last record */
+    assert(rl_Append(&g_sLog, 5, g_pui8Big, 4) == FR_INVALID_PARAMETER);
+
+    /* The frames carry the CRC-32 of zlib; full files index every 8th */
+    assert(f_open(&sFil, "0:/LOG/00000001.RL", FA_READ) == FR_OK);
+    assert(f_read(&sFil, pui8Frame, 512, &br) == FR_OK && br == 512);
+    assert(f_close(&sFil) == FR_OK);
+    memcpy(&ui32Crc, pui8Frame + 20, 4);
+    memset(pui8Frame + 20, 0, 4);
+    assert(ui32Crc == crc32(pui8Frame, RL_FRAME_HDR + (pui8Frame[18] |
+                                                       pui8Frame[19] << 8)));
+    assert(fsize("0:/LOG/00000001.RL") == FILE_BYTES);
+    assert(fsize("0:/LOG/00000001.RLI") == FILE_BYTES / 512 /
+           RL_INDEX_FRAMES * 8);
+
+    /* Queries read only the frames of their range */
+    sQ = query(0, 0xFFFFFFFF, &ulUs, &ulRead);
+    printf("query all: %lu records, %lu sectors, %lu us\n",
+           (unsigned long)sQ.n, ulRead, ulUs);
+    assert(sQ.n == n);
+    for (i = 0; i < sizeof(psRanges) / sizeof(psRanges[0]); i++) {
+        sQ = query(psRanges[i].ui32From, psRanges[i].ui32To, &ulUs, &ulRead);
+        printf("query %lu..%lu: %lu records, %lu sectors, %lu us\n",
+               (unsigned long)psRanges[i].ui32From,
+               (unsigned long)psRanges[i].ui32To, (unsigned long)sQ.n,
+               ulRead, ulUs);
+        ui32Lo = (psRanges[i].ui32From + 9) / 10;
+        ui32Hi = psRanges[i].ui32To / 10;
+        if (ui32Hi >= n) ui32Hi = n - 1;
+        if (ui32Lo > ui32Hi) {
+            assert(!sQ.n);
+        } else {
+            assert(sQ.n == ui32Hi - ui32Lo + 1 && sQ.ui32Next == ui32Hi + 1);
+            assert(ulRead < (sQ.n * 64 / 512 + 4 * RL_INDEX_FRAMES) * 2);
+        }
+    }
+
+    /* A reset after a sync of a part frame, which is written again as more
+     * is added to it: nothing is lost */
+    n = append(n, 5, 0, 0);
+    assert(rl_Sync(&g_sLog) == FR_OK);
+    n = append(n, 3, 0, 0);
+    assert(rl_Sync(&g_sLog) == FR_OK);
+    ui32File = g_sLog.ui32File;
+    ui32Frame = g_sLog.ui32Frame;
+    reset();
+    assert(g_sLog.ui32File == ui32File && g_sLog.ui32Frame == ui32Frame);
+    assert(query(0, 0xFFFFFFFF, 0, 0).n == n);
+
+    /* A torn last frame: its records are lost, and the log goes on */
+    sprintf(pcPath, "0:/LOG/%08lu.RL", (unsigned long)g_sLog.ui32File);
+    ui32Frame = g_sLog.ui32Frame;
+    memcpy(&ui16Last, (uint8_t *)g_sLog.pui32Frame + 16, 2);
+    assert(rl_Close(&g_sLog) == FR_OK);
+    sim_cards[0].data[lba(pcPath, ui32Frame * 512) * 512 + 100] ^= 0xFF;
+    reset();
+    assert(fsize(pcPath) == ui32Frame * 512);
+    assert(query(0, 0xFFFFFFFF, 0, 0).n == n - ui16Last);
+    n = append(n - ui16Last, 300, 50, 0);
+    assert(query(0, 0xFFFFFFFF, 0, 0).n == n);
+
+    /* Part of a frame past the data, and the index cut after its first
+     * entry: the part is cut off and the index written again */
+    assert(rl_Close(&g_sLog) == FR_OK);
+    sprintf(pcPath, "0:/LOG/%08lu.RL", (unsigned long)g_sLog.ui32File);
+    sprintf(pcIndex, "0:/LOG/%08lu.RLI", (unsigned long)g_sLog.ui32File);
+    extend(pcPath, g_pui8Big, 100);
+    ui32Index = fsize(pcIndex);
+    assert(f_open(&sFil, pcIndex, FA_WRITE) == FR_OK);
+    assert(f_lseek(&sFil, 8) == FR_OK && f_truncate(&sFil) == FR_OK);
+    assert(f_close(&sFil) == FR_OK);
+    reset();
+    assert(fsize(pcPath) % 512 == 0 && fsize(pcIndex) == ui32Index);
+    assert(query(0, 0xFFFFFFFF, 0, 0).n == n);
+    sQ = query(n * 10 - 2000, n * 10, 0, &ulRead);
+    printf("index rebuilt: %lu entries, tail query %lu sectors\n",
+           (unsigned long)(ui32Index / 8 - 1), ulRead);
+    assert(sQ.n == 200);
+
+    /* Index entries past the data, written before and after a close */
+    extend(pcIndex, pui32Stale, 8);
+    assert(rl_Close(&g_sLog) == FR_OK);
+    extend(pcIndex, pui32Stale, 8);
+    reset();
+    assert(fsize(pcIndex) == ui32Index);
+    assert(query(0, 0xFFFFFFFF, 0, 0).n == n);
+    assert(rl_Close(&g_sLog) == FR_OK);
+
+    /* Rotation by time: 10 s of records in files of 1 s, and a query over
+     * two of them */
+    assert(rl_Open(&g_sLog, &g_sByTime) == FR_OK);
+    append(0, 1000, 0, 0);
+    assert(g_sLog.ui32File == 10);
+    assert(query(0, 0xFFFFFFFF, 0, 0).n == 1000);
+    sQ = query(4995, 5015, 0, &ulRead);
+    printf("query 4995..5015 across files: %lu sectors\n", ulRead);
+    assert(sQ.n == 2 && sQ.ui32Next == 502);
+    assert(rl_Close(&g_sLog) == FR_OK);
+    return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * test_reserve.c - clusters claimed ahead of files (_FS_RESERVE of ff.c)
+ *
+ * Four files are appended to in turn, as loggers do, with records of 64
+ * bytes to 4KB, with an f_sync() after each record, and with directories
+ * made in between, and the runs of contiguous clusters of each file are
+ * printed. With the claims, each file is in a few runs; files past
+ * _FS_RSVFILES are not. The claims leave no cluster behind once the files
+ * are closed, and files filling the volume together use every cluster of
+ * it. Run with -s _FS_RESERVE=0 for the runs without the claims.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+
+#define FILES           6
+
+static FATFS g_sFs;
+static FIL g_psFil[FILES];
+static BYTE g_pui8Buf[65536];
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static BYTE
+pattern(int i, DWORD ui32Ofs)
+{
+    return (BYTE)(ui32Ofs * 7 + (ui32Ofs >> 9) * 13 + i * 31);
+}
+
+static void
+check(const char *pcName, int i, DWORD ui32Size)
+{
+    FIL sFil;
+    UINT br, k;
+    DWORD ui32Ofs;
+
+    assert(f_open(&sFil, pcName, FA_READ) == FR_OK);
+    assert(sFil.fsize == ui32Size);
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += br) {
+        assert(f_read(&sFil, g_pui8Buf, sizeof(g_pui8Buf), &br) == FR_OK);
+        assert(br);
+        for (k = 0; k < br; k++) {
+            assert(g_pui8Buf[k] == pattern(i, ui32Ofs + k));
+        }
+    }
+    assert(f_close(&sFil) == FR_OK);
+}
+
+static DWORD
+free_clusters(void)
+{
+    FATFS *psFs;
+    DWORD ui32Free;
+    FRESULT iRes;
+
+    while ((iRes = f_getfree("0:", &ui32Free, &psFs)) == FR_IN_PROGRESS) ;
+    assert(iRes == FR_OK);
+    return ui32Free;
+}
+
+/* Runs of contiguous clusters of a file, and its clusters */
+static DWORD
+runs(const char *pcName, DWORD *pui32Clusters)
+{
+    FIL sFil;
+    UINT br;
+    BYTE c;
+    DWORD ui32Ofs, ui32Runs = 0, ui32Last = 0, n = 0;
+
+    assert(f_open(&sFil, pcName, FA_READ) == FR_OK);
+    for (ui32Ofs = 0; ui32Ofs < sFil.fsize;
+         ui32Ofs += g_sFs.csize * 512, n++) {
+        assert(f_lseek(&sFil, ui32Ofs) == FR_OK);
+        assert(f_read(&sFil, &c, 1, &br) == FR_OK && br == 1);
+        if (sFil.clust != ui32Last + 1) ui32Runs++;
+        ui32Last = sFil.clust;
+    }
+    assert(f_close(&sFil) == FR_OK);
+    *pui32Clusters = n;
+    return ui32Runs;
+}
+
+/* Forget all that is held in RAM, claims included */
+static void
+remount(void)
+{
+    memset(&g_sFs, 0, sizeof(g_sFs));
+    f_mount(0, 0);
+    f_mount(0, &g_sFs);
+}
+
+static void
+format(UINT uAu)
+{
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, uAu) == FR_OK);
+    remount();
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+/* iFiles files appended to in turn uRecord bytes at a time, to ui32Size
+ * bytes each */
+static void
+round_robin(const char *pcTitle, UINT uAu, int iFiles, UINT uRecord,
+            DWORD ui32Size, bool bSync, bool bMkdir)
+{
+    char pcName[16];
+    DWORD ui32Ofs, ui32Free, ui32Runs, ui32Clusters, ui32Used = 0;
+    UINT n, k, bw;
+    int i, iDirs = 0;
+
+    format(uAu);
+    ui32Free = free_clusters();
+    for (i = 0; i < iFiles; i++) {
+        sprintf(pcName, "L%d.CSV", i);
+        assert(f_open(&g_psFil[i], pcName, FA_CREATE_ALWAYS | FA_WRITE) ==
+               FR_OK);
+    }
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += n) {
+        n = ui32Size - ui32Ofs < uRecord ? ui32Size - ui32Ofs : uRecord;
+        for (i = 0; i < iFiles; i++) {
+            for (k = 0; k < n; k++) g_pui8Buf[k] = pattern(i, ui32Ofs + k);
+            assert(f_write(&g_psFil[i], g_pui8Buf, n, &bw) == FR_OK &&
+                   bw == n);
+            if (bSync) assert(f_sync(&g_psFil[i]) == FR_OK);
+        }
+        if (bMkdir && (ui32Ofs + n) % (ui32Size / 4) < uRecord) {
+            sprintf(pcName, "D%d", iDirs++);
+            assert(f_mkdir(pcName) == FR_OK);
+        }
+    }
+    for (i = 0; i < iFiles; i++) assert(f_close(&g_psFil[i]) == FR_OK);
+
+    printf("  %-36s", pcTitle);
+    for (i = 0; i < iFiles; i++) {
+        sprintf(pcName, "L%d.CSV", i);
+        check(pcName, i, ui32Size);
+        ui32Runs = runs(pcName, &ui32Clusters);
+        ui32Used += ui32Clusters;
+        printf(" %4lu", (unsigned long)ui32Runs);
+#if _FS_RESERVE
+        if (i < _FS_RSVFILES) assert(ui32Runs <= 8);
+#endif
+    }
+    printf("  runs of %lu clusters\n", (unsigned long)(ui32Used / iFiles));
+
+    /* Claims are in RAM only and leave nothing behind */
+    remount();
+    assert(ui32Free - free_clusters() == ui32Used + iDirs);
+}
+
+int
+main(void)
+{
+    char pcName[16];
+    DWORD pui32Size[4] = { 0 }, ui32Free, ui32Clusters, ui32Used = 0;
+    UINT bw, k;
+    bool pbFull[4] = { false };
+    int i, iFull = 0;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 1, 1);
+    assert(disk_initialize(0) == 0);
+
+    printf("_FS_RESERVE %d\n", _FS_RESERVE);
+    round_robin("4 files, 64-byte records, 4KB cl", 4096, 4, 64,
+                1024 * 1024, false, false);
+    round_robin("4 files, 512-byte records, 4KB cl", 4096, 4, 512,
+                1024 * 1024, false, false);
+    round_robin("4 files, 4KB records, 1KB cl", 1024, 4, 4096, 1024 * 1024,
+                false, false);
+    round_robin("4 files, 100 B, f_sync each, 2KB cl", 2048, 4, 100,
+                256 * 1024, true, false);
+    round_robin("4 files and f_mkdir, 4KB cl", 4096, 4, 512, 1024 * 1024,
+                false, true);
+    round_robin("6 files, 4KB cl", 4096, 6, 512, 1024 * 1024, false, false);
+
+    /* Four files filling the volume together use every cluster */
+    format(4096);
+    ui32Free = free_clusters();
+    for (i = 0; i < 4; i++) {
+        sprintf(pcName, "F%d.BIN", i);
+        assert(f_open(&g_psFil[i], pcName, FA_CREATE_ALWAYS | FA_WRITE) ==
+               FR_OK);
+    }
+    while (iFull < 4) {
+        for (i = 0; i < 4; i++) {
+            if (pbFull[i]) continue;
+            for (k = 0; k < 3000; k++) {
+                g_pui8Buf[k] = pattern(i, pui32Size[i] + k);
+            }
+            assert(f_write(&g_psFil[i], g_pui8Buf, 3000, &bw) == FR_OK);
+            pui32Size[i] += bw;
+            if (bw < 3000) {
+                pbFull[i] = true;
+                iFull++;
+            }
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        assert(f_close(&g_psFil[i]) == FR_OK);
+        sprintf(pcName, "F%d.BIN", i);
+        check(pcName, i, pui32Size[i]);
+        runs(pcName, &ui32Clusters);
+        ui32Used += ui32Clusters;
+    }
+    assert(!free_clusters() && ui32Used == ui32Free);
+    printf("  4 files filling the volume: all %lu clusters used\n",
+           (unsigned long)ui32Free);
+    return 0;
+}
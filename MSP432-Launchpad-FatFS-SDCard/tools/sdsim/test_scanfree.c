@@ -0,0 +1,187 @@
+/*
+ * test_scanfree.c - free clusters counted in steps (_FS_SCANFREE of ff.c)
+ *
+ * A FAT32 volume of more than a million clusters is mounted with the free
+ * count of its FSInfo sector unknown. Each ls, which lists the root
+ * directory and asks f_getfree() as Cmd_ls does, returns within the time of
+ * a listing and _FS_SCANFREE FAT sectors while the count is not ready, and
+ * then within that of the listing alone. Clusters are taken and given back
+ * on both sides of the scan meanwhile, and the count it comes to is that of
+ * the FAT on the card. Run with -s _FS_SCANFREE=0 for the full scan that a
+ * single ls waits for without it.
+ *
+ * sdsim: set _USE_STAGE 0
+ * sdsim: set _FS_FASTMOUNT 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+#define SECTORS         1100000         /* 512-byte clusters, over 1M */
+
+static FATFS g_sFs;
+static FIL g_sFil;
+static DIR g_sDir;
+static FILINFO g_psInfo[16];
+static BYTE g_pui8Buf[4096];
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+/* Free clusters counted in the FAT on the card */
+static DWORD
+fat_free(void)
+{
+    const BYTE *pui8Fat = sim_cards[0].data + g_sFs.fatbase * 512;
+    DWORD ui32Cl, ui32Free = 0;
+
+    for (ui32Cl = 2; ui32Cl < g_sFs.n_fatent; ui32Cl++)
+        ui32Free += !(LD_DWORD(pui8Fat + ui32Cl * 4) & 0x0FFFFFFF);
+    return ui32Free;
+}
+
+/* Forget the free count, on the card and in RAM */
+static void
+remount_unknown(void)
+{
+    BYTE *pui8Fsi = sim_cards[0].data + g_sFs.fsi_sector * 512;
+
+    ST_DWORD(pui8Fsi + 488, 0xFFFFFFFF);           /* FSI_Free_Count */
+    memset(&g_sFs, 0, sizeof(g_sFs));
+    f_mount(0, 0);
+    f_mount(0, &g_sFs);
+}
+
+/* What Cmd_ls does to the card: the listing in batches of 16 and the free
+ * space. Returns the time it took. */
+static unsigned long
+ls(FRESULT *piRes, DWORD *pui32Free)
+{
+    FATFS *psFs;
+    UINT uRead;
+    uint64_t ui64Start = tb_Now();
+
+    assert(f_opendir(&g_sDir, "/") == FR_OK);
+    do {
+        assert(f_readdirs(&g_sDir, g_psInfo, 16, &uRead, 0, 0) == FR_OK);
+    } while (uRead == 16);
+    *piRes = f_getfree("0:", pui32Free, &psFs);
+    assert(*piRes == FR_OK || *piRes == FR_IN_PROGRESS);
+    return (unsigned long)(tb_Now() - ui64Start);
+}
+
+static void
+make_file(const char *pcName, DWORD ui32Size)
+{
+    UINT n, bw;
+    DWORD ui32Ofs;
+
+    memset(g_pui8Buf, 0x5A, sizeof(g_pui8Buf));
+    assert(f_open(&g_sFil, pcName, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (ui32Ofs = 0; ui32Ofs < ui32Size; ui32Ofs += n) {
+        n = ui32Size - ui32Ofs < sizeof(g_pui8Buf) ? ui32Size - ui32Ofs :
+            sizeof(g_pui8Buf);
+        assert(f_write(&g_sFil, g_pui8Buf, n, &bw) == FR_OK && bw == n);
+    }
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+/* A file of ui32Clusters clusters from cluster ui32At on, allocated by
+ * seeking past its end */
+static void
+make_file_at(const char *pcName, DWORD ui32At, DWORD ui32Clusters)
+{
+    g_sFs.last_clust = ui32At - 1;
+    assert(f_open(&g_sFil, pcName, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_lseek(&g_sFil, ui32Clusters * 512) == FR_OK);
+    assert(g_sFil.fptr == ui32Clusters * 512);
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    FRESULT iRes;
+    DWORD ui32Free, ui32Clusters;
+    unsigned long ulUs, ulWorst = 0, ulListing, ulSector;
+    uint64_t ui64Start;
+    int i, iSteps = 0;
+    char pcName[16];
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, SECTORS, 1, 1);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 512) == FR_OK);
+    for (i = 0; i < 40; i++) {
+        sprintf(pcName, "F%02d.TXT", i);
+        make_file(pcName, 1000 + i * 700);
+    }
+    make_file("A.BIN", 200 * 1024);
+    ui32Clusters = g_sFs.n_fatent - 2;
+    assert(g_sFs.fs_type == FS_FAT32 && ui32Clusters > 1000000);
+
+    /* Files in the middle and at the end of the FAT */
+    make_file_at("M.BIN", ui32Clusters / 2, 50000);
+    make_file_at("Z.BIN", ui32Clusters - 60000, 50000);
+
+    /* The time of a sector read, and of the listing */
+    ui64Start = tb_Now();
+    assert(disk_read(0, g_pui8Buf, 100, 1) == RES_OK);
+    ulSector = (unsigned long)(tb_Now() - ui64Start);
+    ulListing = ls(&iRes, &ui32Free);
+    assert(iRes == FR_OK);
+
+    /* ls while the count is worked out in steps, with clusters taken and
+     * given back below the scan, across it and ahead of it */
+    remount_unknown();
+    assert(f_stat("F00.TXT", g_psInfo) == FR_OK);    /* Mounts it */
+    assert(g_sFs.free_clust > ui32Clusters);
+    ui64Start = tb_Now();
+    do {
+        ulUs = ls(&iRes, &ui32Free);
+        if (ulUs > ulWorst) ulWorst = ulUs;
+        iSteps++;
+#if _FS_SCANFREE
+        if (iRes != FR_IN_PROGRESS) break;
+        assert(ui32Free <= ui32Clusters);
+        if (g_sFs.scan_clst > 50000 && f_unlink("A.BIN") == FR_OK)
+            make_file("B.BIN", 300 * 1024);
+        if (g_sFs.scan_clst > ui32Clusters / 2 + 20000 &&
+            f_unlink("M.BIN") == FR_OK)
+            make_file_at("N.BIN", ui32Clusters / 2 - 10000, 30000);
+        if (g_sFs.scan_clst > ui32Clusters / 2 + 40000 &&
+            f_unlink("Z.BIN") == FR_OK)
+            make_file_at("Y.BIN", ui32Clusters - 100000, 1000);
+        for (i = 0; i < 4 && f_scanfree("0:") == FR_IN_PROGRESS; i++) ;
+#endif
+    } while (iRes == FR_IN_PROGRESS);
+    assert(iRes == FR_OK);
+    printf("  %lu clusters: ls %lu us with the count known, %lu us at worst "
+           "while counting, over %d listings of %lu us\n",
+           (unsigned long)ui32Clusters, ulListing, ulWorst, iSteps,
+           (unsigned long)(tb_Now() - ui64Start));
+#if _FS_SCANFREE
+    assert(ulWorst <= ulListing + (_FS_SCANFREE + 2) * ulSector);
+    assert(f_stat("Y.BIN", g_psInfo) == FR_OK);
+#endif
+    assert(ui32Free == fat_free());
+
+    /* Once it is known, ls takes no longer than with the count known */
+    ulUs = ls(&iRes, &ui32Free);
+    assert(iRes == FR_OK && ulUs <= ulListing + ulSector);
+    assert(ui32Free == fat_free());
+    return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * test_spibus.c - the SPI bus shared by the cards and other devices (spiBus.c)
+ *
+ * Two devices besides card 0 sit on the bus, each with its own chip select,
+ * clock and clock mode, and answer each byte with the byte XOR 0x5A. Only one
+ * chip select is ever low at a time, and a device always sees its own clock
+ * and mode. Queued transfers run in arrival order, the ones queued by a done
+ * callback on the next sb_Poll(). A chain of SB_HOLD transfers selects its
+ * device once, takes in the transfers queued for that device meanwhile, and
+ * the others wait for its end, sb_Acquire() too. A card busy programming
+ * lets queued transfers through, and a multiple block read stops for them
+ * between sectors.
+ *
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "diskio.h"
+#include "spiBus.h"
+
+static tSpiDevice g_psDev[2] =
+{
+    { GPIO_PORT_P3, GPIO_PIN0, 1000000,
+      EUSCI_B_SPI_PHASE_DATA_CAPTURED_ONFIRST_CHANGED_ON_NEXT,
+      EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_LOW, 0 },
+    { GPIO_PORT_P3, GPIO_PIN1, 8000000,
+      EUSCI_B_SPI_PHASE_DATA_CHANGED_ONFIRST_CAPTURED_ON_NEXT,
+      EUSCI_B_SPI_CLOCKPOLARITY_INACTIVITY_HIGH, 0 },
+};
+
+static bool g_pbSel[2];                 /* Chip select of a device is low */
+static unsigned long g_pulBytes[2];     /* Bytes each device saw */
+static char g_pcEvents[256];            /* 'A', 'B' selected, 'a', 'b' not */
+static int g_iEvents;
+static char g_pcDone[64];               /* Tag of each transfer done */
+static int g_iDone;
+static unsigned long g_ulDoneAt;        /* sim_clock of the last one */
+
+static tSpiXfer g_psXfer[8];
+static uint8_t g_ppui8Tx[8][16], g_ppui8Rx[8][16];
+static int g_iRepeat;
+static unsigned long g_ulSubmitAt;
+static BYTE g_pui8Buf[512 * 32];
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static int
+device_at(uint_fast8_t port, uint_fast16_t pin)
+{
+    int i;
+
+    for (i = 0; i < 2; i++)
+        if (g_psDev[i].ui8CsPort == port && g_psDev[i].ui16CsPin == pin)
+            return i;
+    return -1;
+}
+
+static void
+gpio(uint_fast8_t port, uint_fast16_t pin, int level)
+{
+    int i = device_at(port, pin), k;
+
+    if (!level) {
+        /* Nothing else selected while a chip select goes low */
+        for (k = 0; k < 2; k++) assert(!g_pbSel[k] || k == i);
+        for (k = 0; k < SIM_NCARDS; k++) assert(!sim_cards[k].sel);
+    }
+    if (i < 0) return;
+    if (!level && !g_pbSel[i] && g_iEvents < (int)sizeof(g_pcEvents) - 1)
+        g_pcEvents[g_iEvents++] = 'A' + i;
+    if (level && g_pbSel[i] && g_iEvents < (int)sizeof(g_pcEvents) - 1)
+        g_pcEvents[g_iEvents++] = 'a' + i;
+    g_pbSel[i] = !level;
+}
+
+static uint8_t
+byte(uint8_t ui8In)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (!g_pbSel[i]) continue;
+        assert(sim_phase == g_psDev[i].ui16Phase);
+        assert(sim_pol == g_psDev[i].ui16Polarity);
+        assert(sim_smclk / sim_div <= g_psDev[i].ui32Hz);
+        g_pulBytes[i]++;
+        return ui8In ^ 0x5A;
+    }
+    return 0xFF;
+}
+
+static void
+reset(void)
+{
+    memset(g_pcEvents, 0, sizeof(g_pcEvents));
+    memset(g_pcDone, 0, sizeof(g_pcDone));
+    g_iEvents = g_iDone = 0;
+}
+
+static void
+done(tSpiXfer *psXfer)
+{
+    int i = psXfer - g_psXfer;
+
+    assert(!psXfer->bBusy);
+    if (g_iDone < (int)sizeof(g_pcDone) - 1) g_pcDone[g_iDone++] = '0' + i;
+    g_ulDoneAt = sim_clock;
+}
+
+/* Transfer i of iLen bytes to device iDev */
+static void
+submit(int i, int iDev, uint16_t ui16Len, uint8_t ui8Flags,
+       void (*pfnDone)(tSpiXfer *psXfer))
+{
+    int k;
+
+    for (k = 0; k < ui16Len; k++) g_ppui8Tx[i][k] = (uint8_t)(i * 16 + k);
+    memset(g_ppui8Rx[i], 0, sizeof(g_ppui8Rx[i]));
+    g_psXfer[i].psDevice = &g_psDev[iDev];
+    g_psXfer[i].pui8Tx = g_ppui8Tx[i];
+    g_psXfer[i].pui8Rx = g_ppui8Rx[i];
+    g_psXfer[i].ui16Len = ui16Len;
+    g_psXfer[i].ui8Flags = ui8Flags;
+    g_psXfer[i].pfnDone = pfnDone ? pfnDone : done;
+    sb_Submit(&g_psXfer[i]);
+    assert(g_psXfer[i].bBusy);
+}
+
+static void
+check_rx(int i)
+{
+    int k;
+
+    for (k = 0; k < g_psXfer[i].ui16Len; k++)
+        assert(g_ppui8Rx[i][k] == (g_ppui8Tx[i][k] ^ 0x5A));
+}
+
+/* Queues the same transfer again when done */
+static void
+again(tSpiXfer *psXfer)
+{
+    done(psXfer);
+    g_iRepeat++;
+    submit(psXfer - g_psXfer, 0, 4, 0, again);
+}
+
+/* Queues transfer 4 from "interrupt" at sim_clock g_ulSubmitAt */
+static void
+late(void)
+{
+    if (sim_clock == g_ulSubmitAt) submit(4, 1, 16, 0, 0);
+}
+
+static unsigned long
+count_cmd(int cmd, unsigned long ulFrom)
+{
+    unsigned long i, n = 0;
+
+    for (i = ulFrom; i < sim_cards[0].nlog; i++)
+        if (sim_cards[0].log[i % SIM_LOG].cmd == cmd) n++;
+    return n;
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    SimCard *psCard = &sim_cards[0];
+    unsigned long ulLog, ulStart, ulReady, ulWritten;
+    int i;
+
+    sim_gpio_hook = gpio;
+    sim_byte_hook = byte;
+    sb_AddDevice(&g_psDev[0]);
+    sb_AddDevice(&g_psDev[1]);
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 20, 375);
+    assert(disk_initialize(0) == 0);
+
+    /* Queued transfers run in order, each with its own select, clock and
+     * mode; one queued by a done callback waits for the next sb_Poll() */
+    reset();
+    submit(0, 0, 5, 0, 0);
+    submit(1, 1, 16, 0, 0);
+    submit(2, 0, 1, 0, 0);
+    assert(sb_Pending());
+    assert(!sb_Poll());
+    assert(!strcmp(g_pcDone, "012") && !strcmp(g_pcEvents, "AaBbAa"));
+    for (i = 0; i < 3; i++) check_rx(i);
+    assert(g_pulBytes[0] == 6 && g_pulBytes[1] == 16);
+    g_iRepeat = 0;
+    submit(3, 0, 4, 0, again);
+    assert(sb_Poll() == 1 && g_iRepeat == 1);
+    assert(sb_Poll() == 1 && g_iRepeat == 2);
+    g_psXfer[3].pfnDone = done;
+    assert(!sb_Poll() && !sb_Pending());
+
+    /* An SB_HOLD chain selects its device once, across calls of sb_Poll(),
+     * and the transfers of the other device wait for its end */
+    reset();
+    submit(0, 0, 4, SB_HOLD, 0);
+    submit(1, 1, 4, 0, 0);
+    submit(2, 0, 4, SB_HOLD, 0);
+    assert(sb_Poll() == 1);
+    assert(!strcmp(g_pcDone, "02") && !strcmp(g_pcEvents, "A"));
+    assert(sb_Poll() == 1 && !strcmp(g_pcEvents, "A"));
+    submit(3, 0, 4, 0, 0);
+    assert(!sb_Poll());
+    assert(!strcmp(g_pcDone, "0231") && !strcmp(g_pcEvents, "AaBb"));
+    for (i = 0; i < 4; i++) check_rx(i);
+
+    /* sb_Acquire() waits behind a holder until its chain ends, both for a
+     * device and for a card */
+    reset();
+    submit(0, 0, 8, SB_HOLD, 0);
+    assert(!sb_Poll());
+    submit(1, 0, 8, SB_HOLD, 0);
+    submit(2, 0, 8, 0, 0);
+    sb_Acquire(&g_psDev[1]);
+    assert(!strcmp(g_pcDone, "012") && !strcmp(g_pcEvents, "AaB"));
+    sb_Release(&g_psDev[1]);
+    reset();
+    submit(0, 0, 8, SB_HOLD, 0);
+    assert(!sb_Poll());
+    submit(1, 0, 8, 0, 0);
+    assert(disk_ioctl(0, CTRL_SYNC, 0) == RES_OK);
+    assert(!strcmp(g_pcDone, "01") && !strcmp(g_pcEvents, "Aa"));
+
+    /* A card busy programming yields the bus to queued transfers, each
+     * queued again as it is done, and still finishes */
+    psCard->busy_single = psCard->busy_stop = 20000;
+    memset(g_pui8Buf, 0x33, 512);
+    assert(disk_write(0, g_pui8Buf, 200, 1) == RES_OK);
+    ulReady = psCard->busy_until;
+    ulWritten = sim_clock;
+    assert(ulReady > ulWritten + 10000);
+    reset();
+    g_iRepeat = 0;
+    submit(3, 0, 4, 0, again);
+    assert(disk_ioctl(0, CTRL_SYNC, 0) == RES_OK);
+    assert(sim_clock >= ulReady && g_iRepeat > 1);
+    printf("  %d transfers while the card was busy for %lu byte times\n",
+           g_iRepeat, ulReady - ulWritten);
+    g_psXfer[3].pfnDone = done;
+    assert(!sb_Poll());
+    assert(!memcmp(psCard->data + 200 * 512, g_pui8Buf, 512));
+    psCard->busy_single = psCard->busy_stop = 375;
+
+    /* A multiple block read stops between sectors for a transfer queued
+     * while it runs, and then goes on */
+    for (i = 0; i < 32 * 512; i++) psCard->data[300 * 512 + i] = (BYTE)i;
+    reset();
+    ulLog = psCard->nlog;
+    ulStart = sim_clock;
+    g_ulSubmitAt = sim_clock + 4000;
+    sim_time_hook = late;
+    assert(disk_read(0, g_pui8Buf, 300, 32) == RES_OK);
+    sim_time_hook = 0;
+    assert(!memcmp(g_pui8Buf, psCard->data + 300 * 512, 32 * 512));
+    assert(!strcmp(g_pcDone, "4") && !strcmp(g_pcEvents, "Bb"));
+    check_rx(4);
+    assert(count_cmd(18, ulLog) == 2);
+    assert(g_ulDoneAt < g_ulSubmitAt + 2 * 600);
+    printf("  transfer queued during a 32-sector read done after %lu of "
+           "%lu byte times\n", g_ulDoneAt - g_ulSubmitAt,
+           sim_clock - ulStart);
+    return 0;
+}
@@ -0,0 +1,347 @@
+/*
+ * test_stage.c - staging of writes to a busy card (stage-msp432P401r.c)
+ *
+ * A logger writes and syncs a record every 10 ms to a card that stops for
+ * 300 ms every 40 writes; with the staging log only the records that
+ * have to read from the card wait for it.
+ * The test then resets itself, by running itself again on an image of the
+ * card and of the flash it saved, at the points that matter:
+ *
+ *   2  with sectors staged and the entry after the newest torn: the file
+ *      reads back whole through the log, and staging goes on past the
+ *      torn entry
+ *   3  with the log erased: the card alone holds the file. Requests of
+ *      disk_submit() see the sectors staged after that.
+ *   4  with a sector staged and another card inserted: the sector is kept
+ *      but neither read from the log nor written to that card, and is
+ *      copied once the first card is back. Sectors of the first card are
+ *      given up only when the log runs full for the other one, and are
+ *      counted by disk_stage_dropped().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+#define NSECT           65536
+#define RECORDS         600
+#define ENTRIES         56              /* ST_ENTRIES of the staging layer */
+#define ENTRY_SIZE      544
+#define PER_SECTOR      7
+#define MAGIC           0x47545353
+#define IMAGE           "stage.img"
+
+static BYTE g_pui8Buf[512], g_pui8Read[512];
+static const char *g_pcSelf;
+static FATFS g_sFs;
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static void
+setup(void)
+{
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, NSECT, 60, 100);
+    sim_cards[0].gc_busy = 300000 / SIM_US_PER_BYTE;
+    sim_cards[0].gc_period = 40;
+}
+
+/* Save the card and the flash, and start over as after a reset */
+static void
+reset(const char *pcPhase)
+{
+    FILE *psFile = fopen(IMAGE, "wb");
+
+    assert(psFile);
+    fwrite(sim_cards[0].data, 512, NSECT, psFile);
+    fwrite(sim_cards[0].erased, 1, NSECT, psFile);
+    fwrite(sim_stage, 1, sizeof(sim_stage), psFile);
+    fclose(psFile);
+    fflush(stdout);
+    execl(g_pcSelf, g_pcSelf, pcPhase, (char *)0);
+    assert(0);
+}
+
+static void
+restore(void)
+{
+    FILE *psFile = fopen(IMAGE, "rb");
+
+    assert(psFile);
+    assert(fread(sim_cards[0].data, 512, NSECT, psFile) == NSECT);
+    assert(fread(sim_cards[0].erased, 1, NSECT, psFile) == NSECT);
+    assert(fread(sim_stage, 1, sizeof(sim_stage), psFile) ==
+           sizeof(sim_stage));
+    fclose(psFile);
+}
+
+/* The main loop between records */
+static void
+idle(int iMs)
+{
+    while (iMs--) {
+        sim_idle(1000 / SIM_US_PER_BYTE);
+        disk_stage_poll();
+    }
+}
+
+static void
+fill(int iRecord)
+{
+    int i;
+
+    for (i = 0; i < 512; i++) g_pui8Buf[i] = (BYTE)(iRecord * 7 + i);
+}
+
+static void
+verify(int iRecords)
+{
+    FIL sFil;
+    UINT br;
+    int i;
+
+    assert(f_open(&sFil, "LOG.BIN", FA_READ) == FR_OK);
+    assert(sFil.fsize == (DWORD)iRecords * 512);
+    for (i = 0; i < iRecords; i++) {
+        fill(i);
+        assert(f_read(&sFil, g_pui8Read, 512, &br) == FR_OK && br == 512);
+        assert(!memcmp(g_pui8Read, g_pui8Buf, 512));
+    }
+    assert(f_close(&sFil) == FR_OK);
+}
+
+/* Stage a sector: the card is busy for longer than the layer waits */
+static void
+stage(DWORD ui32Sector, int iRecord)
+{
+    sim_cards[0].gc_period = 1;
+    assert(disk_write(0, g_pui8Buf, NSECT - 100, 1) == RES_OK);
+    fill(iRecord);
+    assert(disk_write(0, g_pui8Buf, ui32Sector, 1) == RES_OK);
+    assert(memcmp(sim_cards[0].data + ui32Sector * 512, g_pui8Buf, 512));
+    sim_cards[0].gc_period = 40;
+}
+
+//*****************************************************************************
+//
+// The phases
+//
+//*****************************************************************************
+static void
+records(void)
+{
+    FIL sFil;
+    UINT bw;
+    uint64_t ui64Start, ui64Took, ui64Total = 0;
+    BYTE pui8Ocr[5];
+    int i, iSlow = 0;
+
+    assert(disk_initialize(0) == 0);
+    pui8Ocr[4] = 0x5A;
+    assert(disk_ioctl(0, MMC_GET_OCR, pui8Ocr) == RES_OK && pui8Ocr[4] == 0x5A);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 0) == FR_OK);
+
+    sim_cards[0].gc_count = sim_cards[0].ngc = 0;
+    assert(f_open(&sFil, "LOG.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (i = 0; i < RECORDS; i++) {
+        fill(i);
+        ui64Start = tb_Now();
+        assert(f_write(&sFil, g_pui8Buf, 512, &bw) == FR_OK && bw == 512);
+        assert(f_sync(&sFil) == FR_OK);
+        ui64Took = tb_Now() - ui64Start;
+        ui64Total += ui64Took;
+        if (ui64Took > 100000) iSlow++;
+        idle(10);
+    }
+    assert(f_close(&sFil) == FR_OK);
+    printf("%d records, %lu stalls of the card, %d over 100 ms, %llu us on "
+           "average\n", RECORDS, sim_cards[0].ngc, iSlow,
+           (unsigned long long)(ui64Total / RECORDS));
+
+    /* The records that wait are those that read the FAT or the directory
+     * from a stalled card */
+    assert(sim_cards[0].ngc > RECORDS / 40 && iSlow * 2 <= sim_cards[0].ngc);
+    verify(RECORDS);
+
+    /* Twenty more while the card stalls all the time */
+    sim_cards[0].gc_period = 1;
+    assert(f_open(&sFil, "LOG.BIN", FA_OPEN_EXISTING | FA_WRITE) == FR_OK);
+    assert(f_lseek(&sFil, sFil.fsize) == FR_OK);
+    for (i = RECORDS; i < RECORDS + 20; i++) {
+        fill(i);
+        assert(f_write(&sFil, g_pui8Buf, 512, &bw) == FR_OK && bw == 512);
+        assert(f_sync(&sFil) == FR_OK);
+    }
+    assert(f_close(&sFil) == FR_OK);
+    assert(disk_stage_poll() > 0);
+    reset("2");
+}
+
+static void
+torn(void)
+{
+    uint32_t *pui32Entry, ui32Seq = 0;
+    int i, iLast = -1;
+    BYTE n;
+
+    /* Tear the entry after the newest one */
+    for (i = 0; i < ENTRIES; i++) {
+        pui32Entry = (uint32_t *)(sim_stage + i / PER_SECTOR * 4096 +
+                                  i % PER_SECTOR * ENTRY_SIZE);
+        if (pui32Entry[0] == MAGIC && pui32Entry[2] >= ui32Seq) {
+            ui32Seq = pui32Entry[2];
+            iLast = i;
+        }
+    }
+    assert(iLast >= 0);
+    i = (iLast + 1) % ENTRIES;
+    memset(sim_stage + i / PER_SECTOR * 4096 + i % PER_SECTOR * ENTRY_SIZE + 8,
+           0, 192);
+
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    verify(RECORDS + 20);
+    for (n = 0; disk_stage_poll(); n++) sim_idle(100);
+    printf("log drained in %u polls after the reset\n", n);
+
+    stage(NSECT - 3, 6);
+    assert(disk_stage_poll() == 1);
+    assert(disk_read(0, g_pui8Read, NSECT - 3, 1) == RES_OK);
+    assert(!memcmp(g_pui8Read, g_pui8Buf, 512));
+    while (disk_stage_poll()) sim_idle(100);
+    assert(!memcmp(sim_cards[0].data + (NSECT - 3) * 512, g_pui8Buf, 512));
+    reset("3");
+}
+
+/* Requests of disk_submit() on staged sectors */
+static void
+queued(void)
+{
+    static BYTE pui8Sects[3 * 512];
+    DREQ sReq;
+
+    /* A read gets the staged sector, which is on the card by then */
+    stage(NSECT - 5, 9);
+    memset(&sReq, 0, sizeof(sReq));
+    sReq.buff = pui8Sects;
+    sReq.sector = NSECT - 6;
+    sReq.op = DREQ_READ;
+    sReq.count = 3;
+    assert(disk_submit(&sReq) == RES_OK);
+    while (disk_poll()) ;
+    assert(!sReq.busy && sReq.res == RES_OK);
+    assert(!memcmp(pui8Sects + 512, g_pui8Buf, 512));
+    assert(!memcmp(sim_cards[0].data + (NSECT - 5) * 512, g_pui8Buf, 512));
+    assert(!disk_stage_poll());
+
+    /* A write is not undone by an older staged copy */
+    stage(NSECT - 7, 10);
+    fill(11);
+    sReq.buff = g_pui8Buf;
+    sReq.sector = NSECT - 7;
+    sReq.op = DREQ_WRITE;
+    sReq.count = 1;
+    assert(disk_submit(&sReq) == RES_OK);
+    while (disk_poll()) ;
+    assert(!sReq.busy && sReq.res == RES_OK);
+    idle(1000);
+    assert(!disk_stage_poll());
+    assert(!memcmp(sim_cards[0].data + (NSECT - 7) * 512, g_pui8Buf, 512));
+}
+
+static void
+erased(void)
+{
+    memset(sim_stage, 0xFF, sizeof(sim_stage));
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    verify(RECORDS + 20);
+    queued();
+
+    stage(NSECT - 1, 1);
+    assert(disk_stage_poll() == 1);
+    reset("4");
+}
+
+static void
+swapped(void)
+{
+    static BYTE pui8Before[512];
+    int i, iFirst = sim_cards[0].id;
+    DWORD ui32Sector;
+
+    /* Another card: the sector stays in the log, away from it */
+    memcpy(pui8Before, sim_cards[0].data + (NSECT - 1) * 512, 512);
+    sim_cards[0].id = 99;
+    assert(disk_initialize(0) == 0);
+    idle(100);
+    assert(disk_stage_poll() == 1);
+    assert(!memcmp(sim_cards[0].data + (NSECT - 1) * 512, pui8Before, 512));
+    assert(disk_read(0, g_pui8Read, NSECT - 1, 1) == RES_OK);
+    assert(!memcmp(g_pui8Read, pui8Before, 512));
+    assert(!disk_stage_dropped());
+
+    /* The first card again: the sector is copied to it */
+    sim_cards[0].id = iFirst;
+    assert(disk_initialize(0) == 0);
+    idle(100);
+    assert(!disk_stage_poll());
+    fill(1);
+    assert(!memcmp(sim_cards[0].data + (NSECT - 1) * 512, g_pui8Buf, 512));
+
+    /* A sector of the first card is given up when the log is full */
+    stage(NSECT - 1, 2);
+    memcpy(pui8Before, sim_cards[0].data + (NSECT - 1) * 512, 512);
+    sim_cards[0].id = 99;
+    assert(disk_initialize(0) == 0);
+    sim_cards[0].gc_period = 1;
+    for (i = 0; i < ENTRIES; i++) {
+        fill(100 + i);
+        assert(disk_write(0, g_pui8Buf, 1000 + i, 1) == RES_OK);
+    }
+    assert(disk_stage_dropped() == 1 && !disk_stage_dropped());
+    sim_cards[0].gc_period = 40;
+    idle(1000);
+    assert(!disk_stage_poll());
+    for (i = 0; i < ENTRIES; i++) {
+        fill(100 + i);
+        ui32Sector = 1000 + i;
+        assert(!memcmp(sim_cards[0].data + ui32Sector * 512, g_pui8Buf, 512));
+    }
+    assert(!memcmp(sim_cards[0].data + (NSECT - 1) * 512, pui8Before, 512));
+}
+
+int
+main(int argc, char **argv)
+{
+    g_pcSelf = argv[0];
+    setup();
+    switch (argc > 1 ? atoi(argv[1]) : 1) {
+    case 1:
+        records();
+        break;
+    case 2:
+        restore();
+        torn();
+        break;
+    case 3:
+        restore();
+        erased();
+        break;
+    case 4:
+        restore();
+        swapped();
+        break;
+    }
+    return 0;
+}
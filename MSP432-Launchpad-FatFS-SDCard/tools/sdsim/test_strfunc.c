@@ -0,0 +1,199 @@
+/*
+ * test_strfunc.c - f_gets, f_putc, f_puts and f_printf
+ *
+ * The writers return the number of characters they were given, whether or
+ * not _USE_STRFUNC 2 puts a CR in front of each LF, and EOF when the file
+ * cannot be written. f_gets splits lines that do not fit and strips the CRs
+ * again with _USE_STRFUNC 2. Run it with -s _USE_STRFUNC=2 as well.
+ *
+ * A 1MB CSV file is written with f_printf, a line a call, and read back
+ * with f_gets, for lines of 4 and of 16 columns, and the lines per second
+ * of each on the host and on the bus are printed. That is done with the
+ * output buffer of 64 bytes, which takes two f_write calls for a line of 16
+ * columns, and with one of 128, which takes one; the host time of a line
+ * written in one, two and three calls is printed as well. Run with -O for
+ * the numbers.
+ *
+ * sdsim: set _USE_STAGE 0
+ * sdsim: vary SZ_PUTBUFF 64 128
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+
+#if _USE_STRFUNC >= 2
+#define CR  1                           /* Bytes put in front of a LF */
+#else
+#define CR  0
+#endif
+
+static FATFS g_sFs;
+static FIL g_sFil;
+static char g_pcLong[301];
+static char g_pcLine[400];
+
+static double
+seconds(void)
+{
+    struct timespec sTs;
+
+    clock_gettime(CLOCK_MONOTONIC, &sTs);
+    return sTs.tv_sec + sTs.tv_nsec * 1e-9;
+}
+
+/* A line of iCols columns of the CSV file */
+static int
+csv_line(int iCols, long lRow)
+{
+    if (iCols == 4)
+        return f_printf(&g_sFil, "%lu,%d,%d,%d\n", lRow, (int)(lRow % 2000) - 1000,
+                        (int)(lRow * 7 % 30000), (int)(lRow * 13 % 999));
+    return f_printf(&g_sFil, "%lu,%d,%d,%d,%d,%d,%ld,%d,%ld,%d,%ld,%ld,%ld,"
+                    "%d,%04X,%s\n", lRow, (int)(lRow % 2000) - 1000,
+                    (int)(lRow * 7 % 30000), (int)(lRow * 13 % 999),
+                    (int)(lRow * 17 % 32768) - 16384, (int)(lRow % 97),
+                    lRow * 3 % 100000, (int)(lRow * 11 % 5000) - 2500,
+                    lRow * 19 % 70000, (int)(lRow % 7), lRow * 12345 % 9999999,
+                    -(lRow * 777 % 1000000), lRow * 31 % 4000000,
+                    (int)(lRow % 2), (unsigned)(lRow * 29 & 0xFFFF),
+                    lRow & 1 ? "ok" : "retry");
+}
+
+/* Host time in ns a line of 1MB of 80-byte lines written with uCalls calls
+ * of f_write each, the best of three */
+static double
+write_calls(UINT uCalls)
+{
+    UINT bw, k, uPart = 80 / uCalls;
+    DWORD ui32Size;
+    double dStart, dBest = 1e9;
+    int r;
+
+    memset(g_pcLine, 'x', 80);
+    for (r = 0; r < 3; r++) {
+        assert(f_open(&g_sFil, "W.CSV", FA_CREATE_ALWAYS | FA_WRITE) ==
+               FR_OK);
+        dStart = seconds();
+        for (ui32Size = 0; ui32Size < 1024 * 1024; ui32Size += 80) {
+            for (k = 0; k < uCalls; k++)
+                assert(f_write(&g_sFil, g_pcLine + k * uPart,
+                               k + 1 < uCalls ? uPart : 80 - k * uPart, &bw)
+                       == FR_OK);
+        }
+        assert(f_close(&g_sFil) == FR_OK);
+        if (seconds() - dStart < dBest) dBest = seconds() - dStart;
+    }
+    return dBest * 1e9 / (1024 * 1024 / 80);
+}
+
+/* Lines per second of a 1MB CSV file of iCols columns written with
+ * f_printf and read with f_gets, the best of three on the host */
+static void
+bench(int iCols)
+{
+    long lRows, l;
+    int n, r;
+    DWORD ui32Size;
+    double dStart, dWrite = 1e9, dRead = 1e9;
+    uint64_t ui64Start, ui64Write, ui64Read;
+
+    for (r = 0; r < 3; r++) {
+        assert(f_open(&g_sFil, "D.CSV", FA_CREATE_ALWAYS | FA_WRITE) ==
+               FR_OK);
+        lRows = 0;
+        ui32Size = 0;
+        dStart = seconds();
+        ui64Start = tb_Now();
+        while (ui32Size < 1024 * 1024) {
+            n = csv_line(iCols, lRows++);
+            assert(n > 0);
+            ui32Size += n + CR;
+        }
+        assert(f_close(&g_sFil) == FR_OK);
+        if (seconds() - dStart < dWrite) dWrite = seconds() - dStart;
+        ui64Write = tb_Now() - ui64Start;
+
+        assert(f_open(&g_sFil, "D.CSV", FA_READ) == FR_OK);
+        assert(f_size(&g_sFil) == ui32Size);
+        dStart = seconds();
+        ui64Start = tb_Now();
+        for (l = 0; f_gets(g_pcLine, sizeof(g_pcLine), &g_sFil); l++)
+            assert(g_pcLine[strlen(g_pcLine) - 1] == '\n');
+        if (seconds() - dStart < dRead) dRead = seconds() - dStart;
+        ui64Read = tb_Now() - ui64Start;
+        assert(l == lRows);
+        assert(f_close(&g_sFil) == FR_OK);
+    }
+
+    printf("  %2d columns, %3lu bytes a line: f_printf %7.0f lines/s on the "
+           "host, %5.0f on the bus, f_gets %7.0f and %5.0f\n", iCols,
+           (unsigned long)(ui32Size / lRows), lRows / dWrite,
+           lRows * 1e6 / ui64Write, lRows / dRead, lRows * 1e6 / ui64Read);
+}
+
+int
+main(void)
+{
+    DWORD size;
+    int i;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 20, 200);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 4096) == FR_OK);
+
+    /* 300 characters, a LF every 30, across the output buffer */
+    for (i = 0; i < 300; i++) g_pcLong[i] = i % 30 == 29 ? '\n' : 'a' + i % 26;
+
+    assert(f_open(&g_sFil, "S.TXT", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_puts("ab\ncd\n", &g_sFil) == 6);
+    assert(f_putc('\n', &g_sFil) == 1);
+    assert(f_putc('x', &g_sFil) == 1);
+    assert(f_printf(&g_sFil, "%5d|%-3s|%c\n", 42, "x", 'y') == 12);
+    assert(f_printf(&g_sFil, "%08lX\n", 0xBEEFUL) == 9);
+    assert(f_puts(g_pcLong, &g_sFil) == 300);
+    assert(f_printf(&g_sFil, "%s", g_pcLong) == 300);
+    assert(f_close(&g_sFil) == FR_OK);
+    size = 6 + 1 + 1 + 12 + 9 + 300 + 300 + (2 + 1 + 1 + 1 + 20) * CR;
+
+    assert(f_open(&g_sFil, "S.TXT", FA_READ) == FR_OK);
+    assert(f_size(&g_sFil) == size);
+    assert(f_gets(g_pcLine, sizeof(g_pcLine), &g_sFil) && !strcmp(g_pcLine, "ab\n"));
+    assert(f_gets(g_pcLine, sizeof(g_pcLine), &g_sFil) && !strcmp(g_pcLine, "cd\n"));
+    assert(f_gets(g_pcLine, sizeof(g_pcLine), &g_sFil) && !strcmp(g_pcLine, "\n"));
+    assert(f_gets(g_pcLine, sizeof(g_pcLine), &g_sFil) &&
+           !strcmp(g_pcLine, "x   42|x  |y\n"));
+    /* A line longer than the buffer comes in pieces */
+    assert(f_gets(g_pcLine, 5, &g_sFil) && !strcmp(g_pcLine, "0000"));
+    assert(f_gets(g_pcLine, 5, &g_sFil) && !strcmp(g_pcLine, "BEEF"));
+    assert(f_gets(g_pcLine, 5, &g_sFil) && !strcmp(g_pcLine, "\n"));
+    for (i = 0; i < 20; i++) {
+        assert(f_gets(g_pcLine, sizeof(g_pcLine), &g_sFil));
+        assert(strlen(g_pcLine) == 30 && !memcmp(g_pcLine, g_pcLong + i % 10 * 30, 30));
+    }
+    assert(!f_gets(g_pcLine, sizeof(g_pcLine), &g_sFil));
+    assert(f_close(&g_sFil) == FR_OK);
+
+    /* A file open for reading only cannot take them */
+    assert(f_open(&g_sFil, "S.TXT", FA_READ) == FR_OK);
+    assert(f_puts("hello\n", &g_sFil) == EOF);
+    assert(f_putc('x', &g_sFil) == EOF);
+    assert(f_printf(&g_sFil, "%s", g_pcLong) == EOF);
+    assert(f_close(&g_sFil) == FR_OK);
+
+    printf("_USE_STRFUNC %d, %lu bytes\n", _USE_STRFUNC, (unsigned long)size);
+
+    bench(4);
+    bench(16);
+    printf("  80 bytes a line in 1, 2 and 3 calls of f_write: %.0f, %.0f "
+           "and %.0f ns a line on the host\n", write_calls(1), write_calls(2),
+           write_calls(3));
+    return 0;
+}
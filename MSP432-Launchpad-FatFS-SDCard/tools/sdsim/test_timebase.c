@@ -0,0 +1,285 @@
+/*
+ * test_timebase.c - microsecond time base and software timers (timebase.c)
+ *
+ * Timer32 and SysTick are emulated here from the simulated time, at the
+ * MCLK of sim_mclk. The time base keeps counting over Timer32 wraps, also
+ * while interrupts are masked, and over a change of MCLK. Timers expire in
+ * deadline order, no earlier than asked, also beyond the longest SysTick
+ * period; tb_Sleep() waits for its own timer. The card driver runs on it.
+ *
+ * sdsim: src timebase.c
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "diskio.h"
+#include "timebase.h"
+
+//*****************************************************************************
+//
+// Timer32 module 0 and SysTick, both counting MCLK cycles
+//
+//*****************************************************************************
+static uint64_t g_ui64Cycles;           /* MCLK cycles since the start */
+static uint64_t g_ui64T32Load;          /* g_ui64Cycles when loaded */
+static bool g_bT32Flag, g_bT32Irq;
+static int64_t g_i64SysTickLeft;        /* Cycles to the next SysTick */
+static bool g_bSysTickPending;
+static SysTick_Type g_sSysTick;
+SysTick_Type *SysTick = &g_sSysTick;
+
+static void
+serve(void)
+{
+    if (sim_irq_masked()) return;
+    if (g_bT32Flag && g_bT32Irq) T32_INT1_ISR();
+    if (g_bSysTickPending) {
+        g_bSysTickPending = false;
+        SysTick_ISR();
+    }
+}
+
+/* One byte time of the simulation */
+static void
+advance(void)
+{
+    uint64_t ui64Step = (uint64_t)sim_mclk / 1000000 * SIM_US_PER_BYTE;
+
+    if ((g_ui64Cycles - g_ui64T32Load) >> 32 !=
+        (g_ui64Cycles + ui64Step - g_ui64T32Load) >> 32)
+        g_bT32Flag = true;
+    g_ui64Cycles += ui64Step;
+    if (g_sSysTick.CTRL & 1) {
+        g_i64SysTickLeft -= ui64Step;
+        while (g_i64SysTickLeft <= 0) {
+            g_i64SysTickLeft += g_sSysTick.LOAD;
+            if (g_sSysTick.CTRL & 2) g_bSysTickPending = true;
+        }
+    }
+    serve();
+}
+
+void
+Timer32_initModule(uint32_t m, uint32_t pre, uint32_t res, uint32_t mode)
+{
+    assert(m == TIMER32_0_MODULE && pre == TIMER32_PRESCALER_1);
+    assert(res == TIMER32_32BIT && mode == TIMER32_PERIODIC_MODE);
+}
+
+void
+Timer32_setCount(uint32_t m, uint32_t count)
+{
+    assert(count == 0xFFFFFFFF);
+    g_ui64T32Load = g_ui64Cycles;
+}
+
+void
+Timer32_startTimer(uint32_t m, bool oneshot)
+{
+    assert(!oneshot);
+}
+
+uint32_t
+Timer32_getValue(uint32_t m)
+{
+    return 0xFFFFFFFF - (uint32_t)(g_ui64Cycles - g_ui64T32Load);
+}
+
+uint32_t
+Timer32_getInterruptStatus(uint32_t m)
+{
+    return g_bT32Flag;
+}
+
+void
+Timer32_clearInterruptFlag(uint32_t m)
+{
+    g_bT32Flag = false;
+}
+
+void
+Timer32_enableInterrupt(uint32_t m)
+{
+    g_bT32Irq = true;
+}
+
+void
+Interrupt_enableInterrupt(uint32_t n)
+{
+    assert(n == INT_T32_INT1);
+}
+
+void
+SysTick_setPeriod(uint32_t period)
+{
+    assert(period && period <= 0x01000000);
+    g_sSysTick.LOAD = period;
+    g_i64SysTickLeft = period;
+}
+
+void
+SysTick_enableModule(void)
+{
+    g_sSysTick.CTRL |= 1;
+    if (!g_sSysTick.VAL) g_i64SysTickLeft = g_sSysTick.LOAD;
+    g_sSysTick.VAL = 1;
+}
+
+void
+SysTick_disableModule(void)
+{
+    g_sSysTick.CTRL &= ~1;
+    g_bSysTickPending = false;
+}
+
+void
+SysTick_enableInterrupt(void)
+{
+    g_sSysTick.CTRL |= 2;
+}
+
+/* Sleep until an interrupt is pending. The handlers run when tb_Sleep()
+ * enables the interrupts again, which it does right after; they are run
+ * here already, as the master enable of sdsim.c cannot call them. */
+bool
+PCM_gotoLPM0(void)
+{
+    assert(sim_irq_masked());
+    while (!(g_bT32Flag && g_bT32Irq) && !g_bSysTickPending) {
+        sim_idle(1);
+    }
+    Interrupt_enableMaster();
+    serve();
+    Interrupt_disableMaster();
+    return true;
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+static uint64_t g_pui64Fired[8];
+static int g_iFired;
+static tTimer g_psTimers[4];
+
+/* Simulated time in microseconds */
+static uint64_t
+now(void)
+{
+    return (uint64_t)sim_clock * SIM_US_PER_BYTE;
+}
+
+static void
+fired(tTimer *psTimer)
+{
+    g_pui64Fired[g_iFired++] = now();
+    assert(psTimer->ui64Deadline <= tb_Now());
+}
+
+static void
+periodic(tTimer *psTimer)
+{
+    fired(psTimer);
+    if (g_iFired < 5) tb_TimerStart(psTimer, 30000, periodic);
+}
+
+/* The time base is within a byte time of the simulated time */
+static void
+check_now(uint64_t ui64Offset)
+{
+    uint64_t t = tb_Now() + ui64Offset, n = now();
+
+    assert(t <= n + SIM_US_PER_BYTE && t + SIM_US_PER_BYTE >= n);
+}
+
+int
+main(void)
+{
+    uint64_t t, ui64Offset;
+    int i;
+
+    sim_time_hook = advance;
+    sim_mclk = 48000000;
+    sim_idle(100);
+    ui64Offset = now();
+    tb_Init();
+    check_now(ui64Offset);
+
+    /* Over three Timer32 wraps (89 s each at 48 MHz) */
+    for (i = 0; i < 3; i++) {
+        sim_idle(6000000);
+        check_now(ui64Offset);
+    }
+
+    /* A wrap while interrupts are masked is seen from the pending flag */
+    while (Timer32_getValue(0) > 48000000 / 1000000 * SIM_US_PER_BYTE * 10) {
+        sim_idle(1);
+    }
+    Interrupt_disableMaster();
+    sim_idle(20);
+    assert(g_bT32Flag);
+    check_now(ui64Offset);
+    Interrupt_enableMaster();
+    sim_idle(1);
+    check_now(ui64Offset);
+
+    /* MCLK goes down to 12 MHz and back */
+    sim_mclk = 12000000;
+    tb_Rebase();
+    sim_idle(10000);
+    check_now(ui64Offset);
+    sim_mclk = 48000000;
+    tb_Rebase();
+    check_now(ui64Offset);
+
+    /* Timers expire in deadline order, also one beyond the longest SysTick
+     * period (0.35 s at 48 MHz), and not before they are due */
+    t = now();
+    tb_TimerStart(&g_psTimers[0], 50000, fired);
+    tb_TimerStart(&g_psTimers[1], 1000000, fired);
+    tb_TimerStart(&g_psTimers[2], 20000, fired);
+    tb_TimerStart(&g_psTimers[3], 70000, fired);
+    tb_TimerStop(&g_psTimers[3]);
+    sim_idle(1100000 / SIM_US_PER_BYTE);
+    assert(g_iFired == 3);
+    assert(g_pui64Fired[0] >= t + 20000 && g_pui64Fired[0] < t + 20100);
+    assert(g_pui64Fired[1] >= t + 50000 && g_pui64Fired[1] < t + 50100);
+    assert(g_pui64Fired[2] >= t + 1000000 && g_pui64Fired[2] < t + 1000100);
+    assert(!g_psTimers[3].bPending && !(SysTick->CTRL & 1));
+
+    /* A timer that starts itself again */
+    g_iFired = 0;
+    t = now();
+    tb_TimerStart(&g_psTimers[0], 30000, periodic);
+    sim_idle(200000 / SIM_US_PER_BYTE);
+    assert(g_iFired == 5);
+    assert(g_pui64Fired[4] >= t + 150000 && g_pui64Fired[4] < t + 150500);
+
+    /* tb_Sleep() while another timer is pending */
+    g_iFired = 0;
+    tb_TimerStart(&g_psTimers[1], 5000, fired);
+    t = now();
+    tb_Sleep(12000);
+    assert(now() >= t + 12000 && now() < t + 12100);
+    assert(g_iFired == 1 && !sim_irq_masked());
+    check_now(ui64Offset);
+
+    /* The card driver waits on it, for a slow card and an empty socket */
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 8192, 20, 200);
+    sim_init(1, GPIO_PORT_P4, GPIO_PIN7, 8192, 20, 200);
+    sim_cards[0].init_time = 50000 / SIM_US_PER_BYTE;
+    sim_cards[1].pin = 0;
+    t = now();
+    assert(disk_initialize(0) == 0);
+    assert(now() >= t + 50000);
+    assert(disk_initialize(1) & STA_NOINIT);
+    check_now(ui64Offset);
+
+    printf("%lu s simulated\n", (unsigned long)(now() / 1000000));
+    return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * test_trace.c - the event trace ring (trace.c)
+ *
+ * A file is written with all categories of events enabled, and the dump is
+ * read back: every begin has its end inside the event it is nested in, the
+ * time stamps are microseconds across a clock change, and the disk and
+ * command events carry their drive, count, sector and results. A wait for a
+ * busy card, during which the CPU sleeps, lasts as long as the card is busy.
+ * Only the enabled categories are recorded, and a ring that has wrapped
+ * keeps the latest events and counts the others as lost.
+ *
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "timebase.h"
+#include "trace.h"
+
+#define RECORDS         256             /* TR_RECORDS of trace.c */
+
+typedef struct {
+    uint32_t ui32Time;
+    unsigned uEvent, uAux;
+    uint32_t ui32Arg;
+} tEvent;
+
+static tEvent g_psEvents[RECORDS];
+static unsigned g_uEvents, g_uLost;
+
+/* Run tr_Dump() and parse what it prints */
+static void
+dump(void)
+{
+    FILE *psFile = tmpfile();
+    int iOut = dup(1);
+    char pcLine[80];
+    tEvent *psEv;
+
+    fflush(stdout);
+    dup2(fileno(psFile), 1);
+    tr_Dump();
+    fflush(stdout);
+    dup2(iOut, 1);
+    close(iOut);
+    rewind(psFile);
+
+    assert(fgets(pcLine, sizeof(pcLine), psFile));
+    assert(sscanf(pcLine, "trace us %u events %u lost\r\n", &g_uEvents,
+                  &g_uLost) == 2);
+    assert(g_uEvents <= RECORDS);
+    for (psEv = g_psEvents; psEv < g_psEvents + g_uEvents; psEv++) {
+        assert(fgets(pcLine, sizeof(pcLine), psFile));
+        assert(strlen(pcLine) == 8 + 1 + 2 + 1 + 4 + 1 + 8 + 2);
+        assert(sscanf(pcLine, "%8x %2x %4x %8x", &psEv->ui32Time,
+                      &psEv->uEvent, &psEv->uAux, &psEv->ui32Arg) == 4);
+    }
+    assert(fgets(pcLine, sizeof(pcLine), psFile));
+    assert(!strcmp(pcLine, "trace end\r\n"));
+    assert(!fgets(pcLine, sizeof(pcLine), psFile));
+    fclose(psFile);
+}
+
+/* Number of events of a kind in the dump */
+static unsigned
+count(unsigned uEvent)
+{
+    unsigned i, n = 0;
+
+    for (i = 0; i < g_uEvents; i++) n += g_psEvents[i].uEvent == uEvent;
+    return n;
+}
+
+int
+main(void)
+{
+    static BYTE pui8Buf[4096];
+    FATFS sFs;
+    FIL sFil;
+    UINT bw;
+    tEvent *psStack[16], *psEv, *psBegin;
+    unsigned uDepth = 0, uWrites = 0, uMulti = 0, i;
+    unsigned long ulSleeps;
+    uint64_t ui64Start;
+    uint32_t ui32Us;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 131072, 20, 200);
+    sim_mclk = 48000000;
+    tr_Init();
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &sFs);
+    assert(f_mkfs(0, 0, 0) == FR_OK);
+
+    /* Nothing is recorded before tr_Enable() */
+    dump();
+    assert(!g_uEvents && !g_uLost);
+
+    /* A file of four multiple block writes, closed at 12 MHz */
+    tr_Enable(TR_ALL);
+    assert(f_open(&sFil, "A.BIN", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    for (i = 0; i < 4; i++) {
+        memset(pui8Buf, i, sizeof(pui8Buf));
+        assert(f_write(&sFil, pui8Buf, sizeof(pui8Buf), &bw) == FR_OK);
+    }
+    sim_mclk = 12000000;
+    tr_ClockChanged();
+    tr_ClockChanged();                          /* No change, no event */
+    assert(f_close(&sFil) == FR_OK);
+    dump();
+    assert(!g_uLost && g_uEvents > 20);
+    assert(count(FT_OPEN) == 1 && count(FT_OPEN | TR_END) == 1);
+    assert(count(FT_WRITE) == 4 && count(FT_CLOSE | TR_END) == 1);
+    assert(count(TR_EV_CLOCK) == 1);
+
+    for (i = 0; i < g_uEvents; i++) {
+        psEv = &g_psEvents[i];
+        if (i) assert(psEv->ui32Time >= g_psEvents[i - 1].ui32Time);
+        if (psEv->uEvent == TR_EV_CLOCK) {
+            assert(psEv->uAux == 48000 && psEv->ui32Arg == 12000);
+            assert(!uDepth);
+            continue;
+        }
+        if (!(psEv->uEvent & TR_END)) {
+            assert(uDepth < 16);
+            psStack[uDepth++] = psEv;
+            continue;
+        }
+
+        /* An end closes the innermost open event, and takes as long as the
+         * bytes on the bus of a write do at least */
+        assert(uDepth);
+        psBegin = psStack[--uDepth];
+        assert(psBegin->uEvent == (psEv->uEvent & ~TR_END));
+        ui32Us = psEv->ui32Time - psBegin->ui32Time;
+        switch (psBegin->uEvent) {
+        case TR_EV_DISK_WRITE:
+            assert(psEv->uAux == RES_OK);
+            assert((psBegin->uAux >> 8) == 0 && (psBegin->uAux & 0xFF));
+            assert(ui32Us >= (psBegin->uAux & 0xFF) * 512 * SIM_US_PER_BYTE);
+            uWrites += psBegin->uAux & 0xFF;
+            assert(uDepth && psStack[uDepth - 1]->uEvent < 32);
+            break;
+        case TR_EV_DISK_READ:
+            assert(psEv->uAux == RES_OK && (psBegin->uAux >> 8) == 0);
+            assert(uDepth && psStack[uDepth - 1]->uEvent < 32);
+            break;
+        case TR_EV_SEND_CMD:
+            /* No error bits in R1. Commands outside disk_read() and
+             * disk_write() initialize the card on mount or erase ahead of
+             * the writes to a file. */
+            assert(!(psEv->uAux & 0xFE) && uDepth);
+            if (psStack[uDepth - 1]->uEvent < 32) {
+                assert(psStack[uDepth - 1]->uEvent == FT_OPEN ||
+                       (psBegin->uAux >= 32 && psBegin->uAux <= 38));
+            }
+            if (psBegin->uAux == 25) {
+                assert(psStack[uDepth - 1]->uEvent == TR_EV_DISK_WRITE);
+                assert((psStack[uDepth - 1]->uAux & 0xFF) > 1);
+                uMulti++;
+            }
+            break;
+        case TR_EV_WAIT_READY:
+            assert(psEv->uAux == 0xFF);
+            break;
+        case FT_OPEN:
+        case FT_WRITE:
+        case FT_CLOSE:
+            assert(!uDepth && psEv->uAux == FR_OK);
+            break;
+        default:
+            assert(0);
+        }
+    }
+    assert(!uDepth && uMulti >= 4);
+    assert(uWrites >= 4 * sizeof(pui8Buf) / 512);
+
+    /* Only the API calls; an error is the result of the end */
+    tr_Clear();
+    tr_Enable(TR_FS);
+    assert(f_open(&sFil, "NOFILE", FA_READ) == FR_NO_FILE);
+    assert(f_open(&sFil, "A.BIN", FA_READ) == FR_OK);
+    dump();
+    assert(g_uEvents == 4);
+    assert(g_psEvents[0].uEvent == FT_OPEN);
+    assert(g_psEvents[1].uEvent == (FT_OPEN | TR_END));
+    assert(g_psEvents[1].uAux == FR_NO_FILE);
+    assert(g_psEvents[3].uAux == FR_OK);
+
+    /* Off: nothing more */
+    tr_Enable(0);
+    assert(f_close(&sFil) == FR_OK);
+    sim_mclk = 48000000;
+    tr_ClockChanged();
+    dump();
+    assert(g_uEvents == 4);
+
+    /* A wait of 200ms for a busy card, sleeping between the polls */
+    sim_cards[0].busy_single = 200000 / SIM_US_PER_BYTE;
+    memset(pui8Buf, 0x55, 512);
+    assert(disk_write(0, pui8Buf, 1000, 1) == RES_OK);
+    tr_Clear();
+    tr_Enable(TR_WAIT);
+    ulSleeps = sim_nsleep;
+    ui64Start = tb_Now();
+    assert(disk_ioctl(0, CTRL_SYNC, 0) == RES_OK);
+    ui32Us = (uint32_t)(tb_Now() - ui64Start);
+    tr_Enable(0);
+    dump();
+    assert(sim_nsleep - ulSleeps > 10);
+    assert(g_uEvents == 2 && g_psEvents[0].uEvent == TR_EV_WAIT_READY);
+    assert(g_psEvents[1].uEvent == (TR_EV_WAIT_READY | TR_END));
+    assert(g_psEvents[1].uAux == 0xFF);
+    assert(g_psEvents[1].ui32Time - g_psEvents[0].ui32Time > 190000);
+    assert(g_psEvents[1].ui32Time - g_psEvents[0].ui32Time <= ui32Us);
+    sim_cards[0].busy_single = 200;
+
+    /* The ring keeps the latest events */
+    tr_Clear();
+    for (i = 0; i < RECORDS + 44; i++) tr_Record(TR_EV_DISK_READ, i, i * 3);
+    dump();
+    assert(g_uEvents == RECORDS && g_uLost == 44);
+    for (i = 0; i < RECORDS; i++) {
+        assert(g_psEvents[i].uAux == 44 + i);
+        assert(g_psEvents[i].ui32Arg == (44 + i) * 3);
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * test_ymodem.c - receiving a file with YMODEM (ymodem.c)
+ *
+ * A sender in the test answers what ym_Receive() puts on the UART: the
+ * header block, one data block, EOT twice and the header that ends the
+ * batch. A file comes in under the name of the sender, or under the path
+ * given. A name with a drive or a directory in it, or one that does not
+ * end within the header block, is refused and the transfer cancelled.
+ *
+ * sdsim: src ymodem.c
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "ymodem.h"
+#include "timebase.h"
+
+#define SOH     0x01
+#define EOT     0x04
+#define ACK     0x06
+#define NAK     0x15
+#define CAN     0x18
+
+//*****************************************************************************
+//
+// The sender, on the other end of the UART
+//
+//*****************************************************************************
+static uint8_t g_pui8Header[128];       /* Data of the header block */
+static uint8_t g_pui8Data[128];         /* Data of the one data block */
+static enum { HEADER, DATA, EOT1, EOT2, END, DONE } g_eState;
+static int g_iCans;
+static uint8_t g_pui8Line[1024];        /* Bytes on the way to the receiver */
+static int g_iLine;
+static tTimer *g_psTimer;
+
+static void
+queue_block(uint8_t ui8Num, const uint8_t *pui8Data)
+{
+    uint16_t ui16Crc = 0;
+    int i, b;
+
+    g_pui8Line[g_iLine++] = SOH;
+    g_pui8Line[g_iLine++] = ui8Num;
+    g_pui8Line[g_iLine++] = ~ui8Num;
+    for (i = 0; i < 128; i++) {
+        g_pui8Line[g_iLine++] = pui8Data[i];
+        ui16Crc ^= (uint16_t)pui8Data[i] << 8;
+        for (b = 0; b < 8; b++)
+            ui16Crc = (ui16Crc & 0x8000) ? (ui16Crc << 1) ^ 0x1021 : ui16Crc << 1;
+    }
+    g_pui8Line[g_iLine++] = ui16Crc >> 8;
+    g_pui8Line[g_iLine++] = ui16Crc;
+}
+
+/* A byte from the receiver */
+void
+UART_transmitData(uint32_t module, uint_fast8_t b)
+{
+    static const uint8_t pui8End[128];
+
+    if (b == CAN) {
+        g_iCans++;
+        g_eState = DONE;
+        return;
+    }
+    switch (g_eState) {
+    case HEADER:
+        if (b == 'C') queue_block(0, g_pui8Header);
+        else if (b == ACK) g_eState = DATA;
+        break;
+    case DATA:
+        if (b == 'C') queue_block(1, g_pui8Data);
+        else if (b == ACK) {
+            g_pui8Line[g_iLine++] = EOT;
+            g_eState = EOT1;
+        }
+        break;
+    case EOT1:
+        assert(b == NAK);
+        g_pui8Line[g_iLine++] = EOT;
+        g_eState = EOT2;
+        break;
+    case EOT2:
+        assert(b == ACK);
+        g_eState = END;
+        break;
+    case END:
+        if (b == 'C') queue_block(0, pui8End);
+        else if (b == ACK) g_eState = DONE;
+        break;
+    case DONE:
+        break;
+    }
+}
+
+void
+tb_TimerStart(tTimer *psTimer, uint32_t ui32Us,
+              void (*pfnCallback)(tTimer *psTimer))
+{
+    psTimer->ui64Deadline = tb_Now() + ui32Us;
+    psTimer->pfnCallback = pfnCallback;
+    psTimer->bPending = true;
+    g_psTimer = psTimer;
+}
+
+void
+tb_TimerStop(tTimer *psTimer)
+{
+    psTimer->bPending = false;
+}
+
+/* The receiver waits: the bytes on the line arrive, or else its timer */
+bool
+PCM_gotoLPM0(void)
+{
+    int i;
+
+    if (g_iLine) {
+        for (i = 0; i < g_iLine; i++) ym_RxByte(g_pui8Line[i]);
+        g_iLine = 0;
+        return true;
+    }
+    while (!tb_Expired(g_psTimer->ui64Deadline)) sim_idle(100);
+    g_psTimer->bPending = false;
+    g_psTimer->pfnCallback(g_psTimer);
+    return true;
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+static FATFS g_sFs;
+static FIL g_sFil;
+
+/* Offer a file with a header of n bytes and receive it into pcPath */
+static FRESULT
+receive(const char *pcName, size_t n, char *pcPath, uint32_t *pui32Bytes)
+{
+    memset(g_pui8Header, 0, sizeof(g_pui8Header));
+    memcpy(g_pui8Header, pcName, n);
+    g_eState = HEADER;
+    g_iCans = 0;
+    g_iLine = 0;
+    return ym_Receive(&g_sFil, pcPath, 64, pui32Bytes);
+}
+
+static void
+refused(const char *pcName, size_t n)
+{
+    char pcPath[64] = "/";
+    uint32_t ui32Bytes;
+    DIR sDir;
+    FILINFO sInfo;
+
+    assert(receive(pcName, n, pcPath, &ui32Bytes) == FR_INVALID_NAME);
+    assert(g_iCans == 2 && !ym_Busy());
+    assert(f_opendir(&sDir, "/") == FR_OK);
+    while (f_readdir(&sDir, &sInfo) == FR_OK && sInfo.fname[0]) {
+        assert(!strcmp(sInfo.fname, "A.TXT") || !strcmp(sInfo.fname, "B.TXT"));
+    }
+}
+
+int
+main(void)
+{
+    char pcPath[64];
+    uint8_t pui8Buf[128];
+    uint32_t ui32Bytes;
+    UINT br;
+    int i;
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 8192, 20, 200);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 1024) == FR_OK);
+    for (i = 0; i < 128; i++) g_pui8Data[i] = i * 7;
+
+    /* Under the name of the sender, 100 bytes of the 128 of the block */
+    strcpy(pcPath, "/");
+    assert(receive("A.TXT\0" "100 0 0", 14, pcPath, &ui32Bytes) == FR_OK);
+    assert(ui32Bytes == 100 && !strcmp(pcPath, "/A.TXT") && !g_iCans);
+    assert(f_open(&g_sFil, "A.TXT", FA_READ) == FR_OK);
+    assert(f_read(&g_sFil, pui8Buf, 128, &br) == FR_OK && br == 100);
+    assert(!memcmp(pui8Buf, g_pui8Data, 100));
+    assert(f_close(&g_sFil) == FR_OK);
+
+    /* Under the path given, whatever the sender calls it */
+    strcpy(pcPath, "B.TXT");
+    assert(receive("../X.TXT\0" "5", 10, pcPath, &ui32Bytes) == FR_OK);
+    assert(ui32Bytes == 5 && !strcmp(pcPath, "B.TXT"));
+
+    /* Names that would leave the directory */
+    refused("../X.TXT\0" "5", 10);
+    refused("SUB/X.TXT\0" "5", 11);
+    refused("SUB\\X.TXT\0" "5", 11);
+    refused("1:X.TXT\0" "5", 9);
+    refused("..\0" "5", 4);
+
+    /* A name that does not end in the block */
+    memset(pui8Buf, 'N', sizeof(pui8Buf));
+    refused((const char *)pui8Buf, 128);
+    return 0;
+}
@@ -0,0 +1,309 @@
+/*
+ * test_ymodem_pty.c - YMODEM against tools/ymodem.py on a pseudo-terminal
+ *                     (ymodem.c)
+ *
+ * The console UART is the master side of a pseudo-terminal and ymodem.py
+ * runs on the slave side, as it would on the serial port of the board. A
+ * file of 1K blocks is put onto the card with ym_Receive(), and files of 1K
+ * and of 128-byte blocks are got from it with ym_Send(). On the way, one
+ * data block in each direction has a byte changed, which the receiver
+ * asks for again, and one ACK in each direction is lost, after which the
+ * receiver asks again and is sent the block it already has. The files come
+ * through whole. Time on the board runs five times faster, so its waits are
+ * short, and the transfers do not depend on the timeouts of ymodem.py.
+ *
+ * sdsim: src ymodem.c
+ * sdsim: set _USE_STAGE 0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include "sdsim.h"
+#include "driverlib.h"
+#include "ff.h"
+#include "diskio.h"
+#include "ymodem.h"
+#include "timebase.h"
+
+#define SOH     0x01
+#define STX     0x02
+#define ACK     0x06
+
+#define SPEEDUP 5                       /* Board time against real time */
+
+//*****************************************************************************
+//
+// The line, with the faults put on it
+//
+//*****************************************************************************
+typedef struct {
+    int iCorrupt;                       /* Block number to change a byte of */
+    int iDropAck;                       /* ACK to lose, counting from 1 */
+    int iLeft;                          /* Bytes of the block under way */
+    int iPos, iNum;
+    int iAcks, iCorrupted, iDropped;
+} tLine;
+
+static tLine g_sToHost, g_sToBoard;
+static int g_iMaster = -1;
+static tTimer *g_psTimer;
+
+/* The byte as it comes out of the line, or -1 if it is lost */
+static int
+line(tLine *psLine, uint8_t ui8Byte)
+{
+    if (psLine->iLeft) {
+        psLine->iLeft--;
+        psLine->iPos++;
+        if (psLine->iPos == 2) psLine->iNum = ui8Byte;
+        if (psLine->iPos == 10 && psLine->iNum == psLine->iCorrupt &&
+            !psLine->iCorrupted) {
+            psLine->iCorrupted++;
+            return ui8Byte ^ 0x40;
+        }
+        return ui8Byte;
+    }
+    if (ui8Byte == SOH || ui8Byte == STX) {
+        psLine->iLeft = (ui8Byte == STX ? 1024 : 128) + 4;
+        psLine->iPos = 1;
+    } else if (ui8Byte == ACK && ++psLine->iAcks == psLine->iDropAck) {
+        psLine->iDropped++;
+        return -1;
+    }
+    return ui8Byte;
+}
+
+static uint64_t
+real_us(void)
+{
+    struct timespec sTs;
+
+    clock_gettime(CLOCK_MONOTONIC, &sTs);
+    return (uint64_t)sTs.tv_sec * 1000000 + sTs.tv_nsec / 1000;
+}
+
+/* A byte from the board */
+void
+UART_transmitData(uint32_t module, uint_fast8_t b)
+{
+    int iByte = line(&g_sToHost, b);
+    uint8_t ui8Byte = iByte;
+
+    if (iByte >= 0) assert(write(g_iMaster, &ui8Byte, 1) == 1);
+}
+
+void
+tb_TimerStart(tTimer *psTimer, uint32_t ui32Us,
+              void (*pfnCallback)(tTimer *psTimer))
+{
+    psTimer->ui64Deadline = real_us() + ui32Us / SPEEDUP;
+    psTimer->pfnCallback = pfnCallback;
+    psTimer->bPending = true;
+    g_psTimer = psTimer;
+}
+
+void
+tb_TimerStop(tTimer *psTimer)
+{
+    psTimer->bPending = false;
+}
+
+/* The board waits: bytes from the host come in, no more than its receive
+ * buffer has room for, or else its timer runs out */
+bool
+PCM_gotoLPM0(void)
+{
+    struct pollfd sPoll = { g_iMaster, POLLIN, 0 };
+    uint8_t pui8Buf[64];
+    uint64_t ui64Now = real_us();
+    int i, n = 0, iByte;
+
+    if (ui64Now < g_psTimer->ui64Deadline &&
+        poll(&sPoll, 1, (g_psTimer->ui64Deadline - ui64Now) / 1000 + 1) > 0)
+        n = read(g_iMaster, pui8Buf, sizeof(pui8Buf));
+    for (i = 0; i < n; i++) {
+        iByte = line(&g_sToBoard, pui8Buf[i]);
+        if (iByte >= 0) ym_RxByte(iByte);
+    }
+    if (n <= 0 && real_us() >= g_psTimer->ui64Deadline) {
+        g_psTimer->bPending = false;
+        g_psTimer->pfnCallback(g_psTimer);
+    }
+    return true;
+}
+
+//*****************************************************************************
+//
+// Helpers
+//
+//*****************************************************************************
+static FATFS g_sFs;
+static FIL g_sFil;
+static char g_pcSlave[64];
+static char g_pcClient[256];
+static uint8_t g_pui8Data[8192], g_pui8Got[8192];
+
+/* Run ymodem.py get or put on the slave side */
+static pid_t
+client(const char *pcCommand, const char *pcFile, const char *pcOther)
+{
+    pid_t iPid = fork();
+
+    assert(iPid >= 0);
+    if (!iPid) {
+        execlp("python3", "python3", g_pcClient, "-n", g_pcSlave, pcCommand,
+               pcFile, pcOther, (char *)0);
+        _exit(127);
+    }
+    return iPid;
+}
+
+static int
+client_status(pid_t iPid)
+{
+    int iStatus;
+
+    assert(waitpid(iPid, &iStatus, 0) == iPid);
+    return WIFEXITED(iStatus) ? WEXITSTATUS(iStatus) : -1;
+}
+
+static void
+faults(int iToBoardBlock, int iToBoardAck, int iToHostBlock, int iToHostAck)
+{
+    memset(&g_sToBoard, 0, sizeof(g_sToBoard));
+    memset(&g_sToHost, 0, sizeof(g_sToHost));
+    g_sToBoard.iCorrupt = iToBoardBlock;
+    g_sToBoard.iDropAck = iToBoardAck;
+    g_sToHost.iCorrupt = iToHostBlock;
+    g_sToHost.iDropAck = iToHostAck;
+}
+
+static void
+make_host_file(const char *pcName, uint32_t ui32Size)
+{
+    FILE *psFile = fopen(pcName, "wb");
+
+    assert(psFile && fwrite(g_pui8Data, 1, ui32Size, psFile) == ui32Size);
+    fclose(psFile);
+}
+
+static void
+make_card_file(const char *pcName, uint32_t ui32Size)
+{
+    UINT bw;
+
+    assert(f_open(&g_sFil, pcName, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+    assert(f_write(&g_sFil, g_pui8Data, ui32Size, &bw) == FR_OK &&
+           bw == ui32Size);
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+static void
+check_host_file(const char *pcName, uint32_t ui32Size)
+{
+    FILE *psFile = fopen(pcName, "rb");
+
+    assert(psFile);
+    assert(fread(g_pui8Got, 1, sizeof(g_pui8Got), psFile) == ui32Size);
+    assert(!memcmp(g_pui8Got, g_pui8Data, ui32Size));
+    fclose(psFile);
+}
+
+static void
+check_card_file(const char *pcName, uint32_t ui32Size)
+{
+    UINT br;
+
+    assert(f_open(&g_sFil, pcName, FA_READ) == FR_OK);
+    assert(f_read(&g_sFil, g_pui8Got, sizeof(g_pui8Got), &br) == FR_OK &&
+           br == ui32Size);
+    assert(!memcmp(g_pui8Got, g_pui8Data, ui32Size));
+    assert(f_close(&g_sFil) == FR_OK);
+}
+
+//*****************************************************************************
+//
+// The tests
+//
+//*****************************************************************************
+int
+main(void)
+{
+    struct termios sTerm;
+    char pcPath[64];
+    uint32_t ui32Bytes;
+    uint64_t ui64Start;
+    pid_t iPid;
+    int iSlave, iPty, iUnlock = 0, i;
+
+    /* ymodem.py next to this file's directory */
+    strcpy(g_pcClient, __FILE__);
+    *strrchr(g_pcClient, '/') = 0;
+    strcpy(strrchr(g_pcClient, '/'), "/ymodem.py");
+
+    /* A raw pseudo-terminal, its slave kept open across the clients */
+    g_iMaster = open("/dev/ptmx", O_RDWR | O_NOCTTY);
+    assert(g_iMaster >= 0 && !ioctl(g_iMaster, TIOCSPTLCK, &iUnlock) &&
+           !ioctl(g_iMaster, TIOCGPTN, &iPty));
+    sprintf(g_pcSlave, "/dev/pts/%d", iPty);
+    iSlave = open(g_pcSlave, O_RDWR | O_NOCTTY);
+    assert(iSlave >= 0 && !tcgetattr(iSlave, &sTerm));
+    cfmakeraw(&sTerm);
+    assert(!tcsetattr(iSlave, TCSANOW, &sTerm));
+
+    sim_init(0, GPIO_PORT_P4, GPIO_PIN6, 65536, 20, 200);
+    assert(disk_initialize(0) == 0);
+    f_mount(0, &g_sFs);
+    assert(f_mkfs(0, 0, 1024) == FR_OK);
+    for (i = 0; i < (int)sizeof(g_pui8Data); i++)
+        g_pui8Data[i] = (uint8_t)(i * 7 + i / 251);
+
+    /* put: 1K blocks onto the card. Block 2 comes damaged, and the ACK of
+     * block 3 is lost: the header and blocks 1 to 3 are ACKs 1 to 4. */
+    make_host_file("put.bin", 5000);
+    faults(2, 0, 0, 4);
+    ui64Start = real_us();
+    iPid = client("put", "put.bin", "P.BIN");
+    strcpy(pcPath, "/");
+    assert(ym_Receive(&g_sFil, pcPath, sizeof(pcPath), &ui32Bytes) == FR_OK);
+    assert(!client_status(iPid));
+    assert(ui32Bytes == 5000 && !strcmp(pcPath, "/P.BIN"));
+    assert(g_sToBoard.iCorrupted == 1 && g_sToHost.iDropped == 1);
+    check_card_file("P.BIN", 5000);
+    printf("  put 5000 bytes in %.1f s\n", (real_us() - ui64Start) * 1e-6);
+
+    /* get: 1K blocks off the card. Block 1 comes damaged, and the ACK of
+     * block 2 is lost: the header and blocks 1 and 2 are ACKs 1 to 3. */
+    make_card_file("G.BIN", 2500);
+    faults(0, 3, 1, 0);
+    ui64Start = real_us();
+    iPid = client("get", "G.BIN", "get.bin");
+    assert(ym_Send(&g_sFil, "/G.BIN", &ui32Bytes) == FR_OK);
+    assert(!client_status(iPid));
+    assert(ui32Bytes == 2500);
+    assert(g_sToHost.iCorrupted == 1 && g_sToBoard.iDropped == 1);
+    check_host_file("get.bin", 2500);
+    printf("  got 2500 bytes in %.1f s\n", (real_us() - ui64Start) * 1e-6);
+
+    /* get: a file of one 128-byte block, under its own name */
+    make_card_file("S.TXT", 100);
+    faults(0, 0, 0, 0);
+    iPid = client("get", "/S.TXT", ".");
+    assert(ym_Send(&g_sFil, "/S.TXT", &ui32Bytes) == FR_OK);
+    assert(!client_status(iPid));
+    assert(ui32Bytes == 100);
+    check_host_file("S.TXT", 100);
+
+    close(iSlave);
+    close(g_iMaster);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Chrome trace from the trace command of the SD card example.
+
+    trace2json.py [-o OUT] DUMP             convert a saved dump
+    trace2json.py [-o OUT] [-b BAUD] -p PORT   fetch it with "trace dump"
+
+DUMP is a capture of the console with the output of "trace dump" in it; the
+last one is used, and "-" reads standard input. The JSON goes to OUT or to
+standard output, and loads into chrome://tracing or ui.perfetto.dev. Time
+starts at the oldest event kept in the ring. Ends of calls that began before
+it are dropped. Needs only the standard library.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+HEADER = re.compile(r"trace us (\d+) events (\d+) lost")
+
+# Event numbers, as in trace.h; 1 to 31 are FT_x in ff.h
+EV_CLOCK, EV_DISK_READ, EV_DISK_WRITE, EV_SEND_CMD, EV_WAIT_READY = 0, 32, 33, 34, 35
+END = 0x80
+
+FS_CALLS = ("f_mount f_open f_read f_lseek f_close f_opendir f_readdir "
+            "f_readdirs f_stat f_write f_getfree f_truncate f_sync f_unlink "
+            "f_mkdir f_chmod f_utime f_rename f_chdrive f_chdir f_getcwd "
+            "f_getlabel f_setlabel f_forward f_mkfs f_fdisk f_defrag").split()
+
+FRESULTS = ("FR_OK FR_DISK_ERR FR_INT_ERR FR_NOT_READY FR_NO_FILE FR_NO_PATH "
+            "FR_INVALID_NAME FR_DENIED FR_EXIST FR_INVALID_OBJECT "
+            "FR_WRITE_PROTECTED FR_INVALID_DRIVE FR_NOT_ENABLED "
+            "FR_NO_FILESYSTEM FR_MKFS_ABORTED FR_TIMEOUT FR_LOCKED "
+            "FR_NOT_ENOUGH_CORE FR_TOO_MANY_OPEN_FILES FR_INVALID_PARAMETER "
+            "FR_IN_PROGRESS").split()
+
+DRESULTS = "RES_OK RES_ERROR RES_WRPRT RES_NOTRDY RES_PARERR".split()
+
+
+def parse(text):
+    """(lost, [(time, event, aux, arg)]) of the last complete dump"""
+    result = records = None
+    for line in text.splitlines():
+        m = HEADER.search(line)
+        if m:
+            lost, records = int(m.group(2)), []
+        elif line.split() == ["trace", "end"] and records is not None:
+            result, records = (lost, records), None
+        elif records is not None:
+            f = line.split()
+            if len(f) == 4:
+                records.append(tuple(int(x, 16) for x in f))
+    if result is None:
+        raise ValueError("no complete trace dump found")
+    return result
+
+
+def name_of(ev):
+    if 1 <= ev <= len(FS_CALLS):
+        return FS_CALLS[ev - 1], "fs"
+    return {EV_DISK_READ: ("disk_read", "disk"),
+            EV_DISK_WRITE: ("disk_write", "disk"),
+            EV_SEND_CMD: ("send_cmd", "cmd"),
+            EV_WAIT_READY: ("wait_ready", "wait")}.get(ev, ("event %d" % ev, "?"))
+
+
+def table(names, n):
+    return names[n] if n < len(names) else n
+
+
+def begin_args(ev, aux, arg):
+    if ev in (EV_DISK_READ, EV_DISK_WRITE):
+        return {"drive": aux >> 8, "sector": arg, "count": aux & 0xFF}
+    if ev == EV_SEND_CMD:
+        return {"cmd": "CMD%d" % aux, "arg": "0x%08x" % arg}
+    return {}
+
+
+def end_args(ev, aux):
+    if 1 <= ev <= len(FS_CALLS):
+        return {"result": table(FRESULTS, aux)}
+    if ev in (EV_DISK_READ, EV_DISK_WRITE):
+        return {"result": table(DRESULTS, aux)}
+    return {"response": "0x%02x" % aux}
+
+
+def convert(records):
+    """Chrome trace events of the records, time stamped in microseconds"""
+    events, stack = [], []
+    us, last = 0, None
+    for time, ev, aux, arg in records:
+        if last is not None:
+            us += (time - last) & 0xFFFFFFFF
+        last = time
+        common = {"pid": 1, "tid": 1, "ts": us}
+
+        if ev == EV_CLOCK:
+            events.append(dict(common, name="clock", ph="i", s="g",
+                               args={"from_kHz": aux, "to_kHz": arg}))
+        elif ev & END:
+            ev &= ~END
+            if ev not in stack:
+                continue                        # Began before the ring
+            while stack.pop() != ev:
+                pass
+            events.append(dict(common, ph="E", args=end_args(ev, aux)))
+        else:
+            name, cat = name_of(ev)
+            stack.append(ev)
+            events.append(dict(common, name=name, cat=cat, ph="B",
+                               args=begin_args(ev, aux, arg)))
+    return events
+
+
+def fetch(port_path, baud):
+    from ymodem import Cancelled, Port
+    port = Port(port_path, baud)
+    port.write(b"trace dump\r")
+    try:
+        return port.wait_for(b"trace end", 30.0).decode("latin-1")
+    except Cancelled as e:
+        raise ValueError(str(e))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-b", "--baud", type=int, default=115200)
+    ap.add_argument("-p", "--port", help="read the dump from the board")
+    ap.add_argument("-o", "--output", help="JSON file to write")
+    ap.add_argument("dump", nargs="?")
+    args = ap.parse_args()
+
+    try:
+        if args.port:
+            text = fetch(args.port, args.baud)
+        elif args.dump in (None, "-"):
+            text = sys.stdin.read()
+        else:
+            with open(args.dump, encoding="latin-1") as f:
+                text = f.read()
+        lost, records = parse(text)
+        trace = {"traceEvents": convert(records),
+                 "displayTimeUnit": "ms",
+                 "otherData": {"events": len(records), "lost": lost}}
+        if args.output:
+            with open(args.output, "w") as f:
+                json.dump(trace, f)
+        else:
+            json.dump(trace, sys.stdout)
+    except (ValueError, OSError) as e:
+        sys.stderr.write("%s\n" % e)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,270 @@
+#!/usr/bin/env python3
+"""YMODEM client for the get and put commands of the SD card example.
+
+    ymodem.py [-b BAUD] PORT get NAME [LOCAL]   copy NAME off the card
+    ymodem.py [-b BAUD] PORT put LOCAL [NAME]   copy LOCAL onto the card
+
+The command is typed on the console first, unless -n is given because it
+was already entered in a terminal program. Needs only the standard library,
+and works on any tty, a pseudo-terminal included.
+"""
+
+import argparse
+import os
+import select
+import sys
+import termios
+import time
+
+SOH, STX, EOT, ACK, NAK, CAN, CRC_REQ, CPMEOF = 1, 2, 4, 6, 0x15, 0x18, 67, 0x1A
+RETRIES = 10
+
+
+class Cancelled(Exception):
+    pass
+
+
+def crc16(data):
+    crc = 0
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xFFFF
+    return crc
+
+
+class Port:
+    def __init__(self, path, baud):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        attr = termios.tcgetattr(self.fd)
+        attr[0] = attr[1] = attr[3] = 0                 # raw in, out, local
+        attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        speed = getattr(termios, "B%d" % baud)
+        attr[4] = attr[5] = speed
+        attr[6][termios.VMIN] = 0
+        attr[6][termios.VTIME] = 0
+        termios.tcsetattr(self.fd, termios.TCSANOW, attr)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+        self.pending = b""
+
+    def write(self, data):
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+
+    def read(self, n, timeout):
+        """Up to n bytes, fewer if the timeout passes first"""
+        end = time.monotonic() + timeout
+        while len(self.pending) < n:
+            left = end - time.monotonic()
+            if left <= 0 or not select.select([self.fd], [], [], left)[0]:
+                break
+            self.pending += os.read(self.fd, 4096)
+        data, self.pending = self.pending[:n], self.pending[n:]
+        return data
+
+    def getc(self, timeout):
+        data = self.read(1, timeout)
+        return data[0] if data else None
+
+    def purge(self, quiet=0.2):
+        while self.read(4096, quiet):
+            pass
+
+    def cancel(self):
+        self.write(bytes([CAN, CAN]))
+        raise Cancelled("transfer cancelled")
+
+    def wait_for(self, text, timeout):
+        """Read up to and including text, and return what was read"""
+        seen = b""
+        end = time.monotonic() + timeout
+        while text not in seen:
+            c = self.read(1, max(0, end - time.monotonic()))
+            if not c:
+                raise Cancelled("no %r from the board" % text)
+            seen += c
+        return seen
+
+
+def recv_block(port, first):
+    """Rest of a block that starts with SOH or STX: (number, data) or None"""
+    size = 1024 if first == STX else 128
+    body = port.read(size + 4, 1.0)
+    if len(body) != size + 4 or body[0] ^ body[1] != 0xFF:
+        return None
+    data = body[2:2 + size]
+    if crc16(data) != (body[-2] << 8 | body[-1]):
+        return None
+    return body[0], data
+
+
+def request_block(port, req, timeout=10.0):
+    """Send req until a good block or EOT comes: (type, number, data)"""
+    for _ in range(RETRIES):
+        port.write(bytes([req]))
+        c = port.getc(timeout)
+        if c == EOT:
+            return EOT, None, None
+        if c == CAN and port.getc(1.0) == CAN:
+            raise Cancelled("cancelled by the board")
+        if c in (SOH, STX):
+            block = recv_block(port, c)
+            if block:
+                return (c,) + block
+        if c is not None:
+            port.purge()
+        if req == ACK:
+            req = NAK
+    port.cancel()
+
+
+def receive(port, local):
+    """Receive one file into local, or under its own name if local is a
+    directory or None. Returns (path, size)."""
+    kind, num, data = request_block(port, CRC_REQ, 3.0)
+    if kind == EOT or num != 0:
+        port.cancel()
+    name, _, rest = data.partition(b"\0")
+    if not name:
+        port.write(bytes([ACK]))
+        raise Cancelled("the board sent no file")
+    fields = rest.split(b"\0")[0].split()
+    size = int(fields[0]) if fields else None
+    name = os.path.basename(name.decode("latin-1"))
+    if local is None:
+        local = name
+    elif os.path.isdir(local):
+        local = os.path.join(local, name)
+
+    got = 0
+    with open(local, "wb") as f:
+        port.write(bytes([ACK]))
+        req, expect, eot = CRC_REQ, 1, False
+        while True:
+            kind, num, data = request_block(port, req)
+            if kind == EOT:
+                if eot:
+                    break
+                eot, req = True, NAK
+                continue
+            eot = False
+            if num == (expect - 1) & 0xFF:           # Our ACK was lost
+                if expect == 1:
+                    port.write(bytes([ACK]))
+                req = CRC_REQ if expect == 1 else ACK
+                continue
+            if num != expect & 0xFF:
+                port.cancel()
+            if size is not None:
+                data = data[:max(0, size - got)]
+            f.write(data)
+            got += len(data)
+            expect += 1
+            req = ACK
+            progress(got, size)
+    for _ in range(RETRIES):                        # EOT again: ACK lost
+        port.write(bytes([ACK]))
+        kind, num, data = request_block(port, CRC_REQ)
+        if kind != EOT:
+            port.write(bytes([ACK]))
+            break
+    return local, got
+
+
+def send_block(port, num, data):
+    size = 128 if len(data) <= 128 else 1024
+    data = data.ljust(size, bytes([0 if num == 0 else CPMEOF]))
+    crc = crc16(data)
+    block = bytes([STX if size == 1024 else SOH, num & 0xFF, ~num & 0xFF])
+    block += data + bytes([crc >> 8, crc & 0xFF])
+    for _ in range(RETRIES):
+        port.write(block)
+        while True:
+            c = port.getc(10.0)
+            if c == ACK:
+                return
+            if c == CAN and port.getc(1.0) == CAN:
+                raise Cancelled("cancelled by the board")
+            if c in (None, NAK, CRC_REQ):
+                break
+    port.cancel()
+
+
+def wait_request(port, timeout=60.0):
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        c = port.getc(1.0)
+        if c == CRC_REQ:
+            return
+        if c == CAN and port.getc(1.0) == CAN:
+            raise Cancelled("cancelled by the board")
+    port.cancel()
+
+
+def send(port, local, name):
+    """Send local under name. Returns the size."""
+    with open(local, "rb") as f:
+        data = f.read()
+    wait_request(port)
+    send_block(port, 0, name.encode("latin-1") + b"\0" + b"%d" % len(data))
+    wait_request(port)
+    for num, ofs in enumerate(range(0, len(data), 1024), 1):
+        send_block(port, num, data[ofs:ofs + 1024])
+        progress(min(ofs + 1024, len(data)), len(data))
+    for _ in range(RETRIES):
+        port.write(bytes([EOT]))
+        if port.getc(10.0) == ACK:
+            break
+    else:
+        port.cancel()
+    wait_request(port)
+    send_block(port, 0, b"")
+    return len(data)
+
+
+def progress(done, size):
+    if sys.stderr.isatty():
+        total = "/%d" % size if size is not None else ""
+        sys.stderr.write("\r%d%s bytes" % (done, total))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("-b", "--baud", type=int, default=115200)
+    ap.add_argument("-n", "--no-command", action="store_true",
+                    help="the get or put command was already typed")
+    ap.add_argument("port")
+    ap.add_argument("command", choices=("get", "put"))
+    ap.add_argument("file")
+    ap.add_argument("other", nargs="?")
+    args = ap.parse_args()
+
+    port = Port(args.port, args.baud)
+    start = time.monotonic()
+    try:
+        if args.command == "get":
+            if not args.no_command:
+                port.write(b"get %s\r" % args.file.encode("latin-1"))
+                port.wait_for(b"YMODEM", 5.0)
+            path, size = receive(port, args.other)
+        else:
+            name = args.other or os.path.basename(args.file)
+            if not args.no_command:
+                port.write(b"put %s\r" % name.encode("latin-1"))
+                port.wait_for(b"YMODEM", 5.0)
+            path, size = args.file, send(port, args.file, name)
+    except Cancelled as e:
+        sys.stderr.write("\n%s\n" % e)
+        return 1
+
+    secs = time.monotonic() - start
+    sys.stderr.write("\n%s: %d bytes in %.1f s, %.0f bytes/s\n"
+                     % (path, size, secs, size / secs if secs else 0))
+    if not args.no_command:
+        port.wait_for(b">", 5.0)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
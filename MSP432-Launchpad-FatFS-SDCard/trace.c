@@ -0,0 +1,105 @@
+/*
+ * trace.c - event trace ring
+ *
+ * Time stamps are the low 32 bits of tb_Now(), in microseconds, and wrap
+ * every 71 minutes. They go on while the CPU sleeps in LPM0 waiting for a
+ * busy card, which the DWT cycle counter does not, and do not depend on
+ * the MCLK frequency. A gap of more than one wrap between two events cannot
+ * be told from a short one.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "driverlib.h"
+#include "fatfs/src/ff.h"
+#include "timebase.h"
+#include "trace.h"
+
+/* Number of events kept, a power of 2 */
+#define TR_RECORDS              256
+
+typedef struct {
+    uint32_t ui32Time;          /* tb_Now() */
+    uint32_t ui32Arg;
+    uint16_t ui16Aux;
+    uint8_t ui8Event;           /* TR_EV_x or FT_x, with TR_END */
+} tTraceRecord;
+
+uint8_t g_ui8TraceMask;
+
+static tTraceRecord g_psRing[TR_RECORDS];
+static uint32_t g_ui32Next;             /* Events recorded since tr_Clear() */
+static uint32_t g_ui32Khz;              /* MCLK in kHz */
+
+void
+tr_Init(void)
+{
+    g_ui32Khz = CS_getMCLK() / 1000;
+}
+
+void
+tr_Enable(uint8_t ui8Mask)
+{
+    g_ui8TraceMask = ui8Mask;
+}
+
+void
+tr_Clear(void)
+{
+    g_ui32Next = 0;
+}
+
+void
+tr_Record(uint_fast8_t ui8Event, uint_fast16_t ui16Aux, uint32_t ui32Arg)
+{
+    tTraceRecord *psRec = &g_psRing[g_ui32Next++ & (TR_RECORDS - 1)];
+
+    psRec->ui32Time = (uint32_t)tb_Now();
+    psRec->ui32Arg = ui32Arg;
+    psRec->ui16Aux = ui16Aux;
+    psRec->ui8Event = ui8Event;
+}
+
+void
+tr_ClockChanged(void)
+{
+    uint32_t ui32Khz = CS_getMCLK() / 1000;
+
+    if (g_ui8TraceMask && ui32Khz != g_ui32Khz)
+        tr_Record(TR_EV_CLOCK, g_ui32Khz, ui32Khz);
+    g_ui32Khz = ui32Khz;
+}
+
+void
+tr_Dump(void)
+{
+    uint32_t i, ui32First, ui32Next = g_ui32Next;
+    tTraceRecord *psRec;
+
+    ui32First = (ui32Next > TR_RECORDS) ? ui32Next - TR_RECORDS : 0;
+    printf("trace us %u events %u lost\r\n", ui32Next - ui32First,
+           ui32First);
+    for (i = ui32First; i != ui32Next; i++) {
+        psRec = &g_psRing[i & (TR_RECORDS - 1)];
+        printf("%08x %02x %04x %08x\r\n", psRec->ui32Time, psRec->ui8Event,
+               psRec->ui16Aux, psRec->ui32Arg);
+    }
+    printf("trace end\r\n");
+}
+
+#if _FS_TRACE
+/* Hooks of the FatFs API calls, see ff.h */
+void
+ff_trace_call(BYTE func)
+{
+    TR_BEGIN(TR_FS, func, 0, 0);
+}
+
+FRESULT
+ff_trace_return(BYTE func, FRESULT res)
+{
+    TR_FINISH(TR_FS, func, res);
+    return res;
+}
+#endif
@@ -0,0 +1,79 @@
+/*
+ * trace.h - event trace ring
+ *
+ * Begin and end events of the FatFs API calls, disk_read() and disk_write(),
+ * and of send_cmd() and wait_ready() in the SD card driver are recorded with
+ * a microsecond time stamp in a ring in RAM, which keeps the latest
+ * TR_RECORDS events. Each category of events is enabled on its own at run
+ * time. A disabled event costs a load and a branch, an enabled one a call,
+ * a read of the time base and a 12-byte store.
+ *
+ * tr_Dump() prints the ring, and tools/trace2json.py converts the output to
+ * the Chrome trace format for chrome://tracing or Perfetto.
+ *
+ * Events are recorded from the main loop only; interrupt handlers must not
+ * record.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Event categories for tr_Enable() */
+#define TR_FS                   0x01    /* FatFs API calls */
+#define TR_DISK                 0x02    /* disk_read() and disk_write() */
+#define TR_CMD                  0x04    /* Commands to the SD cards */
+#define TR_WAIT                 0x08    /* Waits for a busy card */
+#define TR_ALL                  0x0F
+
+/* Events. 1 to 31 are the FatFs API functions, numbered FT_x in ff.h. The
+ * end of an event has TR_END set. */
+#define TR_EV_CLOCK             0       /* MCLK changed, aux: old kHz, arg: new kHz */
+#define TR_EV_DISK_READ         32      /* aux: drive << 8 | count, arg: sector;
+                                           end aux: DRESULT */
+#define TR_EV_DISK_WRITE        33      /* as TR_EV_DISK_READ */
+#define TR_EV_SEND_CMD          34      /* aux: command index, arg: argument;
+                                           end aux: R1 response */
+#define TR_EV_WAIT_READY        35      /* end aux: last byte read, 0xFF if ready */
+#define TR_END                  0x80
+
+/* Enabled categories. Read by the macros below; set with tr_Enable(). */
+extern uint8_t g_ui8TraceMask;
+
+#define TR_BEGIN(cat, ev, aux, arg)                                           \
+    do { if (g_ui8TraceMask & (cat)) tr_Record((ev), (aux), (arg)); } while (0)
+#define TR_FINISH(cat, ev, aux)                                               \
+    do { if (g_ui8TraceMask & (cat)) tr_Record((ev) | TR_END, (aux), 0); } while (0)
+
+/* Set up the trace. The time stamps are taken from tb_Now(), so tb_Init()
+ * must have been called. Recording is off until tr_Enable(). */
+void tr_Init(void);
+
+/* Record the categories in ui8Mask (TR_x) from now on, and no others */
+void tr_Enable(uint8_t ui8Mask);
+
+/* Forget the events recorded so far */
+void tr_Clear(void);
+
+/* Record an event, see the macros above */
+void tr_Record(uint_fast8_t ui8Event, uint_fast16_t ui16Aux, uint32_t ui32Arg);
+
+/* Note a change of the MCLK frequency as an event. Called by
+ * clk_SetProfile(). */
+void tr_ClockChanged(void);
+
+/* Print the ring to stdout, oldest event first: a header line, one
+ * "TIME EVENT AUX ARG" line in hex for each event, and a trailer line */
+void tr_Dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TRACE_H__ */
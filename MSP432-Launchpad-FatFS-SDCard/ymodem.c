@@ -0,0 +1,454 @@
+/*
+ * ymodem.c - YMODEM file transfer over the console UART
+ *
+ * The receive interrupt queues bytes in a ring buffer while a transfer runs,
+ * and the transfer waits for them in LPM0. Data blocks are read from the
+ * file straight into the block buffer and sent from there, or received into
+ * it and written to the file from there. The CRC is worked out a byte at a
+ * time while the UART is busy with the byte before.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "driverlib.h"
+#include "ymodem.h"
+#include "timebase.h"
+
+/* Protocol characters */
+#define SOH                     0x01    /* 128-byte block */
+#define STX                     0x02    /* 1024-byte block */
+#define EOT                     0x04    /* End of file */
+#define ACK                     0x06
+#define NAK                     0x15
+#define CAN                     0x18    /* Two of them cancel the transfer */
+#define CRC_REQ                 'C'     /* Receiver asks for CRC-16 blocks */
+#define CPMEOF                  0x1A    /* Pads the last block */
+
+/* Waits, in microseconds */
+#define YM_BYTE_US              1000000 /* Between the bytes of a block */
+#define YM_REPLY_US             10000000 /* For the reply to a block */
+#define YM_START_US             3000000 /* Between requests for the header */
+#define YM_PURGE_US             200000  /* Quiet line that ends a purge */
+
+/* Tries before giving up */
+#define YM_START_TRIES          20      /* Header requests, one minute */
+#define YM_RETRIES              10      /* Sends or receives of a block */
+
+/* Receive ring buffer, a power of two */
+#define YM_RX_SIZE              256
+
+/* Block buffer: block type, number, its complement, data and CRC */
+#define YM_HDR                  3
+static uint8_t g_pui8Block[YM_HDR + 1024 + 2];
+
+static volatile uint8_t g_pui8Rx[YM_RX_SIZE];
+static volatile uint16_t g_ui16RxHead;  /* Written by the interrupt */
+static volatile uint16_t g_ui16RxTail;  /* Written by the transfer */
+static volatile bool g_bBusy;
+
+/* Add a byte to a CRC-16/XMODEM */
+static uint16_t
+crc16(uint16_t ui16Crc, uint8_t ui8Byte)
+{
+    uint_fast8_t i;
+
+    ui16Crc ^= (uint16_t)ui8Byte << 8;
+    for (i = 0; i < 8; i++)
+        ui16Crc = (ui16Crc & 0x8000) ? (ui16Crc << 1) ^ 0x1021 : ui16Crc << 1;
+    return ui16Crc;
+}
+
+bool
+ym_Busy(void)
+{
+    return g_bBusy;
+}
+
+void
+ym_RxByte(uint8_t ui8Byte)
+{
+    uint16_t ui16Next = (g_ui16RxHead + 1) & (YM_RX_SIZE - 1);
+
+    /* On overrun the byte is dropped, and the block fails its CRC */
+    if (ui16Next != g_ui16RxTail) {
+        g_pui8Rx[g_ui16RxHead] = ui8Byte;
+        g_ui16RxHead = ui16Next;
+    }
+}
+
+/* Timer callback of rx_byte(), the wake-up itself is all it needs */
+static void
+wake(tTimer *psTimer)
+{
+    (void)psTimer;
+}
+
+/* Next received byte, or -1 if none comes within ui32Us microseconds */
+static int
+rx_byte(uint32_t ui32Us)
+{
+    tTimer sTimer;
+    int iByte;
+
+    if (g_ui16RxHead == g_ui16RxTail) {
+        /* Sleep until a byte or the timer wakes us up, as in tb_Sleep() */
+        sTimer.bPending = false;
+        tb_TimerStart(&sTimer, ui32Us, wake);
+        Interrupt_disableMaster();
+        while (g_ui16RxHead == g_ui16RxTail && sTimer.bPending) {
+            PCM_gotoLPM0();
+            Interrupt_enableMaster();
+            Interrupt_disableMaster();
+        }
+        Interrupt_enableMaster();
+        tb_TimerStop(&sTimer);
+        if (g_ui16RxHead == g_ui16RxTail) return -1;
+    }
+
+    iByte = g_pui8Rx[g_ui16RxTail];
+    g_ui16RxTail = (g_ui16RxTail + 1) & (YM_RX_SIZE - 1);
+    return iByte;
+}
+
+/* Drop received bytes until the line has been quiet for a while */
+static void
+purge(void)
+{
+    while (rx_byte(YM_PURGE_US) >= 0) ;
+}
+
+static void
+tx_byte(uint8_t ui8Byte)
+{
+    UART_transmitData(EUSCI_A0_MODULE, ui8Byte);
+}
+
+/* Cancel the transfer on the other side */
+static void
+cancel(void)
+{
+    purge();
+    tx_byte(CAN);
+    tx_byte(CAN);
+}
+
+/* Send the block in g_pui8Block with ui32Len data bytes, numbered ui8Num,
+ * and wait for it to be acknowledged. Returns false if the receiver cancels
+ * or stops answering. */
+static bool
+send_block(uint8_t ui8Num, uint32_t ui32Len)
+{
+    uint8_t *pui8Data = &g_pui8Block[YM_HDR];
+    uint16_t ui16Crc;
+    uint32_t i;
+    uint_fast8_t ui8Try;
+    int iReply;
+
+    g_pui8Block[0] = (ui32Len == 1024) ? STX : SOH;
+    g_pui8Block[1] = ui8Num;
+    g_pui8Block[2] = ~ui8Num;
+
+    for (ui8Try = 0; ui8Try < YM_RETRIES; ui8Try++) {
+        tx_byte(g_pui8Block[0]);
+        tx_byte(g_pui8Block[1]);
+        tx_byte(g_pui8Block[2]);
+        ui16Crc = 0;
+        for (i = 0; i < ui32Len; i++) {
+            tx_byte(pui8Data[i]);
+            ui16Crc = crc16(ui16Crc, pui8Data[i]);
+        }
+        tx_byte(ui16Crc >> 8);
+        tx_byte(ui16Crc);
+
+        /* Anything but ACK or CAN CAN asks for the block again */
+        do {
+            iReply = rx_byte(YM_REPLY_US);
+            if (iReply == ACK) return true;
+            if (iReply == CAN && rx_byte(YM_BYTE_US) == CAN) return false;
+        } while (iReply >= 0 && iReply != NAK && iReply != CRC_REQ);
+    }
+    return false;
+}
+
+/* Wait for the receiver to ask for a block with CRC */
+static bool
+wait_request(void)
+{
+    uint_fast8_t ui8Try;
+    int iByte;
+
+    for (ui8Try = 0; ui8Try < YM_START_TRIES; ui8Try++) {
+        iByte = rx_byte(YM_START_US);
+        if (iByte == CRC_REQ) return true;
+        if (iByte == CAN && rx_byte(YM_BYTE_US) == CAN) return false;
+    }
+    return false;
+}
+
+/* Fill in a header block for pcName and ui32Size, or the empty header that
+ * ends the batch if pcName is 0. Returns the block length. */
+static uint32_t
+make_header(const char *pcName, uint32_t ui32Size)
+{
+    uint8_t *pui8Data = &g_pui8Block[YM_HDR];
+    uint32_t ui32Len;
+
+    memset(pui8Data, 0, 1024);
+    if (!pcName) return 128;
+
+    ui32Len = strlen(pcName) + 1;
+    if (ui32Len > 1024 - 12) return 0;      /* No room for the size */
+    memcpy(pui8Data, pcName, ui32Len);
+    ui32Len += snprintf((char *)&pui8Data[ui32Len], 12, "%lu",
+                        (unsigned long)ui32Size) + 1;
+    return (ui32Len <= 128) ? 128 : 1024;
+}
+
+FRESULT
+ym_Send(FIL *psFile, const char *pcPath, uint32_t *pui32Bytes)
+{
+    const char *pcName;
+    uint32_t ui32Len;
+    UINT uRead;
+    uint8_t ui8Num;
+    uint_fast8_t ui8Try;
+    FRESULT iFResult;
+    int iReply;
+
+    *pui32Bytes = 0;
+    iFResult = f_open(psFile, pcPath, FA_READ);
+    if (iFResult != FR_OK) return iFResult;
+
+    pcName = strrchr(pcPath, '/');
+    pcName = pcName ? pcName + 1 : pcPath;
+
+    g_ui16RxTail = g_ui16RxHead;
+    g_bBusy = true;
+
+    /* Header block, then the data blocks after the receiver asks again */
+    iFResult = FR_TIMEOUT;
+    ui32Len = make_header(pcName, f_size(psFile));
+    if (!ui32Len) {
+        iFResult = FR_INVALID_NAME;
+        goto done;
+    }
+    if (!wait_request() || !send_block(0, ui32Len) || !wait_request())
+        goto done;
+
+    for (ui8Num = 1; ; ui8Num++) {
+        iFResult = f_read(psFile, &g_pui8Block[YM_HDR], 1024, &uRead);
+        if (iFResult != FR_OK) goto done;
+        if (!uRead) break;
+
+        ui32Len = (uRead <= 128) ? 128 : 1024;
+        memset(&g_pui8Block[YM_HDR + uRead], CPMEOF, ui32Len - uRead);
+        if (!send_block(ui8Num, ui32Len)) {
+            iFResult = FR_TIMEOUT;
+            goto done;
+        }
+        *pui32Bytes += uRead;
+    }
+
+    /* End of file, repeated until the receiver takes it */
+    iFResult = FR_TIMEOUT;
+    for (ui8Try = 0; ui8Try < YM_RETRIES; ui8Try++) {
+        tx_byte(EOT);
+        iReply = rx_byte(YM_REPLY_US);
+        if (iReply == ACK) break;
+        if (iReply == CAN) goto done;
+    }
+    if (ui8Try == YM_RETRIES) goto done;
+
+    /* No more files. The file is through, whatever the answer to this. */
+    iFResult = FR_OK;
+    ui32Len = make_header(0, 0);
+    if (wait_request()) send_block(0, ui32Len);
+
+done:
+    if (iFResult != FR_OK) cancel();
+    else purge();
+    g_bBusy = false;
+    f_close(psFile);
+    return iFResult;
+}
+
+/* Receive a block into g_pui8Block, the first byte iFirst already taken.
+ * Returns the data length, 0 if the block is damaged. */
+static uint32_t
+recv_block(int iFirst)
+{
+    uint32_t ui32Len, i;
+    uint16_t ui16Crc;
+    int iByte;
+
+    ui32Len = (iFirst == STX) ? 1024 : 128;
+    g_pui8Block[0] = iFirst;
+    ui16Crc = 0;
+    for (i = 1; i < YM_HDR + ui32Len + 2; i++) {
+        iByte = rx_byte(YM_BYTE_US);
+        if (iByte < 0) return 0;
+        g_pui8Block[i] = iByte;
+        if (i >= YM_HDR) ui16Crc = crc16(ui16Crc, iByte);
+    }
+
+    /* The CRC over the data and the CRC itself comes out to 0 */
+    if (ui16Crc || (uint8_t)(g_pui8Block[1] ^ g_pui8Block[2]) != 0xFF)
+        return 0;
+    return ui32Len;
+}
+
+/* Ask for a block with ui8Req, and receive it. Returns the first byte of
+ * the block (SOH, STX or EOT) with the block in g_pui8Block, or -1 if the
+ * sender cancels or stops sending. */
+static int
+request_block(uint8_t ui8Req, uint_fast8_t ui8Tries, uint32_t ui32Us)
+{
+    uint_fast8_t ui8Try;
+    int iByte;
+
+    for (ui8Try = 0; ui8Try < ui8Tries; ui8Try++) {
+        tx_byte(ui8Req);
+        iByte = rx_byte(ui32Us);
+        if (iByte == EOT) return EOT;
+        if (iByte == CAN && rx_byte(YM_BYTE_US) == CAN) return -1;
+        if ((iByte == SOH || iByte == STX) && recv_block(iByte)) return iByte;
+
+        /* Damaged or out of step: let it end, then ask again */
+        if (iByte >= 0) purge();
+        ui8Req = (ui8Req == ACK) ? NAK : ui8Req;
+    }
+    return -1;
+}
+
+FRESULT
+ym_Receive(FIL *psFile, char *pcPath, uint32_t ui32PathSize,
+           uint32_t *pui32Bytes)
+{
+    const char *pcName, *pcEnd, *pc;
+    uint32_t ui32Size, ui32Left, ui32Len, ui32PathLen, ui32Num;
+    UINT uWritten;
+    uint8_t ui8Req;
+    uint_fast8_t ui8Try;
+    bool bOpen = false, bEot = false;
+    FRESULT iFResult;
+    int iType;
+
+    *pui32Bytes = 0;
+    g_ui16RxTail = g_ui16RxHead;
+    g_bBusy = true;
+
+    /* Header block with the name and size */
+    iFResult = FR_TIMEOUT;
+    iType = request_block(CRC_REQ, YM_START_TRIES, YM_START_US);
+    if (iType < 0 || g_pui8Block[1] != 0)
+        goto done;
+    pcName = (const char *)&g_pui8Block[YM_HDR];
+    if (!*pcName) {                         /* Empty batch */
+        tx_byte(ACK);
+        iFResult = FR_NO_FILE;
+        goto done;
+    }
+
+    /* The name must end within the block, and the size after it is read
+     * no further than the end of the block either */
+    pcEnd = pcName + ((iType == STX) ? 1024 : 128);
+    pc = memchr(pcName, 0, pcEnd - pcName);
+    if (!pc) {
+        iFResult = FR_INVALID_NAME;
+        goto done;
+    }
+    for (ui32Size = 0, pc++; pc < pcEnd && *pc >= '0' && *pc <= '9'; pc++)
+        ui32Size = ui32Size * 10 + (*pc - '0');
+    ui32Left = ui32Size ? ui32Size : 0xFFFFFFFF;
+
+    /* A name from the sender stays in the directory given: it may not name
+     * a drive or another directory */
+    ui32PathLen = strlen(pcPath);
+    if (ui32PathLen && pcPath[ui32PathLen - 1] == '/') {
+        if (strpbrk(pcName, "/\\:") || !strcmp(pcName, ".")
+            || !strcmp(pcName, "..")) {
+            iFResult = FR_INVALID_NAME;
+            goto done;
+        }
+        if (ui32PathLen + strlen(pcName) + 1 > ui32PathSize) {
+            iFResult = FR_INVALID_NAME;
+            goto done;
+        }
+        strcpy(&pcPath[ui32PathLen], pcName);
+    }
+    iFResult = f_open(psFile, pcPath, FA_WRITE | FA_CREATE_ALWAYS);
+    if (iFResult != FR_OK) goto done;
+    bOpen = true;
+
+    /* Data blocks: ACK the header, then ask for CRC blocks */
+    tx_byte(ACK);
+    ui8Req = CRC_REQ;
+    ui32Num = 1;
+    for (;;) {
+        iType = request_block(ui8Req, YM_RETRIES, YM_REPLY_US);
+        if (iType < 0) {
+            iFResult = FR_TIMEOUT;
+            goto done;
+        }
+
+        /* The first EOT is answered with NAK to make sure it is one */
+        if (iType == EOT) {
+            if (bEot) break;
+            bEot = true;
+            ui8Req = NAK;
+            continue;
+        }
+        bEot = false;
+
+        /* A block whose ACK was lost comes again. For the header that is
+         * followed by the request for CRC blocks again. */
+        if (g_pui8Block[1] == (uint8_t)(ui32Num - 1)) {
+            if (ui32Num == 1) tx_byte(ACK);
+            ui8Req = (ui32Num == 1) ? CRC_REQ : ACK;
+            continue;
+        }
+        if (g_pui8Block[1] != (uint8_t)ui32Num) {
+            iFResult = FR_TIMEOUT;
+            goto done;
+        }
+
+        /* The padding past the size in the header is not written */
+        ui32Len = (iType == STX) ? 1024 : 128;
+        if (ui32Len > ui32Left) ui32Len = ui32Left;
+        iFResult = f_write(psFile, &g_pui8Block[YM_HDR], ui32Len, &uWritten);
+        if (iFResult == FR_OK && uWritten != ui32Len) iFResult = FR_DENIED;
+        if (iFResult != FR_OK) goto done;
+        ui32Left -= ui32Len;
+        *pui32Bytes += ui32Len;
+        ui32Num++;
+        ui8Req = ACK;
+    }
+
+    iFResult = f_close(psFile);
+    bOpen = false;
+    if (iFResult != FR_OK) goto done;
+
+    /* The header that ends the batch. EOT again means the ACK was lost. A
+     * second file is refused. */
+    ui8Try = 0;
+    do {
+        tx_byte(ACK);
+        iType = request_block(CRC_REQ, YM_RETRIES, YM_REPLY_US);
+    } while (iType == EOT && ++ui8Try < YM_RETRIES);
+    if (iType == SOH || iType == STX) {
+        if (g_pui8Block[YM_HDR]) cancel();
+        else tx_byte(ACK);
+    }
+
+done:
+    if (iFResult != FR_OK && iFResult != FR_NO_FILE) cancel();
+    else purge();
+    g_bBusy = false;
+    if (bOpen) {
+        f_close(psFile);
+        f_unlink(pcPath);
+    }
+    return iFResult;
+}
@@ -0,0 +1,48 @@
+/*
+ * ymodem.h - YMODEM file transfer over the console UART
+ *
+ * Files are sent and received one at a time as a YMODEM batch: a header
+ * block with the name and size, 1024-byte data blocks with a CRC-16, and an
+ * empty header at the end. Terminal programs and lrzsz (sb, rb) speak it,
+ * and tools/ymodem.py is a client for Linux. While a transfer runs the
+ * console UART carries binary data only.
+ */
+
+#ifndef __YMODEM_H__
+#define __YMODEM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fatfs/src/ff.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Send the file at pcPath under its base name. *pui32Bytes is set to the
+ * number of bytes sent. Returns FR_TIMEOUT if the receiver stops answering
+ * or cancels, or the error of the file access. */
+FRESULT ym_Send(FIL *psFile, const char *pcPath, uint32_t *pui32Bytes);
+
+/* Receive a file into pcPath. If pcPath ends with a '/', the name given by
+ * the sender is appended to it, so the buffer must have room for it
+ * (ui32PathSize bytes in all). A name with a drive or a directory in it is
+ * refused with FR_INVALID_NAME. A file that is not received in full is
+ * removed. Errors are returned as for ym_Send(), and FR_TIMEOUT also
+ * stands for a protocol error: a block out of sequence, or one still
+ * damaged when it has been asked for ten times. */
+FRESULT ym_Receive(FIL *psFile, char *pcPath, uint32_t ui32PathSize,
+                   uint32_t *pui32Bytes);
+
+/* Whether a transfer is running. The console UART receive interrupt then
+ * passes each byte to ym_RxByte() instead of the command line. */
+bool ym_Busy(void);
+
+/* Take a byte from the console UART, from its receive interrupt */
+void ym_RxByte(uint8_t ui8Byte);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __YMODEM_H__ */
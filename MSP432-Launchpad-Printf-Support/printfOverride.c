@@ -7,6 +7,11 @@
  *  With input from:
  *  http://processors.wiki.ti.com/index.php/
  *       Printf_support_for_MSP430_CCSTUDIO_compiler
+ *
+ *  printf and vprintf are replaced by a compact formatter that renders into
+ *  a small buffer on the stack and sends it to the UART a span at a time.
+ *  The conversions it handles are selected below. The library printf is no
+ *  longer linked in.
  */
 
 /* DriverLib Includes */
@@ -14,11 +19,58 @@
 
 /* Standard Includes */
 #include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
+/* Formatter features. %d %i %u %c %s and %% are always handled. */
+#define PRINTF_WIDTH    1   /* Field width, precision, '*' and the flags */
+#define PRINTF_HEX      1   /* %x %X %o %p */
+#define PRINTF_LONG     1   /* hh h l ll j z t length modifiers */
+#define PRINTF_FLOAT    1   /* %f and %F */
+
+/* Characters rendered before they are written to the UART */
+#define PRINTF_BUF_SIZE 32
+
+/* Flags of a conversion */
+#define FL_LEFT         0x01    /* '-' */
+#define FL_PLUS         0x02    /* '+' */
+#define FL_SPACE        0x04    /* ' ' */
+#define FL_ALT          0x08    /* '#' */
+#define FL_ZERO         0x10    /* '0' */
+#define FL_UPPER        0x20    /* Upper case hex digits */
+#define FL_PREC         0x40    /* A precision was given */
+
+#if PRINTF_LONG || PRINTF_FLOAT
+#define PF_WIDE         1
+typedef unsigned long long pf_uint;
+#else
+#define PF_WIDE         0
+typedef unsigned int pf_uint;
+#endif
+
+/* Where the formatter puts its output */
+typedef struct {
+  char *buf;                /* Output buffer */
+  size_t len;               /* Characters in buf */
+  size_t size;              /* Size of buf */
+  void (*flush)(const char *s, size_t n);   /* Empties a full buf, 0:drop */
+  int count;                /* Characters output in total */
+} tPrintOut;
+
 int fputc(int _c, register FILE *_fp);
 int fputs(const char *_ptr, register FILE *_fp);
 
+static void uart_write(const char *s, size_t n)
+{
+  while(n--)
+  {
+    while(!(UCA0IFG&UCTXIFG));
+    UCA0TXBUF = (unsigned char) *s++;
+  }
+}
+
 int fputc(int _c, register FILE *_fp)
 {
   while(!(UCA0IFG&UCTXIFG));
@@ -29,15 +81,406 @@ int fputc(int _c, register FILE *_fp)
 
 int fputs(const char *_ptr, register FILE *_fp)
 {
-  unsigned int i, len;
+  unsigned int len;
 
   len = strlen(_ptr);
+  uart_write(_ptr, len);
 
-  for(i=0 ; i<len ; i++)
+  return len;
+}
+
+/* Append n characters, flushing the buffer as it fills */
+static void out_span(tPrintOut *o, const char *s, size_t n)
+{
+  size_t k;
+
+  o->count += n;
+  while(n)
   {
-    while(!(UCA0IFG&UCTXIFG));
-    UCA0TXBUF = (unsigned char) _ptr[i];
+    k = o->size - o->len;
+    if(k > n) k = n;
+    if(k) memcpy(o->buf + o->len, s, k);  /* (buf is null for snprintf(0, 0)) */
+    o->len += k;
+    s += k;
+    n -= k;
+    if(n)
+    {
+      if(!o->flush) return;
+      o->flush(o->buf, o->len);
+      o->len = 0;
+    }
   }
+}
 
-  return len;
+/* Append n copies of c */
+static void out_fill(tPrintOut *o, char c, int n)
+{
+  char fill[8];
+
+  memset(fill, c, sizeof(fill));
+  for( ; n > (int)sizeof(fill) ; n -= sizeof(fill))
+    out_span(o, fill, sizeof(fill));
+  if(n > 0) out_span(o, fill, n);
+}
+
+/* Put out a converted field: prefix (sign, 0x), zeros, then the digits,
+ * padded with spaces to the field width */
+static void out_field(tPrintOut *o, const char *pre, int npre, int zeros,
+                      const char *s, int n, int width, int flags)
+{
+  int pad = width - npre - zeros - n;
+
+  if(!(flags & FL_LEFT)) out_fill(o, ' ', pad);
+  out_span(o, pre, npre);
+  out_fill(o, '0', zeros);
+  out_span(o, s, n);
+  if(flags & FL_LEFT) out_fill(o, ' ', pad);
+}
+
+/* Render v in base 10, 8 or 16 backwards from end, returns the start */
+static char *utoa_rev(char *end, pf_uint v, unsigned base, int flags)
+{
+  const char *digits = (flags & FL_UPPER) ? "0123456789ABCDEF"
+                                          : "0123456789abcdef";
+  uint32_t v32;
+
+#if PF_WIDE
+  /* 64-bit division is slow, leave it as soon as the value fits 32 bits */
+  while(v > 0xFFFFFFFFu)
+  {
+    *--end = digits[v % base];
+    v /= base;
+  }
+#endif
+  v32 = (uint32_t)v;
+  if(base == 10)
+  {
+    do { *--end = '0' + v32 % 10; v32 /= 10; } while(v32);
+  }
+  else
+  {
+    unsigned shift = (base == 16) ? 4 : 3;
+    do { *--end = digits[v32 & (base - 1)]; v32 >>= shift; } while(v32);
+  }
+  return end;
+}
+
+static void out_int(tPrintOut *o, pf_uint v, int neg, unsigned base,
+                    int width, int prec, int flags)
+{
+  char tmp[24], pre[3], *s;
+  int n, npre = 0, zeros = 0;
+
+  s = tmp + sizeof(tmp);
+  if(!(v == 0 && (flags & FL_PREC) && prec == 0))
+    s = utoa_rev(s, v, base, flags);
+  n = tmp + sizeof(tmp) - s;
+
+  if(neg) pre[npre++] = '-';
+  else if(flags & FL_PLUS) pre[npre++] = '+';
+  else if(flags & FL_SPACE) pre[npre++] = ' ';
+#if PRINTF_HEX
+  if((flags & FL_ALT) && base == 16 && v)
+  {
+    pre[npre++] = '0';
+    pre[npre++] = (flags & FL_UPPER) ? 'X' : 'x';
+  }
+#endif
+
+  if(prec > n) zeros = prec - n;
+  else if((flags & (FL_ZERO | FL_LEFT | FL_PREC)) == FL_ZERO && width > npre + n)
+    zeros = width - npre - n;
+#if PRINTF_HEX
+  if((flags & FL_ALT) && base == 8 && !zeros && (n == 0 || *s != '0'))
+    zeros = 1;          /* "%#o" starts with a zero */
+#endif
+
+  out_field(o, pre, npre, zeros, s, n, width, flags);
+}
+
+#if PRINTF_FLOAT
+/* %f: exact for integer parts below 10^19, with the fraction rounded to
+ * nearest from a scaled product. Digits past the 9th decimal, and below the
+ * 19th integer digit of larger values, come out as zeros. */
+static void out_float(tPrintOut *o, double v, int width, int prec, int flags)
+{
+  static const uint32_t pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+  };
+  char tmp[32], pre[1], *s, *end, *frac;
+  int npre = 0, n, zeros = 0, dprec, big, total, pad;
+  unsigned long long ip;
+  uint32_t fp;
+  double f;
+
+  if(!(flags & FL_PREC)) prec = 6;
+  dprec = (prec > 9) ? 9 : prec;
+
+  if(v < 0 || (v == 0 && 1 / v < 0))
+  {
+    pre[npre++] = '-';
+    v = -v;
+  }
+  else if(flags & FL_PLUS) pre[npre++] = '+';
+  else if(flags & FL_SPACE) pre[npre++] = ' ';
+
+  if(v != v || v > 1.7976931348623157e308)
+  {
+    const char *w = (v != v) ? "nan" : "inf";
+    if(flags & FL_UPPER) w = (v != v) ? "NAN" : "INF";
+    out_field(o, pre, npre, 0, w, 3, width, flags & FL_LEFT);
+    return;
+  }
+
+  for(big = 0 ; v >= 1e19 ; big++) v /= 10;
+
+  ip = (unsigned long long)v;
+  fp = 0;
+  if(!big)
+  {
+    f = (v - (double)ip) * pow10[dprec];
+    fp = (uint32_t)f;
+    f -= fp;
+    if(f > 0.5 || (f == 0.5 && ((dprec ? fp : (uint32_t)ip) & 1)))
+    {
+      if(++fp == pow10[dprec])
+      {
+        fp = 0;
+        ip++;
+      }
+    }
+  }
+
+  /* Integer digits at the front of tmp, the point and decimals at the end */
+  end = tmp + sizeof(tmp);
+  s = end;
+  if(dprec)
+  {
+    s = utoa_rev(end, fp, 10, 0);
+    while(s > end - dprec) *--s = '0';
+  }
+  if(prec || (flags & FL_ALT)) *--s = '.';
+  frac = s;
+  s = utoa_rev(s, ip, 10, 0);
+  n = frac - s;
+
+  total = npre + n + big + (end - frac) + (prec - dprec);
+  if((flags & (FL_ZERO | FL_LEFT)) == FL_ZERO && width > total)
+    zeros = width - total;
+  pad = width - total - zeros;
+
+  if(!(flags & FL_LEFT)) out_fill(o, ' ', pad);
+  out_span(o, pre, npre);
+  out_fill(o, '0', zeros);
+  out_span(o, s, n);
+  out_fill(o, '0', big);
+  out_span(o, frac, end - frac);
+  out_fill(o, '0', prec - dprec);
+  if(flags & FL_LEFT) out_fill(o, ' ', pad);
+}
+#endif
+
+/* The formatter */
+static void format(tPrintOut *o, const char *fmt, va_list ap)
+{
+  const char *p;
+  int flags, width, prec, lng;
+  unsigned base;
+  pf_uint v;
+  int neg;
+  char c;
+
+  for(;;)
+  {
+    /* Copy the text up to the next conversion in one go */
+    for(p = fmt ; *p && *p != '%' ; p++) ;
+    if(p != fmt) out_span(o, fmt, p - fmt);
+    if(!*p) break;
+    fmt = p + 1;
+
+    flags = 0;
+    width = 0;
+    prec = 0;
+#if PRINTF_WIDTH
+    for(;; fmt++)
+    {
+      if(*fmt == '-') flags |= FL_LEFT;
+      else if(*fmt == '+') flags |= FL_PLUS;
+      else if(*fmt == ' ') flags |= FL_SPACE;
+      else if(*fmt == '#') flags |= FL_ALT;
+      else if(*fmt == '0') flags |= FL_ZERO;
+      else break;
+    }
+    if(*fmt == '*')
+    {
+      width = va_arg(ap, int);
+      if(width < 0)
+      {
+        flags |= FL_LEFT;
+        width = -width;
+      }
+      fmt++;
+    }
+    else
+      while(*fmt >= '0' && *fmt <= '9') width = width * 10 + *fmt++ - '0';
+    if(*fmt == '.')
+    {
+      fmt++;
+      flags |= FL_PREC;
+      if(*fmt == '*')
+      {
+        prec = va_arg(ap, int);
+        if(prec < 0) flags &= ~FL_PREC;
+        fmt++;
+      }
+      else
+        while(*fmt >= '0' && *fmt <= '9') prec = prec * 10 + *fmt++ - '0';
+    }
+#endif
+
+    /* Length modifier: -2:hh, -1:h, 0:int, 1:long, 2:long long */
+    lng = 0;
+#if PRINTF_LONG
+    if(*fmt == 'h') { lng = -1; if(*++fmt == 'h') { lng = -2; fmt++; } }
+    else if(*fmt == 'l') { lng = 1; if(*++fmt == 'l') { lng = 2; fmt++; } }
+    else if(*fmt == 'j') { lng = 2; fmt++; }
+    else if(*fmt == 'z' || *fmt == 't')
+    {
+      lng = (sizeof(size_t) > sizeof(int)) ? 2 : 0;
+      fmt++;
+    }
+#endif
+
+    c = *fmt++;
+    base = 10;
+    switch(c)
+    {
+    case 'd':
+    case 'i':
+    {
+      long long sv;
+
+#if PRINTF_LONG
+      if(lng == 2) sv = va_arg(ap, long long);
+      else if(lng == 1) sv = va_arg(ap, long);
+      else
+#endif
+        sv = va_arg(ap, int);
+      if(lng == -1) sv = (short)sv;
+      else if(lng == -2) sv = (signed char)sv;
+      neg = sv < 0;
+      v = neg ? (pf_uint)0 - (pf_uint)sv : (pf_uint)sv;
+      out_int(o, v, neg, 10, width, prec, flags);
+      break;
+    }
+
+#if PRINTF_HEX
+    case 'X':
+      flags |= FL_UPPER;
+      /* no break */
+    case 'x':
+      base = 16;
+      goto unsigned_conv;
+    case 'o':
+      base = 8;
+      goto unsigned_conv;
+    case 'p':
+      /* As "%#x" for a non-null pointer, like glibc */
+      v = (uintptr_t)va_arg(ap, void *);
+      if(!v)
+      {
+        out_field(o, 0, 0, 0, "(nil)", 5, width, flags);
+        break;
+      }
+      out_int(o, v, 0, 16, width, prec, flags | FL_ALT);
+      break;
+unsigned_conv:
+#endif
+    case 'u':
+#if PRINTF_LONG
+      if(lng == 2) v = va_arg(ap, unsigned long long);
+      else if(lng == 1) v = va_arg(ap, unsigned long);
+      else
+#endif
+        v = va_arg(ap, unsigned int);
+      if(lng == -1) v = (unsigned short)v;
+      else if(lng == -2) v = (unsigned char)v;
+      out_int(o, v, 0, base, width, prec, flags & ~(FL_PLUS | FL_SPACE));
+      break;
+
+    case 'c':
+      c = (char)va_arg(ap, int);
+      out_field(o, 0, 0, 0, &c, 1, width, flags);
+      break;
+
+    case 's':
+    {
+      const char *s = va_arg(ap, const char *);
+      size_t n;
+
+      if(!s) s = "(null)";
+      if(flags & FL_PREC)
+      {
+        const char *z = memchr(s, 0, prec);
+        n = z ? (size_t)(z - s) : (size_t)prec;
+      }
+      else
+        n = strlen(s);
+      out_field(o, 0, 0, 0, s, n, width, flags);
+      break;
+    }
+
+#if PRINTF_FLOAT
+    case 'F':
+      flags |= FL_UPPER;
+      /* no break */
+    case 'f':
+      out_float(o, va_arg(ap, double), width, prec, flags);
+      break;
+#endif
+
+    case '%':
+      out_span(o, "%", 1);
+      break;
+
+    default:
+      /* Unknown conversion: show it as it is */
+      if(!c)
+      {
+        out_span(o, p, fmt - 1 - p);
+        return;
+      }
+      out_span(o, p, fmt - p);
+      break;
+    }
+  }
+}
+
+int vprintf(const char *_format, va_list _ap)
+{
+  char buf[PRINTF_BUF_SIZE];
+  tPrintOut o;
+
+  o.buf = buf;
+  o.len = 0;
+  o.size = sizeof(buf);
+  o.flush = uart_write;
+  o.count = 0;
+
+  format(&o, _format, _ap);
+  uart_write(buf, o.len);
+
+  return o.count;
+}
+
+int printf(const char *_format, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, _format);
+  n = vprintf(_format, ap);
+  va_end(ap);
+
+  return n;
 }